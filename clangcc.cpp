@@ -17,16 +17,32 @@
 #include <projectmanager.h>
 
 #include <algorithm>
+#include <iterator>
 #include <vector>
 #include <wx/dir.h>
 #include <wx/tokenzr.h>
 #include <wx/choice.h>
 //#endif // CB_PRECOMP
 #include "cclogger.h"
+#include "cppkeywords.h"
 
 const int idHighlightTimer = wxNewId();
 
 #define HIGHLIGHT_DELAY 700
+/// Weight taken off a completion per rank in the completion history
+#define HISTORY_WEIGHT_STEP 5
+/// Number of completion rows that get their documentation rendered ahead
+#define DOC_PREFETCH_COUNT 16
+/// Number of symbols whose occurrences are kept for the active editor
+#define OCCURRENCE_CACHE_SIZE 32
+/// The highlighted occurrences are painted for the visible lines and this many screens above and below
+#define OCCURRENCE_PAINT_MARGIN 1
+/// Indicator of the highlighted occurrences, a high value hoping not to interfere with the indicators
+/// used by some lexers if they get updated from deprecated old style indicators someday
+#define OCCURRENCE_INDICATOR 16
+
+/// Token id of the #include completion entries, code completion tokens are numbered from 0
+static const int IncludeFileTokenId = -2;
 
 const wxString ClangCodeCompletion::SettingName = _T("/code_completion");
 
@@ -38,7 +54,12 @@ ClangCodeCompletion::ClangCodeCompletion() :
     m_CCOutstanding(0),
     m_CCOutstandingLastMessageTime(0),
     m_CCOutstandingTokenStart(-1),
-    m_CCOutstandingLoc(0,0)
+    m_CCOutstandingLoc(0,0),
+    m_CCOutstandingPreemptive(false),
+    m_BufferVersion(0),
+    m_OccurrencesRequestCurrent(false),
+    m_pOccurrencesCtrl(nullptr),
+    m_IncludeDirsChanged(true)
 {
 
 }
@@ -59,15 +80,23 @@ void ClangCodeCompletion::OnAttach(IClangPlugin* pClangPlugin)
     typedef cbEventFunctor<ClangCodeCompletion, CodeBlocksEvent> CBCCEvent;
     Manager::Get()->RegisterEventSink(cbEVT_EDITOR_ACTIVATED, new CBCCEvent(this, &ClangCodeCompletion::OnEditorActivate));
     Manager::Get()->RegisterEventSink(cbEVT_EDITOR_CLOSE,     new CBCCEvent(this, &ClangCodeCompletion::OnEditorClose));
+    Manager::Get()->RegisterEventSink(cbEVT_PROJECT_CLOSE,    new CBCCEvent(this, &ClangCodeCompletion::OnProjectChanged));
+    Manager::Get()->RegisterEventSink(cbEVT_PROJECT_OPTIONS_CHANGED, new CBCCEvent(this, &ClangCodeCompletion::OnProjectChanged));
+    Manager::Get()->RegisterEventSink(cbEVT_BUILDTARGET_ADDED,   new CBCCEvent(this, &ClangCodeCompletion::OnProjectChanged));
+    Manager::Get()->RegisterEventSink(cbEVT_BUILDTARGET_REMOVED, new CBCCEvent(this, &ClangCodeCompletion::OnProjectChanged));
 
     Connect(idHighlightTimer, wxEVT_TIMER, wxTimerEventHandler(ClangCodeCompletion::OnTimer));
 
     typedef cbEventFunctor<ClangCodeCompletion, ClangEvent> ClCCEvent;
     pClangPlugin->RegisterEventSink(clEVT_TRANSLATIONUNIT_CREATED,  new ClCCEvent(this, &ClangCodeCompletion::OnTranslationUnitCreated));
     pClangPlugin->RegisterEventSink(clEVT_GETCODECOMPLETE_FINISHED, new ClCCEvent(this, &ClangCodeCompletion::OnCodeCompleteFinished));
+    pClangPlugin->RegisterEventSink(clEVT_REPARSE_FINISHED,         new ClCCEvent(this, &ClangCodeCompletion::OnReparseFinished));
     pClangPlugin->RegisterEventSink(clEVT_GETOCCURRENCES_FINISHED, new ClCCEvent(this, &ClangCodeCompletion::OnGetOccurrencesFinished));
 
     m_EditorHookId = EditorHooks::RegisterHook(new EditorHooks::HookFunctor<ClangCodeCompletion>(this, &ClangCodeCompletion::OnEditorHook));
+
+    m_CompletionHistory.ReadIn(GetUserDataFilename(wxT("completions.cbcc")));
+    m_IncludeIndex.ReadIn(GetUserDataFilename(wxT("includes.cbcc")));
 }
 
 void ClangCodeCompletion::OnRelease(IClangPlugin* pClangPlugin)
@@ -77,6 +106,11 @@ void ClangCodeCompletion::OnRelease(IClangPlugin* pClangPlugin)
     EditorHooks::UnregisterHook(m_EditorHookId);
     Manager::Get()->RemoveAllEventSinksFor(this);
 
+    if (m_CompletionHistory.IsModified())
+        m_CompletionHistory.WriteOut(GetUserDataFilename(wxT("completions.cbcc")));
+    m_IncludeIndex.Shutdown();
+    m_IncludeIndex.WriteOut(GetUserDataFilename(wxT("includes.cbcc")));
+
     ClangPluginComponent::OnRelease(pClangPlugin);
 }
 
@@ -96,7 +130,8 @@ void ClangCodeCompletion::OnEditorActivate(CodeBlocksEvent& event)
         m_CCOutstanding = 0;
         m_CCOutstandingLastMessageTime = 0;
         m_CCOutstandingTokenStart = 0;
-        m_CCOutstandingResults.clear();
+        m_CompletionCache.Clear();
+        m_OccurrencesRequestCurrent = false;
         cbStyledTextCtrl* stc = ed->GetControl();
 #ifndef __WXMSW__
         stc->Disconnect(wxEVT_KEY_DOWN, wxKeyEventHandler(ClangCodeCompletion::OnKeyDown));
@@ -105,9 +140,22 @@ void ClangCodeCompletion::OnEditorActivate(CodeBlocksEvent& event)
         const int imgCount = m_pClangPlugin->GetImageList(id).GetImageCount();
         for (int i = 0; i < imgCount; ++i)
             stc->RegisterImage(i, m_pClangPlugin->GetImageList(id).GetBitmap(i));
+
+        // Start indexing now, so #include completion has the entries when it is needed
+        wxArrayString includeDirs;
+        GetIncludeSearchDirs(ed, true, m_IncludeDirsChanged, includeDirs);
+        m_IncludeDirsChanged = false;
+        m_IncludeIndex.AddRoots(includeDirs);
     }
 }
 
+void ClangCodeCompletion::OnProjectChanged(CodeBlocksEvent& event)
+{
+    event.Skip();
+    // The cached system include directories are recomputed on the next editor activation
+    m_IncludeDirsChanged = true;
+}
+
 void ClangCodeCompletion::OnEditorClose(CodeBlocksEvent& event)
 {
     event.Skip();
@@ -117,6 +165,13 @@ void ClangCodeCompletion::OnEditorClose(CodeBlocksEvent& event)
     EditorManager* edm = Manager::Get()->GetEditorManager();
     if (!edm)
         return;
+    cbEditor* ed = edm->GetBuiltinEditor(event.GetEditor());
+    if (ed && (ed->GetControl() == m_pOccurrencesCtrl))
+    {
+        m_pOccurrencesCtrl = nullptr;
+        m_HighlightedOccurrences.clear();
+        m_PaintedOccurrences.clear();
+    }
 }
 
 void ClangCodeCompletion::OnEditorHook(cbEditor* ed, wxScintillaEvent& event)
@@ -125,6 +180,7 @@ void ClangCodeCompletion::OnEditorHook(cbEditor* ed, wxScintillaEvent& event)
     if (!IsAttached())
         return;
     bool clearIndicator = false;
+    int editLength = 0;
 
     //if (!m_pClangPlugin->IsProviderFor(ed))
     //    return;
@@ -135,6 +191,23 @@ void ClangCodeCompletion::OnEditorHook(cbEditor* ed, wxScintillaEvent& event)
         {
             m_HighlightTimer.Stop();
             clearIndicator = true;
+            editLength = event.GetLength();
+            m_OccurrenceCache.Clear();
+            m_OccurrencesRequestCurrent = false;
+
+            // Typing within the identifier being completed keeps the completion results valid
+            const int pos = event.GetPosition();
+            const int tknStart = m_CompletionCache.tokenStart;
+            bool insideToken = (tknStart != wxNOT_FOUND) && (pos >= tknStart)
+                               && (pos <= stc->WordEndPosition(tknStart, true));
+            if (insideToken && (event.GetModificationType() & wxSCI_MOD_INSERTTEXT))
+            {
+                const wxString& text = event.GetText();
+                for (size_t i = 0; insideToken && (i < text.Length()); ++i)
+                    insideToken = (wxIsalnum(text[i]) || text[i] == wxT('_'));
+            }
+            if (!insideToken)
+                ++m_BufferVersion;
         }
     }
     else if (event.GetEventType() == wxEVT_SCI_UPDATEUI)
@@ -142,10 +215,27 @@ void ClangCodeCompletion::OnEditorHook(cbEditor* ed, wxScintillaEvent& event)
         if (event.GetUpdated() & wxSCI_UPDATE_SELECTION)
         {
             m_HighlightTimer.Stop();
-            m_HighlightTimer.Start(HIGHLIGHT_DELAY, wxTIMER_ONE_SHOT);
-            clearIndicator = true;
+            if (!HighlightCachedOccurrences(ed))
+            {
+                m_HighlightTimer.Start(HIGHLIGHT_DELAY, wxTIMER_ONE_SHOT);
+                clearIndicator = true;
+            }
+
+            const int pos = stc->GetCurrentPos();
+            if ((stc->GetSelectionStart() == stc->GetSelectionEnd()) && IsAfterAccessOperator(stc, pos))
+                RequestPreemptiveCompletion(ed, pos);
+        }
+        else if ((stc == m_pOccurrencesCtrl) && (!m_HighlightedOccurrences.empty()))
+        {
+            // Scrolling, resizing and folding change the visible lines without a separate notification,
+            // the occurrences that came into view are painted now. This is cheap when nothing changed
+            PaintOccurrences(stc);
         }
     }
+    else if ((event.GetEventType() == wxEVT_SCI_ZOOM) && (stc == m_pOccurrencesCtrl))
+    {
+        PaintOccurrences(stc);
+    }
     else if (event.GetEventType() == wxEVT_SCI_CHANGE)
     {
         //fprintf(stdout,"wxEVT_SCI_CHANGE\n");
@@ -155,11 +245,7 @@ void ClangCodeCompletion::OnEditorHook(cbEditor* ed, wxScintillaEvent& event)
         //fprintf(stdout,"wxEVT_SCI_KEY\n");
     }
     if (clearIndicator)
-    {
-        const int theIndicator = 16;
-        stc->SetIndicatorCurrent(theIndicator);
-        stc->IndicatorClearRange(0, stc->GetLength());
-    }
+        ClearOccurrences(stc, editLength);
 }
 
 void ClangCodeCompletion::OnTimer(wxTimerEvent& event)
@@ -219,6 +305,108 @@ void ClangCodeCompletion::OnCompleteCode(CodeBlocksEvent &event)
     //m_pClangPlugin->RequestReparse( m_TranslUnitId, filename );
 }
 
+/** @brief Check whether a position directly follows a member or scope access operator
+ *
+ * @param stc The editor control
+ * @param pos The position to check
+ * @return true when '.', '->' or '::' is in front of the position
+ *
+ */
+bool ClangCodeCompletion::IsAfterAccessOperator(cbStyledTextCtrl* stc, int pos)
+{
+    return GetCompletionContext(stc, pos) != ClCompletionContext_Global;
+}
+
+/** @brief Classify a completion on the access operator in front of it
+ *
+ * @param stc The editor control
+ * @param pos The start of the identifier being completed
+ * @return ClCompletionContext_Member after '.' or '->', ClCompletionContext_Scope after '::'
+ *
+ */
+ClCompletionContext ClangCodeCompletion::GetCompletionContext(cbStyledTextCtrl* stc, int pos)
+{
+    if (pos < 2)
+        return ClCompletionContext_Global;
+    const wxChar curChar = stc->GetCharAt(pos - 1);
+    const wxChar prevChar = stc->GetCharAt(pos - 2);
+    switch (curChar)
+    {
+    case wxT('.'):
+        // No floating point literal or ellipsis
+        if (wxIsalnum(prevChar) || prevChar == wxT('_'))
+        {
+            // Identifiers can end in digits, check that the word in front is not a number
+            int wordStart = pos - 2;
+            while ((wordStart > 0) && (wxIsalnum(stc->GetCharAt(wordStart - 1)) || stc->GetCharAt(wordStart - 1) == wxT('_')))
+                --wordStart;
+            if (!wxIsdigit(stc->GetCharAt(wordStart)))
+                return ClCompletionContext_Member;
+        }
+        else if (prevChar == wxT(')') || prevChar == wxT(']'))
+            return ClCompletionContext_Member;
+        break;
+    case wxT('>'):
+        if (prevChar == wxT('-'))
+            return ClCompletionContext_Member;
+        break;
+    case wxT(':'):
+        if (prevChar == wxT(':'))
+            return ClCompletionContext_Scope;
+        break;
+    default:
+        break;
+    }
+    return ClCompletionContext_Global;
+}
+
+wxString ClangCodeCompletion::GetUserDataFilename(const wxString& name)
+{
+    wxString dir = ConfigManager::GetFolder(sdDataUser) + wxT("/clanglib");
+    if (!wxDirExists(dir))
+        wxFileName::Mkdir(dir, 0755, wxPATH_MKDIR_FULL);
+    return dir + wxT("/") + name;
+}
+
+/** @brief Start code completion in the background before Code::Blocks asks for it
+ *
+ * The results end up in the completion cache, so the popup that follows is a cache hit.
+ *
+ * @param ed The editor
+ * @param tknStart Position directly after the access operator
+ *
+ */
+void ClangCodeCompletion::RequestPreemptiveCompletion(cbEditor* ed, int tknStart)
+{
+    if (ed != Manager::Get()->GetEditorManager()->GetBuiltinActiveEditor())
+        return;
+    ClTranslUnitId translUnitId = GetCurrentTranslationUnitId();
+    if ((translUnitId == wxNOT_FOUND) || (translUnitId != m_TranslUnitId))
+        return;
+    if (m_CCOutstanding > 0) // Don't queue up work while a request is in the pipe
+        return;
+    if (m_CompletionCache.Matches(translUnitId, ed->GetFilename(), tknStart, m_BufferVersion))
+        return;
+    cbStyledTextCtrl* stc = ed->GetControl();
+    const int style = stc->GetStyleAt(tknStart - 1);
+    if (stc->IsString(style) || stc->IsComment(style) || stc->IsCharacter(style) || stc->IsPreprocessor(style))
+        return;
+
+    const int line = stc->LineFromPosition(tknStart);
+    ClTokenPosition loc(line + 1, tknStart - stc->PositionFromLine(line) + 1);
+    CCLogger::Get()->DebugLog( F(wxT("Preemptive code completion at %d,%d"), loc.line, loc.column) );
+
+    // Without a result limit, so the cache can be filtered on whatever is typed next. The popup
+    // itself still only shows the best max_matches results
+    m_CompletionCache.Start(translUnitId, ed->GetFilename(), tknStart, m_BufferVersion, wxEmptyString, 0);
+    std::vector<ClToken> results;
+    m_pClangPlugin->GetCodeCompletionAt(translUnitId, ed->GetFilename(), loc, wxEmptyString, 0, ClCompletionRanks(), 0, results);
+    m_CCOutstanding++;
+    m_CCOutstandingTokenStart = tknStart;
+    m_CCOutstandingLoc = loc;
+    m_CCOutstandingPreemptive = true;
+}
+
 ClTranslUnitId ClangCodeCompletion::GetCurrentTranslationUnitId()
 {
     if (m_TranslUnitId == wxNOT_FOUND)
@@ -239,12 +427,19 @@ cbCodeCompletionPlugin::CCProviderStatus ClangCodeCompletion::GetProviderStatusF
     return cbCodeCompletionPlugin::ccpsInactive;
 }
 
+/// Orders indices of code completion results on priority, the ones accepted before first
 struct PrioritySorter
 {
-    bool operator()(const cbCodeCompletionPlugin::CCToken& a, const cbCodeCompletionPlugin::CCToken& b)
+    PrioritySorter(const std::vector<ClToken>& tokens, const std::vector<int>& historyRanks) :
+        m_Tokens(tokens), m_HistoryRanks(historyRanks) {}
+    bool operator()(size_t a, size_t b) const
     {
-        return a.weight < b.weight;
+        if (m_HistoryRanks[a] != m_HistoryRanks[b])
+            return m_HistoryRanks[a] > m_HistoryRanks[b];
+        return m_Tokens[a].weight < m_Tokens[b].weight;
     }
+    const std::vector<ClToken>& m_Tokens;
+    const std::vector<int>& m_HistoryRanks;
 };
 
 static wxString GetActualName(const wxString& name)
@@ -255,6 +450,36 @@ static wxString GetActualName(const wxString& name)
     return name.Mid(0, idx);
 }
 
+/** @brief Check if the results can be filtered on a prefix without a new request
+ *
+ * The results of a short prefix only hold tokens that match it at word starts, longer prefixes
+ * match any subsequence. See ClKeyMatcher
+ *
+ * Results that filled the limit of their request may have been cut, so they are only reused for
+ * the same prefix. Preemptive requests are therefore made without a limit.
+ */
+bool ClangCodeCompletion::CompletionCache::CanFilter(const wxString& tknPrefix) const
+{
+    if (!hasResults)
+        return false;
+    if (tknPrefix == prefix)
+        return true;
+    return isComplete && tknPrefix.StartsWith(prefix)
+           && (!ClKeyMatcher::IsShortPattern(prefix) || ClKeyMatcher::IsShortPattern(tknPrefix));
+}
+
+void ClangCodeCompletion::CompletionCache::SetResults(std::vector<ClToken>& tokens)
+{
+    hasResults = true;
+    isComplete = (maxCount == 0) || (tokens.size() < maxCount);
+    results.swap(tokens);
+    isMaterialized.assign(results.size(), false);
+    typedTexts.Clear();
+    typedTexts.Reserve(results.size(), results.size() * 16);
+    for (std::vector<ClToken>::const_iterator tknIt = results.begin(); tknIt != results.end(); ++tknIt)
+        typedTexts.AddKey(tknIt->name);
+}
+
 std::vector<cbCodeCompletionPlugin::CCToken> ClangCodeCompletion::GetAutocompList(bool isAuto, cbEditor* ed, int& tknStart, int& tknEnd)
 {
     CCLogger::Get()->DebugLog( wxT("ClangCodeCompletion::GetAutocompList") );
@@ -300,7 +525,7 @@ std::vector<cbCodeCompletionPlugin::CCToken> ClangCodeCompletion::GetAutocompLis
                 && stc->GetCharAt(tknEnd - 2) != wxT(':') )
             || (   curChar == wxT('>') // '->'
                 && stc->GetCharAt(tknEnd - 2) != wxT('-') )
-            || (   wxString(wxT("<\"/")).Find(curChar) != wxNOT_FOUND // #include directive (TODO: enumerate completable include files)
+            || (   wxString(wxT("<\"/")).Find(curChar) != wxNOT_FOUND // #include directive, see GetAutocompListIncludes()
                 && !stc->IsPreprocessor(style) ) )
         {
             return tokens;
@@ -314,23 +539,13 @@ std::vector<cbCodeCompletionPlugin::CCToken> ClangCodeCompletion::GetAutocompLis
 
     //CCLogger::Get()->DebugLog( F(wxT("GetAutoCompList m_CCOutstanding=%d m_CCOutstandingTokenStart=%d"), m_CCOutstanding, m_CCOutstandingTokenStart ) );
 
-    int CCOutstanding = m_CCOutstanding;
-    if ((CCOutstanding > 0) && (m_CCOutstandingTokenStart == tknStart) && m_CCOutstandingResults.empty())
-    {
-        CCLogger::Get()->DebugLog(wxT("CC request allready requested"));
-        return tokens;
-    }
-    if (m_CCOutstandingTokenStart != tknStart)
-    {
-        m_CCOutstandingResults.clear();
-    }
-    if ((CCOutstanding > 0) && (m_CCOutstandingTokenStart != tknStart))
-    {
-        CCOutstanding = 0;
-    }
-
-    if ((CCOutstanding > 0) && m_CCOutstandingResults.empty())
+    const wxString& prefix = stc->GetTextRange(tknStart, tknEnd).Lower();
+    const bool cacheHit = m_CompletionCache.Matches(translUnitId, ed->GetFilename(), tknStart, m_BufferVersion)
+                          && m_CompletionCache.CanFilter(prefix);
+    if ((m_CCOutstanding > 0) && (m_CCOutstandingTokenStart == tknStart) && !cacheHit)
     {
+        // Show the results when they arrive, also when the request was a preemptive one
+        m_CCOutstandingPreemptive = false;
         CCLogger::Get()->DebugLog( wxT("CodeCompletion allready requested, wait until it's finished!") );
         // This request is allready scheduled to be performed but is not ready yet...
         return tokens;
@@ -349,7 +564,6 @@ std::vector<cbCodeCompletionPlugin::CCToken> ClangCodeCompletion::GetAutocompLis
         }
     }
 
-    const wxString& prefix = stc->GetTextRange(tknStart, tknEnd).Lower();
     bool includeCtors = true; // sometimes we get a lot of these
     for (int i = tknStart - 1; i > 0; --i)
     {
@@ -361,9 +575,9 @@ std::vector<cbCodeCompletionPlugin::CCToken> ClangCodeCompletion::GetAutocompLis
             break;
         }
     }
+    const ClCompletionContext context = GetCompletionContext(stc, tknStart);
 
-    std::vector<ClToken> tknResults;
-    if (m_CCOutstandingResults.empty())
+    if (!cacheHit)
     {
         ClTokenPosition loc(line + 1, column + 1);
         unsigned long timeout = 20;
@@ -371,61 +585,92 @@ std::vector<cbCodeCompletionPlugin::CCToken> ClangCodeCompletion::GetAutocompLis
         {
             timeout = 100;
         }
-        if (wxCOND_TIMEOUT == m_pClangPlugin->GetCodeCompletionAt(translUnitId, ed->GetFilename(), loc, includeCtors, timeout, tknResults))
+        m_CompletionCache.Start(translUnitId, ed->GetFilename(), tknStart, m_BufferVersion, prefix, maxResultCount);
+        // The history is blended in below, the results that are left out should not be the ones picked before
+        ClCompletionRanks historyRanks;
+        m_CompletionHistory.GetRanks(context, historyRanks);
+        std::vector<ClToken> results;
+        if (wxCOND_TIMEOUT == m_pClangPlugin->GetCodeCompletionAt(translUnitId, ed->GetFilename(), loc,
+                                                                  prefix, maxResultCount, historyRanks, timeout, results))
         {
             m_CCOutstanding++;
             m_CCOutstandingTokenStart = tknStart;
             m_CCOutstandingLoc = loc;
-            m_CCOutstandingResults.clear();
+            m_CCOutstandingPreemptive = false;
             return tokens;
         }
+        m_CompletionCache.SetResults(results);
     }
     else
+        CCLogger::Get()->DebugLog( wxT("Filtering cached code completion results") );
+    m_CCOutstanding = 0;
+    std::vector<ClToken>& tknResults = m_CompletionCache.results;
+    std::vector<size_t> shownIndices;
+    if (prefix.IsEmpty())
     {
-        tknResults = m_CCOutstandingResults;
+        for (size_t tknIdx = 0; tknIdx < tknResults.size(); ++tknIdx)
+        {
+            // it is rather unlikely for an operator to be the desired completion
+            if ( (!tknResults[tknIdx].name.StartsWith(wxT("operator"))) && (includeCtors || tknResults[tknIdx].category != tcCtorPublic) )
+                shownIndices.push_back(tknIdx);
+        }
     }
-    m_CCOutstanding = 0;
-    if (prefix.Length() > 3) // larger context, match the prefix at any point in the token
+    else
     {
-        for (std::vector<ClToken>::const_iterator tknIt = tknResults.begin();
-             tknIt != tknResults.end(); ++tknIt)
+        std::vector< std::pair<size_t, int> > matches;
+        m_CompletionCache.typedTexts.Match(prefix, matches);
+        for (std::vector< std::pair<size_t, int> >::const_iterator it = matches.begin(); it != matches.end(); ++it)
         {
-            if ( (tknIt->name.Lower().Find(prefix) != wxNOT_FOUND) && (includeCtors || (tknIt->category != tcCtorPublic)) )
-                tokens.push_back(cbCodeCompletionPlugin::CCToken(tknIt->id, tknIt->name, tknIt->name, tknIt->weight, tknIt->category));
+            if (includeCtors || (tknResults[it->first].category != tcCtorPublic))
+                shownIndices.push_back(it->first);
         }
     }
-    else if (prefix.IsEmpty())
+    if (prefix.IsEmpty() && (shownIndices.size() > maxResultCount)) // reduce to give only top matches
     {
-        for (std::vector<ClToken>::const_iterator tknIt = tknResults.begin();
-                tknIt != tknResults.end(); ++tknIt)
+        std::vector<int> historyRanks(tknResults.size(), 0);
+        for (std::vector<size_t>::const_iterator idxIt = shownIndices.begin(); idxIt != shownIndices.end(); ++idxIt)
+            historyRanks[*idxIt] = m_CompletionHistory.GetRank(context, GetActualName(tknResults[*idxIt].name));
+        std::partial_sort(shownIndices.begin(), shownIndices.begin() + maxResultCount, shownIndices.end(), PrioritySorter(tknResults, historyRanks));
+        shownIndices.erase(shownIndices.begin() + maxResultCount, shownIndices.end());
+    }
+
+    // Only the shown tokens get their display name and precise category, once
+    std::vector<size_t> newIndices;
+    std::vector<ClToken> newTokens;
+    for (std::vector<size_t>::const_iterator idxIt = shownIndices.begin(); idxIt != shownIndices.end(); ++idxIt)
+    {
+        if (!m_CompletionCache.isMaterialized[*idxIt])
         {
-            // it is rather unlikely for an operator to be the desired completion
-            if ( (!tknIt->name.StartsWith(wxT("operator"))) && (includeCtors || tknIt->category != tcCtorPublic) )
-                tokens.push_back(cbCodeCompletionPlugin::CCToken(tknIt->id, tknIt->name, tknIt->name, tknIt->weight, tknIt->category));
+            newIndices.push_back(*idxIt);
+            newTokens.push_back(tknResults[*idxIt]);
         }
     }
-    else // smaller context, only allow matches of the prefix at the beginning of the token
+    if (!newTokens.empty())
     {
-        for (std::vector<ClToken>::const_iterator tknIt = tknResults.begin();
-             tknIt != tknResults.end(); ++tknIt)
+        std::vector<bool> isMaterialized;
+        m_pClangPlugin->MaterializeCodeCompletionTokens(translUnitId, newTokens, isMaterialized);
+        for (size_t i = 0; i < newIndices.size(); ++i)
         {
-            if (tknIt->name.Lower().StartsWith(prefix) && (includeCtors || tknIt->category != tcCtorPublic))
-                tokens.push_back(cbCodeCompletionPlugin::CCToken(tknIt->id, tknIt->name, tknIt->name, tknIt->weight, tknIt->category));
+            if (!isMaterialized[i])
+                continue; // Shown with its typed text this time
+            tknResults[newIndices[i]] = newTokens[i];
+            m_CompletionCache.isMaterialized[newIndices[i]] = true;
         }
     }
+    tokens.reserve(shownIndices.size());
+    for (std::vector<size_t>::const_iterator idxIt = shownIndices.begin(); idxIt != shownIndices.end(); ++idxIt)
+    {
+        const ClToken& tkn = tknResults[*idxIt];
+        tokens.push_back(cbCodeCompletionPlugin::CCToken(tkn.id, tkn.name, tkn.name, tkn.weight, tkn.category));
+    }
 
     if (!tokens.empty())
     {
-        if (prefix.IsEmpty() && (tokens.size() > maxResultCount)) // reduce to give only top matches
-        {
-            std::partial_sort(tokens.begin(), tokens.begin() + maxResultCount, tokens.end(), PrioritySorter());
-            tokens.erase(tokens.begin() + maxResultCount, tokens.end());
-        }
         //const int imgCount = m_pClangPlugin->GetImageList(translUnitId).GetImageCount();
         //for (int i = 0; i < imgCount; ++i)
         //    stc->RegisterImage(i, m_pClangPlugin->GetImageList(translUnitId).GetBitmap(i));
         bool isPP = stc->GetLine(line).Strip(wxString::leading).StartsWith(wxT("#"));
-        wxStringVec keywords = m_pClangPlugin->GetKeywords(translUnitId);
+        const ClCppKeywords& keywords = m_pClangPlugin->GetKeywords(translUnitId);
         std::set<int> usedWeights;
         for (std::vector<cbCodeCompletionPlugin::CCToken>::iterator tknIt = tokens.begin();
              tknIt != tokens.end(); ++tknIt)
@@ -436,7 +681,7 @@ std::vector<cbCodeCompletionPlugin::CCToken> ClangCodeCompletion::GetAutocompLis
             case tcNone:
                 if (isPP)
                     tknIt->category = tcMacroDef;
-                else if (std::binary_search(keywords.begin(), keywords.end(), GetActualName(tknIt->name)))
+                else if (keywords.IsKeyword(GetActualName(tknIt->name)))
                     tknIt->category = tcLangKeyword;
                 break;
             default:
@@ -462,6 +707,29 @@ std::vector<cbCodeCompletionPlugin::CCToken> ClangCodeCompletion::GetAutocompLis
                 tknIt->weight = weightCompr[tknIt->weight];
             }
         }
+        // Blend in what was picked before in the same context, so it is usually the first match
+        for (std::vector<cbCodeCompletionPlugin::CCToken>::iterator tknIt = tokens.begin();
+                tknIt != tokens.end(); ++tknIt)
+        {
+            const int rank = m_CompletionHistory.GetRank(context, GetActualName(tknIt->name));
+            if (rank > 0)
+                tknIt->weight = std::max(0, tknIt->weight - rank * HISTORY_WEIGHT_STEP);
+        }
+        // Render the documentation of the first rows of the list before the user gets to them
+        std::vector< std::pair<std::pair<int, wxString>, int> > listOrder;
+        listOrder.reserve(tokens.size());
+        for (std::vector<cbCodeCompletionPlugin::CCToken>::const_iterator tknIt = tokens.begin();
+                tknIt != tokens.end(); ++tknIt)
+        {
+            listOrder.push_back(std::make_pair(std::make_pair(tknIt->weight, tknIt->displayName.Lower()), tknIt->id));
+        }
+        const size_t prefetchCount = std::min<size_t>(listOrder.size(), DOC_PREFETCH_COUNT);
+        std::partial_sort(listOrder.begin(), listOrder.begin() + prefetchCount, listOrder.end());
+        std::vector<ClTokenId> prefetchIds;
+        prefetchIds.reserve(prefetchCount);
+        for (size_t i = 0; i < prefetchCount; ++i)
+            prefetchIds.push_back(listOrder[i].second);
+        m_pClangPlugin->PrefetchCodeCompletionDocumentation(translUnitId, prefetchIds);
     }
 
     CCLogger::Get()->DebugLog( wxT("Delivering list of CC Tokens") );
@@ -469,15 +737,154 @@ std::vector<cbCodeCompletionPlugin::CCToken> ClangCodeCompletion::GetAutocompLis
     return tokens;
 }
 
-std::vector<cbCodeCompletionPlugin::CCToken> ClangCodeCompletion::GetAutocompListIncludes(bool WXUNUSED(isAuto), cbEditor* WXUNUSED(ed), int& WXUNUSED(tknStart), int& WXUNUSED(tknEnd))
+/** @brief List the files and directories matching the path typed in an #include directive
+ *
+ * The entries come from the include index, so no directory is read here. Directories that are not
+ * indexed yet are queued, their entries show up once the background scan has reached them.
+ */
+std::vector<cbCodeCompletionPlugin::CCToken> ClangCodeCompletion::GetAutocompListIncludes(bool WXUNUSED(isAuto), cbEditor* ed, int& tknStart, int& tknEnd)
+{
+    std::vector<cbCodeCompletionPlugin::CCToken> tokens;
+
+    cbStyledTextCtrl* stc = ed->GetControl();
+    int pathStart;
+    wxChar closeChar;
+    if (!GetIncludePathStart(stc, tknEnd, pathStart, closeChar))
+        return tokens;
+    const wxString path = stc->GetTextRange(pathStart, tknEnd);
+    if (path.Find(closeChar) != wxNOT_FOUND)
+        return tokens;
+    const size_t sepPos = path.find_last_of(wxT("/\\"));
+    const wxString subDir = (sepPos == wxString::npos) ? wxString() : path.Left(sepPos + 1);
+    const wxString prefix = path.Mid(subDir.Length());
+
+    wxArrayString dirs;
+    GetIncludeSearchDirs(ed, closeChar == wxT('"'), false, dirs);
+    m_IncludeIndex.AddRoots(dirs);
+    wxArrayString entries;
+    m_IncludeIndex.GetEntries(dirs, subDir, prefix, entries);
+
+    tknStart = pathStart + subDir.Length();
+    tokens.reserve(entries.GetCount());
+    for (size_t i = 0; i < entries.GetCount(); ++i)
+    {
+        const ClTokenCategory category = entries[i].EndsWith(wxT("/")) ? tcOthersFolder : tcNone;
+        tokens.push_back(cbCodeCompletionPlugin::CCToken(IncludeFileTokenId, entries[i], entries[i], 5, category));
+    }
+    return tokens;
+}
+
+/** @brief Insert the picked #include entry in place of the file name being typed
+ *
+ * A file gets the closing character of the directive, a directory starts a new completion in it.
+ */
+bool ClangCodeCompletion::DoAutocompleteInclude(const cbCodeCompletionPlugin::CCToken& token, cbEditor* ed)
+{
+    cbStyledTextCtrl* stc = ed->GetControl();
+    const int pos = stc->GetCurrentPos();
+    int pathStart;
+    wxChar closeChar;
+    if (!GetIncludePathStart(stc, pos, pathStart, closeChar))
+        return false;
+
+    int startPos = pos;
+    while ((startPos > pathStart) && (stc->GetCharAt(startPos - 1) != wxT('/')) && (stc->GetCharAt(startPos - 1) != wxT('\\')))
+        --startPos;
+    const int lineEndPos = stc->GetLineEndPosition(stc->LineFromPosition(pos));
+    int endPos = pos;
+    while ((endPos < lineEndPos) && (stc->GetCharAt(endPos) != closeChar) && (stc->GetCharAt(endPos) != wxT('/'))
+           && !wxIsspace(stc->GetCharAt(endPos)))
+    {
+        ++endPos;
+    }
+
+    wxString text = token.name;
+    const bool isDir = text.EndsWith(wxT("/"));
+    if (isDir && (endPos < lineEndPos) && (stc->GetCharAt(endPos) == wxT('/')))
+        ++endPos;
+    else if (!isDir && (stc->GetCharAt(endPos) != closeChar))
+        text += closeChar;
+
+    stc->AutoCompCancel(); // so (wx)Scintilla does not insert the text as well
+    stc->SetTargetStart(startPos);
+    stc->SetTargetEnd(endPos);
+    stc->ReplaceTarget(text);
+    const int caretPos = startPos + token.name.Length() + (isDir ? 0 : 1);
+    stc->SetSelectionVoid(caretPos, caretPos);
+    stc->ChooseCaretX();
+
+    if (isDir)
+    {
+        CodeBlocksEvent evt(cbEVT_COMPLETE_CODE);
+        Manager::Get()->ProcessEvent(evt);
+    }
+    return true;
+}
+
+/** @brief Parse the start of an #include directive
+ *
+ * @param stc The editor control
+ * @param pos A position on the line of the directive
+ * @param out_pathStart Position after the '<' or '"'
+ * @param out_closeChar '>' or '"'
+ * @return false if the line is no #include directive or pos is before its path
+ *
+ */
+bool ClangCodeCompletion::GetIncludePathStart(cbStyledTextCtrl* stc, int pos, int& out_pathStart, wxChar& out_closeChar)
 {
-    std::vector<cbCodeCompletionPlugin::CCToken> result;
+    const int line = stc->LineFromPosition(pos);
+    const int lineEndPos = stc->GetLineEndPosition(line);
+    int curPos = stc->GetLineIndentPosition(line);
+    if (stc->GetCharAt(curPos) != wxT('#'))
+        return false;
+    for (++curPos; (curPos < lineEndPos) && wxIsspace(stc->GetCharAt(curPos)); ++curPos)
+        ;
+    const int wordEndPos = stc->WordEndPosition(curPos, true);
+    const wxString directive = stc->GetTextRange(curPos, wordEndPos);
+    if ((directive != wxT("include")) && (directive != wxT("include_next")) && (directive != wxT("import")))
+        return false;
+    for (curPos = wordEndPos; (curPos < lineEndPos) && wxIsspace(stc->GetCharAt(curPos)); ++curPos)
+        ;
+    const wxChar openChar = stc->GetCharAt(curPos);
+    if ((openChar != wxT('<')) && (openChar != wxT('"')))
+        return false;
+    if (pos <= curPos)
+        return false;
+    out_pathStart = curPos + 1;
+    out_closeChar = (openChar == wxT('<')) ? wxT('>') : wxT('"');
+    return true;
+}
 
-    return result;
+/** @brief Collect the directories an #include is looked up in
+ *
+ * @param ed The editor with the #include
+ * @param isQuoted For #include "...", which is searched in the directory of the file first
+ * @param force Recompute the cached system directories
+ * @param out_dirs The directories, in search order
+ *
+ */
+void ClangCodeCompletion::GetIncludeSearchDirs(cbEditor* ed, bool isQuoted, bool force, wxArrayString& out_dirs)
+{
+    out_dirs.Clear();
+    if (isQuoted)
+        out_dirs.Add(wxFileName(ed->GetFilename()).GetPath());
+    ProjectFile* pf = ed->GetProjectFile();
+    cbProject* project = (pf ? pf->GetParentProject() : nullptr);
+    if (project)
+    {
+        const wxArrayString localDirs = GetLocalIncludeDirs(project, pf->GetBuildTargets());
+        for (size_t i = 0; i < localDirs.GetCount(); ++i)
+            out_dirs.Add(localDirs[i]);
+    }
+    const wxArrayString& sysDirs = GetSystemIncludeDirs(project, force);
+    for (size_t i = 0; i < sysDirs.GetCount(); ++i)
+        out_dirs.Add(sysDirs[i]);
 }
 
 bool ClangCodeCompletion::DoAutocomplete( const cbCodeCompletionPlugin::CCToken& token, cbEditor* ed)
 {
+    if (token.id == IncludeFileTokenId)
+        return DoAutocompleteInclude(token, ed);
     wxString tknText = token.name;
     int idx = tknText.Find(wxT(':'));
     if (idx != wxNOT_FOUND)
@@ -493,6 +900,7 @@ bool ClangCodeCompletion::DoAutocomplete( const cbCodeCompletionPlugin::CCToken&
     int pos = stc->GetCurrentPos();
     int startPos = std::min(stc->WordStartPosition(pos, true), std::min(stc->GetSelectionStart(),
                             stc->GetSelectionEnd()));
+    m_CompletionHistory.AddAccepted(GetCompletionContext(stc, startPos), tknText);
     int moveToPos = startPos + tknText.Length();
     stc->SetTargetStart(startPos);
     int endPos = stc->WordEndPosition(pos, true);
@@ -569,6 +977,8 @@ bool ClangCodeCompletion::DoAutocomplete( const cbCodeCompletionPlugin::CCToken&
 
 wxString ClangCodeCompletion::GetDocumentation(const cbCodeCompletionPlugin::CCToken &token)
 {
+    if (token.id == IncludeFileTokenId)
+        return wxEmptyString;
     EditorManager* edMgr = Manager::Get()->GetEditorManager();
     cbEditor* ed = edMgr->GetBuiltinActiveEditor();
     if (ed)
@@ -583,6 +993,26 @@ void ClangCodeCompletion::BeginHighlightOccurrences(cbEditor* ed)
     ClTranslUnitId translId = GetCurrentTranslationUnitId();
 
     cbStyledTextCtrl* stc = ed->GetControl();
+    const int pos = GetHighlightPosition(stc);
+    if (stc->GetTextRange(pos - 1, pos + 1).Strip().IsEmpty())
+    {
+        HighlightOccurrences(stc, OccurrenceCache::Occurrences());
+        return;
+    }
+    if (HighlightCachedOccurrences(ed))
+        return;
+    // clear all style indications set in a previous run
+    HighlightOccurrences(stc, OccurrenceCache::Occurrences());
+
+    const int line = stc->LineFromPosition(pos);
+    ClTokenPosition loc(line + 1, pos - stc->PositionFromLine(line) + 1);
+
+    m_OccurrencesRequestCurrent = true;
+    m_pClangPlugin->GetOccurrencesOf( translId,  ed->GetFilename(), loc );
+}
+
+int ClangCodeCompletion::GetHighlightPosition(cbStyledTextCtrl* stc)
+{
     int pos = stc->GetCurrentPos();
     const wxChar ch = stc->GetCharAt(pos);
     if (   pos > 0
@@ -591,22 +1021,156 @@ void ClangCodeCompletion::BeginHighlightOccurrences(cbEditor* ed)
     {
         --pos;
     }
-    // chosen a high value for indicator, hoping not to interfere with the indicators used by some lexers
-    // if they get updated from deprecated old style indicators someday.
-    const int theIndicator = 16;
-    stc->SetIndicatorCurrent(theIndicator);
+    return pos;
+}
 
-    // Set Styling:
-    // clear all style indications set in a previous run (is also done once after text gets unselected)
-    stc->IndicatorClearRange(0, stc->GetLength());
+bool ClangCodeCompletion::HighlightCachedOccurrences(cbEditor* ed)
+{
+    cbStyledTextCtrl* stc = ed->GetControl();
+    const OccurrenceCache::Occurrences* occurrences = m_OccurrenceCache.Find(GetCurrentTranslationUnitId(), ed->GetFilename(),
+                                                                             GetHighlightPosition(stc));
+    if (!occurrences)
+        return false;
+    HighlightOccurrences(stc, *occurrences);
+    return true;
+}
 
-    if (stc->GetTextRange(pos - 1, pos + 1).Strip().IsEmpty())
+void ClangCodeCompletion::HighlightOccurrences(cbStyledTextCtrl* stc, const OccurrenceCache::Occurrences& occurrences)
+{
+    if (stc != m_pOccurrencesCtrl)
+    {
+        // Nothing is known about the indicators of another editor
+        stc->SetIndicatorCurrent(OCCURRENCE_INDICATOR);
+        stc->IndicatorClearRange(0, stc->GetLength());
+        m_pOccurrencesCtrl = stc;
+        m_PaintedOccurrences.clear();
+    }
+    m_HighlightedOccurrences = occurrences;
+    std::sort(m_HighlightedOccurrences.begin(), m_HighlightedOccurrences.end());
+    PaintOccurrences(stc);
+}
+
+/** @brief Update the indicators to the highlighted occurrences
+ *
+ * Only the occurrences near the visible lines are painted, the others are painted when they are
+ * scrolled into view. The indicators of the occurrences that were painted and are still
+ * highlighted are left alone, so moving to another symbol only touches the ranges that differ.
+ */
+void ClangCodeCompletion::PaintOccurrences(cbStyledTextCtrl* stc)
+{
+    stc->SetIndicatorCurrent(OCCURRENCE_INDICATOR);
+
+    OccurrenceCache::Occurrences stale;
+    std::set_difference(m_PaintedOccurrences.begin(), m_PaintedOccurrences.end(),
+                        m_HighlightedOccurrences.begin(), m_HighlightedOccurrences.end(), std::back_inserter(stale));
+    for (OccurrenceCache::Occurrences::const_iterator tkn = stale.begin(); tkn != stale.end(); ++tkn)
+        stc->IndicatorClearRange(tkn->first, tkn->second);
+    if (!stale.empty())
+    {
+        OccurrenceCache::Occurrences painted;
+        std::set_difference(m_PaintedOccurrences.begin(), m_PaintedOccurrences.end(),
+                            stale.begin(), stale.end(), std::back_inserter(painted));
+        m_PaintedOccurrences.swap(painted);
+    }
+    if (m_HighlightedOccurrences.empty())
         return;
 
-    const int line = stc->LineFromPosition(pos);
-    ClTokenPosition loc(line + 1, pos - stc->PositionFromLine(line) + 1);
+    const int firstVisible = stc->GetFirstVisibleLine();
+    const int margin = stc->LinesOnScreen() * OCCURRENCE_PAINT_MARGIN;
+    const int firstLine = std::max(0, stc->DocLineFromVisible(firstVisible) - margin);
+    const int lastLine = std::min(stc->GetLineCount() - 1, stc->DocLineFromVisible(firstVisible + stc->LinesOnScreen()) + margin);
+    const std::pair<int, int> first(stc->PositionFromLine(firstLine), 0);
+    const std::pair<int, int> last(stc->GetLineEndPosition(lastLine), 0);
+    OccurrenceCache::Occurrences fresh;
+    std::set_difference(std::lower_bound(m_HighlightedOccurrences.begin(), m_HighlightedOccurrences.end(), first),
+                        std::lower_bound(m_HighlightedOccurrences.begin(), m_HighlightedOccurrences.end(), last),
+                        m_PaintedOccurrences.begin(), m_PaintedOccurrences.end(), std::back_inserter(fresh));
+    if (fresh.empty())
+        return;
 
-    m_pClangPlugin->GetOccurrencesOf( translId,  ed->GetFilename(), loc );
+    // TODO: use independent key
+    wxColour highlightColour(Manager::Get()->GetColourManager()->GetColour(wxT("editor_highlight_occurrence")));
+    stc->IndicatorSetStyle(OCCURRENCE_INDICATOR, wxSCI_INDIC_HIGHLIGHT);
+    stc->IndicatorSetForeground(OCCURRENCE_INDICATOR, highlightColour);
+    stc->IndicatorSetUnder(OCCURRENCE_INDICATOR, true);
+    for (OccurrenceCache::Occurrences::const_iterator tkn = fresh.begin(); tkn != fresh.end(); ++tkn)
+        stc->IndicatorFillRange(tkn->first, tkn->second);
+
+    OccurrenceCache::Occurrences painted;
+    painted.reserve(m_PaintedOccurrences.size() + fresh.size());
+    std::merge(m_PaintedOccurrences.begin(), m_PaintedOccurrences.end(), fresh.begin(), fresh.end(), std::back_inserter(painted));
+    m_PaintedOccurrences.swap(painted);
+}
+
+void ClangCodeCompletion::ClearOccurrences(cbStyledTextCtrl* stc, int editLength)
+{
+    stc->SetIndicatorCurrent(OCCURRENCE_INDICATOR);
+    if (stc != m_pOccurrencesCtrl)
+    {
+        // Nothing is known about the indicators of another editor, clear them once and keep track of it from now on
+        stc->IndicatorClearRange(0, stc->GetLength());
+        m_pOccurrencesCtrl = stc;
+    }
+    else if (!m_PaintedOccurrences.empty())
+    {
+        // Only the span of the painted occurrences, widened by how far an edit may have moved them
+        const int start = std::max(0, m_PaintedOccurrences.front().first - editLength);
+        const int end = std::min(stc->GetLength(), m_PaintedOccurrences.back().first + m_PaintedOccurrences.back().second + editLength);
+        if (end > start)
+            stc->IndicatorClearRange(start, end - start);
+    }
+    m_HighlightedOccurrences.clear();
+    m_PaintedOccurrences.clear();
+}
+
+static bool OccurrenceStartLess(int pos, const std::pair<int, int>& occurrence)
+{
+    return pos < occurrence.first;
+}
+
+const ClangCodeCompletion::OccurrenceCache::Occurrences* ClangCodeCompletion::OccurrenceCache::Find(ClTranslUnitId translId, const wxString& fn, int pos) const
+{
+    if ((translId != translUnitId) || (fn != filename))
+        return nullptr;
+    const Occurrences* pFound = nullptr;
+    for (std::vector<Occurrences>::const_iterator it = symbols.begin(); it != symbols.end(); ++it)
+    {
+        // The last occurrence that starts at or before the position
+        Occurrences::const_iterator occIt = std::upper_bound(it->begin(), it->end(), pos, OccurrenceStartLess);
+        if (occIt == it->begin())
+            continue;
+        --occIt;
+        if (pos >= occIt->first + occIt->second)
+            continue;
+        // Overlapping symbols cannot be told apart without libclang
+        if (pFound)
+            return nullptr;
+        pFound = &(*it);
+    }
+    return pFound;
+}
+
+void ClangCodeCompletion::OccurrenceCache::Add(ClTranslUnitId translId, const wxString& fn, const Occurrences& occurrences)
+{
+    if (occurrences.empty())
+        return;
+    if ((translId != translUnitId) || (fn != filename))
+    {
+        Clear();
+        translUnitId = translId;
+        filename = fn;
+    }
+    Occurrences sorted(occurrences);
+    std::sort(sorted.begin(), sorted.end());
+    for (std::vector<Occurrences>::const_iterator it = symbols.begin(); it != symbols.end(); ++it)
+    {
+        if (*it == sorted)
+            return;
+    }
+    if (symbols.size() >= OCCURRENCE_CACHE_SIZE)
+        symbols.erase(symbols.begin());
+    symbols.push_back(Occurrences());
+    symbols.back().swap(sorted);
 }
 
 void ClangCodeCompletion::OnTranslationUnitCreated( ClangEvent& event )
@@ -615,7 +1179,18 @@ void ClangCodeCompletion::OnTranslationUnitCreated( ClangEvent& event )
         return;
     m_CCOutstanding = 0;
     m_CCOutstandingTokenStart = 0;
-    m_CCOutstandingResults.clear();
+    m_CompletionCache.Clear();
+    m_OccurrenceCache.Clear();
+}
+
+void ClangCodeCompletion::OnReparseFinished(ClangEvent& event)
+{
+    // Reparsing disposes the completion results of the translation unit, the cached token id's refer to them
+    if (event.GetTranslationUnitId() == m_CompletionCache.translUnitId)
+        m_CompletionCache.Clear();
+    // The symbols may resolve differently, e.g. after a header changed
+    if (event.GetTranslationUnitId() == m_OccurrenceCache.translUnitId)
+        m_OccurrenceCache.Clear();
 }
 
 void ClangCodeCompletion::OnCodeCompleteFinished(ClangEvent& event)
@@ -628,20 +1203,24 @@ void ClangCodeCompletion::OnCodeCompleteFinished(ClangEvent& event)
         if (event.GetLocation() != m_CCOutstandingLoc)
         {
             CCLogger::Get()->DebugLog(wxT("Discard old CodeCompletion request result"));
+            m_CCOutstanding--;
             return;
         }
         EditorManager* edMgr = Manager::Get()->GetEditorManager();
         cbEditor* ed = edMgr->GetBuiltinActiveEditor();
-        if (ed)
+        if (ed && (m_CompletionCache.bufferVersion == m_BufferVersion)
+               && (m_CompletionCache.tokenStart == m_CCOutstandingTokenStart))
         {
-            m_CCOutstandingResults = event.GetCodeCompletionResults();
-            if (m_CCOutstandingResults.size() > 0)
+            std::vector<ClToken> results = event.GetCodeCompletionResults();
+            m_CompletionCache.SetResults(results);
+            m_CCOutstanding = 0;
+            if (!m_CompletionCache.results.empty() && !m_CCOutstandingPreemptive)
             {
                 CodeBlocksEvent evt(cbEVT_COMPLETE_CODE);
                 evt.SetInt(1);
                 Manager::Get()->ProcessEvent(evt);
-                return;
             }
+            return;
         }
         m_CCOutstanding--;
     }
@@ -660,14 +1239,7 @@ void ClangCodeCompletion::OnGetOccurrencesFinished(ClangEvent& event)
     if (!ed)
         return;
     cbStyledTextCtrl* stc = ed->GetControl();
-    int pos = stc->GetCurrentPos();
-    const wxChar ch = stc->GetCharAt(pos);
-    if (   pos > 0
-        && (wxIsspace(ch) || (ch != wxT('_') && wxIspunct(ch)))
-        && !wxIsspace(stc->GetCharAt(pos - 1)) )
-    {
-        --pos;
-    }
+    const int pos = GetHighlightPosition(stc);
     const int line = stc->LineFromPosition(pos);
     ClTokenPosition loc(line + 1, pos - stc->PositionFromLine(line) + 1);
 
@@ -677,27 +1249,10 @@ void ClangCodeCompletion::OnGetOccurrencesFinished(ClangEvent& event)
         return; // Location has changed since the request
     }
 
-    // chosen a high value for indicator, hoping not to interfere with the indicators used by some lexers
-    // if they get updated from deprecated old style indicators someday.
-    const int theIndicator = 16;
-    stc->SetIndicatorCurrent(theIndicator);
-
-    // Set Styling:
-    // clear all style indications set in a previous run (is also done once after text gets unselected)
-    stc->IndicatorClearRange(0, stc->GetLength());
-    // TODO: use independent key
-    wxColour highlightColour(Manager::Get()->GetColourManager()->GetColour(wxT("editor_highlight_occurrence")));
-    stc->IndicatorSetStyle(theIndicator, wxSCI_INDIC_HIGHLIGHT);
-    stc->IndicatorSetForeground(theIndicator, highlightColour);
-    stc->IndicatorSetUnder(theIndicator, true);
-
     const std::vector< std::pair<int, int> >& occurrences = event.GetOccurrencesResults();
-
-    for (std::vector< std::pair<int, int> >::const_iterator tkn = occurrences.begin();
-         tkn != occurrences.end(); ++tkn)
-    {
-        stc->IndicatorFillRange(tkn->first, tkn->second);
-    }
+    if (m_OccurrencesRequestCurrent && !event.AreOccurrencesShared())
+        m_OccurrenceCache.Add(event.GetTranslationUnitId(), ed->GetFilename(), occurrences);
+    HighlightOccurrences(stc, occurrences);
 }
 
 // Sorting in GetLocalIncludeDirs()
@@ -709,11 +1264,9 @@ static int CompareStringLen(const wxString& first, const wxString& second)
 wxArrayString ClangCodeCompletion::GetLocalIncludeDirs(cbProject* project, const wxArrayString& buildTargets)
 {
     wxArrayString dirs;
-#if 0 //TODO
     // Do not try to operate include directories if the project is not for this platform
-    if (m_CCEnablePlatformCheck && !project->SupportsCurrentPlatform())
+    if (!project->SupportsCurrentPlatform())
         return dirs;
-#endif
     const wxString prjPath = project->GetCommonTopLevelPath();
     GetAbsolutePath(prjPath, project->GetIncludeDirs(), dirs);
 
@@ -721,43 +1274,18 @@ wxArrayString ClangCodeCompletion::GetLocalIncludeDirs(cbProject* project, const
     {
         ProjectBuildTarget* tgt = project->GetBuildTarget(buildTargets[i]);
         // Do not try to operate include directories if the target is not for this platform
-#if 0 //TODO
-        if (   !m_CCEnablePlatformCheck
-                || (m_CCEnablePlatformCheck && tgt->SupportsCurrentPlatform()) )
-        {
-#endif
+        if (tgt && tgt->SupportsCurrentPlatform())
             GetAbsolutePath(prjPath, tgt->GetIncludeDirs(), dirs);
-#if 0 //TODO
-        }
-#endif
     }
 
     // if a path has prefix with the project's path, it is a local include search dir
-    // other wise, it is a system level include search dir, we try to collect all the system dirs
-    wxArrayString sysDirs;
+    // other wise, it is a system level include search dir, see GetSystemIncludeDirs()
     for (size_t i = 0; i < dirs.GetCount();)
     {
         if (dirs[i].StartsWith(prjPath))
             ++i;
         else
-        {
-#if 0 //TODO
-            wxCriticalSectionLocker locker(m_SystemHeadersThreadCS);
-            if (m_SystemHeadersMap.find(dirs[i]) == m_SystemHeadersMap.end())
-                sysDirs.Add(dirs[i]);
-#endif
             dirs.RemoveAt(i);
-        }
-    }
-
-    if (!sysDirs.IsEmpty())
-    {
-#if 0 //TODO
-        SystemHeadersThread* thread = new SystemHeadersThread(this, &m_SystemHeadersThreadCS, m_SystemHeadersMap, sysDirs);
-        m_SystemHeadersThreads.push_back(thread);
-        if (!m_SystemHeadersThreads.front()->IsRunning() && m_NativeParser.Done())
-            thread->Run();
-#endif
     }
 
     dirs.Sort(CompareStringLen);
@@ -779,24 +1307,32 @@ wxArrayString& ClangCodeCompletion::GetSystemIncludeDirs(cbProject* project, boo
     wxString prjPath;
     if (project)
         prjPath = project->GetCommonTopLevelPath();
-#if 0
-    ParserBase* parser = m_NativeParser.GetParserByProject(project);
-    if (!parser)
+
+    // the compiler's own search dirs, as " -I<dir>" flags
+    const wxString compId = (project ? project->GetCompilerID() : CompilerFactory::GetDefaultCompilerID());
+    wxString flags = m_pClangPlugin->GetCompilerInclDirs(compId);
+    for (int pos = flags.Find(wxT(" -I")); pos != wxNOT_FOUND; pos = flags.Find(wxT(" -I")))
+    {
+        flags = flags.Mid(pos + 3);
+        const int nextPos = flags.Find(wxT(" -I"));
+        const wxString dir = (nextPos == wxNOT_FOUND) ? flags : flags.Left(nextPos);
+        if (!dir.IsEmpty() && (incDirs.Index(dir) == wxNOT_FOUND))
+            incDirs.Add(dir);
+    }
+    if (!project)
         return incDirs;
 
-    incDirs = parser->GetIncludeDirs();
-    // we try to remove the dirs which belong to the project
-    for (size_t i = 0; i < incDirs.GetCount();)
+    // the project's search dirs outside of the project
+    wxArrayString prjDirs;
+    GetAbsolutePath(prjPath, project->GetIncludeDirs(), prjDirs);
+    for (int i = 0; i < project->GetBuildTargetsCount(); ++i)
+        GetAbsolutePath(prjPath, project->GetBuildTarget(i)->GetIncludeDirs(), prjDirs);
+    for (size_t i = 0; i < prjDirs.GetCount(); ++i)
     {
-        if (incDirs[i].Last() != wxFILE_SEP_PATH)
-            incDirs[i].Append(wxFILE_SEP_PATH);
-        // the dirs which have prjPath prefix are local dirs, so they should be removed
-        if (project && incDirs[i].StartsWith(prjPath))
-            incDirs.RemoveAt(i);
-        else
-            ++i;
+        // the dirs which have prjPath prefix are local dirs, see GetLocalIncludeDirs()
+        if (!prjDirs[i].StartsWith(prjPath) && (incDirs.Index(prjDirs[i]) == wxNOT_FOUND))
+            incDirs.Add(prjDirs[i]);
     }
-#endif
 
     return incDirs;
 }
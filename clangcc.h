@@ -6,6 +6,11 @@
 #include <wx/timer.h>
 
 #include "clangpluginapi.h"
+#include "completionhistory.h"
+#include "includeindex.h"
+#include "keymatcher.h"
+
+class cbStyledTextCtrl;
 
 class ClangCodeCompletion : public ClangPluginComponent
 {
@@ -34,6 +39,7 @@ public:
 public: // Code::Blocks events
     void OnEditorActivate(CodeBlocksEvent& event);
     void OnEditorClose(CodeBlocksEvent& event);
+    void OnProjectChanged(CodeBlocksEvent& event);
     void OnEditorHook(cbEditor* ed, wxScintillaEvent& event);
     void OnTimer(wxTimerEvent& event);
     void OnKeyDown(wxKeyEvent& event);
@@ -42,19 +48,125 @@ public: // Code::Blocks events
 public: // Clang events
     void OnTranslationUnitCreated(ClangEvent& event);
     void OnCodeCompleteFinished(ClangEvent& event);
+    void OnReparseFinished(ClangEvent& event);
     void OnGetOccurrencesFinished(ClangEvent& event);
 
 private:
+    /** @brief Completion results of the identifier being typed
+     *
+     * Valid as long as the text outside the identifier is not modified, so typing more of the
+     * identifier only re-filters the results instead of asking libclang again.
+     */
+    struct CompletionCache
+    {
+        CompletionCache() :
+            translUnitId(wxNOT_FOUND), tokenStart(wxNOT_FOUND), bufferVersion(0), maxCount(0),
+            hasResults(false), isComplete(false) {}
+        void Clear()
+        {
+            translUnitId = wxNOT_FOUND;
+            tokenStart = wxNOT_FOUND;
+            hasResults = false;
+            results.clear();
+            isMaterialized.clear();
+            typedTexts.Clear();
+        }
+        /** Forget the results and remember the key of a new request */
+        void Start(ClTranslUnitId translId, const wxString& fn, int tknStart, unsigned int version,
+                   const wxString& tknPrefix, size_t maxResults)
+        {
+            Clear();
+            translUnitId = translId;
+            filename = fn;
+            tokenStart = tknStart;
+            bufferVersion = version;
+            prefix = tknPrefix;
+            maxCount = maxResults;
+        }
+        bool Matches(ClTranslUnitId translId, const wxString& fn, int tknStart, unsigned int version) const
+        {
+            return (translUnitId == translId) && (tokenStart == tknStart) && (bufferVersion == version) && (filename == fn);
+        }
+        bool CanFilter(const wxString& tknPrefix) const;
+        void SetResults(std::vector<ClToken>& tokens);
+
+        ClTranslUnitId translUnitId;
+        wxString filename;
+        int tokenStart;                 ///< Position of the start of the identifier in the editor
+        unsigned int bufferVersion;     ///< m_BufferVersion when the results were requested
+        wxString prefix;                ///< Lower case prefix the results were filtered on
+        size_t maxCount;                ///< Result limit of the request
+        bool hasResults;
+        bool isComplete;                ///< All results matching the prefix are there, none was dropped by the limit
+        std::vector<ClToken> results;
+        std::vector<bool> isMaterialized; ///< The result has its display name, see IClangPlugin::MaterializeCodeCompletionTokens()
+        ClKeyMatcher typedTexts;          ///< Typed text of the results, for filtering
+    };
+
+    /** @brief Occurrences of the symbols that were highlighted in the active editor
+     *
+     * Moving the caret between the occurrences of a cached symbol is answered from here without a job.
+     * Only symbols whose occurrences belong to them alone are cached, so no class names (which also
+     * name the constructors) or macros, and a position within more than one cached symbol is not
+     * answered. Valid until the buffer is modified or the translation unit is reparsed.
+     */
+    struct OccurrenceCache
+    {
+        typedef std::vector< std::pair<int, int> > Occurrences; ///< (start, length), sorted on start
+
+        OccurrenceCache() :
+            translUnitId(wxNOT_FOUND) {}
+        void Clear()
+        {
+            translUnitId = wxNOT_FOUND;
+            filename.Clear();
+            symbols.clear();
+        }
+        /** Find the occurrences of the symbol that has an occurrence at the position, nullptr when not cached or ambiguous */
+        const Occurrences* Find(ClTranslUnitId translId, const wxString& fn, int pos) const;
+        void Add(ClTranslUnitId translId, const wxString& fn, const Occurrences& occurrences);
+
+        ClTranslUnitId translUnitId;
+        wxString filename;
+        std::vector<Occurrences> symbols; ///< Least recently added first
+    };
+
     /** Perform auto completion for #include filenames */
     std::vector<cbCodeCompletionPlugin::CCToken> GetAutocompListIncludes(bool isAuto, cbEditor* ed, int& tknStart, int& tknEnd);
+    /** Insert an #include filename picked from the list */
+    bool DoAutocompleteInclude(const cbCodeCompletionPlugin::CCToken& token, cbEditor* ed);
+    /** Find the start of the path in an #include directive, and the character that closes it */
+    static bool GetIncludePathStart(cbStyledTextCtrl* stc, int pos, int& out_pathStart, wxChar& out_closeChar);
+    /** Get the directories an #include in the editor is searched in, in search order */
+    void GetIncludeSearchDirs(cbEditor* ed, bool isQuoted, bool force, wxArrayString& out_dirs);
     /** Get the current translation unit id */
     ClTranslUnitId GetCurrentTranslationUnitId();
+    /** Check if the position follows a '.', '->' or '::' */
+    static bool IsAfterAccessOperator(cbStyledTextCtrl* stc, int pos);
+    /** Get the completion context from the access operator in front of the position */
+    static ClCompletionContext GetCompletionContext(cbStyledTextCtrl* stc, int pos);
+    /** Get the full path of a file kept between sessions, its directory is created when needed */
+    static wxString GetUserDataFilename(const wxString& name);
+    /** Start code completion in the background, so its results are cached when Code::Blocks asks for them */
+    void RequestPreemptiveCompletion(cbEditor* ed, int tknStart);
+    /** Get the position of the token the occurrences are highlighted for, near the caret */
+    static int GetHighlightPosition(cbStyledTextCtrl* stc);
+    /** Highlight the occurrences of the symbol at the caret when they are cached */
+    bool HighlightCachedOccurrences(cbEditor* ed);
+    /** Replace the highlighted occurrences in the editor */
+    void HighlightOccurrences(cbStyledTextCtrl* stc, const OccurrenceCache::Occurrences& occurrences);
+    /** Paint the highlighted occurrences around the visible lines, and remove the ones no longer highlighted */
+    void PaintOccurrences(cbStyledTextCtrl* stc);
+    /** Remove the highlighted occurrences
+     *
+     * @param editLength Length of the text that was just inserted or deleted, the painted occurrences moved by at most that
+     */
+    void ClearOccurrences(cbStyledTextCtrl* stc, int editLength = 0);
 
 protected: // Code completion for #include
     /** get the include paths setting (usually set by user for each C::B project)
-     * note that this function is only be called in CodeCompletion::DoCodeCompleteIncludes()
-     * if it finds some system level include search dirs which does not been scanned, it will start a
-     * a new thread(SystemHeadersThread).
+     * only the ones below the project's path are returned, the others are system level include
+     * search dirs, see GetSystemIncludeDirs().
      * @param project project info
      * @param buildTargets target info
      * @return the local include paths
@@ -88,7 +200,17 @@ private:
     long m_CCOutstandingLastMessageTime;
     int m_CCOutstandingTokenStart;
     ClTokenPosition m_CCOutstandingLoc;
-    std::vector<ClToken> m_CCOutstandingResults;
+    bool m_CCOutstandingPreemptive; ///< The outstanding request was not asked for by Code::Blocks, don't show its results
+    unsigned int m_BufferVersion; ///< Incremented on every edit outside the identifier being completed
+    CompletionCache m_CompletionCache;
+    OccurrenceCache m_OccurrenceCache;
+    bool m_OccurrencesRequestCurrent; ///< The buffer was not modified since occurrences were last requested
+    cbStyledTextCtrl* m_pOccurrencesCtrl; ///< Editor control of m_HighlightedOccurrences
+    OccurrenceCache::Occurrences m_HighlightedOccurrences; ///< Occurrences of the symbol at the caret
+    OccurrenceCache::Occurrences m_PaintedOccurrences; ///< Occurrences that have the indicator, sorted
+    ClCompletionHistory m_CompletionHistory; ///< Completions accepted in DoAutocomplete(), ranked first next time
+    ClIncludeIndex m_IncludeIndex; ///< Files below the include search directories, for #include completion
+    bool m_IncludeDirsChanged; ///< A project or its build targets changed since the system include dirs were cached
     std::vector<wxString> m_TabJumpArguments;
 };
 
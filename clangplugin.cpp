@@ -7,12 +7,14 @@
 #include <iostream>
 #include "clangplugin.h"
 #include "clangccsettingsdlg.h"
+#include "clangsymbolpicker.h"
 #include "cclogger.h"
 
 #include <cbcolourmanager.h>
 #include <cbstyledtextctrl.h>
 #include <compilercommandgenerator.h>
 #include <editor_hooks.h>
+#include <searchresultslog.h>
 
 #include <wx/tokenzr.h>
 
@@ -31,6 +33,7 @@
 #include <algorithm>
 #include <wx/dir.h>
 #include <wx/menu.h>
+#include <wx/textfile.h>
 #endif // CB_PRECOMP
 
 #define CLANGPLUGIN_TRACE_FUNCTIONS
@@ -51,8 +54,13 @@ DEFINE_EVENT_TYPE(clEVT_TOKENDATABASE_UPDATED);
 
 static const wxString g_InvalidStr(wxT("invalid"));
 const int idReparseTimer    = wxNewId();
+const int idIdleTimer       = wxNewId();
 const int idGotoDeclaration = wxNewId();
 const int idGotoImplementation = wxNewId();
+const int idFindReferences = wxNewId();
+const int idFindOverrides = wxNewId();
+const int idTypeHierarchy = wxNewId();
+const int idGotoSymbol = wxNewId();
 
 DEFINE_EVENT_TYPE(cbEVT_COMMAND_CREATETU);
 // Asynchronous events received
@@ -66,8 +74,15 @@ const int idClangUpdateTokenDatabase = wxNewId();
 const int idClangGetDiagnostics = wxNewId();
 const int idClangSyncTask = wxNewId();
 const int idClangCodeCompleteTask = wxNewId();
+const int idClangGetCallTipsTask = wxNewId();
 const int idClangGetCCDocumentationTask = wxNewId();
 const int idClangGetOccurrencesTask = wxNewId();
+const int idClangCompactTokenDatabase = wxNewId();
+const int idClangStoreTokenDatabase = wxNewId();
+const int idClangPrefetchCCDocumentation = wxNewId();
+const int idClangGetReferencesTask = wxNewId();
+const int idClangGetTypeHierarchyTask = wxNewId();
+const int idClangGetOverridesTask = wxNewId();
 
 ClangPlugin::ClangPlugin() :
     m_FileDatabase(),
@@ -75,8 +90,10 @@ ClangPlugin::ClangPlugin() :
     m_Proxy(this, m_Database, m_CppKeywords),
     m_ImageList(16, 16),
     m_ReparseTimer(this, idReparseTimer),
+    m_IdleTimer(this, idIdleTimer),
     m_pLastEditor(nullptr),
     m_TranslUnitId(wxNOT_FOUND),
+    m_LastCallTipPos(wxSCI_INVALID_POSITION),
     m_UpdateCompileCommand(0),
     m_ReparseNeeded(0)
 {
@@ -146,10 +163,12 @@ void ClangPlugin::OnAttach()
 
     EditorColourSet* theme = Manager::Get()->GetEditorManager()->GetColourSet();
     wxStringTokenizer tokenizer(theme->GetKeywords(theme->GetHighlightLanguage(wxT("C/C++")), 0));
+    wxStringVec lexerKeywords;
     while (tokenizer.HasMoreTokens())
-        m_CppKeywords.push_back(tokenizer.GetNextToken());
-    std::sort(m_CppKeywords.begin(), m_CppKeywords.end());
-    wxStringVec(m_CppKeywords).swap(m_CppKeywords);
+        lexerKeywords.push_back(tokenizer.GetNextToken());
+    m_CppKeywords.SetExtraKeywords(lexerKeywords);
+
+    m_Proxy.LoadTokenDatabase(GetTokenDatabaseFilename());
 
     typedef cbEventFunctor<ClangPlugin, CodeBlocksEvent> ClEvent;
     Manager::Get()->RegisterEventSink(cbEVT_EDITOR_OPEN,             new ClEvent(this, &ClangPlugin::OnEditorOpen));
@@ -164,15 +183,25 @@ void ClangPlugin::OnAttach()
     Connect(g_idCCLogger,                  wxEVT_COMMAND_MENU_SELECTED,    CodeBlocksThreadEventHandler(ClangPlugin::OnCCLogger));
     Connect(g_idCCDebugLogger,             wxEVT_COMMAND_MENU_SELECTED,    CodeBlocksThreadEventHandler(ClangPlugin::OnCCDebugLogger));
     Connect(idReparseTimer,                wxEVT_TIMER,                    wxTimerEventHandler(ClangPlugin::OnTimer));
+    Connect(idIdleTimer,                   wxEVT_TIMER,                    wxTimerEventHandler(ClangPlugin::OnTimer));
     Connect(idGotoDeclaration,             wxEVT_COMMAND_MENU_SELECTED,    wxCommandEventHandler(ClangPlugin::OnGotoDeclaration),       nullptr, this);
     Connect(idGotoImplementation,          wxEVT_COMMAND_MENU_SELECTED,    wxCommandEventHandler(ClangPlugin::OnGotoImplementation),    nullptr, this);
+    Connect(idFindReferences,              wxEVT_COMMAND_MENU_SELECTED,    wxCommandEventHandler(ClangPlugin::OnFindReferences),        nullptr, this);
+    Connect(idFindOverrides,               wxEVT_COMMAND_MENU_SELECTED,    wxCommandEventHandler(ClangPlugin::OnFindOverrides),         nullptr, this);
+    Connect(idTypeHierarchy,               wxEVT_COMMAND_MENU_SELECTED,    wxCommandEventHandler(ClangPlugin::OnTypeHierarchy),         nullptr, this);
+    Connect(idGotoSymbol,                  wxEVT_COMMAND_MENU_SELECTED,    wxCommandEventHandler(ClangPlugin::OnGotoSymbol),            nullptr, this);
     Connect(idClangCreateTU,               cbEVT_COMMAND_CREATETU,         wxCommandEventHandler(ClangPlugin::OnCreateTranslationUnit), nullptr, this);
     Connect(idClangCreateTU,               cbEVT_CLANG_ASYNCTASK_FINISHED, wxEventHandler(ClangPlugin::OnClangCreateTUFinished),        nullptr, this);
     Connect(idClangReparse,                cbEVT_CLANG_ASYNCTASK_FINISHED, wxEventHandler(ClangPlugin::OnClangReparseFinished),         nullptr, this);
+    Connect(idClangUpdateTokenDatabase,    cbEVT_CLANG_ASYNCTASK_FINISHED, wxEventHandler(ClangPlugin::OnClangUpdateTokenDatabaseFinished), nullptr, this);
     Connect(idClangGetDiagnostics,         cbEVT_CLANG_ASYNCTASK_FINISHED, wxEventHandler(ClangPlugin::OnClangGetDiagnosticsFinished),  nullptr, this);
     Connect(idClangGetOccurrencesTask,     cbEVT_CLANG_ASYNCTASK_FINISHED, wxEventHandler(ClangPlugin::OnClangGetOccurrencesFinished),  nullptr, this);
+    Connect(idClangGetReferencesTask,      cbEVT_CLANG_ASYNCTASK_FINISHED, wxEventHandler(ClangPlugin::OnClangGetReferencesFinished),   nullptr, this);
+    Connect(idClangGetTypeHierarchyTask,   cbEVT_CLANG_ASYNCTASK_FINISHED, wxEventHandler(ClangPlugin::OnClangGetTypeHierarchyFinished), nullptr, this);
+    Connect(idClangGetOverridesTask,       cbEVT_CLANG_ASYNCTASK_FINISHED, wxEventHandler(ClangPlugin::OnClangGetOverridesFinished),    nullptr, this);
     Connect(idClangSyncTask,               cbEVT_CLANG_SYNCTASK_FINISHED,  wxEventHandler(ClangPlugin::OnClangSyncTaskFinished),        nullptr, this);
     Connect(idClangCodeCompleteTask,       cbEVT_CLANG_SYNCTASK_FINISHED,  wxEventHandler(ClangPlugin::OnClangSyncTaskFinished),        nullptr, this);
+    Connect(idClangGetCallTipsTask,        cbEVT_CLANG_SYNCTASK_FINISHED,  wxEventHandler(ClangPlugin::OnClangSyncTaskFinished),        nullptr, this);
     Connect(idClangGetCCDocumentationTask, cbEVT_CLANG_SYNCTASK_FINISHED,  wxEventHandler(ClangPlugin::OnClangSyncTaskFinished),        nullptr, this);
     m_EditorHookId = EditorHooks::RegisterHook(new EditorHooks::HookFunctor<ClangPlugin>(this, &ClangPlugin::OnEditorHook));
 
@@ -205,19 +234,32 @@ void ClangPlugin::OnRelease(bool WXUNUSED(appShutDown))
     EditorHooks::UnregisterHook(m_EditorHookId);
     Disconnect(idClangGetCCDocumentationTask);
     Disconnect(idClangGetOccurrencesTask);
+    Disconnect(idClangGetReferencesTask);
+    Disconnect(idClangGetTypeHierarchyTask);
+    Disconnect(idClangGetOverridesTask);
+    Disconnect(idClangGetCallTipsTask);
     Disconnect(idClangCodeCompleteTask);
     Disconnect(idClangSyncTask);
     Disconnect(idClangGetDiagnostics);
+    Disconnect(idClangUpdateTokenDatabase);
     Disconnect(idClangReparse);
     Disconnect(idClangCreateTU);
     Disconnect(idGotoDeclaration);
     Disconnect(idGotoImplementation);
+    Disconnect(idFindReferences);
+    Disconnect(idFindOverrides);
+    Disconnect(idTypeHierarchy);
+    Disconnect(idGotoSymbol);
+    Disconnect(idIdleTimer);
     Disconnect(idReparseTimer);
     Disconnect(g_idCCDebugLogger);
     Disconnect(g_idCCLogger);
 
     Manager::Get()->RemoveAllEventSinksFor(this);
     m_ImageList.RemoveAll();
+
+    // Pending store jobs may not run anymore. This does not write anything when one of them already did
+    m_Proxy.StoreTokenDatabase(GetTokenDatabaseFilename());
 }
 
 bool ClangPlugin::ActivateComponent( ClangPluginComponent* pComponent )
@@ -372,6 +414,7 @@ std::vector<ClangPlugin::CCCallTip> ClangPlugin::GetCallTips(int pos, int WXUNUS
                 break;
         }
     }
+    const int callPos = pos + 1;
     while (--pos > 0)
     {
         if ( stc->GetCharAt(pos) <= wxT(' ')
@@ -384,6 +427,8 @@ std::vector<ClangPlugin::CCCallTip> ClangPlugin::GetCallTips(int pos, int WXUNUS
     argsPos = stc->WordEndPosition(pos, true);
     if (argsPos != m_LastCallTipPos)
     {
+        // Remember the position right away so that moving the caret inside the same call does not queue another job
+        m_LastCallTipPos = argsPos;
         m_LastCallTips.clear();
         const int line = stc->LineFromPosition(pos);
         const int column = pos - stc->PositionFromLine(line);
@@ -391,16 +436,17 @@ std::vector<ClangPlugin::CCCallTip> ClangPlugin::GetCallTips(int pos, int WXUNUS
         if (!tknText.IsEmpty())
         {
             ClTokenPosition loc(line + 1, column + 1);
-            ClangProxy::GetCallTipsAtJob job(cbEVT_CLANG_SYNCTASK_FINISHED, idClangSyncTask, ed->GetFilename(), loc, m_TranslUnitId, tknText);
+            const int callLine = stc->LineFromPosition(callPos);
+            ClTokenPosition callLoc(callLine + 1, callPos - stc->PositionFromLine(callLine) + 1);
+            std::map<wxString, wxString> unsavedFiles;
+            GetUnsavedFiles(unsavedFiles);
+            // The tips are shown from OnClangSyncTaskFinished once the job has finished
+            ClangProxy::GetCallTipsAtJob job(cbEVT_CLANG_SYNCTASK_FINISHED, idClangGetCallTipsTask, ed->GetFilename(), loc, callLoc,
+                                             m_TranslUnitId, tknText, unsavedFiles);
             m_Proxy.AppendPendingJob(job);
-            if (job.WaitCompletion(40) == wxCOND_TIMEOUT)
-                return tips;
-            m_LastCallTips = job.GetResults();
-            // m_Proxy.GetCallTipsAt(ed->GetFilename(), line + 1, column + 1,
-            //           m_TranslUnitId, tknText, m_LastCallTips);
         }
+        return tips;
     }
-    m_LastCallTipPos = argsPos;
     for (std::vector<wxStringVec>::const_iterator strVecItr = m_LastCallTips.begin();
             strVecItr != m_LastCallTips.end(); ++strVecItr)
     {
@@ -475,6 +521,10 @@ void ClangPlugin::BuildMenu(wxMenuBar* menuBar)
         menuBar->GetMenu(idx)->AppendSeparator();
         menuBar->GetMenu(idx)->Append(idGotoDeclaration, _("Find &declaration (clang)"));
         menuBar->GetMenu(idx)->Append(idGotoImplementation, _("Find &implementation (clang)"));
+        menuBar->GetMenu(idx)->Append(idFindReferences, _("Find &references (clang)"));
+        menuBar->GetMenu(idx)->Append(idFindOverrides, _("Find &overrides (clang)"));
+        menuBar->GetMenu(idx)->Append(idTypeHierarchy, _("Type &hierarchy (clang)"));
+        menuBar->GetMenu(idx)->Append(idGotoSymbol, _("Go to symbol in &workspace (clang)..."));
     }
 
     for (std::vector<ClangPluginComponent*>::iterator it = m_ActiveComponentList.begin(); it != m_ActiveComponentList.end(); ++it)
@@ -506,6 +556,9 @@ void ClangPlugin::BuildModuleMenu(const ModuleType type, wxMenu* menu,
         return;
     menu->Insert(0, idGotoDeclaration,    _("Find declaration (clang)"));
     menu->Insert(1, idGotoImplementation, _("Find implementation (clang)"));
+    menu->Insert(2, idFindReferences,     _("Find references (clang)"));
+    menu->Insert(3, idFindOverrides,      _("Find overrides (clang)"));
+    menu->Insert(4, idTypeHierarchy,      _("Type hierarchy (clang)"));
 }
 
 bool ClangPlugin::BuildToolBar(wxToolBar* toolBar)
@@ -592,12 +645,7 @@ void ClangPlugin::OnEditorSave(CodeBlocksEvent& event)
     std::map<wxString, wxString> unsavedFiles;
     // Our saved file is not yet known to all translation units since it's no longer in the unsaved files. We update them here
     unsavedFiles.insert(std::make_pair(ed->GetFilename(), ed->GetControl()->GetText()));
-    for (int i = 0; i < edMgr->GetEditorsCount(); ++i)
-    {
-        cbEditor* editor = edMgr->GetBuiltinEditor(i);
-        if (editor && editor->GetModified())
-            unsavedFiles.insert(std::make_pair(editor->GetFilename(), editor->GetControl()->GetText()));
-    }
+    GetUnsavedFiles(unsavedFiles);
     ClangProxy::ReparseJob job(cbEVT_CLANG_ASYNCTASK_FINISHED, idClangReparse, m_TranslUnitId, m_CompileCommand, ed->GetFilename(), unsavedFiles, true);
     m_Proxy.AppendPendingJob(job);
 }
@@ -652,6 +700,8 @@ void ClangPlugin::OnProjectOptionsChanged(CodeBlocksEvent& event)
 void ClangPlugin::OnProjectClose(CodeBlocksEvent& event)
 {
     event.Skip();
+    ClangProxy::StoreTokenDatabaseJob job(cbEVT_CLANG_ASYNCTASK_FINISHED, idClangStoreTokenDatabase, GetTokenDatabaseFilename());
+    m_Proxy.AppendPendingJob(job);
 }
 
 void ClangPlugin::OnProjectFileChanged(CodeBlocksEvent& event)
@@ -665,10 +715,18 @@ void ClangPlugin::OnProjectFileChanged(CodeBlocksEvent& event)
 
 void ClangPlugin::OnTimer(wxTimerEvent& event)
 {
+    const int evId = event.GetId();
+    if (evId == idIdleTimer)
+    {
+        ClangProxy::CompactTokenDatabaseJob job(cbEVT_CLANG_ASYNCTASK_FINISHED, idClangCompactTokenDatabase);
+        m_Proxy.AppendPendingJob(job);
+        ClangProxy::StoreTokenDatabaseJob storeJob(cbEVT_CLANG_ASYNCTASK_FINISHED, idClangStoreTokenDatabase, GetTokenDatabaseFilename());
+        m_Proxy.AppendPendingJob(storeJob);
+        return;
+    }
     cbEditor* ed = Manager::Get()->GetEditorManager()->GetBuiltinActiveEditor();
     if ((!ed) || (m_TranslUnitId == wxNOT_FOUND))
         return;
-    const int evId = event.GetId();
     if (evId == idReparseTimer)
     {
         RequestReparse(m_TranslUnitId, ed->GetFilename());
@@ -692,12 +750,7 @@ void ClangPlugin::OnCreateTranslationUnit(wxCommandEvent& event)
         if (filename != ed->GetFilename())
             return;
         std::map<wxString, wxString> unsavedFiles;
-        for (int i = 0; i < edMgr->GetEditorsCount(); ++i)
-        {
-            ed = edMgr->GetBuiltinEditor(i);
-            if (ed && ed->GetModified())
-                unsavedFiles.insert(std::make_pair(ed->GetFilename(), ed->GetControl()->GetText()));
-        }
+        GetUnsavedFiles(unsavedFiles);
         ClangProxy::CreateTranslationUnitJob job( cbEVT_CLANG_ASYNCTASK_FINISHED, idClangCreateTU, filename, m_CompileCommand, unsavedFiles );
         m_Proxy.AppendPendingJob(job);
     }
@@ -751,6 +804,103 @@ void ClangPlugin::OnGotoImplementation(wxCommandEvent& WXUNUSED(event))
     }
 }
 
+void ClangPlugin::OnFindReferences(wxCommandEvent& WXUNUSED(event))
+{
+    cbEditor* ed = Manager::Get()->GetEditorManager()->GetBuiltinActiveEditor();
+    if (!ed || m_TranslUnitId == wxNOT_FOUND)
+        return;
+    cbStyledTextCtrl* stc = ed->GetControl();
+    const int pos = stc->GetCurrentPos();
+    int line = stc->LineFromPosition(pos);
+    ClTokenPosition loc(line + 1, pos - stc->PositionFromLine(line) + 1);
+    ClangProxy::GetReferencesOfJob job(cbEVT_CLANG_ASYNCTASK_FINISHED, idClangGetReferencesTask, ed->GetFilename(), loc, m_TranslUnitId);
+    m_Proxy.AppendPendingJob(job);
+}
+
+void ClangPlugin::OnFindOverrides(wxCommandEvent& WXUNUSED(event))
+{
+    cbEditor* ed = Manager::Get()->GetEditorManager()->GetBuiltinActiveEditor();
+    if (!ed || m_TranslUnitId == wxNOT_FOUND)
+        return;
+    cbStyledTextCtrl* stc = ed->GetControl();
+    const int pos = stc->GetCurrentPos();
+    int line = stc->LineFromPosition(pos);
+    ClTokenPosition loc(line + 1, pos - stc->PositionFromLine(line) + 1);
+    const wxString word = stc->GetTextRange(stc->WordStartPosition(pos, true), stc->WordEndPosition(pos, true));
+    ClangProxy::GetOverridesAtJob job(cbEVT_CLANG_ASYNCTASK_FINISHED, idClangGetOverridesTask, ed->GetFilename(), loc, m_TranslUnitId, word);
+    m_Proxy.AppendPendingJob(job);
+}
+
+void ClangPlugin::OnTypeHierarchy(wxCommandEvent& WXUNUSED(event))
+{
+    cbEditor* ed = Manager::Get()->GetEditorManager()->GetBuiltinActiveEditor();
+    if (!ed || m_TranslUnitId == wxNOT_FOUND)
+        return;
+    cbStyledTextCtrl* stc = ed->GetControl();
+    const int pos = stc->GetCurrentPos();
+    int line = stc->LineFromPosition(pos);
+    ClTokenPosition loc(line + 1, pos - stc->PositionFromLine(line) + 1);
+    ClangProxy::GetTypeHierarchyAtJob job(cbEVT_CLANG_ASYNCTASK_FINISHED, idClangGetTypeHierarchyTask, ed->GetFilename(), loc, m_TranslUnitId);
+    m_Proxy.AppendPendingJob(job);
+}
+
+void ClangPlugin::OnGotoSymbol(wxCommandEvent& WXUNUSED(event))
+{
+    ClangSymbolPickerDlg dlg(Manager::Get()->GetAppWindow(), m_Database);
+    PlaceWindow(&dlg);
+    if (dlg.ShowModal() != wxID_OK)
+        return;
+    ClFileId fileId;
+    ClTokenPosition loc(0, 0);
+    wxString identifier;
+    if (!dlg.GetSelection(fileId, loc, identifier))
+        return;
+    cbEditor* ed = Manager::Get()->GetEditorManager()->Open(m_Database.GetFilename(fileId));
+    if (ed)
+        ed->GotoTokenPosition(loc.line - 1, identifier);
+}
+
+void ClangPlugin::AppendToSearchLog(cbSearchResultsLog* searchLog, const ClTokenReferenceList& locations, const wxString& prefix)
+{
+    EditorManager* edMgr = Manager::Get()->GetEditorManager();
+    wxTextFile textFile;
+    ClFileId textFileId = wxNOT_FOUND;
+    for (ClTokenReferenceList::const_iterator it = locations.begin(); it != locations.end(); ++it)
+    {
+        const wxString filename = m_Database.GetFilename(it->fileId);
+        wxString lineText;
+        cbEditor* refEd = edMgr->GetBuiltinEditor(edMgr->IsOpen(filename));
+        if (refEd)
+            lineText = refEd->GetControl()->GetLine(it->location.line - 1);
+        else
+        {
+            // Locations are mostly ordered on file, every file is read once
+            if (it->fileId != textFileId)
+            {
+                if (textFile.IsOpened())
+                    textFile.Close();
+                textFileId = it->fileId;
+                textFile.Open(filename);
+            }
+            if (textFile.IsOpened() && (it->location.line <= textFile.GetLineCount()))
+                lineText = textFile.GetLine(it->location.line - 1);
+        }
+        wxArrayString values;
+        values.Add(filename);
+        values.Add(wxString::Format(wxT("%u"), it->location.line));
+        values.Add(prefix + lineText.Trim().Trim(false));
+        searchLog->Append(values, Logger::info);
+    }
+}
+
+void ClangPlugin::ShowSearchLog(cbSearchResultsLog* searchLog)
+{
+    CodeBlocksLogEvent evtShow(cbEVT_SHOW_LOG_MANAGER);
+    Manager::Get()->ProcessEvent(evtShow);
+    CodeBlocksLogEvent evtSwitch(cbEVT_SWITCH_TO_LOG_WINDOW, searchLog);
+    Manager::Get()->ProcessEvent(evtSwitch);
+}
+
 wxString ClangPlugin::GetCompilerInclDirs(const wxString& compId)
 {
     std::map<wxString, wxString>::const_iterator idItr = m_compInclDirs.find(compId);
@@ -790,6 +940,11 @@ wxString ClangPlugin::GetCompilerInclDirs(const wxString& compId)
     }
     return m_compInclDirs.insert(std::pair<wxString, wxString>(compId, includeDirs)).first->second;
 }
+
+wxString ClangPlugin::GetTokenDatabaseFilename() const
+{
+    return ConfigManager::GetFolder(sdDataUser) + wxT("/clanglib/tokens.cbcc");
+}
 #if 0
 wxString ClangPlugin::GetSourceOf(cbEditor* ed)
 {
@@ -1096,6 +1251,9 @@ void ClangPlugin::OnClangUpdateTokenDatabaseFinished(wxEvent& event)
 
     ClangEvent evt(clEVT_TOKENDATABASE_UPDATED, pJob->GetTranslationUnitId(), wxEmptyString);
     ProcessEvent(evt);
+
+    // Housekeeping of the token database is done when the user stops typing for a while
+    m_IdleTimer.Start(CLANG_IDLE_DELAY, wxTIMER_ONE_SHOT);
 }
 
 void ClangPlugin::OnEditorHook(cbEditor* ed, wxScintillaEvent& event)
@@ -1104,6 +1262,8 @@ void ClangPlugin::OnEditorHook(cbEditor* ed, wxScintillaEvent& event)
 
     if (!IsProviderFor(ed))
         return;
+    if (m_IdleTimer.IsRunning())
+        m_IdleTimer.Start(CLANG_IDLE_DELAY, wxTIMER_ONE_SHOT);
     if (m_ReparseTimer.IsRunning()&&(m_ReparseNeeded > 0))
     {
         m_ReparseTimer.Stop();
@@ -1132,10 +1292,68 @@ void ClangPlugin::OnClangGetOccurrencesFinished(wxEvent& event)
     event.Skip();
 
     ClangProxy::GetOccurrencesOfJob* pOCJob = dynamic_cast<ClangProxy::GetOccurrencesOfJob*>(event.GetEventObject());
-    ClangEvent evt( clEVT_GETOCCURRENCES_FINISHED, pOCJob->GetTranslationUnitId(), pOCJob->GetFilename(), pOCJob->GetLocation(), pOCJob->GetResults());
+    ClangEvent evt( clEVT_GETOCCURRENCES_FINISHED, pOCJob->GetTranslationUnitId(), pOCJob->GetFilename(), pOCJob->GetLocation(), pOCJob->GetResults(), pOCJob->IsShared());
     ProcessEvent(evt);
 }
 
+void ClangPlugin::OnClangGetReferencesFinished(wxEvent& event)
+{
+    event.Skip();
+
+    ClangProxy::GetReferencesOfJob* pJob = dynamic_cast<ClangProxy::GetReferencesOfJob*>(event.GetEventObject());
+    cbSearchResultsLog* searchLog = Manager::Get()->GetSearchResultLogger();
+    if (!pJob || !searchLog)
+        return;
+    const ClTokenReferenceList& references = pJob->GetResults();
+    searchLog->Clear();
+    searchLog->SetBasePath(wxFileName(pJob->GetFilename()).GetPath());
+    AppendToSearchLog(searchLog, references, wxEmptyString);
+    CCLogger::Get()->DebugLog(F(_T("Find references: %d references found"), (int)references.size()));
+    ShowSearchLog(searchLog);
+}
+
+void ClangPlugin::OnClangGetOverridesFinished(wxEvent& event)
+{
+    event.Skip();
+
+    ClangProxy::GetOverridesAtJob* pJob = dynamic_cast<ClangProxy::GetOverridesAtJob*>(event.GetEventObject());
+    if (!pJob)
+        return;
+    const ClTokenReferenceList& overrides = pJob->GetResults();
+    if (overrides.empty())
+        return;
+    if (overrides.size() == 1)
+    {
+        // Go to the only override directly
+        cbEditor* ed = Manager::Get()->GetEditorManager()->Open(m_Database.GetFilename(overrides.front().fileId));
+        if (ed)
+            ed->GotoTokenPosition(overrides.front().location.line - 1, pJob->GetTokenStr());
+        return;
+    }
+    cbSearchResultsLog* searchLog = Manager::Get()->GetSearchResultLogger();
+    if (!searchLog)
+        return;
+    searchLog->Clear();
+    searchLog->SetBasePath(wxFileName(pJob->GetFilename()).GetPath());
+    AppendToSearchLog(searchLog, overrides, wxEmptyString);
+    ShowSearchLog(searchLog);
+}
+
+void ClangPlugin::OnClangGetTypeHierarchyFinished(wxEvent& event)
+{
+    event.Skip();
+
+    ClangProxy::GetTypeHierarchyAtJob* pJob = dynamic_cast<ClangProxy::GetTypeHierarchyAtJob*>(event.GetEventObject());
+    cbSearchResultsLog* searchLog = Manager::Get()->GetSearchResultLogger();
+    if (!pJob || !searchLog)
+        return;
+    searchLog->Clear();
+    searchLog->SetBasePath(wxFileName(pJob->GetFilename()).GetPath());
+    AppendToSearchLog(searchLog, pJob->GetBases(), _("Base: "));
+    AppendToSearchLog(searchLog, pJob->GetDerived(), _("Derived: "));
+    ShowSearchLog(searchLog);
+}
+
 void ClangPlugin::OnClangSyncTaskFinished(wxEvent& event)
 {
     event.Skip();
@@ -1158,10 +1376,39 @@ void ClangPlugin::OnClangSyncTaskFinished(wxEvent& event)
         ClangEvent evt( clEVT_GETOCCURRENCES_FINISHED, pCCDocJob->GetTranslationUnitId(), pCCDocJob->GetFilename(), pCCDocJob->GetLocation(), pCCDocJob->GetResult());
         ProcessEvent(evt);
     }
+    else if (event.GetId() == idClangGetCallTipsTask)
+    {
+        ClangProxy::GetCallTipsAtJob* pCallTipsJob = dynamic_cast<ClangProxy::GetCallTipsAtJob*>(pJob);
+        cbEditor* ed = Manager::Get()->GetEditorManager()->GetBuiltinActiveEditor();
+        if (ed && (ed == m_pLastEditor) && (ed->GetFilename() == pCallTipsJob->GetFilename()))
+        {
+            cbStyledTextCtrl* stc = ed->GetControl();
+            const ClTokenPosition& loc = pCallTipsJob->GetLocation();
+            const int pos = stc->PositionFromLine(loc.line - 1) + loc.column - 1;
+            // Drop the result when the caret has left the call in the meantime
+            if ((stc->WordEndPosition(pos, true) == m_LastCallTipPos) && !pCallTipsJob->GetResults().empty())
+            {
+                m_LastCallTips = pCallTipsJob->GetResults();
+                CodeBlocksEvent evt(cbEVT_SHOW_CALL_TIP);
+                Manager::Get()->ProcessEvent(evt);
+            }
+        }
+    }
 
     pJob->Finalize();
 }
 
+void ClangPlugin::GetUnsavedFiles(std::map<wxString, wxString>& out_unsavedFiles)
+{
+    EditorManager* edMgr = Manager::Get()->GetEditorManager();
+    for (int i = 0; i < edMgr->GetEditorsCount(); ++i)
+    {
+        cbEditor* ed = edMgr->GetBuiltinEditor(i);
+        if (ed && ed->GetModified())
+            out_unsavedFiles.insert(std::make_pair(ed->GetFilename(), ed->GetControl()->GetText()));
+    }
+}
+
 bool ClangPlugin::IsProviderFor(cbEditor* ed)
 {
     return cbCodeCompletionPlugin::IsProviderFor(ed);
@@ -1215,18 +1462,13 @@ void ClangPlugin::GetOccurrencesOf(const ClTranslUnitId translUnitId, const wxSt
 }
 
 wxCondError ClangPlugin::GetCodeCompletionAt(const ClTranslUnitId translUnitId, const wxString& filename, const ClTokenPosition& loc,
-                                             bool includeCtors, unsigned long timeout, std::vector<ClToken>& out_tknResults)
+                                             const wxString& prefix, size_t maxCount, const ClCompletionRanks& historyRanks,
+                                             unsigned long timeout, std::vector<ClToken>& out_tknResults)
 {
     CCLogger::Get()->DebugLog(F(wxT("GetCodeCompletionAt %d,%d"), loc.line, loc.column));
     std::map<wxString, wxString> unsavedFiles;
-    EditorManager* edMgr = Manager::Get()->GetEditorManager();
-    for (int i = 0; i < edMgr->GetEditorsCount(); ++i)
-    {
-        cbEditor* ed = edMgr->GetBuiltinEditor(i);
-        if (ed && ed->GetModified())
-            unsavedFiles.insert(std::make_pair(ed->GetFilename(), ed->GetControl()->GetText()));
-    }
-    ClangProxy::CodeCompleteAtJob job(cbEVT_CLANG_SYNCTASK_FINISHED, idClangCodeCompleteTask, 0, filename, loc, translUnitId, unsavedFiles, includeCtors);
+    GetUnsavedFiles(unsavedFiles);
+    ClangProxy::CodeCompleteAtJob job(cbEVT_CLANG_SYNCTASK_FINISHED, idClangCodeCompleteTask, 0, filename, loc, translUnitId, unsavedFiles, prefix, maxCount, historyRanks);
     m_Proxy.AppendPendingJob(job);
     if( timeout == 0 )
         return wxCOND_TIMEOUT;
@@ -1237,10 +1479,19 @@ wxCondError ClangPlugin::GetCodeCompletionAt(const ClTranslUnitId translUnitId,
     return wxCOND_NO_ERROR;
 }
 
+void ClangPlugin::MaterializeCodeCompletionTokens(const ClTranslUnitId id, std::vector<ClToken>& inout_tknResults,
+                                                  std::vector<bool>& out_isMaterialized)
+{
+    m_Proxy.MaterializeCCTokens(id, inout_tknResults, out_isMaterialized);
+}
+
 wxString ClangPlugin::GetCodeCompletionTokenDocumentation(const ClTranslUnitId id, const wxString& filename, const ClTokenPosition& location, ClTokenId tokenId)
 {
     if (id < 0)
         return wxEmptyString;
+    wxString html;
+    if (m_Proxy.GetCachedCCDocumentation(id, tokenId, html))
+        return html;
     ClangProxy::DocumentCCTokenJob job(cbEVT_CLANG_SYNCTASK_FINISHED, idClangGetCCDocumentationTask, id, filename, location, tokenId);
     m_Proxy.AppendPendingJob(job);
     if (wxCOND_TIMEOUT == job.WaitCompletion(40))
@@ -1250,6 +1501,23 @@ wxString ClangPlugin::GetCodeCompletionTokenDocumentation(const ClTranslUnitId i
     return job.GetResult();
 }
 
+void ClangPlugin::PrefetchCodeCompletionDocumentation(const ClTranslUnitId id, const std::vector<ClTokenId>& tokenIds)
+{
+    if (id < 0)
+        return;
+    std::vector<ClTokenId> missingIds;
+    wxString html;
+    for (std::vector<ClTokenId>::const_iterator it = tokenIds.begin(); it != tokenIds.end(); ++it)
+    {
+        if (!m_Proxy.GetCachedCCDocumentation(id, *it, html))
+            missingIds.push_back(*it);
+    }
+    if (missingIds.empty())
+        return;
+    ClangProxy::PrefetchCCDocumentationJob job(cbEVT_CLANG_ASYNCTASK_FINISHED, idClangPrefetchCCDocumentation, id, missingIds);
+    m_Proxy.AppendPendingJob(job);
+}
+
 wxString ClangPlugin::GetCodeCompletionInsertSuffix(const ClTranslUnitId translId, int tknId, const wxString& newLine, std::vector< std::pair<int, int> >& offsets)
 {
     return m_Proxy.GetCCInsertSuffix(translId, tknId, newLine, offsets);
@@ -1275,12 +1543,7 @@ void ClangPlugin::RequestReparse(const ClTranslUnitId translUnitId, const wxStri
     }
 
     std::map<wxString, wxString> unsavedFiles;
-    for (int i = 0; i < edMgr->GetEditorsCount(); ++i)
-    {
-        ed = edMgr->GetBuiltinEditor(i);
-        if (ed && ed->GetModified())
-            unsavedFiles.insert(std::make_pair(ed->GetFilename(), ed->GetControl()->GetText()));
-    }
+    GetUnsavedFiles(unsavedFiles);
     ClangProxy::ReparseJob job(cbEVT_CLANG_ASYNCTASK_FINISHED, idClangReparse, translUnitId, m_CompileCommand, filename, unsavedFiles);
     m_Proxy.AppendPendingJob(job);
 }
@@ -6,6 +6,7 @@
 #include <wx/timer.h>
 
 #include "clangpluginapi.h"
+#include "cppkeywords.h"
 #include "clangproxy.h"
 #include "tokendatabase.h"
 #include "clangtoolbar.h"
@@ -14,7 +15,9 @@
 
 // milliseconds
 #define CLANG_REPARSE_DELAY 10000
+#define CLANG_IDLE_DELAY 30000
 
+class cbSearchResultsLog;
 
 /* final */
 class ClangPlugin : public cbCodeCompletionPlugin, public IClangPlugin
@@ -65,12 +68,11 @@ protected:
 
 private:
     /**
-     * Compute the locations of STL headers for the given compiler (cached)
+     * Get the file the token database is kept in between sessions
      *
-     * @param compId The id of the compiler
-     * @return Include search flags pointing to said locations
+     * @return Full path to the file. Its directory may not exist yet, ClangProxy::StoreTokenDatabase() creates it
      */
-    wxString GetCompilerInclDirs(const wxString& compId);
+    wxString GetTokenDatabaseFilename() const;
 
 #if 0
     /**
@@ -123,6 +125,18 @@ private:
     void OnGotoDeclaration(wxCommandEvent& event);
     /// Find the token implementation under the cursor and open the relevant location
     void OnGotoImplementation(wxCommandEvent& event);
+    /// List all indexed references to the token under the cursor in the search results log
+    void OnFindReferences(wxCommandEvent& event);
+    /// Open the override of the method under the cursor, or list them when there are several
+    void OnFindOverrides(wxCommandEvent& event);
+    /// List the base and derived classes of the class under the cursor
+    void OnTypeHierarchy(wxCommandEvent& event);
+    /// Pick a symbol of the token database by fuzzy matching its name and open its location
+    void OnGotoSymbol(wxCommandEvent& event);
+    /// Append token locations with the text of their line to the search results log
+    void AppendToSearchLog(cbSearchResultsLog* searchLog, const ClTokenReferenceList& locations, const wxString& prefix);
+    /// Bring the search results log to the front
+    void ShowSearchLog(cbSearchResultsLog* searchLog);
 
     // Async
     //void OnReparse( wxCommandEvent& evt );
@@ -158,11 +172,23 @@ private:
     /// Update after clang has finished building the occurrences list
     void OnClangGetOccurrencesFinished(wxEvent& event);
 
+    /// Show the references found in the token database
+    void OnClangGetReferencesFinished(wxEvent& event);
+
+    /// Go to the override of a method, or list them when there are several
+    void OnClangGetOverridesFinished(wxEvent& event);
+
+    /// Show the base and derived classes found in the token database
+    void OnClangGetTypeHierarchyFinished(wxEvent& event);
+
 
 private: // Internal utility functions
     // Builds compile command
     int UpdateCompileCommand(cbEditor* ed);
 
+    // Copies the text of every modified editor, to pass as unsaved files to clang
+    void GetUnsavedFiles(std::map<wxString, wxString>& out_unsavedFiles);
+
     void RequestReparse(int delayMilliseconds = CLANG_REPARSE_DELAY);
 
     bool ActivateComponent(ClangPluginComponent* pComponent);
@@ -185,17 +211,28 @@ public: // IClangPlugin
                            std::vector<std::pair<wxString, wxString> >& out_scopes);
     void GetOccurrencesOf(const ClTranslUnitId, const wxString& filename, const ClTokenPosition& loc);
     wxCondError GetCodeCompletionAt(const ClTranslUnitId id, const wxString& filename, const ClTokenPosition& loc,
-                                    bool includeCtors, unsigned long timeout, std::vector<ClToken>& out_tknResults);
+                                    const wxString& prefix, size_t maxCount, const ClCompletionRanks& historyRanks,
+                                    unsigned long timeout, std::vector<ClToken>& out_tknResults);
+    void MaterializeCodeCompletionTokens(const ClTranslUnitId id, std::vector<ClToken>& inout_tknResults,
+                                         std::vector<bool>& out_isMaterialized);
     wxString GetCodeCompletionTokenDocumentation(const ClTranslUnitId id, const wxString& filename,
                                                  const ClTokenPosition& loc, ClTokenId tokenId);
+    void PrefetchCodeCompletionDocumentation(const ClTranslUnitId id, const std::vector<ClTokenId>& tokenIds);
     wxString GetCodeCompletionInsertSuffix(const ClTranslUnitId translId, int tknId, const wxString& newLine,
                                            std::vector< std::pair<int, int> >& offsets);
+    /**
+     * Compute the locations of STL headers for the given compiler (cached)
+     *
+     * @param compId The id of the compiler
+     * @return Include search flags pointing to said locations
+     */
+    wxString GetCompilerInclDirs(const wxString& compId);
 
     const wxImageList& GetImageList(const ClTranslUnitId WXUNUSED(id))
     {
         return m_ImageList;
     }
-    const wxStringVec& GetKeywords(const ClTranslUnitId WXUNUSED(id))
+    const ClCppKeywords& GetKeywords(const ClTranslUnitId WXUNUSED(id))
     {
         return m_CppKeywords;
     }
@@ -208,11 +245,12 @@ private: // Members
 
     ClFilenameDatabase m_FileDatabase;
     ClTokenDatabase m_Database;
-    wxStringVec m_CppKeywords;
+    ClCppKeywords m_CppKeywords;
     ClangProxy m_Proxy;
     wxImageList m_ImageList;
 
     wxTimer m_ReparseTimer;
+    wxTimer m_IdleTimer;
     std::map<wxString, wxString> m_compInclDirs;
     cbEditor* m_pLastEditor;
     int m_TranslUnitId;
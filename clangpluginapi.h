@@ -3,6 +3,8 @@
 
 #include <cbplugin.h>
 
+class ClCppKeywords;
+class ClCompletionRanks;
 
 typedef int8_t ClTranslUnitId;
 typedef int ClTokenId;
@@ -118,35 +120,40 @@ public:
         wxCommandEvent(wxEVT_NULL, evtId),
         m_TranslationUnitId(id),
         m_Filename(filename),
-        m_Location(0,0) {}
+        m_Location(0,0),
+        m_OccurrencesShared(false) {}
     ClangEvent( const wxEventType evtId, const ClTranslUnitId id, const wxString& filename,
-                const ClTokenPosition& pos, const std::vector< std::pair<int, int> >& occurrences ) :
+                const ClTokenPosition& pos, const std::vector< std::pair<int, int> >& occurrences, bool occurrencesShared = false ) :
         wxCommandEvent(wxEVT_NULL, evtId),
         m_TranslationUnitId(id),
         m_Filename(filename),
         m_Location(pos),
-        m_GetOccurrencesResults(occurrences) {}
+        m_GetOccurrencesResults(occurrences),
+        m_OccurrencesShared(occurrencesShared) {}
     ClangEvent( const wxEventType evtId, const ClTranslUnitId id, const wxString& filename,
                 const ClTokenPosition& pos, const std::vector<ClToken>& completions ) :
         wxCommandEvent(wxEVT_NULL, evtId),
         m_TranslationUnitId(id),
         m_Filename(filename),
         m_Location(pos),
-        m_GetCodeCompletionResults(completions) {}
+        m_GetCodeCompletionResults(completions),
+        m_OccurrencesShared(false) {}
     ClangEvent( const wxEventType evtId, const ClTranslUnitId id, const wxString& filename,
                 const ClTokenPosition& loc, const std::vector<ClDiagnostic>& diag ) :
         wxCommandEvent(wxEVT_NULL, evtId),
         m_TranslationUnitId(id),
         m_Filename(filename),
         m_Location(loc),
-        m_DiagnosticResults(diag) {}
+        m_DiagnosticResults(diag),
+        m_OccurrencesShared(false) {}
     ClangEvent( const wxEventType evtId, const ClTranslUnitId id, const wxString& filename,
                 const ClTokenPosition& loc, const wxString& documentation ) :
         wxCommandEvent(wxEVT_NULL, evtId),
         m_TranslationUnitId(id),
         m_Filename(filename),
         m_Location(loc),
-        m_DocumentationResults(documentation) {}
+        m_DocumentationResults(documentation),
+        m_OccurrencesShared(false) {}
 
     /** @brief Copy constructor
      *
@@ -161,7 +168,8 @@ public:
         m_GetOccurrencesResults(other.m_GetOccurrencesResults),
         m_GetCodeCompletionResults(other.m_GetCodeCompletionResults),
         m_DiagnosticResults(other.m_DiagnosticResults),
-        m_DocumentationResults(other.m_DocumentationResults) {}
+        m_DocumentationResults(other.m_DocumentationResults),
+        m_OccurrencesShared(other.m_OccurrencesShared) {}
     virtual ~ClangEvent() {}
     virtual wxEvent *Clone() const
     {
@@ -180,6 +188,11 @@ public:
     {
         return m_GetOccurrencesResults;
     }
+    /// Some of the occurrences are also occurrences of another symbol, like a class name that names its constructor
+    bool AreOccurrencesShared() const
+    {
+        return m_OccurrencesShared;
+    }
     const std::vector<ClToken>& GetCodeCompletionResults()
     {
         return m_GetCodeCompletionResults;
@@ -200,6 +213,7 @@ private:
     const std::vector<ClToken> m_GetCodeCompletionResults;
     const std::vector<ClDiagnostic> m_DiagnosticResults;
     const wxString m_DocumentationResults;
+    const bool m_OccurrencesShared;
 };
 
 extern const wxEventType clEVT_TRANSLATIONUNIT_CREATED;
@@ -219,7 +233,7 @@ public:
     virtual bool IsProviderFor(cbEditor* ed) = 0;
     virtual ClTranslUnitId GetTranslationUnitId(const wxString& filename) = 0;
     virtual const wxImageList& GetImageList(const ClTranslUnitId id) = 0;
-    virtual const wxStringVec& GetKeywords(const ClTranslUnitId id) = 0;
+    virtual const ClCppKeywords& GetKeywords(const ClTranslUnitId id) = 0;
     /* Events  */
     virtual void RegisterEventSink(wxEventType, IEventFunctorBase<ClangEvent>* functor) = 0;
     virtual void RemoveAllEventSinksFor(void* owner) = 0;
@@ -237,13 +251,24 @@ public:
      *  Performs an asynchronous request for occurences highlight. Will send an event with */
     virtual void GetOccurrencesOf(const ClTranslUnitId, const wxString& filename, const ClTokenPosition& loc) = 0;
 
-    /** Code completion */
+    /** Code completion
+     *  Only the best maxCount results matching the typed prefix are returned, named by their typed text.
+     *  The completions in historyRanks are counted as the best ones */
     virtual wxCondError GetCodeCompletionAt(const ClTranslUnitId id, const wxString& filename, const ClTokenPosition& loc,
-                                            bool includeCtors, unsigned long timeout, std::vector<ClToken>& out_tknResults) = 0;
+                                            const wxString& prefix, size_t maxCount, const ClCompletionRanks& historyRanks,
+                                            unsigned long timeout, std::vector<ClToken>& out_tknResults) = 0;
+    /** Compute display names and precise categories of code completion tokens, only call it for tokens that are displayed
+     *  out_isMaterialized tells which tokens were done, the others are left as is, e.g. while the translation unit is busy */
+    virtual void MaterializeCodeCompletionTokens(const ClTranslUnitId id, std::vector<ClToken>& inout_tknResults,
+                                                 std::vector<bool>& out_isMaterialized) = 0;
     virtual wxString GetCodeCompletionTokenDocumentation(const ClTranslUnitId id, const wxString& filename,
                                                          const ClTokenPosition& location, ClTokenId tokenId) = 0;
+    /** Render the documentation of code completion tokens in the background, so GetCodeCompletionTokenDocumentation() returns it at once */
+    virtual void PrefetchCodeCompletionDocumentation(const ClTranslUnitId id, const std::vector<ClTokenId>& tokenIds) = 0;
     virtual wxString GetCodeCompletionInsertSuffix(const ClTranslUnitId translId, int tknId, const wxString& newLine,
                                                    std::vector< std::pair<int, int> >& offsets) = 0;
+    /** Include search directories of a compiler, as " -I<dir>" flags (cached) */
+    virtual wxString GetCompilerInclDirs(const wxString& compId) = 0;
 };
 
 /** @brief Base class for ClangPlugin components.
@@ -7,19 +7,28 @@
 #include "clangproxy.h"
 
 #include <wx/tokenzr.h>
+#include <wx/filename.h>
 
 #ifndef CB_PRECOMP
 #include <algorithm>
 #include <wx/wxscintilla.h>
 #endif // CB_PRECOMP
 
+#include <limits>
 #include <set>
 
+#include "htmlwriter.h"
+#include "keymatcher.h"
 #include "tokendatabase.h"
 #include "translationunit.h"
 #include <cbcolourmanager.h>
 #include "cclogger.h"
 
+/// Maximum number of declarations in the documentation cache, it is emptied when it is full
+static const size_t MaxCCDocumentation = 512;
+/// Maximum number of declarations in the call tips cache, it is emptied when it is full
+static const size_t MaxCallTipsCache = 1024;
+
 namespace ProxyHelper
 {
 static ClTokenCategory GetTokenCategory(CXCursorKind kind, CX_CXXAccessSpecifier access = CX_CXXInvalidAccessSpecifier)
@@ -203,6 +212,88 @@ static CXChildVisitResult ClEnum_Visitor(CXCursor cursor,
     return CXChildVisit_Continue;
 }
 
+/** @brief Append the parameters of an overload candidate to its call tip
+ *
+ * @param completionString The completion string of the candidate, or of an optional chunk of it
+ * @param firstChunk The chunk after the open parenthesis
+ * @param inout_entry The call tip
+ * @return true when one of the parameters is the current parameter
+ */
+static bool AppendOverloadParameters(CXCompletionString completionString, unsigned firstChunk, wxStringVec& inout_entry)
+{
+    bool hasCurrentParameter = false;
+    const unsigned numChunks = clang_getNumCompletionChunks(completionString);
+    for (unsigned chunkIdx = firstChunk; chunkIdx < numChunks; ++chunkIdx)
+    {
+        switch (clang_getCompletionChunkKind(completionString, chunkIdx))
+        {
+        case CXCompletionChunk_Optional: // parameters with a default argument
+        {
+            if (AppendOverloadParameters(clang_getCompletionChunkCompletionString(completionString, chunkIdx), 0, inout_entry))
+                hasCurrentParameter = true;
+            break;
+        }
+
+        case CXCompletionChunk_CurrentParameter:
+            hasCurrentParameter = true;
+            // fall through
+        case CXCompletionChunk_Placeholder:
+        {
+            CXString str = clang_getCompletionChunkText(completionString, chunkIdx);
+            inout_entry.push_back(wxString::FromUTF8(clang_getCString(str)).Trim());
+            clang_disposeString(str);
+            break;
+        }
+
+        default:
+            break;
+        }
+    }
+    return hasCurrentParameter;
+}
+
+/** @brief Build the call tip of a code completion result at the open parenthesis of a call
+ *
+ * @param result The completion result
+ * @param out_entry "ResultType Name(", the parameters and ")"
+ * @return false when the result is not an overload candidate of the call
+ *
+ * Overload candidates mark the parameter being completed with a CurrentParameter chunk, which
+ * tells them apart from the declarations that are merely proposed as the first argument.
+ */
+static bool GetOverloadCallTip(const CXCompletionResult& result, wxStringVec& out_entry)
+{
+    out_entry.assign(1, wxEmptyString);
+    const unsigned numChunks = clang_getNumCompletionChunks(result.CompletionString);
+    unsigned chunkIdx = 0;
+    for (; chunkIdx < numChunks; ++chunkIdx)
+    {
+        CXCompletionChunkKind kind = clang_getCompletionChunkKind(result.CompletionString, chunkIdx);
+        if (kind == CXCompletionChunk_LeftParen)
+            break;
+        CXString str = clang_getCompletionChunkText(result.CompletionString, chunkIdx);
+        out_entry[0] += wxString::FromUTF8(clang_getCString(str));
+        if (kind == CXCompletionChunk_ResultType)
+        {
+            if (out_entry[0].Length() > 2 && out_entry[0][out_entry[0].Length() - 2] == wxT(' '))
+                out_entry[0].RemoveLast(2) += out_entry[0].Last();
+            out_entry[0] += wxT(' ');
+        }
+        clang_disposeString(str);
+    }
+    if (chunkIdx == numChunks)
+        return false;
+    out_entry[0] += wxT('(');
+    bool isCandidate = AppendOverloadParameters(result.CompletionString, chunkIdx + 1, out_entry);
+#if CINDEX_VERSION_MINOR >= 30
+    // A candidate without parameters has no current parameter either
+    if (result.CursorKind == CXCursor_OverloadCandidate)
+        isCandidate = true;
+#endif
+    out_entry.push_back(wxT(")"));
+    return isCandidate;
+}
+
 static void ResolveCursorDecl(CXCursor& token)
 {
     CXCursor resolve = clang_getCursorDefinition(token);
@@ -228,6 +319,137 @@ static bool ResolveCursorDefinition(CXCursor& token)
     return true;
 }
 
+/** @brief Find the declaration of a code completion result in the token database
+ *
+ * @param database The token database
+ * @param translUnit The translation unit the completion result is from
+ * @param completionString The completion string of the result
+ * @param out_cursor The declaration, only valid when a token is returned
+ * @return ClTokenId The token of the declaration or wxNOT_FOUND
+ *
+ * A completion result has no cursor and thus no USR. The tokens with the same identifier are resolved to their
+ * cursor instead, and when there is more than one entity with that identifier, the completion strings are compared.
+ */
+static ClTokenId ResolveCompletionToken(const ClTokenDatabase& database, ClTranslationUnit& translUnit,
+                                        CXCompletionString completionString, CXCursor& out_cursor)
+{
+    wxString identifier;
+    unsigned completionHash = HashToken(completionString, identifier);
+    if (identifier.IsEmpty())
+        return wxNOT_FOUND;
+    std::vector<ClTokenId> tknIds = database.GetTokenMatches(identifier);
+    std::vector<ClUSRHash> usrHashes;
+    for (std::vector<ClTokenId>::const_iterator itr = tknIds.begin(); itr != tknIds.end(); ++itr)
+    {
+        ClTokenView aTkn = database.GetToken(*itr);
+        if (std::find(usrHashes.begin(), usrHashes.end(), aTkn.GetHash()) == usrHashes.end())
+            usrHashes.push_back(aTkn.GetHash());
+    }
+    std::vector<ClUSRHash> rejectedHashes;
+    for (std::vector<ClTokenId>::const_iterator itr = tknIds.begin(); itr != tknIds.end(); ++itr)
+    {
+        ClTokenView aTkn = database.GetToken(*itr);
+        if (std::find(rejectedHashes.begin(), rejectedHashes.end(), aTkn.GetHash()) != rejectedHashes.end())
+            continue; // Another declaration of an entity that does not match
+        CXCursor clTkn = translUnit.GetTokenAt(database.GetFilename(aTkn.GetFileId()), aTkn.GetLocation());
+        if (clang_Cursor_isNull(clTkn) || clang_isInvalid(clTkn.kind))
+            continue;
+        if (usrHashes.size() > 1)
+        {
+            wxString tknIdentifier;
+            if (HashToken(clang_getCursorCompletionString(clTkn), tknIdentifier) != completionHash)
+            {
+                rejectedHashes.push_back(aTkn.GetHash());
+                continue;
+            }
+        }
+        out_cursor = clTkn;
+        return *itr;
+    }
+    return wxNOT_FOUND;
+}
+
+/** @brief Find an indexed declaration of a symbol
+ *
+ * @param database The token database
+ * @param usrHash The hash of the USR of the symbol
+ * @param out_declaration The first declaration in file and offset order
+ * @return bool false if the symbol has no indexed declaration
+ *
+ */
+static bool FindDeclaration(const ClTokenDatabase& database, ClUSRHash usrHash, ClTokenReference& out_declaration)
+{
+    ClTokenReferenceList references;
+    database.GetReferences(usrHash, references);
+    for (ClTokenReferenceList::const_iterator it = references.begin(); it != references.end(); ++it)
+    {
+        if (clang_isDeclaration((CXCursorKind)it->cursorKind))
+        {
+            out_declaration = *it;
+            return true;
+        }
+    }
+    return false;
+}
+
+/** @brief Follow the relations of a symbol transitively
+ *
+ * @param database The token database
+ * @param usrHash The hash of the USR of the symbol to start from
+ * @param kind The kind of relations to follow
+ * @param incoming true to walk towards the derived declarations, false to walk towards the bases
+ * @param out_relations The relations in breadth first order, each declaration is visited once
+ * @return void
+ *
+ */
+static void CollectRelations(const ClTokenDatabase& database, ClUSRHash usrHash, ClTokenRelationKind kind, bool incoming,
+                             ClTokenRelationList& out_relations)
+{
+    std::set<ClUSRHash> visited;
+    visited.insert(usrHash);
+    std::vector<ClUSRHash> pending(1, usrHash);
+    for (size_t i = 0; i < pending.size(); ++i)
+    {
+        ClTokenRelationList relations;
+        if (incoming)
+            database.GetRelationsTo(pending[i], kind, relations);
+        else
+            database.GetRelationsFrom(pending[i], kind, relations);
+        for (ClTokenRelationList::const_iterator it = relations.begin(); it != relations.end(); ++it)
+        {
+            const ClUSRHash next = incoming ? it->fromHash : it->toHash;
+            out_relations.push_back(*it);
+            if (visited.insert(next).second)
+                pending.push_back(next);
+        }
+    }
+}
+
+/** @brief Get the declaration a symbol relation is about, templates instead of their specializations
+ *
+ * @param token The cursor under the caret, resolved to its declaration
+ * @return CXCursor
+ *
+ */
+static CXCursor GetRelationCursor(CXCursor token)
+{
+    switch (token.kind)
+    {
+    case CXCursor_StructDecl:
+    case CXCursor_ClassDecl:
+    case CXCursor_ClassTemplatePartialSpecialization:
+    {
+        CXCursor templ = clang_getSpecializedCursorTemplate(token);
+        if (!clang_Cursor_isNull(templ))
+            return templ;
+        break;
+    }
+    default:
+        break;
+    }
+    return token;
+}
+
 static CXVisitorResult ReferencesVisitor(CXClientData context,
         CXCursor WXUNUSED(cursor),
         CXSourceRange range)
@@ -263,196 +485,101 @@ static wxString GetEnumValStr(CXCursor token)
     else
         return val.ToString();
 }
-}
 
-namespace HTML_Writer
+/** @brief A code completion result that matches the typed prefix, not yet converted to a ClToken */
+struct CompletionCandidate
 {
-static wxString Escape(const wxString& text)
+    CompletionCandidate(int res, int chunk, unsigned prio, int matchScore, int histRank) :
+        resIdx(res), typedTextIdx(chunk), priority(prio), score(matchScore), historyRank(histRank) {}
+    int resIdx;
+    int typedTextIdx;   ///< Index of the CXCompletionChunk_TypedText chunk
+    unsigned priority;  ///< clang priority, lower is better
+    int score;          ///< How well the typed text matches the prefix, see ClKeyMatcher::Match()
+    int historyRank;    ///< How often it was accepted before, see ClCompletionHistory::GetRank()
+};
+
+/// Best candidates first: accepted before, then best match of the prefix, then clang priority
+struct CompletionCandidateRankLess
 {
-    wxString html;
-    html.reserve(text.size());
-    for (wxString::const_iterator itr = text.begin();
-            itr != text.end(); ++itr)
+    bool operator()(const CompletionCandidate& a, const CompletionCandidate& b) const
     {
-        switch (wxChar(*itr))
-        {
-        case wxT('&'):
-            html += wxT("&amp;");
-            break;
-        case wxT('\"'):
-            html += wxT("&quot;");
-            break;
-        case wxT('\''):
-            html += wxT("&apos;");
-            break;
-        case wxT('<'):
-            html += wxT("&lt;");
-            break;
-        case wxT('>'):
-            html += wxT("&gt;");
-            break;
-        case wxT('\n'):
-            html += wxT("<br>");
-            break;
-        default:
-            html += *itr;
-            break;
-        }
+        if (a.historyRank != b.historyRank)
+            return a.historyRank > b.historyRank;
+        if (a.score != b.score)
+            return a.score > b.score;
+        if (a.priority != b.priority)
+            return a.priority < b.priority;
+        return a.resIdx < b.resIdx;
     }
-    return html;
-}
+};
 
-static wxString Colourise(const wxString& text, const wxString& colour)
+struct CompletionCandidateOrderLess
 {
-    return wxT("<font color=\"") + colour + wxT("\">") + text + wxT("</font>");
-}
+    bool operator()(const CompletionCandidate& a, const CompletionCandidate& b) const
+    {
+        return a.resIdx < b.resIdx;
+    }
+};
 
-static wxString SyntaxHl(const wxString& code, const std::vector<wxString>& cppKeywords) // C++ style (ish)
+/** @brief Get the result type of a code completion string as it is displayed after the token name
+ *
+ * @return ": type", shortened to about 40 characters, or an empty string when there is no result type
+ */
+static wxString GetCompletionTypeSuffix(CXCompletionString completionString)
 {
-    wxString html;
-    html.reserve(code.size());
-    int stRg = 0;
-    int style = wxSCI_C_DEFAULT;
-    const int codeLen = code.Length();
-    for (int enRg = 0; enRg <= codeLen; ++enRg)
+    wxString type;
+    const int numChunks = clang_getNumCompletionChunks(completionString);
+    for (int chunkIdx = 0; chunkIdx < numChunks; ++chunkIdx)
     {
-        wxChar ch = (enRg < codeLen ? wxChar(code[enRg]) : wxT('\0'));
-        wxChar nextCh = (enRg < codeLen - 1 ? wxChar(code[enRg + 1]) : wxT('\0'));
-        switch (style)
-        {
-        default:
-        case wxSCI_C_DEFAULT:
-        {
-            if (wxIsalpha(ch) || ch == wxT('_'))
-                style = wxSCI_C_IDENTIFIER;
-            else if (wxIsdigit(ch))
-                style = wxSCI_C_NUMBER;
-            else if (ch == wxT('"'))
-                style = wxSCI_C_STRING;
-            else if (ch == wxT('\''))
-                style = wxSCI_C_CHARACTER;
-            else if (ch == wxT('/') && nextCh == wxT('/'))
-                style = wxSCI_C_COMMENTLINE;
-            else if (wxIspunct(ch))
-                style = wxSCI_C_OPERATOR;
-            else
-                break;
-            if (stRg != enRg)
-            {
-                html += Escape(code.Mid(stRg, enRg - stRg));
-                stRg = enRg;
-            }
-            break;
-        }
-
-        case wxSCI_C_IDENTIFIER:
-        {
-            if (wxIsalnum(ch) || ch == wxT('_'))
-                break;
-            if (stRg != enRg)
-            {
-                const wxString& tkn = code.Mid(stRg, enRg - stRg);
-                if (std::binary_search(cppKeywords.begin(), cppKeywords.end(), tkn))
-                    html += wxT("<b>") + Colourise(Escape(tkn), wxT("#00008b")) + wxT("</b>"); // DarkBlue
-                else
-                    html += Escape(tkn);
-                stRg = enRg;
-                --enRg;
-            }
-            style = wxSCI_C_DEFAULT;
-            break;
-        }
-
-        case wxSCI_C_NUMBER:
-        {
-            if (wxIsalnum(ch))
-                break;
-            if (stRg != enRg)
-            {
-                html += Colourise(Escape(code.Mid(stRg, enRg - stRg)), wxT("Magenta"));
-                stRg = enRg;
-                --enRg;
-            }
-            style = wxSCI_C_DEFAULT;
-            break;
-        }
-
-        case wxSCI_C_STRING:
-        {
-            if (ch == wxT('\\'))
-            {
-                if (nextCh != wxT('\n'))
-                    ++enRg;
-                break;
-            }
-            else if (ch && ch != wxT('"') && ch != wxT('\n'))
-                break;
-            if (stRg != enRg)
-            {
-                if (ch == wxT('"'))
-                    ++enRg;
-                html += Colourise(Escape(code.Mid(stRg, enRg - stRg)), wxT("#0000cd")); // MediumBlue
-                stRg = enRg;
-                --enRg;
-            }
-            style = wxSCI_C_DEFAULT;
+        const CXCompletionChunkKind kind = clang_getCompletionChunkKind(completionString, chunkIdx);
+        if (kind == CXCompletionChunk_TypedText)
             break;
-        }
-
-        case wxSCI_C_CHARACTER:
+        if (kind == CXCompletionChunk_ResultType)
         {
-            if (ch == wxT('\\'))
-            {
-                if (nextCh != wxT('\n'))
-                    ++enRg;
-                break;
-            }
-            else if (ch && ch != wxT('\'') && ch != wxT('\n'))
-                break;
-            if (stRg != enRg)
-            {
-                if (ch == wxT('\''))
-                    ++enRg;
-                html += Colourise(Escape(code.Mid(stRg, enRg - stRg)), wxT("GoldenRod"));
-                stRg = enRg;
-                --enRg;
-            }
-            style = wxSCI_C_DEFAULT;
-            break;
+            CXString str = clang_getCompletionChunkText(completionString, chunkIdx);
+            type = wxT(": ") + wxString::FromUTF8(clang_getCString(str));
+            wxString prefixType;
+            if (type.EndsWith(wxT(" *"), &prefixType) || type.EndsWith(wxT(" &"), &prefixType))
+                type = prefixType + type.Last();
+            clang_disposeString(str);
         }
-
-        case wxSCI_C_COMMENTLINE:
+    }
+    if (type.Length() > 40)
+    {
+        type.Truncate(35);
+        if (wxIsspace(type.Last()))
+            type.Trim();
+        else if (wxIspunct(type.Last()))
         {
-            if (ch && ch != wxT('\n'))
-                break;
-            if (stRg != enRg)
+            for (int i = type.Length() - 2; i > 10; --i)
             {
-                html += Colourise(Escape(code.Mid(stRg, enRg - stRg)), wxT("#778899")); // LightSlateGray
-                stRg = enRg;
+                if (!wxIspunct(type[i]))
+                {
+                    type.Truncate(i + 1);
+                    break;
+                }
             }
-            style = wxSCI_C_DEFAULT;
-            break;
         }
-
-        case wxSCI_C_OPERATOR:
+        else if (wxIsalnum(type.Last()) || type.Last() == wxT('_'))
         {
-            if (wxIspunct(ch) && ch != wxT('"') && ch != wxT('\'') && ch != wxT('_'))
-                break;
-            if (stRg != enRg)
+            for (int i = type.Length() - 2; i > 10; --i)
             {
-                html += Colourise(Escape(code.Mid(stRg, enRg - stRg)), wxT("Red"));
-                stRg = enRg;
-                --enRg;
+                if (!( wxIsalnum(type[i]) || type[i] == wxT('_') ))
+                {
+                    type.Truncate(i + 1);
+                    break;
+                }
             }
-            style = wxSCI_C_DEFAULT;
-            break;
-        }
         }
+        type += wxT("...");
     }
-    return html;
+    return type;
+}
 }
 
-static void FormatDocumentation(CXComment comment, wxString& doc, const std::vector<wxString>& cppKeywords)
+namespace HTML_Writer
+{
+static void FormatDocumentation(CXComment comment, ClHtmlWriter& doc, const ClCppKeywords& cppKeywords)
 {
     size_t numChildren = clang_Comment_getNumChildren(comment);
     for (size_t childIdx = 0; childIdx < numChildren; ++childIdx)
@@ -466,40 +593,45 @@ static void FormatDocumentation(CXComment comment, wxString& doc, const std::vec
         case CXComment_Text:
         {
             CXString str = clang_TextComment_getText(cmt);
-            doc += Escape(wxString::FromUTF8(clang_getCString(str)));
+            doc.AppendEscaped(clang_getCString(str));
             clang_disposeString(str);
             break;
         }
 
         case CXComment_InlineCommand:
         {
-            size_t numArgs = clang_InlineCommandComment_getNumArgs(cmt);
-            wxString argText;
-            for (size_t argIdx = 0; argIdx < numArgs; ++argIdx)
-            {
-                CXString str = clang_InlineCommandComment_getArgText(cmt, argIdx);
-                argText += Escape(wxString::FromUTF8(clang_getCString(str)));
-                clang_disposeString(str);
-            }
+            const char* openTag = "";
+            const char* closeTag = "";
             switch (clang_InlineCommandComment_getRenderKind(cmt))
             {
             default:
             case CXCommentInlineCommandRenderKind_Normal:
-                doc += argText;
                 break;
 
             case CXCommentInlineCommandRenderKind_Bold:
-                doc += wxT("<b>") + argText + wxT("</b>");
+                openTag = "<b>";
+                closeTag = "</b>";
                 break;
 
             case CXCommentInlineCommandRenderKind_Monospaced:
-                doc += wxT("<tt>") + argText + wxT("</tt>");
+                openTag = "<tt>";
+                closeTag = "</tt>";
                 break;
 
             case CXCommentInlineCommandRenderKind_Emphasized:
-                doc += wxT("<em>") + argText + wxT("</em>");
+                openTag = "<em>";
+                closeTag = "</em>";
                 break;
             }
+            doc.Append(openTag);
+            size_t numArgs = clang_InlineCommandComment_getNumArgs(cmt);
+            for (size_t argIdx = 0; argIdx < numArgs; ++argIdx)
+            {
+                CXString str = clang_InlineCommandComment_getArgText(cmt, argIdx);
+                doc.AppendEscaped(clang_getCString(str));
+                clang_disposeString(str);
+            }
+            doc.Append(closeTag);
             break;
         }
 
@@ -507,7 +639,7 @@ static void FormatDocumentation(CXComment comment, wxString& doc, const std::vec
         case CXComment_HTMLEndTag:
         {
             CXString str = clang_HTMLTagComment_getAsString(cmt);
-            doc += wxString::FromUTF8(clang_getCString(str));
+            doc.Append(clang_getCString(str));
             clang_disposeString(str);
             break;
         }
@@ -515,9 +647,9 @@ static void FormatDocumentation(CXComment comment, wxString& doc, const std::vec
         case CXComment_Paragraph:
             if (!clang_Comment_isWhitespace(cmt))
             {
-                doc += wxT("<p>");
+                doc.Append("<p>");
                 FormatDocumentation(cmt, doc, cppKeywords);
-                doc += wxT("</p>");
+                doc.Append("</p>");
             }
             break;
 
@@ -530,40 +662,41 @@ static void FormatDocumentation(CXComment comment, wxString& doc, const std::vec
             break;
 
         case CXComment_VerbatimBlockCommand:
-            doc += wxT("<table cellspacing=\"0\" cellpadding=\"1\" bgcolor=\"black\" width=\"100%\"><tr><td>"
+            doc.Append("<table cellspacing=\"0\" cellpadding=\"1\" bgcolor=\"black\" width=\"100%\"><tr><td>"
                        "<table bgcolor=\"white\" width=\"100%\"><tr><td><pre>");
             FormatDocumentation(cmt, doc, cppKeywords);
-            doc += wxT("</pre></td></tr></table></td></tr></table>");
+            doc.Append("</pre></td></tr></table></td></tr></table>");
             break;
 
         case CXComment_VerbatimBlockLine:
         {
             CXString str = clang_VerbatimBlockLineComment_getText(cmt);
-            wxString codeLine = wxString::FromUTF8(clang_getCString(str));
-            clang_disposeString(str);
-            int endIdx = codeLine.Find(wxT("*/")); // clang will throw in the rest of the file when this happens
-            if (endIdx != wxNOT_FOUND)
+            const char* codeLine = clang_getCString(str);
+            const char* codeEnd = strstr(codeLine, "*/"); // clang will throw in the rest of the file when this happens
+            if (codeEnd)
             {
-                endIdx = codeLine.Truncate(endIdx).Find(wxT("\\endcode")); // try to save a bit of grace, and recover what we can
-                if (endIdx == wxNOT_FOUND)
-                {
-                    endIdx = codeLine.Find(wxT("@endcode"));
-                    if (endIdx != wxNOT_FOUND)
-                        codeLine.Truncate(endIdx);
-                }
-                else
-                    codeLine.Truncate(endIdx);
-                doc += SyntaxHl(codeLine, cppKeywords) + wxT("<br><font color=\"red\"><em>__clang_doxygen_parsing_error__</em></font><br>");
+                // try to save a bit of grace, and recover what we can
+                const std::string head(codeLine, codeEnd);
+                size_t endIdx = head.find("\\endcode");
+                if (endIdx == std::string::npos)
+                    endIdx = head.find("@endcode");
+                doc.AppendCode(head.data(), std::min(endIdx, head.length()), cppKeywords);
+                doc.Append("<br><font color=\"red\"><em>__clang_doxygen_parsing_error__</em></font><br>");
+                clang_disposeString(str);
                 return; // abort
             }
-            doc += SyntaxHl(codeLine, cppKeywords) + wxT("<br>");
+            doc.AppendCode(codeLine, strlen(codeLine), cppKeywords);
+            doc.Append("<br>");
+            clang_disposeString(str);
             break;
         }
 
         case CXComment_VerbatimLine:
         {
             CXString str = clang_VerbatimLineComment_getText(cmt);
-            doc += wxT("<pre>") + Escape(wxString::FromUTF8(clang_getCString(str))) + wxT("</pre>"); // TODO: syntax highlight
+            doc.Append("<pre>"); // TODO: syntax highlight
+            doc.AppendEscaped(clang_getCString(str));
+            doc.Append("</pre>");
             clang_disposeString(str);
             break;
         }
@@ -622,10 +755,13 @@ void ClangProxy::ReparseJob::Execute(ClangProxy& clangproxy)
  * @param cppKeywords CPP Keywords to use
  *
  */
-ClangProxy::ClangProxy( wxEvtHandler* pEvtCallbackHandler, ClTokenDatabase& database, const std::vector<wxString>& cppKeywords):
+ClangProxy::ClangProxy( wxEvtHandler* pEvtCallbackHandler, ClTokenDatabase& database, const ClCppKeywords& cppKeywords):
     m_Mutex(),
     m_Database(database),
+    m_StoreMutex(),
+    m_StoredGeneration(0),
     m_CppKeywords(cppKeywords),
+    m_DocMutex(),
     m_pEventCallbackHandler(pEvtCallbackHandler)
 {
     m_ClIndex[0] = clang_createIndex(1, 1);
@@ -760,6 +896,7 @@ void ClangProxy::RemoveTranslationUnit( const ClTranslUnitId translUnitId )
     // Replace with empty one
     ClTranslationUnit emptyTU(translUnitId, nullptr);
     swap( m_TranslUnits[translUnitId], emptyTU );
+    ClearCCDocumentationTokens(translUnitId);
 }
 
 /** @brief Find a translation unit id from a file id. In case the file id is part of multiple translation units, it will search the one in the argument first.
@@ -820,6 +957,10 @@ ClTranslUnitId ClangProxy::GetTranslationUnitId( const ClTranslUnitId CtxTranslU
  * @param location The location of the start of the symbol to do code completion with. This is not the insertion point! (1-based)
  * @param isAuto (unused for now)
  * @param unsavedFiles The map of editor contents of all files that are open in the editor. Key is the filename
+ * @param prefix The part of the identifier that is already typed, only matching results are returned (see ClKeyMatcher)
+ * @param maxCount The maximum number of results to return, the best ranked ones are kept. 0 for no limit
+ * @param historyRanks The completions accepted before in this context, they are kept first so the
+ *        list can rank them first as well
  * @param results[out] The returned results of codecompletion
  * @param diagnostics[out] The returned partial diagnostics results of codecompletion
  * @return
@@ -828,6 +969,8 @@ ClTranslUnitId ClangProxy::GetTranslationUnitId( const ClTranslUnitId CtxTranslU
 void ClangProxy::CodeCompleteAt( const ClTranslUnitId translUnitId, const wxString& filename,
                                  const ClTokenPosition& location, bool /*isAuto*/,
                                  const std::map<wxString, wxString>& unsavedFiles,
+                                 const wxString& prefix, size_t maxCount,
+                                 const ClCompletionRanks& historyRanks,
                                  std::vector<ClToken>& out_results,
                                  std::vector<ClDiagnostic>& out_diagnostics )
 {
@@ -856,6 +999,7 @@ void ClangProxy::CodeCompleteAt( const ClTranslUnitId translUnitId, const wxStri
     wxMutexLocker locker(m_Mutex);
     if (translUnitId >= (int)m_TranslUnits.size())
         return;
+    ClearCCDocumentationTokens(translUnitId);
     CXCodeCompleteResults* clResults = m_TranslUnits[translUnitId].CodeCompleteAt(filename, location,
                                        clUnsavedFiles.empty() ? nullptr : &clUnsavedFiles[0],
                                        clUnsavedFiles.size());
@@ -873,66 +1017,61 @@ void ClangProxy::CodeCompleteAt( const ClTranslUnitId translUnitId, const wxStri
     const int numResults = clResults->NumResults;
     CCLogger::Get()->DebugLog( F(wxT("CodeCompleteAt results: %d"), numResults));
 
-    out_results.reserve(numResults);
+    // Match the typed text of all results against the prefix, but only convert the best ones
+    std::vector<ProxyHelper::CompletionCandidate> candidates;
+    candidates.reserve(numResults);
+    ClKeyMatcher typedTexts;
     for (int resIdx = 0; resIdx < numResults; ++resIdx)
     {
         const CXCompletionResult& token = clResults->Results[resIdx];
         if (CXAvailability_Available != clang_getCompletionAvailability(token.CompletionString))
             continue;
         const int numChunks = clang_getNumCompletionChunks(token.CompletionString);
-        wxString type;
-        for (int chunkIdx = 0; chunkIdx < numChunks; ++chunkIdx)
+        int typedTextIdx = 0;
+        while ((typedTextIdx < numChunks) && (clang_getCompletionChunkKind(token.CompletionString, typedTextIdx) != CXCompletionChunk_TypedText))
+            ++typedTextIdx;
+        if (typedTextIdx == numChunks)
+            continue;
+        int historyRank = 0;
+        if (!prefix.IsEmpty() || !historyRanks.IsEmpty())
         {
-            CXCompletionChunkKind kind = clang_getCompletionChunkKind(token.CompletionString, chunkIdx);
-            if (kind == CXCompletionChunk_ResultType)
-            {
-                CXString str = clang_getCompletionChunkText(token.CompletionString, chunkIdx);
-                type = wxT(": ") + wxString::FromUTF8(clang_getCString(str));
-                wxString prefix;
-                if (type.EndsWith(wxT(" *"), &prefix) || type.EndsWith(wxT(" &"), &prefix))
-                    type = prefix + type.Last();
-                clang_disposeString(str);
-            }
-            else if (kind == CXCompletionChunk_TypedText)
-            {
-                if (type.Length() > 40)
-                {
-                    type.Truncate(35);
-                    if (wxIsspace(type.Last()))
-                        type.Trim();
-                    else if (wxIspunct(type.Last()))
-                    {
-                        for (int i = type.Length() - 2; i > 10; --i)
-                        {
-                            if (!wxIspunct(type[i]))
-                            {
-                                type.Truncate(i + 1);
-                                break;
-                            }
-                        }
-                    }
-                    else if (wxIsalnum(type.Last()) || type.Last() == wxT('_'))
-                    {
-                        for (int i = type.Length() - 2; i > 10; --i)
-                        {
-                            if (!( wxIsalnum(type[i]) || type[i] == wxT('_') ))
-                            {
-                                type.Truncate(i + 1);
-                                break;
-                            }
-                        }
-                    }
-                    type += wxT("...");
-                }
-                CXString completeTxt = clang_getCompletionChunkText(token.CompletionString, chunkIdx);
-                out_results.push_back(ClToken(wxString::FromUTF8(clang_getCString(completeTxt)) + type,
-                                          resIdx, clang_getCompletionPriority(token.CompletionString),
-                                          ProxyHelper::GetTokenCategory(token.CursorKind)));
-                clang_disposeString(completeTxt);
-                type.Empty();
-                break;
-            }
+            CXString str = clang_getCompletionChunkText(token.CompletionString, typedTextIdx);
+            if (!prefix.IsEmpty())
+                typedTexts.AddKey(clang_getCString(str));
+            historyRank = historyRanks.GetRank(clang_getCString(str));
+            clang_disposeString(str);
         }
+        candidates.push_back(ProxyHelper::CompletionCandidate(resIdx, typedTextIdx, clang_getCompletionPriority(token.CompletionString), 1, historyRank));
+    }
+    if (!prefix.IsEmpty())
+    {
+        std::vector< std::pair<size_t, int> > matches;
+        typedTexts.Match(prefix, matches);
+        std::vector<ProxyHelper::CompletionCandidate> matchedCandidates;
+        matchedCandidates.reserve(matches.size());
+        for (std::vector< std::pair<size_t, int> >::const_iterator it = matches.begin(); it != matches.end(); ++it)
+        {
+            matchedCandidates.push_back(candidates[it->first]);
+            matchedCandidates.back().score = it->second;
+        }
+        candidates.swap(matchedCandidates);
+    }
+    if ((maxCount > 0) && (candidates.size() > maxCount))
+    {
+        std::partial_sort(candidates.begin(), candidates.begin() + maxCount, candidates.end(), ProxyHelper::CompletionCandidateRankLess());
+        candidates.resize(maxCount);
+        std::sort(candidates.begin(), candidates.end(), ProxyHelper::CompletionCandidateOrderLess());
+    }
+
+    out_results.reserve(candidates.size());
+    for (std::vector<ProxyHelper::CompletionCandidate>::const_iterator candIt = candidates.begin(); candIt != candidates.end(); ++candIt)
+    {
+        const CXCompletionResult& token = clResults->Results[candIt->resIdx];
+        CXString completeTxt = clang_getCompletionChunkText(token.CompletionString, candIt->typedTextIdx);
+        out_results.push_back(ClToken(wxString::FromUTF8(clang_getCString(completeTxt)),
+                                      candIt->resIdx, candIt->priority,
+                                      ProxyHelper::GetTokenCategory(token.CursorKind)));
+        clang_disposeString(completeTxt);
     }
 
     unsigned numDiag = clang_codeCompleteGetNumDiagnostics(clResults);
@@ -952,6 +1091,8 @@ void ClangProxy::CodeCompleteAt( const ClTranslUnitId translUnitId, const wxStri
  * @param tknId The TokenId
  * @return wxString The documentation or empty string when there is no documentation
  *
+ * The documentation of tokens that resolve to an indexed declaration is cached by the USR of the
+ * declaration, until the timestamp of the file of the declaration changes.
  */
 wxString ClangProxy::DocumentCCToken( const ClTranslUnitId translUnitId, int tknId )
 {
@@ -959,8 +1100,13 @@ wxString ClangProxy::DocumentCCToken( const ClTranslUnitId translUnitId, int tkn
     {
         return wxT("");
     }
+    wxString html;
+    if (GetCachedCCDocumentation(translUnitId, tknId, html))
+        return html;
     wxString doc;
-    wxString descriptor;
+    ClHtmlWriter descriptor;
+    ClUSRHash usrHash = 0;
+    CCDocumentation cacheEntry;
     {
         wxMutexLocker  lock(m_Mutex);
         if (translUnitId >= (int)m_TranslUnits.size())
@@ -971,6 +1117,23 @@ wxString ClangProxy::DocumentCCToken( const ClTranslUnitId translUnitId, int tkn
         if (!token)
             return wxEmptyString;
 
+        CXCursor clTkn;
+        const ClTokenId declTknId = ProxyHelper::ResolveCompletionToken(m_Database, m_TranslUnits[translUnitId], token->CompletionString, clTkn);
+        if (declTknId != wxNOT_FOUND)
+        {
+            const ClTokenView declTkn = m_Database.GetToken(declTknId);
+            usrHash = declTkn.GetHash();
+            cacheEntry.fileId = declTkn.GetFileId();
+            cacheEntry.timestamp = m_Database.GetFilenameTimestamp(cacheEntry.fileId);
+
+            wxMutexLocker docLock(m_DocMutex);
+            if (LookupCCDocumentation(usrHash, html))
+            {
+                m_CCDocumentationTokens[std::make_pair(translUnitId, tknId)] = usrHash;
+                return html;
+            }
+        }
+
         int upperBound = clang_getNumCompletionChunks(token->CompletionString);
         if (token->CursorKind == CXCursor_Namespace)
             doc = wxT("namespace ");
@@ -997,50 +1160,101 @@ wxString ClangProxy::DocumentCCToken( const ClTranslUnitId translUnitId, int tkn
             clang_disposeString(str);
         }
 
-        wxString identifier;
-        unsigned tokenHash = HashToken(token->CompletionString, identifier);
-        if (!identifier.IsEmpty())
+        if (declTknId != wxNOT_FOUND)
         {
-            ClTokenId tId = m_Database.GetTokenId(identifier, wxNOT_FOUND, ClTokenType_Unknown, tokenHash);
-            if (tId != wxNOT_FOUND)
+            CXComment docComment = clang_Cursor_getParsedComment(clTkn);
+            HTML_Writer::FormatDocumentation(docComment, descriptor, m_CppKeywords);
+            if (clTkn.kind == CXCursor_EnumConstantDecl)
+                doc += wxT("=") + ProxyHelper::GetEnumValStr(clTkn);
+            else if (clTkn.kind == CXCursor_TypedefDecl)
             {
-                ClAbstractToken aTkn = m_Database.GetToken(tId);
-                CXCursor clTkn = m_TranslUnits[translUnitId].GetTokenAt(m_Database.GetFilename(aTkn.fileId),
-                                 aTkn.location);
-                if (!clang_Cursor_isNull(clTkn) && !clang_isInvalid(clTkn.kind))
-                {
-                    CXComment docComment = clang_Cursor_getParsedComment(clTkn);
-                    HTML_Writer::FormatDocumentation(docComment, descriptor, m_CppKeywords);
-                    if (clTkn.kind == CXCursor_EnumConstantDecl)
-                        doc += wxT("=") + ProxyHelper::GetEnumValStr(clTkn);
-                    else if (clTkn.kind == CXCursor_TypedefDecl)
-                    {
-                        CXString str = clang_getTypeSpelling(clang_getTypedefDeclUnderlyingType(clTkn));
-                        wxString type = wxString::FromUTF8(clang_getCString(str));
-                        if (!type.IsEmpty())
-                            doc.Prepend(wxT("typedef ") + type + wxT(" "));
-                        clang_disposeString(str);
-                    }
-                }
+                CXString str = clang_getTypeSpelling(clang_getTypedefDeclUnderlyingType(clTkn));
+                wxString type = wxString::FromUTF8(clang_getCString(str));
+                if (!type.IsEmpty())
+                    doc.Prepend(wxT("typedef ") + type + wxT(" "));
+                clang_disposeString(str);
             }
         }
 
         if (descriptor.IsEmpty())
         {
             CXString comment = clang_getCompletionBriefComment(token->CompletionString);
-            descriptor = wxT("<p><font size=\"1\">")+HTML_Writer::Escape(wxString::FromUTF8(clang_getCString(comment)))+wxT("</font></p>");
+            descriptor.Append("<p><font size=\"1\">");
+            descriptor.AppendEscaped(clang_getCString(comment));
+            descriptor.Append("</font></p>");
             clang_disposeString(comment);
         }
     }
     ColourManager *colours = Manager::Get()->GetColourManager();
-    wxString html = _T("<html><body bgcolor=\"");
-    html += colours->GetColour(wxT("cc_docs_back")).GetAsString(wxC2S_HTML_SYNTAX) + _T("\" text=\"");
-    html += colours->GetColour(wxT("cc_docs_fore")).GetAsString(wxC2S_HTML_SYNTAX) + _T("\" link=\"");
-    html += colours->GetColour(wxT("cc_docs_link")).GetAsString(wxC2S_HTML_SYNTAX) + _T("\">");
-    html += _T("<p><a name=\"top\"></a>");
-
-    return html + wxT("<font size=\"2\"><code>") + HTML_Writer::SyntaxHl(doc, m_CppKeywords)
-           + wxT("</code></font></p>") + descriptor + wxT("</body></html>");
+    ClHtmlWriter writer(descriptor.GetUTF8().size() + 512);
+    writer.Append("<html><body bgcolor=\"");
+    writer.Append(colours->GetColour(wxT("cc_docs_back")).GetAsString(wxC2S_HTML_SYNTAX));
+    writer.Append("\" text=\"");
+    writer.Append(colours->GetColour(wxT("cc_docs_fore")).GetAsString(wxC2S_HTML_SYNTAX));
+    writer.Append("\" link=\"");
+    writer.Append(colours->GetColour(wxT("cc_docs_link")).GetAsString(wxC2S_HTML_SYNTAX));
+    writer.Append("\">");
+    writer.Append("<p><a name=\"top\"></a>");
+    writer.Append("<font size=\"2\"><code>");
+    writer.AppendCode(doc, m_CppKeywords);
+    writer.Append("</code></font></p>");
+    writer.Append(descriptor);
+    writer.Append("</body></html>");
+    html = writer.GetHtml();
+
+    if (cacheEntry.timestamp.IsValid())
+    {
+        wxMutexLocker docLock(m_DocMutex);
+        if (m_CCDocumentation.size() >= MaxCCDocumentation)
+            m_CCDocumentation.clear();
+        cacheEntry.html = html.c_str();
+        m_CCDocumentation[usrHash] = cacheEntry;
+        // The token ids are only valid until the next code completion, the job thread runs that after this
+        m_CCDocumentationTokens[std::make_pair(translUnitId, tknId)] = usrHash;
+    }
+    return html;
+}
+
+/** @brief Get the documentation of a Code Completion token that was documented before
+ *
+ * @param translUnitId Translation unit where the token is located
+ * @param tknId The TokenId
+ * @param out_html The documentation
+ * @return bool false when the documentation has to be rendered by DocumentCCToken()
+ *
+ *  Does not wait for the job thread, so it can be used on the UI thread.
+ */
+bool ClangProxy::GetCachedCCDocumentation( const ClTranslUnitId translUnitId, int tknId, wxString& out_html )
+{
+    wxMutexLocker lock(m_DocMutex);
+    std::map<std::pair<ClTranslUnitId, ClTokenId>, ClUSRHash>::const_iterator tknIt = m_CCDocumentationTokens.find(std::make_pair(translUnitId, tknId));
+    if (tknIt == m_CCDocumentationTokens.end())
+        return false;
+    return LookupCCDocumentation(tknIt->second, out_html);
+}
+
+bool ClangProxy::LookupCCDocumentation( ClUSRHash usrHash, wxString& out_html )
+{
+    std::map<ClUSRHash, CCDocumentation>::iterator it = m_CCDocumentation.find(usrHash);
+    if (it == m_CCDocumentation.end())
+        return false;
+    const wxDateTime timestamp = m_Database.GetFilenameTimestamp(it->second.fileId);
+    if ((!timestamp.IsValid()) || (timestamp != it->second.timestamp))
+    {
+        m_CCDocumentation.erase(it);
+        return false;
+    }
+    out_html = it->second.html.c_str(); // Deep copy, the cache is shared between threads
+    return true;
+}
+
+void ClangProxy::ClearCCDocumentationTokens( const ClTranslUnitId translUnitId )
+{
+    wxMutexLocker lock(m_DocMutex);
+    typedef std::map<std::pair<ClTranslUnitId, ClTokenId>, ClUSRHash> TokenMap;
+    TokenMap::iterator first = m_CCDocumentationTokens.lower_bound(std::make_pair(translUnitId, std::numeric_limits<ClTokenId>::min()));
+    TokenMap::iterator last = m_CCDocumentationTokens.lower_bound(std::make_pair(translUnitId + 1, std::numeric_limits<ClTokenId>::min()));
+    m_CCDocumentationTokens.erase(first, last);
 }
 
 /** @brief Get the Code Completion insert suffix. This is the operation after
@@ -1161,47 +1375,69 @@ wxString ClangProxy::GetCCInsertSuffix( const ClTranslUnitId translUnitId, int t
     return suffix;
 }
 
-/** @brief Return the token category of a specific token ID
+/** @brief Compute the display name and the precise category of code completion tokens
  *
- * @param translUnitId ClTranslUnitId
- * @param tknId int
- * @param tknType ClTokenCategory&
+ * CodeCompleteAt() only returns the typed text and the category of the cursor kind, this is
+ * done for the tokens that are actually displayed.
+ *
+ * @param translUnitId The translation unit of the last code completion
+ * @param inout_tokens Tokens returned by CodeCompleteAt(), the result type is appended to the names
+ * @param out_isMaterialized For every token, whether it was computed
  * @return void
  *
+ * This is called on the UI thread. When the job thread is busy with the translation unit, e.g.
+ * reparsing it, the tokens are left as they are instead of waiting, and can be tried again later.
+ * So are the tokens whose completion result is gone.
  */
-void ClangProxy::RefineTokenType( const ClTranslUnitId translUnitId, int tknId, ClTokenCategory& tknType)
+void ClangProxy::MaterializeCCTokens( const ClTranslUnitId translUnitId, std::vector<ClToken>& inout_tokens, std::vector<bool>& out_isMaterialized)
 {
+    out_isMaterialized.assign(inout_tokens.size(), false);
     if (translUnitId < 0)
     {
         return;
     }
-    wxMutexLocker lock(m_Mutex);
-    if (translUnitId >= (int)m_TranslUnits.size())
+    if (m_Mutex.TryLock() != wxMUTEX_NO_ERROR)
     {
+        CCLogger::Get()->DebugLog(wxT("MaterializeCCTokens: translation unit busy"));
         return;
     }
-    const CXCompletionResult* token = m_TranslUnits[translUnitId].GetCCResult(tknId);
-    if (!token)
+    if (translUnitId >= (int)m_TranslUnits.size())
+    {
+        m_Mutex.Unlock();
         return;
-    wxString identifier;
-    unsigned tokenHash = HashToken(token->CompletionString, identifier);
-    if (!identifier.IsEmpty())
+    }
+    for (std::vector<ClToken>::iterator tknIt = inout_tokens.begin(); tknIt != inout_tokens.end(); ++tknIt)
     {
-        ClTokenId tId = m_Database.GetTokenId(identifier, wxNOT_FOUND, ClTokenType_Unknown, tokenHash);
-        if (tId != wxNOT_FOUND)
+        const CXCompletionResult* token = m_TranslUnits[translUnitId].GetCCResult(tknIt->id);
+        if (!token)
+            continue;
+        out_isMaterialized[tknIt - inout_tokens.begin()] = true;
+        tknIt->name += ProxyHelper::GetCompletionTypeSuffix(token->CompletionString);
+        switch (tknIt->category)
         {
-            const ClAbstractToken& aTkn = m_Database.GetToken(tId);
-            CXCursor clTkn = m_TranslUnits[translUnitId].GetTokenAt(m_Database.GetFilename(aTkn.fileId),
-                             aTkn.location);
-            if (!clang_Cursor_isNull(clTkn) && !clang_isInvalid(clTkn.kind))
+        case tcCtorPublic:
+        case tcDtorPublic:
+        case tcClass:
+        case tcFuncPublic:
+        case tcVarPublic:
+        case tcEnum:
+        case tcTypedef:
             {
-                ClTokenCategory tkCat
-                    = ProxyHelper::GetTokenCategory(token->CursorKind, clang_getCXXAccessSpecifier(clTkn));
-                if (tkCat != tcNone)
-                    tknType = tkCat;
+                CXCursor clTkn;
+                if (ProxyHelper::ResolveCompletionToken(m_Database, m_TranslUnits[translUnitId], token->CompletionString, clTkn) != wxNOT_FOUND)
+                {
+                    ClTokenCategory tkCat
+                        = ProxyHelper::GetTokenCategory(token->CursorKind, clang_getCXXAccessSpecifier(clTkn));
+                    if (tkCat != tcNone)
+                        tknIt->category = tkCat;
+                }
             }
+            break;
+        default:
+            break;
         }
     }
+    m_Mutex.Unlock();
 }
 
 /** @brief Get call tips in a translation unit + file on a specific location
@@ -1209,25 +1445,56 @@ void ClangProxy::RefineTokenType( const ClTranslUnitId translUnitId, int tknId,
  * @param translUnitId The translation unit id
  * @param filename The filename
  * @param location The location of the token
+ * @param callLocation The location right after the open parenthesis of the call
  * @param tokenStr The string of the token
+ * @param unsavedFiles The editor buffers that differ from the files on disk
  * @param results[out] The list of calltips text
  * @return
  *
+ * The call tips are the overload candidates of a code completion at the open parenthesis, so
+ * only the overloads that clang selects for the call are shown. The completion is reused while
+ * the arguments of the same call are typed, see ClTranslationUnit::CodeCompleteCallAt(). When
+ * there are none, e.g. for a macro, the declarations matching the token are looked up instead.
+ *
+ * Both kinds of call tips are cached by the USR of the callee, until the timestamp of one of the
+ * files they were read from changes. The cache is looked at first, so a call to a known function
+ * does not need libclang beyond finding the callee in the parsed translation unit.
  */
 void ClangProxy::GetCallTipsAt( const ClTranslUnitId translUnitId, const wxString& filename,
-                                const ClTokenPosition& location, const wxString& tokenStr,
+                                const ClTokenPosition& location, const ClTokenPosition& callLocation,
+                                const wxString& tokenStr, const std::map<wxString, wxString>& unsavedFiles,
                                 std::vector<wxStringVec>& out_results )
 {
     if (translUnitId < 0)
     {
         return;
     }
+    std::vector<CXUnsavedFile> clUnsavedFiles;
+    std::vector<wxCharBuffer> clFileBuffer;
+    for (std::map<wxString, wxString>::const_iterator fileIt = unsavedFiles.begin();
+            fileIt != unsavedFiles.end(); ++fileIt)
+    {
+        CXUnsavedFile unit;
+        clFileBuffer.push_back(fileIt->first.ToUTF8());
+        unit.Filename = clFileBuffer.back().data();
+        clFileBuffer.push_back(fileIt->second.ToUTF8());
+        unit.Contents = clFileBuffer.back().data();
+#if wxCHECK_VERSION(2, 9, 4)
+        unit.Length   = clFileBuffer.back().length();
+#else
+        unit.Length   = strlen(unit.Contents); // extra work needed because wxString::Length() treats multibyte character length as '1'
+#endif
+        clUnsavedFiles.push_back(unit);
+    }
     wxMutexLocker lock(m_Mutex);
     if (translUnitId >= (int)m_TranslUnits.size())
     {
         return;
     }
-    std::vector<CXCursor> tokenSet;
+    if (m_CallTipsCache.size() > MaxCallTipsCache)
+        m_CallTipsCache.clear();
+    // The callee, when it is in the parsed translation unit already
+    CXCursor callee = clang_getNullCursor();
     ClTokenPosition loc = location;
     if (loc.column > static_cast<unsigned int>(tokenStr.Length()))
     {
@@ -1244,24 +1511,175 @@ void ClangProxy::GetCallTipsAt( const ClTranslUnitId translUnitId, const wxStrin
             }
             else
                 token = resolve;
-            tokenSet.push_back(token);
+            callee = token;
+        }
+    }
+    // Only trust the callee for the overload candidates when it is the token of the call, the
+    // parsed translation unit can be older than the buffer
+    ClUSRHash calleeHash = 0;
+    bool calleeMatches = false;
+    if (!clang_Cursor_isNull(callee) && !clang_isInvalid(callee.kind))
+    {
+        CXString spelling = clang_getCursorSpelling(callee);
+        calleeMatches = (wxString::FromUTF8(clang_getCString(spelling)) == tokenStr);
+        clang_disposeString(spelling);
+        calleeHash = HashCursorUSR(callee);
+    }
+    std::set<wxString> uniqueTips;
+    if (calleeMatches)
+    {
+        std::map<ClUSRHash, CallTips>::const_iterator it = m_CallTipsCache.find(calleeHash);
+        if ((it != m_CallTipsCache.end()) && IsCallTipsCurrent(it->second))
+        {
+            // Deep copy, the cache stays on this thread
+            for (std::vector<wxStringVec>::const_iterator sigIt = it->second.signatures.begin(); sigIt != it->second.signatures.end(); ++sigIt)
+            {
+                wxStringVec entry;
+                entry.reserve(sigIt->size());
+                for (wxStringVec::const_iterator itr = sigIt->begin(); itr != sigIt->end(); ++itr)
+                    entry.push_back(itr->c_str());
+                out_results.push_back(entry);
+            }
+            if (!out_results.empty())
+                return;
+        }
+    }
+
+    CXCodeCompleteResults* clResults = m_TranslUnits[translUnitId].CodeCompleteCallAt(filename, callLocation,
+                                       clUnsavedFiles.empty() ? nullptr : &clUnsavedFiles[0],
+                                       clUnsavedFiles.size());
+    if (clResults)
+    {
+        for (unsigned resIdx = 0; resIdx < clResults->NumResults; ++resIdx)
+        {
+            wxStringVec entry;
+            if (!ProxyHelper::GetOverloadCallTip(clResults->Results[resIdx], entry))
+                continue;
+            wxString composit;
+            for (wxStringVec::const_iterator itr = entry.begin(); itr != entry.end(); ++itr)
+                composit += *itr;
+            if (!uniqueTips.insert(composit).second)
+                continue;
+            out_results.push_back(wxStringVec());
+            out_results.back().swap(entry);
+        }
+        if (!out_results.empty())
+        {
+            if (calleeMatches)
+            {
+                // Valid as long as the file that declares the callee does not change
+                CallTips& callTips = m_CallTipsCache[calleeHash];
+                callTips.signatures.clear();
+                callTips.files.clear();
+                for (std::vector<wxStringVec>::const_iterator sigIt = out_results.begin(); sigIt != out_results.end(); ++sigIt)
+                {
+                    wxStringVec entry;
+                    entry.reserve(sigIt->size());
+                    for (wxStringVec::const_iterator itr = sigIt->begin(); itr != sigIt->end(); ++itr)
+                        entry.push_back(itr->c_str());
+                    callTips.signatures.push_back(entry);
+                }
+                CXFile file = nullptr;
+                clang_getSpellingLocation(clang_getCursorLocation(callee), &file, nullptr, nullptr, nullptr);
+                ClFileId fileId = wxNOT_FOUND;
+                if (file)
+                {
+                    CXString calleeFilename = clang_getFileName(file);
+                    fileId = m_Database.GetFilenameId(wxString::FromUTF8(clang_getCString(calleeFilename)));
+                    clang_disposeString(calleeFilename);
+                }
+                const wxDateTime timestamp = (fileId == wxNOT_FOUND) ? wxDateTime() : m_Database.GetFilenameTimestamp(fileId);
+                callTips.files.push_back(std::make_pair(fileId, timestamp));
+            }
+            return;
         }
     }
+
+    std::vector<ClUSRHash> tipHashes; // Entries of m_CallTipsCache, in the order of the results
+    std::set<ClUSRHash> usrHashes;
+    if (!clang_Cursor_isNull(callee))
+    {
+        const ClUSRHash usrHash = HashCursorUSR(callee);
+        usrHashes.insert(usrHash);
+        std::map<ClUSRHash, CallTips>::const_iterator it = m_CallTipsCache.find(usrHash);
+        if ((it == m_CallTipsCache.end()) || !IsCallTipsCurrent(it->second))
+            ComputeCallTips(callee, m_CallTipsCache[usrHash]);
+        tipHashes.push_back(usrHash);
+    }
     // TODO: searching the database is very inexact, but necessary, as clang
     // does not resolve the token when the code is invalid (incomplete)
     std::vector<ClTokenId> tknIds = m_Database.GetTokenMatches(tokenStr);
     for (std::vector<ClTokenId>::const_iterator itr = tknIds.begin(); itr != tknIds.end(); ++itr)
     {
-        const ClAbstractToken& aTkn = m_Database.GetToken(*itr);
-        CXCursor token = m_TranslUnits[translUnitId].GetTokenAt(m_Database.GetFilename(aTkn.fileId),
-                         aTkn.location);
-        if (!clang_Cursor_isNull(token) && !clang_isInvalid(token.kind))
-            tokenSet.push_back(token);
+        ClTokenView aTkn = m_Database.GetToken(*itr);
+        // Other declarations of an entity that is already in the set give the same tips
+        if (!usrHashes.insert(aTkn.GetHash()).second)
+            continue;
+        std::map<ClUSRHash, CallTips>::const_iterator it = m_CallTipsCache.find(aTkn.GetHash());
+        if ((it == m_CallTipsCache.end()) || !IsCallTipsCurrent(it->second))
+        {
+            CXCursor token = m_TranslUnits[translUnitId].GetTokenAt(m_Database.GetFilename(aTkn.GetFileId()),
+                             aTkn.GetLocation());
+            if (clang_Cursor_isNull(token) || clang_isInvalid(token.kind))
+                continue;
+            ComputeCallTips(token, m_CallTipsCache[aTkn.GetHash()]);
+        }
+        tipHashes.push_back(aTkn.GetHash());
     }
-    std::set<wxString> uniqueTips;
+    for (std::vector<ClUSRHash>::const_iterator hashIt = tipHashes.begin(); hashIt != tipHashes.end(); ++hashIt)
+    {
+        const std::vector<wxStringVec>& signatures = m_CallTipsCache[*hashIt].signatures;
+        for (std::vector<wxStringVec>::const_iterator sigIt = signatures.begin(); sigIt != signatures.end(); ++sigIt)
+        {
+            wxString composit;
+            for (wxStringVec::const_iterator itr = sigIt->begin();
+                    itr != sigIt->end(); ++itr)
+            {
+                composit += *itr;
+            }
+            if (!uniqueTips.insert(composit).second)
+                continue;
+            // Deep copy, the cache stays on this thread
+            wxStringVec entry;
+            entry.reserve(sigIt->size());
+            for (wxStringVec::const_iterator itr = sigIt->begin(); itr != sigIt->end(); ++itr)
+                entry.push_back(itr->c_str());
+            out_results.push_back(entry);
+        }
+    }
+}
+
+/** @brief Compute the call tips of a declaration
+ *
+ * @param declaration The declaration of a function, constructor, class, variable or typedef
+ * @param out_callTips The signatures of the functions it leads to, and the files they were read from
+ *
+ *  Variables and typedefs lead to their type, classes to their constructors and 'operator()'.
+ */
+void ClangProxy::ComputeCallTips(CXCursor declaration, CallTips& out_callTips)
+{
+    out_callTips.signatures.clear();
+    out_callTips.files.clear();
+    std::vector<CXCursor> tokenSet;
+    tokenSet.push_back(declaration);
+    std::set<ClFileId> files;
     for (size_t tknIdx = 0; tknIdx < tokenSet.size(); ++tknIdx)
     {
         CXCursor token = tokenSet[tknIdx];
+        CXFile file = nullptr;
+        clang_getSpellingLocation(clang_getCursorLocation(token), &file, nullptr, nullptr, nullptr);
+        ClFileId fileId = wxNOT_FOUND;
+        if (file)
+        {
+            CXString filename = clang_getFileName(file);
+            fileId = m_Database.GetFilenameId(wxString::FromUTF8(clang_getCString(filename)));
+            clang_disposeString(filename);
+        }
+        if (files.insert(fileId).second)
+        {
+            const wxDateTime timestamp = (fileId == wxNOT_FOUND) ? wxDateTime() : m_Database.GetFilenameTimestamp(fileId);
+            out_callTips.files.push_back(std::make_pair(fileId, timestamp));
+        }
         switch (ProxyHelper::GetTokenCategory(token.kind, CX_CXXPublic))
         {
         case tcVarPublic:
@@ -1359,16 +1777,7 @@ void ClangProxy::GetCallTipsAt( const ClTranslUnitId translUnitId, const wxStrin
                 entry.push_back(tknStr.Trim());
             }
             entry.push_back(wxT(')'));
-            wxString composit;
-            for (wxStringVec::const_iterator itr = entry.begin();
-                    itr != entry.end(); ++itr)
-            {
-                composit += *itr;
-            }
-            if (uniqueTips.find(composit) != uniqueTips.end())
-                break;
-            uniqueTips.insert(composit);
-            out_results.push_back(entry);
+            out_callTips.signatures.push_back(entry);
             break;
         }
 
@@ -1378,6 +1787,22 @@ void ClangProxy::GetCallTipsAt( const ClTranslUnitId translUnitId, const wxStrin
     }
 }
 
+/** @brief Check that the files of call tips did not change since they were computed
+ */
+bool ClangProxy::IsCallTipsCurrent(const CallTips& callTips) const
+{
+    for (std::vector< std::pair<ClFileId, wxDateTime> >::const_iterator it = callTips.files.begin(); it != callTips.files.end(); ++it)
+    {
+        // Files without timestamp are being edited, or not indexed yet
+        if ((it->first == wxNOT_FOUND) || !it->second.IsValid())
+            return false;
+        const wxDateTime timestamp = m_Database.GetFilenameTimestamp(it->first);
+        if ((!timestamp.IsValid()) || (timestamp != it->second))
+            return false;
+    }
+    return true;
+}
+
 /** @brief Get a list of tokens at a specific location
  *
  * @param translUnitId The translation unit ID
@@ -1498,11 +1923,14 @@ void ClangProxy::GetTokensAt( const ClTranslUnitId translUnitId, const wxString&
  * @param filename The filename
  * @param location The location in the file
  * @param results[out] The returned results
+ * @param out_shared[out] true when the ranges of the symbol can also be ranges of another symbol: the name of a class
+ *                   is the name of its constructors and destructor, and a macro expansion covers the tokens it expands to
  *
  */
 void ClangProxy::GetOccurrencesOf( const ClTranslUnitId translUnitId, const wxString& filename, const ClTokenPosition& location,
-                                  std::vector< std::pair<int, int> >& out_results )
+                                  std::vector< std::pair<int, int> >& out_results, bool& out_shared )
 {
+    out_shared = false;
     if (translUnitId < 0)
     {
         return;
@@ -1516,10 +1944,141 @@ void ClangProxy::GetOccurrencesOf( const ClTranslUnitId translUnitId, const wxSt
     if (clang_Cursor_isNull(token))
         return;
     ProxyHelper::ResolveCursorDecl(token);
+    switch (token.kind)
+    {
+    case CXCursor_StructDecl:
+    case CXCursor_UnionDecl:
+    case CXCursor_ClassDecl:
+    case CXCursor_ClassTemplate:
+    case CXCursor_ClassTemplatePartialSpecialization:
+    case CXCursor_Constructor:
+    case CXCursor_Destructor:
+    case CXCursor_MacroDefinition:
+    case CXCursor_MacroExpansion:
+        out_shared = true;
+        break;
+    default:
+        break;
+    }
     CXCursorAndRangeVisitor visitor = {&out_results, ProxyHelper::ReferencesVisitor};
     clang_findReferencesInFile(token, m_TranslUnits[translUnitId].GetFileHandle(filename), visitor);
 }
 
+/** @brief Find the references to a token in all indexed files
+ *
+ * @param translUnitId const ClTranslUnitId
+ * @param filename const wxString&
+ * @param location const ClTokenPosition& The position of the token
+ * @param out_references ClTokenReferenceList& The declarations and uses of the symbol, ordered on file and offset
+ * @return void
+ *
+ * Unlike GetOccurrencesOf(), this is served from the token database and covers every file that was indexed, not only the file at hand.
+ */
+void ClangProxy::GetReferencesOf( const ClTranslUnitId translUnitId, const wxString& filename, const ClTokenPosition& location,
+                                  ClTokenReferenceList& out_references )
+{
+    if (translUnitId < 0)
+    {
+        return;
+    }
+    ClUSRHash usrHash = 0;
+    {
+        wxMutexLocker lock(m_Mutex);
+        if (translUnitId >= (int)m_TranslUnits.size())
+        {
+            return;
+        }
+        CXCursor token = m_TranslUnits[translUnitId].GetTokenAt(filename, location);
+        if (clang_Cursor_isNull(token))
+            return;
+        ProxyHelper::ResolveCursorDecl(token);
+        if (!clang_isDeclaration(token.kind))
+            return;
+        usrHash = HashCursorUSR(token);
+    }
+    m_Database.GetReferences(usrHash, out_references);
+}
+
+/** @brief Get the type hierarchy of the class at a location from the token database
+ *
+ * @param translUnitId const ClTranslUnitId
+ * @param filename const wxString&
+ * @param location const ClTokenPosition& The position of the class
+ * @param out_bases ClTokenReferenceList& The declarations of all direct and indirect base classes, nearest first
+ * @param out_derived ClTokenReferenceList& The definitions of all classes that derive from it directly or indirectly, nearest first
+ * @return void
+ *
+ * Only the translation unit at hand is used to find the class, the hierarchy itself is built from the relations that were indexed.
+ */
+void ClangProxy::GetTypeHierarchyAt( const ClTranslUnitId translUnitId, const wxString& filename, const ClTokenPosition& location,
+                                     ClTokenReferenceList& out_bases, ClTokenReferenceList& out_derived )
+{
+    ClUSRHash usrHash = 0;
+    if (!ResolveRelationUSRAt(translUnitId, filename, location, usrHash))
+        return;
+    ClTokenRelationList relations;
+    ProxyHelper::CollectRelations(m_Database, usrHash, ClTokenRelation_Base, false, relations);
+    for (ClTokenRelationList::const_iterator it = relations.begin(); it != relations.end(); ++it)
+    {
+        ClTokenReference declaration(it->toHash, wxNOT_FOUND, 0, ClTokenPosition(0, 0), CXCursor_ClassDecl);
+        if (ProxyHelper::FindDeclaration(m_Database, it->toHash, declaration))
+            out_bases.push_back(declaration);
+    }
+    relations.clear();
+    ProxyHelper::CollectRelations(m_Database, usrHash, ClTokenRelation_Base, true, relations);
+    for (ClTokenRelationList::const_iterator it = relations.begin(); it != relations.end(); ++it)
+        out_derived.push_back(ClTokenReference(it->fromHash, it->fileId, 0, it->location, CXCursor_ClassDecl));
+}
+
+/** @brief Get the methods that override the method at a location from the token database
+ *
+ * @param translUnitId const ClTranslUnitId
+ * @param filename const wxString&
+ * @param location const ClTokenPosition& The position of the method
+ * @param out_overrides ClTokenReferenceList& The declarations of all direct and indirect overrides, nearest first
+ * @return void
+ *
+ */
+void ClangProxy::GetOverridesAt( const ClTranslUnitId translUnitId, const wxString& filename, const ClTokenPosition& location,
+                                 ClTokenReferenceList& out_overrides )
+{
+    ClUSRHash usrHash = 0;
+    if (!ResolveRelationUSRAt(translUnitId, filename, location, usrHash))
+        return;
+    ClTokenRelationList relations;
+    ProxyHelper::CollectRelations(m_Database, usrHash, ClTokenRelation_Override, true, relations);
+    for (ClTokenRelationList::const_iterator it = relations.begin(); it != relations.end(); ++it)
+        out_overrides.push_back(ClTokenReference(it->fromHash, it->fileId, 0, it->location, CXCursor_CXXMethod));
+}
+
+/** @brief Resolve the declaration at a location to the USR hash its relations are indexed with
+ *
+ * @param translUnitId const ClTranslUnitId
+ * @param filename const wxString&
+ * @param location const ClTokenPosition&
+ * @param out_usrHash ClUSRHash&
+ * @return bool false if there is no declaration at the location
+ *
+ */
+bool ClangProxy::ResolveRelationUSRAt( const ClTranslUnitId translUnitId, const wxString& filename, const ClTokenPosition& location,
+                                       ClUSRHash& out_usrHash )
+{
+    if (translUnitId < 0)
+        return false;
+    wxMutexLocker lock(m_Mutex);
+    if (translUnitId >= (int)m_TranslUnits.size())
+        return false;
+    CXCursor token = m_TranslUnits[translUnitId].GetTokenAt(filename, location);
+    if (clang_Cursor_isNull(token))
+        return false;
+    ProxyHelper::ResolveCursorDecl(token);
+    token = ProxyHelper::GetRelationCursor(token);
+    if (!clang_isDeclaration(token.kind))
+        return false;
+    out_usrHash = HashCursorUSR(token);
+    return true;
+}
+
 /** @brief Resolve a token declaration.
  *
  * @param translUnitId const ClTranslUnitId
@@ -1602,16 +2161,16 @@ bool ClangProxy::ResolveDefinitionTokenAt( const ClTranslUnitId translUnitId, wx
         tokenList = m_Database.GetTokenMatches( tokenName );
         for (std::vector<ClTokenId>::const_iterator tokenIt = tokenList.begin(); tokenIt != tokenList.end(); ++tokenIt)
         {
-            ClAbstractToken tok = m_Database.GetToken( *tokenIt );
+            ClTokenView tok = m_Database.GetToken( *tokenIt );
             for ( std::vector<ClTranslationUnit>::iterator it = m_TranslUnits.begin(); it != m_TranslUnits.end(); ++it )
             {
-                if ( it->GetFileId() == tok.fileId ) // TODO: should also check children, if the definition is in a header-file that doesn't have its own TU
+                if ( it->GetFileId() == tok.GetFileId() ) // TODO: should also check children, if the definition is in a header-file that doesn't have its own TU
                 {
                     if ( translIdList.find( it->GetId() ) == translIdList.end())
                     {
                         translIdList.insert( it->GetId() );
-                        ClTokenPosition loc = tok.location;
-                        token = it->GetTokenAt(m_Database.GetFilename(tok.fileId), loc);
+                        ClTokenPosition loc = tok.GetLocation();
+                        token = it->GetTokenAt(m_Database.GetFilename(tok.GetFileId()), loc);
                         if (ProxyHelper::ResolveCursorDefinition( token ))
                         {
                             break;
@@ -1815,12 +2374,19 @@ void ClangProxy::UpdateTokenDatabase( const ClTranslUnitId translUnitId )
     if ( tu.IsValid() )
     {
         std::vector<ClFileId> includeFiles;
+        ClFileTokenMap fileTokens;
+        ClFileReferenceMap fileReferences;
+        ClFileRelationMap fileRelations;
+        std::map<ClFileId, wxDateTime> indexedFiles;
         ClFunctionScopeMap functionScopes;
-        tu.ProcessAllTokens( m_Database, includeFiles, functionScopes );
+        // Collect the tokens separately so tokens that disappeared from a file can be removed from the main database
+        tu.ProcessAllTokens( m_Database, includeFiles, fileTokens, fileReferences, fileRelations, indexedFiles, functionScopes );
+        // Files that were not walked are unchanged, their tokens in the database are still valid
+        m_Database.Update(fileTokens, fileReferences, fileRelations, indexedFiles);
         tu.SetFiles(includeFiles);
         for (ClFunctionScopeMap::const_iterator it = functionScopes.begin(); it != functionScopes.end(); ++it)
             tu.UpdateFunctionScopes(it->first, it->second);
-        CCLogger::Get()->DebugLog( F(wxT("Total token count: %d, function scopes for TU %d: %d, files: %d"), (int)m_Database.GetTokenCount(), (int)translUnitId, (int)functionScopes.size(), (int)includeFiles.size() ) );
+        CCLogger::Get()->DebugLog( F(wxT("Total token count: %d (%d dead), references: %d, function scopes for TU %d: %d, files: %d"), (int)m_Database.GetTokenCount(), (int)m_Database.GetDeadTokenCount(), (int)m_Database.GetReferenceCount(), (int)translUnitId, (int)functionScopes.size(), (int)includeFiles.size() ) );
     } else {
         CCLogger::Get()->DebugLog( F(_T("UpdateTokenDatabase: Translation unit is not valid!")) );
     }
@@ -1830,6 +2396,63 @@ void ClangProxy::UpdateTokenDatabase( const ClTranslUnitId translUnitId )
     }
 }
 
+/** @brief Compact the token database when enough token slots are unused
+ *
+ * @return void
+ *
+ * Removed token slots are reused by new tokens, so compaction is only worth it when a good
+ * part of the storage is dead. Since this renumbers all tokens, it must be run as a job.
+ */
+void ClangProxy::CompactTokenDatabase()
+{
+    unsigned long deadCount = m_Database.GetDeadTokenCount();
+    if ((deadCount == 0) || (deadCount * 8 < m_Database.GetTokenCount()))
+        return;
+    m_Database.Compact();
+}
+
+/** @brief Load the token database from disk
+ *
+ * @param filename The file that was written by StoreTokenDatabase()
+ * @return true if the database was loaded, false if there was no (valid) file
+ *
+ */
+bool ClangProxy::LoadTokenDatabase( const wxString& filename )
+{
+    wxMutexLocker lock(m_StoreMutex);
+    if (!ClTokenDatabase::ReadIn(m_Database, filename))
+        return false;
+    m_StoredGeneration = m_Database.GetGeneration();
+    return true;
+}
+
+/** @brief Write the token database to disk
+ *
+ * @param filename The file to write to, it is replaced atomically
+ * @return true if the file is up to date, false if writing failed
+ *
+ * Can be called from any thread. Nothing is written when the database did not change since it was last loaded or written.
+ * The directory of the file is created when it does not exist yet.
+ */
+bool ClangProxy::StoreTokenDatabase( const wxString& filename )
+{
+    wxMutexLocker lock(m_StoreMutex);
+    // Read the generation first: when the database changes while writing, the next call writes it again
+    unsigned long generation = m_Database.GetGeneration();
+    if (generation == m_StoredGeneration)
+        return true;
+    const wxString dir = wxFileName(filename).GetPath();
+    if ((!dir.IsEmpty()) && (!wxDirExists(dir)))
+        wxFileName::Mkdir(dir, 0755, wxPATH_MKDIR_FULL);
+    if (!ClTokenDatabase::WriteOut(m_Database, filename))
+    {
+        CCLogger::Get()->DebugLog(F(_T("Failed to write token database '%s'"), filename.wx_str()));
+        return false;
+    }
+    m_StoredGeneration = generation;
+    return true;
+}
+
 /** @brief Get the diagnostics of a file within a translation unit.
  *
  * @param translUnitId Translation unit ID
@@ -9,6 +9,7 @@
 #include <backgroundthread.h>
 #include "clangpluginapi.h"
 #include "translationunit.h"
+#include "completionhistory.h"
 
 #undef CLANGPROXY_TRACE_FUNCTIONS
 
@@ -42,7 +43,13 @@ public:
             GetTokensAtType,
             GetCallTipsAtType,
             GetOccurrencesOfType,
-            GetFunctionScopeAtType
+            GetFunctionScopeAtType,
+            CompactTokenDatabaseType,
+            StoreTokenDatabaseType,
+            PrefetchCCDocumentationType,
+            GetReferencesOfType,
+            GetTypeHierarchyAtType,
+            GetOverridesAtType
         };
     protected:
         ClangJob(JobType jt) :
@@ -348,6 +355,71 @@ public:
         ClTranslUnitId m_TranslId;
     };
 
+    /* final */
+    /** @brief Compact the tokendatabase at idle time job
+     */
+    class CompactTokenDatabaseJob : public EventJob
+    {
+    public:
+        /** @brief Constructor
+         *
+         * @param evtType wxEventType to use when the job is completed
+         * @param evtId Event ID to use when the job is completed
+         *
+         */
+        CompactTokenDatabaseJob( const wxEventType evtType, const int evtId ) :
+            EventJob(CompactTokenDatabaseType, evtType, evtId)
+        {
+        }
+        ClangJob* Clone() const
+        {
+            return new CompactTokenDatabaseJob(*this);
+        }
+        void Execute(ClangProxy& clangproxy)
+        {
+            clangproxy.CompactTokenDatabase();
+        }
+    };
+
+    /* final */
+    /** @brief Write the tokendatabase to disk job
+     */
+    class StoreTokenDatabaseJob : public EventJob
+    {
+    public:
+        /** @brief Constructor
+         *
+         * @param evtType wxEventType to use when the job is completed
+         * @param evtId Event ID to use when the job is completed
+         * @param filename The file to write the tokendatabase to
+         *
+         */
+        StoreTokenDatabaseJob( const wxEventType evtType, const int evtId, const wxString& filename ) :
+            EventJob(StoreTokenDatabaseType, evtType, evtId),
+            m_Filename(filename)
+        {
+        }
+        ClangJob* Clone() const
+        {
+            return new StoreTokenDatabaseJob(*this);
+        }
+        void Execute(ClangProxy& clangproxy)
+        {
+            clangproxy.StoreTokenDatabase(m_Filename);
+        }
+    protected:
+        /** @brief Copy constructor
+         *
+         * @param other To copy from
+         *
+         *  Performs a deep copy for multi-threaded use
+         */
+        StoreTokenDatabaseJob( const StoreTokenDatabaseJob& other ) :
+            EventJob(other),
+            m_Filename(other.m_Filename.c_str()) {}
+        wxString m_Filename;
+    };
+
     /* final */
     /** @brief Request diagnostics job.
      */
@@ -531,14 +603,16 @@ public:
         CodeCompleteAtJob( const wxEventType evtType, const int evtId, const bool isAuto,
                            const wxString& filename, const ClTokenPosition& location,
                            const ClTranslUnitId translId, const std::map<wxString, wxString>& unsavedFiles,
-                           bool includeCtors ):
+                           const wxString& prefix, size_t maxCount, const ClCompletionRanks& historyRanks ):
             SyncJob(CodeCompleteAtType, evtType, evtId),
             m_IsAuto(isAuto),
             m_Filename(filename),
             m_Location(location),
             m_TranslId(translId),
             m_UnsavedFiles(unsavedFiles),
-            m_IncludeCtors(includeCtors),
+            m_Prefix(prefix),
+            m_MaxCount(maxCount),
+            m_HistoryRanks(historyRanks),
             m_pResults(new std::vector<ClToken>()),
             m_Diagnostics()
         {
@@ -552,27 +626,7 @@ public:
         void Execute(ClangProxy& clangproxy)
         {
             std::vector<ClToken> results;
-            clangproxy.CodeCompleteAt(m_TranslId, m_Filename, m_Location, m_IsAuto, m_UnsavedFiles, results, m_Diagnostics);
-            for (std::vector<ClToken>::iterator tknIt = results.begin(); tknIt != results.end(); ++tknIt)
-            {
-                switch (tknIt->category)
-                {
-                case tcCtorPublic:
-                case tcDtorPublic:
-                    if ( !m_IncludeCtors )
-                        continue;
-                case tcClass:
-                case tcFuncPublic:
-                case tcVarPublic:
-                case tcEnum:
-                case tcTypedef:
-                    clangproxy.RefineTokenType(m_TranslId, tknIt->id, tknIt->category);
-                    break;
-                default:
-                    break;
-                }
-            }
-
+            clangproxy.CodeCompleteAt(m_TranslId, m_Filename, m_Location, m_IsAuto, m_UnsavedFiles, m_Prefix, m_MaxCount, m_HistoryRanks, results, m_Diagnostics);
             // Get rid of some copied memory we no longer need
             m_UnsavedFiles.clear();
 
@@ -616,7 +670,9 @@ public:
             m_Filename(other.m_Filename.c_str()),
             m_Location(other.m_Location),
             m_TranslId(other.m_TranslId),
-            m_IncludeCtors(other.m_IncludeCtors),
+            m_Prefix(other.m_Prefix.c_str()),
+            m_MaxCount(other.m_MaxCount),
+            m_HistoryRanks(other.m_HistoryRanks),
             m_pResults(other.m_pResults),
             m_Diagnostics(other.m_Diagnostics)
         {
@@ -631,7 +687,9 @@ public:
         ClTokenPosition m_Location;
         ClTranslUnitId m_TranslId;
         std::map<wxString, wxString> m_UnsavedFiles;
-        bool m_IncludeCtors;
+        wxString m_Prefix;   ///< Only results matching the typed prefix are returned
+        size_t m_MaxCount;   ///< Maximum number of results, 0 for all
+        ClCompletionRanks m_HistoryRanks; ///< Kept first when results are left out
         std::vector<ClToken>* m_pResults; // Returned value
         std::vector<ClDiagnostic> m_Diagnostics;
     };
@@ -707,6 +765,43 @@ public:
         ClTokenId m_TokenId;
         wxString* m_pResult;
     };
+
+    /* final */
+    /** @brief Render the documentation of code completion tokens into the documentation cache job
+     *
+     *  The token ids refer to the last code completion results of the translation unit. The job is
+     *  queued after the code completion job that produced them and runs before the next one.
+     */
+    class PrefetchCCDocumentationJob : public EventJob
+    {
+    public:
+        /** @brief Constructor
+         *
+         * @param evtType wxEventType to use when the job is completed
+         * @param evtId Event ID to use when the job is completed
+         * @param translId The translation unit of the code completion
+         * @param tknIds The tokens to document, the most likely shown first
+         *
+         */
+        PrefetchCCDocumentationJob( const wxEventType evtType, const int evtId, ClTranslUnitId translId, const std::vector<ClTokenId>& tknIds ) :
+            EventJob(PrefetchCCDocumentationType, evtType, evtId),
+            m_TranslId(translId),
+            m_TokenIds(tknIds)
+        {
+        }
+        ClangJob* Clone() const
+        {
+            return new PrefetchCCDocumentationJob(*this);
+        }
+        void Execute(ClangProxy& clangproxy)
+        {
+            for (std::vector<ClTokenId>::const_iterator it = m_TokenIds.begin(); it != m_TokenIds.end(); ++it)
+                clangproxy.DocumentCCToken(m_TranslId, *it);
+        }
+    protected:
+        ClTranslUnitId m_TranslId;
+        std::vector<ClTokenId> m_TokenIds;
+    };
     /* final */
     class GetTokensAtJob : public SyncJob
     {
@@ -770,15 +865,20 @@ public:
          *
          * @param evtType wxEventType to use when the job is completed
          * @param evtId Event ID to use when the job is completed
+         * @param location Location of the called token
+         * @param callLocation Location right after the open parenthesis of the call
          *
          */
         GetCallTipsAtJob( const wxEventType evtType, const int evtId, const wxString& filename,
-                          const ClTokenPosition& location, int translId, const wxString& tokenStr ):
+                          const ClTokenPosition& location, const ClTokenPosition& callLocation, int translId,
+                          const wxString& tokenStr, const std::map<wxString, wxString>& unsavedFiles ):
             SyncJob( GetCallTipsAtType, evtType, evtId),
             m_Filename(filename),
             m_Location(location),
+            m_CallLocation(callLocation),
             m_TranslId(translId),
             m_TokenStr(tokenStr),
+            m_UnsavedFiles(unsavedFiles),
             m_pResults(new std::vector<wxStringVec>())
         {
         }
@@ -789,7 +889,9 @@ public:
         }
         void Execute(ClangProxy& clangproxy)
         {
-            clangproxy.GetCallTipsAt( m_TranslId, m_Filename, m_Location, m_TokenStr, *m_pResults);
+            clangproxy.GetCallTipsAt( m_TranslId, m_Filename, m_Location, m_CallLocation, m_TokenStr, m_UnsavedFiles, *m_pResults);
+            // Get rid of some copied memory we no longer need
+            m_UnsavedFiles.clear();
         }
 
         virtual void Finalize()
@@ -802,20 +904,41 @@ public:
         {
             return *m_pResults;
         }
+        const wxString& GetFilename() const
+        {
+            return m_Filename;
+        }
+        const ClTokenPosition& GetLocation() const
+        {
+            return m_Location;
+        }
     protected:
-        GetCallTipsAtJob( const wxEventType evtType, const int evtId, const wxString& filename, const ClTokenPosition& location, int translId, const wxString& tokenStr,
-                          wxMutex* pMutex, wxCondition* pCond,
-                          std::vector<wxStringVec>* pResults ):
-            SyncJob(GetCallTipsAtType, evtType, evtId, pMutex, pCond),
-            m_Filename(filename.c_str()),
-            m_Location(location),
-            m_TranslId(translId),
-            m_TokenStr(tokenStr.c_str()),
-            m_pResults(pResults) {}
+        /** @brief Copy constructor
+         *
+         * @param other To copy from
+         *
+         *  Performs a deep copy for multi-threaded use
+         */
+        GetCallTipsAtJob( const GetCallTipsAtJob& other ) :
+            SyncJob(other),
+            m_Filename(other.m_Filename.c_str()),
+            m_Location(other.m_Location),
+            m_CallLocation(other.m_CallLocation),
+            m_TranslId(other.m_TranslId),
+            m_TokenStr(other.m_TokenStr.c_str()),
+            m_pResults(other.m_pResults)
+        {
+            for ( std::map<wxString, wxString>::const_iterator it = other.m_UnsavedFiles.begin(); it != other.m_UnsavedFiles.end(); ++it)
+            {
+                m_UnsavedFiles.insert( std::make_pair( wxString(it->first.c_str()), wxString(it->second.c_str()) ) );
+            }
+        }
         wxString m_Filename;
         ClTokenPosition m_Location;
+        ClTokenPosition m_CallLocation;
         ClTranslUnitId m_TranslId;
         wxString m_TokenStr;
+        std::map<wxString, wxString> m_UnsavedFiles;
         std::vector<wxStringVec>* m_pResults;
     };
 
@@ -834,7 +957,8 @@ public:
             EventJob( GetOccurrencesOfType, evtType, evtId),
             m_TranslId(translId),
             m_Filename(filename),
-            m_Location(location)
+            m_Location(location),
+            m_Shared(false)
         {
         }
         ClangJob* Clone() const
@@ -844,7 +968,7 @@ public:
         }
         void Execute(ClangProxy& clangproxy)
         {
-            clangproxy.GetOccurrencesOf(m_TranslId, m_Filename, m_Location, m_Results);
+            clangproxy.GetOccurrencesOf(m_TranslId, m_Filename, m_Location, m_Results, m_Shared);
         }
 
         ClTranslUnitId GetTranslationUnitId() const
@@ -863,17 +987,193 @@ public:
         {
             return m_Results;
         }
+        /// Some of the results are also occurrences of another symbol
+        bool IsShared() const
+        {
+            return m_Shared;
+        }
     protected:
         GetOccurrencesOfJob( const GetOccurrencesOfJob& other) :
             EventJob(other),
             m_TranslId(other.m_TranslId),
             m_Filename(other.m_Filename.c_str()),
             m_Location(other.m_Location),
-            m_Results(other.m_Results){}
+            m_Results(other.m_Results),
+            m_Shared(other.m_Shared){}
         ClTranslUnitId m_TranslId;
         wxString m_Filename;
         ClTokenPosition m_Location;
         std::vector< std::pair<int, int> > m_Results;
+        bool m_Shared;
+    };
+
+    /* final */
+    class GetReferencesOfJob : public EventJob
+    {
+    public:
+        /** @brief Constructor
+         *
+         * @param evtType wxEventType to use when the job is completed
+         * @param evtId Event ID to use when the job is completed
+         *
+         */
+        GetReferencesOfJob( const wxEventType evtType, const int evtId, const wxString& filename,
+                            const ClTokenPosition& location, ClTranslUnitId translId ):
+            EventJob( GetReferencesOfType, evtType, evtId),
+            m_TranslId(translId),
+            m_Filename(filename),
+            m_Location(location)
+        {
+        }
+        ClangJob* Clone() const
+        {
+            GetReferencesOfJob* pJob = new GetReferencesOfJob(*this);
+            return static_cast<ClangJob*>(pJob);
+        }
+        void Execute(ClangProxy& clangproxy)
+        {
+            clangproxy.GetReferencesOf(m_TranslId, m_Filename, m_Location, m_Results);
+        }
+
+        ClTranslUnitId GetTranslationUnitId() const
+        {
+            return m_TranslId;
+        }
+        const wxString& GetFilename() const
+        {
+            return m_Filename;
+        }
+        const ClTokenPosition& GetLocation() const
+        {
+            return m_Location;
+        }
+        const ClTokenReferenceList& GetResults() const
+        {
+            return m_Results;
+        }
+    protected:
+        GetReferencesOfJob( const GetReferencesOfJob& other) :
+            EventJob(other),
+            m_TranslId(other.m_TranslId),
+            m_Filename(other.m_Filename.c_str()),
+            m_Location(other.m_Location),
+            m_Results(other.m_Results){}
+        ClTranslUnitId m_TranslId;
+        wxString m_Filename;
+        ClTokenPosition m_Location;
+        ClTokenReferenceList m_Results;
+    };
+
+    /* final */
+    class GetTypeHierarchyAtJob : public EventJob
+    {
+    public:
+        /** @brief Constructor
+         *
+         * @param evtType wxEventType to use when the job is completed
+         * @param evtId Event ID to use when the job is completed
+         *
+         */
+        GetTypeHierarchyAtJob( const wxEventType evtType, const int evtId, const wxString& filename,
+                               const ClTokenPosition& location, ClTranslUnitId translId ):
+            EventJob( GetTypeHierarchyAtType, evtType, evtId),
+            m_TranslId(translId),
+            m_Filename(filename),
+            m_Location(location)
+        {
+        }
+        ClangJob* Clone() const
+        {
+            GetTypeHierarchyAtJob* pJob = new GetTypeHierarchyAtJob(*this);
+            return static_cast<ClangJob*>(pJob);
+        }
+        void Execute(ClangProxy& clangproxy)
+        {
+            clangproxy.GetTypeHierarchyAt(m_TranslId, m_Filename, m_Location, m_Bases, m_Derived);
+        }
+
+        const wxString& GetFilename() const
+        {
+            return m_Filename;
+        }
+        const ClTokenReferenceList& GetBases() const
+        {
+            return m_Bases;
+        }
+        const ClTokenReferenceList& GetDerived() const
+        {
+            return m_Derived;
+        }
+    protected:
+        GetTypeHierarchyAtJob( const GetTypeHierarchyAtJob& other) :
+            EventJob(other),
+            m_TranslId(other.m_TranslId),
+            m_Filename(other.m_Filename.c_str()),
+            m_Location(other.m_Location),
+            m_Bases(other.m_Bases),
+            m_Derived(other.m_Derived){}
+        ClTranslUnitId m_TranslId;
+        wxString m_Filename;
+        ClTokenPosition m_Location;
+        ClTokenReferenceList m_Bases;
+        ClTokenReferenceList m_Derived;
+    };
+
+    /* final */
+    class GetOverridesAtJob : public EventJob
+    {
+    public:
+        /** @brief Constructor
+         *
+         * @param evtType wxEventType to use when the job is completed
+         * @param evtId Event ID to use when the job is completed
+         * @param tokenStr The name of the method, to find it on the line of an override
+         *
+         */
+        GetOverridesAtJob( const wxEventType evtType, const int evtId, const wxString& filename,
+                           const ClTokenPosition& location, ClTranslUnitId translId, const wxString& tokenStr ):
+            EventJob( GetOverridesAtType, evtType, evtId),
+            m_TranslId(translId),
+            m_Filename(filename),
+            m_Location(location),
+            m_TokenStr(tokenStr)
+        {
+        }
+        ClangJob* Clone() const
+        {
+            GetOverridesAtJob* pJob = new GetOverridesAtJob(*this);
+            return static_cast<ClangJob*>(pJob);
+        }
+        void Execute(ClangProxy& clangproxy)
+        {
+            clangproxy.GetOverridesAt(m_TranslId, m_Filename, m_Location, m_Results);
+        }
+
+        const wxString& GetFilename() const
+        {
+            return m_Filename;
+        }
+        const wxString& GetTokenStr() const
+        {
+            return m_TokenStr;
+        }
+        const ClTokenReferenceList& GetResults() const
+        {
+            return m_Results;
+        }
+    protected:
+        GetOverridesAtJob( const GetOverridesAtJob& other) :
+            EventJob(other),
+            m_TranslId(other.m_TranslId),
+            m_Filename(other.m_Filename.c_str()),
+            m_Location(other.m_Location),
+            m_TokenStr(other.m_TokenStr.c_str()),
+            m_Results(other.m_Results){}
+        ClTranslUnitId m_TranslId;
+        wxString m_Filename;
+        ClTokenPosition m_Location;
+        wxString m_TokenStr;
+        ClTokenReferenceList m_Results;
     };
 
     /**
@@ -918,7 +1218,7 @@ public:
     };
 
 public:
-    ClangProxy(wxEvtHandler* pEvtHandler, ClTokenDatabase& database, const std::vector<wxString>& cppKeywords);
+    ClangProxy(wxEvtHandler* pEvtHandler, ClTokenDatabase& database, const ClCppKeywords& cppKeywords);
     ~ClangProxy();
 
     /** Append a job to the end of the queue */
@@ -928,6 +1228,11 @@ public:
     ClTranslUnitId GetTranslationUnitId( const ClTranslUnitId CtxTranslUnitId, ClFileId fId);
     ClTranslUnitId GetTranslationUnitId( const ClTranslUnitId CtxTranslUnitId, const wxString& filename);
 
+    /** Load the token database from disk, must be called before any job uses the database */
+    bool LoadTokenDatabase( const wxString& filename );
+    /** Write the token database to disk if it was modified since it was last loaded or written */
+    bool StoreTokenDatabase( const wxString& filename );
+
 protected: // jobs that are run only on the thread
     void CreateTranslationUnit( const wxString& filename, const wxString& compileCommand,  const std::map<wxString, wxString>& unsavedFiles, ClTranslUnitId& out_TranslId);
     void RemoveTranslationUnit( const ClTranslUnitId TranslUnitId );
@@ -941,19 +1246,32 @@ protected: // jobs that are run only on the thread
      * @param translId The ID of the intended translation unit
      */
     void UpdateTokenDatabase( const ClTranslUnitId translId );
+    /** Compact the token database when a large part of it consists of removed tokens */
+    void CompactTokenDatabase();
     void GetDiagnostics(  const ClTranslUnitId translId, const wxString& filename, std::vector<ClDiagnostic>& diagnostics);
     void CodeCompleteAt(  const ClTranslUnitId translId, const wxString& filename, const ClTokenPosition& location,
-                          bool isAuto, const std::map<wxString, wxString>& unsavedFiles, std::vector<ClToken>& results, std::vector<ClDiagnostic>& diagnostics);
+                          bool isAuto, const std::map<wxString, wxString>& unsavedFiles, const wxString& prefix, size_t maxCount,
+                          const ClCompletionRanks& historyRanks, std::vector<ClToken>& results, std::vector<ClDiagnostic>& diagnostics);
     wxString DocumentCCToken( ClTranslUnitId translId, int tknId );
     void GetTokensAt(     const ClTranslUnitId translId, const wxString& filename, const ClTokenPosition& location, std::vector<wxString>& results);
     void GetCallTipsAt(   const ClTranslUnitId translId,const wxString& filename, const ClTokenPosition& location,
-                          const wxString& tokenStr, std::vector<wxStringVec>& results);
+                          const ClTokenPosition& callLocation, const wxString& tokenStr,
+                          const std::map<wxString, wxString>& unsavedFiles, std::vector<wxStringVec>& results);
     void GetOccurrencesOf(const ClTranslUnitId translId, const wxString& filename, const ClTokenPosition& location,
-                          std::vector< std::pair<int, int> >& results);
-    void RefineTokenType( const ClTranslUnitId translId, int tknId, ClTokenCategory& out_tknType); // TODO: cache TokenId (if resolved) for DocumentCCToken()
+                          std::vector< std::pair<int, int> >& results, bool& out_shared);
+    void GetReferencesOf( const ClTranslUnitId translId, const wxString& filename, const ClTokenPosition& location,
+                          ClTokenReferenceList& out_references);
+    void GetTypeHierarchyAt( const ClTranslUnitId translId, const wxString& filename, const ClTokenPosition& location,
+                             ClTokenReferenceList& out_bases, ClTokenReferenceList& out_derived);
+    void GetOverridesAt(  const ClTranslUnitId translId, const wxString& filename, const ClTokenPosition& location,
+                          ClTokenReferenceList& out_overrides);
 
 public: // Tokens
+    /** Compute display names and precise categories of code completion tokens, without waiting while the job thread uses libclang */
+    void MaterializeCCTokens( const ClTranslUnitId translId, std::vector<ClToken>& inout_tokens, std::vector<bool>& out_isMaterialized);
     wxString GetCCInsertSuffix( const  ClTranslUnitId translId, int tknId, const wxString& newLine, std::vector< std::pair<int, int> >& offsets );
+    /** Get the documentation of a code completion token when it was rendered before, without waiting for the job thread */
+    bool GetCachedCCDocumentation( const ClTranslUnitId translId, int tknId, wxString& out_html );
     bool ResolveDeclTokenAt( const ClTranslUnitId translId, wxString& filename, const ClTokenPosition& location, ClTokenPosition& out_location);
     bool ResolveDefinitionTokenAt( const ClTranslUnitId translUnitId, wxString& filename, const ClTokenPosition& location, ClTokenPosition& out_location);
 
@@ -963,11 +1281,40 @@ public: // Function scopes
     void GetFunctionScopeLocation( const ClTranslUnitId id, const wxString& filename, const wxString& scopeName, const wxString& functionName, ClTokenPosition& out_Location);
 
 private:
+    bool ResolveRelationUSRAt( const ClTranslUnitId translId, const wxString& filename, const ClTokenPosition& location, ClUSRHash& out_usrHash);
+    /** Find rendered documentation that is still current, call with m_DocMutex locked */
+    bool LookupCCDocumentation( ClUSRHash usrHash, wxString& out_html );
+    /** Forget which code completion tokens of a translation unit were documented, their ids are reused */
+    void ClearCCDocumentationTokens( const ClTranslUnitId translId );
+
+    /** @brief Call tips computed from a declaration */
+    struct CallTips
+    {
+        std::vector<wxStringVec> signatures;
+        std::vector< std::pair<ClFileId, wxDateTime> > files; ///< Files the signatures were read from, with their timestamps
+    };
+    void ComputeCallTips( CXCursor declaration, CallTips& out_callTips );
+    bool IsCallTipsCurrent( const CallTips& callTips ) const;
+
+    /** @brief Rendered documentation of a declaration */
+    struct CCDocumentation
+    {
+        wxString html;
+        ClFileId fileId;        ///< File of the declaration
+        wxDateTime timestamp;   ///< Timestamp of that file when the documentation was rendered
+    };
+
     mutable wxMutex m_Mutex;
     ClTokenDatabase& m_Database;
-    const std::vector<wxString>& m_CppKeywords;
+    wxMutex m_StoreMutex; ///< Serializes writing the token database
+    unsigned long m_StoredGeneration; ///< Generation of the token database when it was last loaded or written
+    const ClCppKeywords& m_CppKeywords;
     std::vector<ClTranslationUnit> m_TranslUnits;
     CXIndex m_ClIndex[2];
+    std::map<ClUSRHash, CallTips> m_CallTipsCache; ///< Guarded by m_Mutex
+    wxMutex m_DocMutex; ///< Guards the documentation cache, may be locked while m_Mutex is held but not the other way around
+    std::map<ClUSRHash, CCDocumentation> m_CCDocumentation;
+    std::map<std::pair<ClTranslUnitId, ClTokenId>, ClUSRHash> m_CCDocumentationTokens; ///< Documented code completion tokens
 private: // Thread
     wxEvtHandler* m_pEventCallbackHandler;
     BackgroundThread* m_pThread;
@@ -0,0 +1,148 @@
+#include <sdk.h>
+#include "clangsymbolpicker.h"
+
+#ifndef CB_PRECOMP
+#include <algorithm>
+#include <wx/listctrl.h>
+#include <wx/sizer.h>
+#include <wx/textctrl.h>
+#include <wx/filename.h>
+#endif // CB_PRECOMP
+
+/// The number of symbols shown in the list
+static const size_t MaxPickerSymbols = 200;
+
+static wxString GetSymbolKindName(ClTokenType tokenType)
+{
+    switch (tokenType & ~ClTokenType_DefGroup)
+    {
+    case ClTokenType_ScopeDecl:
+        return _("type");
+    case ClTokenType_FuncDecl:
+        return _("function");
+    case ClTokenType_VarDecl:
+        return _("variable");
+    case ClTokenType_ParmDecl:
+        return _("parameter");
+    default:
+        break;
+    }
+    return wxEmptyString;
+}
+
+ClangSymbolPickerDlg::ClangSymbolPickerDlg(wxWindow* parent, const ClTokenDatabase& database) :
+    wxDialog(parent, wxID_ANY, _("Go to symbol in workspace"), wxDefaultPosition, wxSize(640, 420),
+             wxDEFAULT_DIALOG_STYLE | wxRESIZE_BORDER),
+    m_Database(database),
+    m_pPattern(nullptr),
+    m_pList(nullptr)
+{
+    wxBoxSizer* sizer = new wxBoxSizer(wxVERTICAL);
+    m_pPattern = new wxTextCtrl(this, wxID_ANY, wxEmptyString, wxDefaultPosition, wxDefaultSize, wxTE_PROCESS_ENTER);
+    sizer->Add(m_pPattern, 0, wxEXPAND | wxALL, 5);
+    m_pList = new wxListView(this, wxID_ANY, wxDefaultPosition, wxDefaultSize, wxLC_REPORT | wxLC_SINGLE_SEL);
+    m_pList->InsertColumn(0, _("Symbol"), wxLIST_FORMAT_LEFT, 220);
+    m_pList->InsertColumn(1, _("Kind"), wxLIST_FORMAT_LEFT, 80);
+    m_pList->InsertColumn(2, _("File"), wxLIST_FORMAT_LEFT, 300);
+    sizer->Add(m_pList, 1, wxEXPAND | wxLEFT | wxRIGHT | wxBOTTOM, 5);
+    sizer->Add(CreateStdDialogButtonSizer(wxOK | wxCANCEL), 0, wxEXPAND | wxLEFT | wxRIGHT | wxBOTTOM, 5);
+    SetSizer(sizer);
+
+    m_pPattern->Connect(wxEVT_COMMAND_TEXT_UPDATED, wxCommandEventHandler(ClangSymbolPickerDlg::OnPatternChanged), nullptr, this);
+    m_pPattern->Connect(wxEVT_COMMAND_TEXT_ENTER, wxCommandEventHandler(ClangSymbolPickerDlg::OnPatternEnter), nullptr, this);
+    m_pPattern->Connect(wxEVT_KEY_DOWN, wxKeyEventHandler(ClangSymbolPickerDlg::OnPatternKeyDown), nullptr, this);
+    m_pList->Connect(wxEVT_COMMAND_LIST_ITEM_ACTIVATED, wxListEventHandler(ClangSymbolPickerDlg::OnItemActivated), nullptr, this);
+
+    m_pPattern->SetFocus();
+}
+
+ClangSymbolPickerDlg::~ClangSymbolPickerDlg()
+{
+    m_pPattern->Disconnect(wxEVT_COMMAND_TEXT_UPDATED, wxCommandEventHandler(ClangSymbolPickerDlg::OnPatternChanged), nullptr, this);
+    m_pPattern->Disconnect(wxEVT_COMMAND_TEXT_ENTER, wxCommandEventHandler(ClangSymbolPickerDlg::OnPatternEnter), nullptr, this);
+    m_pPattern->Disconnect(wxEVT_KEY_DOWN, wxKeyEventHandler(ClangSymbolPickerDlg::OnPatternKeyDown), nullptr, this);
+    m_pList->Disconnect(wxEVT_COMMAND_LIST_ITEM_ACTIVATED, wxListEventHandler(ClangSymbolPickerDlg::OnItemActivated), nullptr, this);
+}
+
+bool ClangSymbolPickerDlg::GetSelection(ClFileId& out_fileId, ClTokenPosition& out_location, wxString& out_identifier) const
+{
+    long sel = m_pList->GetFirstSelected();
+    if ((sel < 0) || (static_cast<size_t>(sel) >= m_Symbols.size()))
+        return false;
+    const ClTokenView& token = m_Symbols[sel];
+    out_fileId = token.GetFileId();
+    out_location = token.GetLocation();
+    out_identifier = token.GetIdentifier();
+    return true;
+}
+
+void ClangSymbolPickerDlg::OnPatternChanged(wxCommandEvent& WXUNUSED(event))
+{
+    UpdateList();
+}
+
+void ClangSymbolPickerDlg::OnPatternKeyDown(wxKeyEvent& event)
+{
+    const int count = m_pList->GetItemCount();
+    if (count == 0)
+    {
+        event.Skip();
+        return;
+    }
+    long sel = m_pList->GetFirstSelected();
+    switch (event.GetKeyCode())
+    {
+    case WXK_DOWN:
+        sel = std::min<long>(sel + 1, count - 1);
+        break;
+    case WXK_UP:
+        sel = std::max<long>(sel - 1, 0);
+        break;
+    case WXK_PAGEDOWN:
+        sel = std::min<long>(sel + m_pList->GetCountPerPage(), count - 1);
+        break;
+    case WXK_PAGEUP:
+        sel = std::max<long>(sel - m_pList->GetCountPerPage(), 0);
+        break;
+    default:
+        event.Skip();
+        return;
+    }
+    m_pList->Select(sel);
+    m_pList->Focus(sel);
+}
+
+void ClangSymbolPickerDlg::OnPatternEnter(wxCommandEvent& WXUNUSED(event))
+{
+    if (m_pList->GetFirstSelected() >= 0)
+        EndModal(wxID_OK);
+}
+
+void ClangSymbolPickerDlg::OnItemActivated(wxListEvent& WXUNUSED(event))
+{
+    EndModal(wxID_OK);
+}
+
+void ClangSymbolPickerDlg::UpdateList()
+{
+    const wxString pattern = m_pPattern->GetValue().Strip(wxString::both);
+    m_Symbols.clear();
+    if (pattern.IsEmpty())
+        m_Search.Reset();
+    else
+        m_Database.SearchSymbols(m_Search, pattern, MaxPickerSymbols, m_Symbols);
+
+    m_pList->Freeze();
+    m_pList->DeleteAllItems();
+    for (std::vector<ClTokenView>::const_iterator it = m_Symbols.begin(); it != m_Symbols.end(); ++it)
+    {
+        const ClTokenView& token = *it;
+        const long idx = m_pList->InsertItem(m_pList->GetItemCount(), token.GetIdentifier());
+        m_pList->SetItem(idx, 1, GetSymbolKindName(token.GetType()));
+        wxFileName fn(m_Database.GetFilename(token.GetFileId()));
+        m_pList->SetItem(idx, 2, wxString::Format(wxT("%s:%d"), fn.GetFullName().c_str(), token.GetLocation().line));
+    }
+    if (!m_Symbols.empty())
+        m_pList->Select(0);
+    m_pList->Thaw();
+}
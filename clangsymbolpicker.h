@@ -0,0 +1,44 @@
+#ifndef CLANGSYMBOLPICKER_H
+#define CLANGSYMBOLPICKER_H
+
+#include <wx/dialog.h>
+#include <vector>
+
+#include "tokendatabase.h"
+
+class wxTextCtrl;
+class wxListView;
+class wxListEvent;
+
+/** @brief Dialog to jump to any symbol in the token database
+ *
+ * The list is refined on every character typed, see ClTokenDatabase::SearchSymbols().
+ */
+class ClangSymbolPickerDlg : public wxDialog
+{
+public:
+    ClangSymbolPickerDlg(wxWindow* parent, const ClTokenDatabase& database);
+    virtual ~ClangSymbolPickerDlg();
+
+    /** @brief Get the symbol that was picked
+     *
+     * @return false if no symbol was picked
+     */
+    bool GetSelection(ClFileId& out_fileId, ClTokenPosition& out_location, wxString& out_identifier) const;
+
+private:
+    void OnPatternChanged(wxCommandEvent& event);
+    void OnPatternKeyDown(wxKeyEvent& event);
+    void OnPatternEnter(wxCommandEvent& event);
+    void OnItemActivated(wxListEvent& event);
+
+    void UpdateList();
+
+    const ClTokenDatabase& m_Database;
+    ClSymbolSearch m_Search;
+    std::vector<ClTokenView> m_Symbols; ///< The symbols in the list, in list order
+    wxTextCtrl* m_pPattern;
+    wxListView* m_pList;
+};
+
+#endif // CLANGSYMBOLPICKER_H
@@ -0,0 +1,222 @@
+#include "completionhistory.h"
+
+#include <wx/file.h>
+#include <wx/filefn.h>
+#include <wx/string.h>
+#include <algorithm>
+#include <vector>
+#include <string.h>
+
+#include "cclogger.h"
+
+/// The count of an entry halves every this many accepted completions
+static const uint32_t HalfLife = 2000;
+/// Maximum number of entries, the least used quarter is dropped when there are more
+static const size_t MaxEntries = 8192;
+/// Counts are clamped so aging stays meaningful
+static const uint32_t MaxCount = 1 << 16;
+
+static const uint32_t ClCompletionHistoryVersion = 1;
+static const uint32_t ClCompletionHistoryByteOrder = 0x01020304;
+
+struct ClCompletionHistoryHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t clock;
+    uint32_t count;     ///< Number of records
+    uint32_t reserved;
+};
+
+struct ClCompletionHistoryRecord
+{
+    uint64_t key;
+    uint32_t count;
+    uint32_t lastUse;
+};
+
+ClCompletionHistory::ClCompletionHistory() :
+    m_Clock(0),
+    m_IsModified(false)
+{
+}
+
+void ClCompletionHistory::Clear()
+{
+    m_Entries.clear();
+    m_Clock = 0;
+    m_IsModified = false;
+}
+
+/** @brief 64 bit FNV-1a hash of the context and the UTF-8 typed text
+ */
+uint64_t ClCompletionHistory::GetKey(ClCompletionContext context, const char* utf8TypedText)
+{
+    uint64_t hVal = 14695981039346656037ULL;
+    hVal ^= static_cast<unsigned>(context);
+    hVal *= 1099511628211ULL;
+    for (const char* pCh = utf8TypedText; pCh && *pCh; ++pCh)
+    {
+        hVal ^= static_cast<unsigned char>(*pCh);
+        hVal *= 1099511628211ULL;
+    }
+    return hVal;
+}
+
+/// 1, 2-3, 4-7, 8 and more
+int ClCompletionHistory::GetRankOf(uint32_t agedCount)
+{
+    int rank = 0;
+    for (; (agedCount > 0) && (rank < 4); agedCount >>= 1)
+        ++rank;
+    return rank;
+}
+
+uint32_t ClCompletionHistory::GetAgedCount(const Entry& entry) const
+{
+    const uint32_t halvings = (m_Clock - entry.lastUse) / HalfLife;
+    if (halvings >= 32)
+        return 0;
+    return entry.count >> halvings;
+}
+
+void ClCompletionHistory::AddAccepted(ClCompletionContext context, const wxString& typedText)
+{
+    if (typedText.IsEmpty())
+        return;
+    ++m_Clock;
+    Entry& entry = m_Entries[GetKey(context, typedText.ToUTF8().data())];
+    entry.count = std::min(GetAgedCount(entry) + 1, MaxCount);
+    entry.lastUse = m_Clock;
+    m_IsModified = true;
+    if (m_Entries.size() > MaxEntries)
+        Prune();
+}
+
+int ClCompletionHistory::GetRank(ClCompletionContext context, const wxString& typedText) const
+{
+    EntryMap::const_iterator it = m_Entries.find(GetKey(context, typedText.ToUTF8().data()));
+    if (it == m_Entries.end())
+        return 0;
+    return GetRankOf(GetAgedCount(it->second));
+}
+
+/** @brief Copy the ranks of all entries that did not fade out yet
+ *
+ * The keys do not tell their context, so the entries of the other contexts are copied as well.
+ * They are never found, since the context is part of the key.
+ */
+void ClCompletionHistory::GetRanks(ClCompletionContext context, ClCompletionRanks& out_ranks) const
+{
+    out_ranks.m_Context = context;
+    out_ranks.m_Ranks.clear();
+    out_ranks.m_Ranks.reserve(m_Entries.size());
+    for (EntryMap::const_iterator it = m_Entries.begin(); it != m_Entries.end(); ++it) // in key order
+    {
+        const int rank = GetRankOf(GetAgedCount(it->second));
+        if (rank > 0)
+            out_ranks.m_Ranks.push_back(std::make_pair(it->first, rank));
+    }
+}
+
+int ClCompletionRanks::GetRank(const char* utf8TypedText) const
+{
+    if (m_Ranks.empty())
+        return 0;
+    const uint64_t key = ClCompletionHistory::GetKey(m_Context, utf8TypedText);
+    RankVec::const_iterator it = std::lower_bound(m_Ranks.begin(), m_Ranks.end(), std::make_pair(key, 0));
+    if ((it == m_Ranks.end()) || (it->first != key))
+        return 0;
+    return it->second;
+}
+
+/** @brief Drop the least used quarter of the entries, the oldest first on equal counts
+ */
+void ClCompletionHistory::Prune()
+{
+    typedef std::pair<std::pair<uint32_t, uint32_t>, uint64_t> UsedKey;
+    std::vector<UsedKey> usage;
+    usage.reserve(m_Entries.size());
+    for (EntryMap::const_iterator it = m_Entries.begin(); it != m_Entries.end(); ++it)
+        usage.push_back(UsedKey(std::make_pair(GetAgedCount(it->second), it->second.lastUse), it->first));
+    std::vector<UsedKey>::iterator nth = usage.begin() + usage.size() / 4;
+    std::nth_element(usage.begin(), nth, usage.end());
+    for (std::vector<UsedKey>::const_iterator it = usage.begin(); it != nth; ++it)
+        m_Entries.erase(it->second);
+}
+
+bool ClCompletionHistory::ReadIn(const wxString& filename)
+{
+    if (!wxFileExists(filename))
+        return false;
+    wxFile in(filename);
+    if (!in.IsOpened())
+        return false;
+    ClCompletionHistoryHeader header;
+    if (   (in.Read(&header, sizeof(header)) != sizeof(header))
+        || (memcmp(header.magic, "CbCh", 4) != 0)
+        || (header.version != ClCompletionHistoryVersion)
+        || (header.byteOrder != ClCompletionHistoryByteOrder)
+        || (header.count > MaxEntries) )
+    {
+        CCLogger::Get()->DebugLog(F(_T("Completion history '%s' has an unsupported format, ignored"), filename.wx_str()));
+        return false;
+    }
+    std::vector<ClCompletionHistoryRecord> records(header.count);
+    const size_t size = records.size() * sizeof(ClCompletionHistoryRecord);
+    if ((size > 0) && (in.Read(&records[0], size) != static_cast<ssize_t>(size)))
+        return false;
+
+    Clear();
+    m_Clock = header.clock;
+    for (std::vector<ClCompletionHistoryRecord>::const_iterator it = records.begin(); it != records.end(); ++it)
+    {
+        Entry& entry = m_Entries[it->key];
+        entry.count = std::min(it->count, MaxCount);
+        entry.lastUse = std::min(it->lastUse, m_Clock);
+    }
+    return true;
+}
+
+bool ClCompletionHistory::WriteOut(const wxString& filename)
+{
+    std::vector<char> data(sizeof(ClCompletionHistoryHeader) + m_Entries.size() * sizeof(ClCompletionHistoryRecord), '\0');
+    ClCompletionHistoryHeader header;
+    memcpy(header.magic, "CbCh", 4);
+    header.version = ClCompletionHistoryVersion;
+    header.byteOrder = ClCompletionHistoryByteOrder;
+    header.clock = m_Clock;
+    header.count = m_Entries.size();
+    header.reserved = 0;
+    memcpy(&data[0], &header, sizeof(header));
+    char* pRecord = &data[0] + sizeof(header);
+    for (EntryMap::const_iterator it = m_Entries.begin(); it != m_Entries.end(); ++it, pRecord += sizeof(ClCompletionHistoryRecord))
+    {
+        ClCompletionHistoryRecord record;
+        record.key = it->first;
+        record.count = it->second.count;
+        record.lastUse = it->second.lastUse;
+        memcpy(pRecord, &record, sizeof(record));
+    }
+
+    const wxString tmpFilename = filename + wxT(".tmp");
+    {
+        wxFile out;
+        if (!out.Create(tmpFilename, true))
+            return false;
+        if ((out.Write(&data[0], data.size()) != data.size()) || (!out.Flush()))
+        {
+            out.Close();
+            wxRemoveFile(tmpFilename);
+            return false;
+        }
+    }
+    if (!wxRenameFile(tmpFilename, filename, true))
+    {
+        wxRemoveFile(tmpFilename);
+        return false;
+    }
+    m_IsModified = false;
+    return true;
+}
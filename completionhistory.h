@@ -0,0 +1,106 @@
+#ifndef COMPLETIONHISTORY_H
+#define COMPLETIONHISTORY_H
+
+#include <map>
+#include <vector>
+#include <stdint.h>
+
+class wxString;
+class ClCompletionRanks;
+
+/** @brief Where a completion was requested, the same name is picked with different frequencies in each
+ */
+enum ClCompletionContext
+{
+    ClCompletionContext_Global, ///< Anywhere else
+    ClCompletionContext_Member, ///< After '.' or '->'
+    ClCompletionContext_Scope   ///< After '::'
+};
+
+/** @brief Frequency table of the code completions the user accepted
+ *
+ * Only a 64 bit hash of the context and the typed text is kept per entry, so the table stays small
+ * enough to load and store at once. Counts fade with the number of completions accepted since an
+ * entry was last used, and the least used entries are dropped when the table is full.
+ */
+class ClCompletionHistory
+{
+public:
+    ClCompletionHistory();
+
+    void Clear();
+    /** @brief Record that a completion was accepted
+     *
+     * @param context The completion context
+     * @param typedText The accepted identifier, without type or arguments
+     */
+    void AddAccepted(ClCompletionContext context, const wxString& typedText);
+    /** @brief Get how well a completion is known
+     *
+     * @return 0 for a completion that was never (or long ago) accepted, up to 4 for the frequently accepted ones
+     */
+    int GetRank(ClCompletionContext context, const wxString& typedText) const;
+    /** @brief Take the ranks of a context, so they can be used in the background while completing
+     *
+     * @param context The completion context
+     * @param out_ranks[out] The ranks of all completions that are still known
+     */
+    void GetRanks(ClCompletionContext context, ClCompletionRanks& out_ranks) const;
+    bool IsModified() const
+    {
+        return m_IsModified;
+    }
+
+    /** @brief Read a table written by WriteOut(), replacing the current entries
+     *
+     * @return false if the file does not exist or has an unsupported format
+     */
+    bool ReadIn(const wxString& filename);
+    bool WriteOut(const wxString& filename);
+
+private:
+    friend class ClCompletionRanks;
+
+    struct Entry
+    {
+        uint32_t count;
+        uint32_t lastUse;   ///< m_Clock when last accepted
+    };
+    typedef std::map<uint64_t, Entry> EntryMap;
+
+    static uint64_t GetKey(ClCompletionContext context, const char* utf8TypedText);
+    static int GetRankOf(uint32_t agedCount);
+    uint32_t GetAgedCount(const Entry& entry) const;
+    void Prune();
+
+    EntryMap m_Entries;
+    uint32_t m_Clock; ///< Number of accepted completions
+    bool m_IsModified;
+};
+
+/** @brief Copy of the ranks of one context of the completion history, see ClCompletionHistory::GetRanks()
+ */
+class ClCompletionRanks
+{
+public:
+    ClCompletionRanks() :
+        m_Context(ClCompletionContext_Global) {}
+
+    /** @brief Same as ClCompletionHistory::GetRank() at the time the ranks were taken
+     */
+    int GetRank(const char* utf8TypedText) const;
+    bool IsEmpty() const
+    {
+        return m_Ranks.empty();
+    }
+
+private:
+    friend class ClCompletionHistory;
+
+    typedef std::vector< std::pair<uint64_t, int> > RankVec; ///< Sorted on key
+
+    ClCompletionContext m_Context;
+    RankVec m_Ranks;
+};
+
+#endif // COMPLETIONHISTORY_H
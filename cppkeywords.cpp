@@ -0,0 +1,181 @@
+#include "cppkeywords.h"
+
+#include <algorithm>
+#include <stdint.h>
+#include <string.h>
+#include <wx/string.h>
+
+static constexpr unsigned char GetCppCharClass(unsigned c)
+{
+    return   (((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) || (c == '_') || (c >= 0x80))
+           ? (ClCppCharClass_IdentifierStart | ClCppCharClass_Identifier | ((c == '_') ? ClCppCharClass_Punct : 0))
+           : ((c >= '0') && (c <= '9'))
+           ? (ClCppCharClass_Identifier | ClCppCharClass_Digit)
+           : (((c >= '!') && (c <= '/')) || ((c >= ':') && (c <= '@')) || ((c >= '[') && (c <= '`')) || ((c >= '{') && (c <= '~')))
+           ? ClCppCharClass_Punct
+           : 0;
+}
+
+#define CL_CPP_CHAR_CLASSES_4(c)   GetCppCharClass(c), GetCppCharClass(c + 1), GetCppCharClass(c + 2), GetCppCharClass(c + 3)
+#define CL_CPP_CHAR_CLASSES_16(c)  CL_CPP_CHAR_CLASSES_4(c), CL_CPP_CHAR_CLASSES_4(c + 4), CL_CPP_CHAR_CLASSES_4(c + 8), CL_CPP_CHAR_CLASSES_4(c + 12)
+#define CL_CPP_CHAR_CLASSES_64(c)  CL_CPP_CHAR_CLASSES_16(c), CL_CPP_CHAR_CLASSES_16(c + 16), CL_CPP_CHAR_CLASSES_16(c + 32), CL_CPP_CHAR_CLASSES_16(c + 48)
+
+const unsigned char ClCppCharClasses[256] =
+{
+    CL_CPP_CHAR_CLASSES_64(0), CL_CPP_CHAR_CLASSES_64(64), CL_CPP_CHAR_CLASSES_64(128), CL_CPP_CHAR_CLASSES_64(192)
+};
+
+#undef CL_CPP_CHAR_CLASSES_64
+#undef CL_CPP_CHAR_CLASSES_16
+#undef CL_CPP_CHAR_CLASSES_4
+
+static const size_t MinKeywordLength = 2;
+static const size_t MaxKeywordLength = 16;
+static const uint32_t KeywordHashBasis = 2166136261u;
+
+/** @brief 32 bit FNV-1a hash of a word, starting from a seed instead of the offset basis
+ */
+static constexpr uint32_t HashKeyword(const char* word, size_t length, uint32_t seed)
+{
+    return (length == 0) ? seed : HashKeyword(word + 1, length - 1, (seed ^ static_cast<unsigned char>(*word)) * 16777619u);
+}
+
+/* Hash and displace: the words are put in buckets by their hash, the words of each bucket are
+ * rehashed with a per bucket seed that places all of them in free slots. The tables are
+ * generated offline for the keywords of C++20, the static_assert below checks them.
+ */
+static constexpr size_t KeywordBucketCount = 32;
+static constexpr size_t KeywordSlotCount = 128;
+
+static constexpr uint32_t KeywordDisplacements[KeywordBucketCount] =
+{
+    2u, 7u, 0u, 18u, 1u, 7u, 1u, 10u,
+    5u, 2u, 14u, 3u, 14u, 1u, 14u, 2u,
+    1u, 9u, 3u, 1u, 4u, 9u, 9u, 13u,
+    9u, 0u, 1u, 9u, 14u, 2u, 3u, 3u
+};
+
+static constexpr const char* KeywordSlots[KeywordSlotCount] =
+{
+    "nullptr", "short", "unsigned", "decltype",
+    "else", nullptr, "using", nullptr,
+    "or", "asm", "not_eq", "not",
+    nullptr, "typename", "bitand", "long",
+    nullptr, "bitor", "explicit", "enum",
+    nullptr, "new", nullptr, "export",
+    nullptr, "signed", nullptr, "true",
+    nullptr, "virtual", nullptr, "static",
+    "co_await", "char16_t", "auto", "thread_local",
+    "compl", nullptr, nullptr, "concept",
+    "xor", "volatile", "constexpr", nullptr,
+    "false", "private", "bool", "char32_t",
+    nullptr, "inline", "operator", "while",
+    "typeid", "switch", "alignas", "try",
+    "protected", "namespace", "constinit", "register",
+    "const_cast", "void", nullptr, nullptr,
+    "consteval", "catch", nullptr, "float",
+    nullptr, "and_eq", "xor_eq", "struct",
+    "double", "reinterpret_cast", nullptr, nullptr,
+    "break", "case", nullptr, "noexcept",
+    "co_return", "template", "goto", "dynamic_cast",
+    nullptr, "class", "char", nullptr,
+    nullptr, "delete", "co_yield", nullptr,
+    "mutable", "do", nullptr, "extern",
+    "continue", "return", "or_eq", nullptr,
+    "for", "wchar_t", "static_cast", "this",
+    "static_assert", "friend", "and", nullptr,
+    "int", nullptr, nullptr, nullptr,
+    "typedef", "requires", "throw", "union",
+    "default", "char8_t", nullptr, "const",
+    nullptr, "alignof", "if", "public",
+    nullptr, nullptr, "sizeof", nullptr
+};
+
+static constexpr size_t GetKeywordSlot(const char* word, size_t length)
+{
+    return HashKeyword(word, length, KeywordDisplacements[HashKeyword(word, length, KeywordHashBasis) % KeywordBucketCount]) % KeywordSlotCount;
+}
+
+static constexpr size_t GetLength(const char* text)
+{
+    return *text ? 1 + GetLength(text + 1) : 0;
+}
+
+static constexpr bool IsKeywordSlotValid(size_t slot)
+{
+    return    (KeywordSlots[slot] == nullptr)
+           || (   (GetKeywordSlot(KeywordSlots[slot], GetLength(KeywordSlots[slot])) == slot)
+               && (GetLength(KeywordSlots[slot]) >= MinKeywordLength)
+               && (GetLength(KeywordSlots[slot]) <= MaxKeywordLength) );
+}
+
+static constexpr bool AreKeywordSlotsValid(size_t slot)
+{
+    return (slot == KeywordSlotCount) || (IsKeywordSlotValid(slot) && AreKeywordSlotsValid(slot + 1));
+}
+
+static_assert(AreKeywordSlotsValid(0), "Every keyword must be in the slot its hash selects, regenerate the keyword tables");
+
+bool ClCppKeywords::IsCppKeyword(const char* utf8Word, size_t length)
+{
+    if ((length < MinKeywordLength) || (length > MaxKeywordLength))
+        return false;
+    const char* keyword = KeywordSlots[GetKeywordSlot(utf8Word, length)];
+    return keyword && (strlen(keyword) == length) && (memcmp(keyword, utf8Word, length) == 0);
+}
+
+static bool ExtraKeywordLess(const std::string& keyword, const std::pair<const char*, size_t>& word)
+{
+    return keyword.compare(0, std::string::npos, word.first, word.second) < 0;
+}
+
+void ClCppKeywords::SetExtraKeywords(const std::vector<wxString>& keywords)
+{
+    m_ExtraKeywords.clear();
+    for (std::vector<wxString>::const_iterator it = keywords.begin(); it != keywords.end(); ++it)
+    {
+        const wxCharBuffer utf8Keyword = it->ToUTF8();
+        const size_t length = strlen(utf8Keyword.data());
+        if ((length > 0) && !IsCppKeyword(utf8Keyword.data(), length))
+            m_ExtraKeywords.push_back(std::string(utf8Keyword.data(), length));
+    }
+    std::sort(m_ExtraKeywords.begin(), m_ExtraKeywords.end());
+    m_ExtraKeywords.erase(std::unique(m_ExtraKeywords.begin(), m_ExtraKeywords.end()), m_ExtraKeywords.end());
+    std::vector<std::string>(m_ExtraKeywords).swap(m_ExtraKeywords);
+}
+
+bool ClCppKeywords::IsExtraKeyword(const char* utf8Word, size_t length) const
+{
+    const std::pair<const char*, size_t> word(utf8Word, length);
+    std::vector<std::string>::const_iterator it = std::lower_bound(m_ExtraKeywords.begin(), m_ExtraKeywords.end(), word, ExtraKeywordLess);
+    return (it != m_ExtraKeywords.end()) && (it->compare(0, std::string::npos, utf8Word, length) == 0);
+}
+
+bool ClCppKeywords::IsKeyword(const char* utf8Word, size_t length) const
+{
+    return IsCppKeyword(utf8Word, length) || (!m_ExtraKeywords.empty() && IsExtraKeyword(utf8Word, length));
+}
+
+bool ClCppKeywords::IsKeyword(const wxString& word) const
+{
+    const size_t length = word.Length();
+    if (length <= MaxKeywordLength)
+    {
+        // Language keywords are ASCII, no conversion needed
+        char asciiWord[MaxKeywordLength];
+        size_t idx = 0;
+        for (; idx < length; ++idx)
+        {
+            const unsigned ch = static_cast<unsigned>(word[idx]);
+            if ((ch == 0) || (ch >= 0x80))
+                break;
+            asciiWord[idx] = static_cast<char>(ch);
+        }
+        if ((idx == length) && IsCppKeyword(asciiWord, length))
+            return true;
+    }
+    if (m_ExtraKeywords.empty())
+        return false;
+    const wxCharBuffer utf8Word = word.ToUTF8();
+    return IsExtraKeyword(utf8Word.data(), strlen(utf8Word.data()));
+}
@@ -0,0 +1,70 @@
+#ifndef CPPKEYWORDS_H
+#define CPPKEYWORDS_H
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+
+class wxString;
+
+/** @brief Character classes of the C++ lexer, the bits of ClCppCharClasses
+ */
+enum ClCppCharClass
+{
+    ClCppCharClass_IdentifierStart = 0x01, ///< Letter, '_' or a byte of a multibyte UTF-8 character
+    ClCppCharClass_Identifier      = 0x02, ///< Identifier start or digit
+    ClCppCharClass_Digit           = 0x04,
+    ClCppCharClass_Punct           = 0x08  ///< ASCII punctuation, including '_'
+};
+
+/// Classes of every byte of UTF-8 text
+extern const unsigned char ClCppCharClasses[256];
+
+inline bool ClIsCppIdentifierStart(char c)
+{
+    return ClCppCharClasses[static_cast<unsigned char>(c)] & ClCppCharClass_IdentifierStart;
+}
+
+inline bool ClIsCppIdentifierChar(char c)
+{
+    return ClCppCharClasses[static_cast<unsigned char>(c)] & ClCppCharClass_Identifier;
+}
+
+inline bool ClIsCppDigit(char c)
+{
+    return ClCppCharClasses[static_cast<unsigned char>(c)] & ClCppCharClass_Digit;
+}
+
+inline bool ClIsCppPunct(char c)
+{
+    return ClCppCharClasses[static_cast<unsigned char>(c)] & ClCppCharClass_Punct;
+}
+
+/** @brief Recognizes C++ keywords
+ *
+ * The language keywords are in a perfect hash table that is laid out and checked at compile time,
+ * so a lookup hashes the word once and compares it to at most one keyword. The keywords of the
+ * editor's lexer settings that are not language keywords are kept in a small sorted overlay.
+ */
+class ClCppKeywords
+{
+public:
+    /** @brief Set the keywords of the editor's lexer settings
+     *
+     * @param keywords Any order, the language keywords among them are skipped
+     */
+    void SetExtraKeywords(const std::vector<wxString>& keywords);
+
+    bool IsKeyword(const char* utf8Word, size_t length) const;
+    bool IsKeyword(const wxString& word) const;
+
+    /** @brief Check for a language keyword, without the extra keywords */
+    static bool IsCppKeyword(const char* utf8Word, size_t length);
+
+private:
+    bool IsExtraKeyword(const char* utf8Word, size_t length) const;
+
+    std::vector<std::string> m_ExtraKeywords; ///< Sorted UTF-8
+};
+
+#endif // CPPKEYWORDS_H
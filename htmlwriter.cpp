@@ -0,0 +1,198 @@
+#include "htmlwriter.h"
+
+#include <algorithm>
+#include <wx/string.h>
+
+#include "cppkeywords.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define CL_HTMLWRITER_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+/// Replacement of the characters that have an entry in EscapeTable
+static const char* const EscapeReplacements[] = { "", "&amp;", "&quot;", "&apos;", "&lt;", "&gt;", "<br>" };
+static const size_t EscapeReplacementLengths[] = { 0, 5, 6, 6, 4, 4, 4 };
+
+/** @brief Index into EscapeReplacements for every byte, 0 for the ones that are copied as is
+ */
+struct ClHtmlEscapeTable
+{
+    ClHtmlEscapeTable()
+    {
+        memset(index, 0, sizeof(index));
+        index[static_cast<unsigned char>('&')]  = 1;
+        index[static_cast<unsigned char>('"')]  = 2;
+        index[static_cast<unsigned char>('\'')] = 3;
+        index[static_cast<unsigned char>('<')]  = 4;
+        index[static_cast<unsigned char>('>')]  = 5;
+        index[static_cast<unsigned char>('\n')] = 6;
+    }
+    unsigned char index[256];
+};
+static const ClHtmlEscapeTable EscapeTable;
+
+/** @brief Find the first character that has to be escaped
+ *
+ * @return Its position, or end
+ */
+static inline const char* FindEscaped(const char* pos, const char* end)
+{
+#ifdef CL_HTMLWRITER_SSE2
+    const __m128i amp   = _mm_set1_epi8('&');
+    const __m128i quot  = _mm_set1_epi8('"');
+    const __m128i apos  = _mm_set1_epi8('\'');
+    const __m128i lt    = _mm_set1_epi8('<');
+    const __m128i gt    = _mm_set1_epi8('>');
+    const __m128i lf    = _mm_set1_epi8('\n');
+    for (; pos + 16 <= end; pos += 16)
+    {
+        const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos));
+        const __m128i hits = _mm_or_si128(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, amp), _mm_cmpeq_epi8(chunk, quot)),
+                                                       _mm_or_si128(_mm_cmpeq_epi8(chunk, apos), _mm_cmpeq_epi8(chunk, lt))),
+                                          _mm_or_si128(_mm_cmpeq_epi8(chunk, gt), _mm_cmpeq_epi8(chunk, lf)));
+        const unsigned bits = static_cast<unsigned>(_mm_movemask_epi8(hits));
+        if (bits)
+        {
+#ifdef _MSC_VER
+            unsigned long idx;
+            _BitScanForward(&idx, bits);
+#else
+            const unsigned idx = __builtin_ctz(bits);
+#endif
+            return pos + idx;
+        }
+    }
+#endif
+    for (; pos < end; ++pos)
+    {
+        if (EscapeTable.index[static_cast<unsigned char>(*pos)])
+            return pos;
+    }
+    return end;
+}
+
+ClHtmlWriter::ClHtmlWriter(size_t capacity)
+{
+    m_Html.reserve(capacity);
+}
+
+void ClHtmlWriter::Append(const wxString& markup)
+{
+    const wxCharBuffer utf8Markup = markup.ToUTF8();
+    Append(utf8Markup.data());
+}
+
+void ClHtmlWriter::AppendEscaped(const char* utf8Text, size_t length)
+{
+    const char* end = utf8Text + length;
+    for (const char* pos = utf8Text; pos < end;)
+    {
+        const char* special = FindEscaped(pos, end);
+        m_Html.append(pos, special - pos);
+        if (special == end)
+            break;
+        const unsigned char idx = EscapeTable.index[static_cast<unsigned char>(*special)];
+        m_Html.append(EscapeReplacements[idx], EscapeReplacementLengths[idx]);
+        pos = special + 1;
+    }
+}
+
+void ClHtmlWriter::AppendEscaped(const wxString& text)
+{
+    const wxCharBuffer utf8Text = text.ToUTF8();
+    AppendEscaped(utf8Text.data());
+}
+
+void ClHtmlWriter::AppendColoured(const char* utf8Text, size_t length, const char* colour)
+{
+    m_Html.append("<font color=\"");
+    m_Html.append(colour);
+    m_Html.append("\">");
+    AppendEscaped(utf8Text, length);
+    m_Html.append("</font>");
+}
+
+void ClHtmlWriter::AppendCode(const char* utf8Code, size_t length, const ClCppKeywords& cppKeywords)
+{
+    m_Html.reserve(m_Html.size() + length * 2);
+    const char* code = utf8Code;
+    const char* codeEnd = utf8Code + length;
+    for (const char* pos = code; pos < codeEnd;)
+    {
+        const char ch = *pos;
+        const char* runEnd = pos + 1;
+        if (ClIsCppIdentifierStart(ch))
+        {
+            while ((runEnd < codeEnd) && ClIsCppIdentifierChar(*runEnd))
+                ++runEnd;
+            if (cppKeywords.IsKeyword(pos, runEnd - pos))
+            {
+                m_Html.append("<b>");
+                AppendColoured(pos, runEnd - pos, "#00008b"); // DarkBlue
+                m_Html.append("</b>");
+            }
+            else
+                AppendEscaped(pos, runEnd - pos);
+        }
+        else if (ClIsCppDigit(ch))
+        {
+            while ((runEnd < codeEnd) && ClIsCppIdentifierChar(*runEnd))
+                ++runEnd;
+            AppendColoured(pos, runEnd - pos, "Magenta");
+        }
+        else if ((ch == '"') || (ch == '\''))
+        {
+            // Up to and including the closing quote, or up to the end of the line
+            while ((runEnd < codeEnd) && (*runEnd != '\n'))
+            {
+                if (*runEnd == '\\')
+                {
+                    if ((runEnd + 1 < codeEnd) && (runEnd[1] != '\n'))
+                        ++runEnd;
+                }
+                else if (*runEnd == ch)
+                {
+                    ++runEnd;
+                    break;
+                }
+                ++runEnd;
+            }
+            runEnd = std::min(runEnd, codeEnd);
+            AppendColoured(pos, runEnd - pos, (ch == '"') ? "#0000cd" : "GoldenRod"); // MediumBlue
+        }
+        else if ((ch == '/') && (runEnd < codeEnd) && (*runEnd == '/'))
+        {
+            while ((runEnd < codeEnd) && (*runEnd != '\n'))
+                ++runEnd;
+            AppendColoured(pos, runEnd - pos, "#778899"); // LightSlateGray
+        }
+        else if (ClIsCppPunct(ch))
+        {
+            while ((runEnd < codeEnd) && ClIsCppPunct(*runEnd) && (*runEnd != '"') && (*runEnd != '\'') && (*runEnd != '_'))
+                ++runEnd;
+            AppendColoured(pos, runEnd - pos, "Red");
+        }
+        else
+        {
+            while ((runEnd < codeEnd) && !ClIsCppIdentifierChar(*runEnd) && !ClIsCppPunct(*runEnd))
+                ++runEnd;
+            AppendEscaped(pos, runEnd - pos);
+        }
+        pos = runEnd;
+    }
+}
+
+void ClHtmlWriter::AppendCode(const wxString& code, const ClCppKeywords& cppKeywords)
+{
+    const wxCharBuffer utf8Code = code.ToUTF8();
+    AppendCode(utf8Code.data(), strlen(utf8Code.data()), cppKeywords);
+}
+
+wxString ClHtmlWriter::GetHtml() const
+{
+    return wxString::FromUTF8(m_Html.c_str());
+}
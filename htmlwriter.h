@@ -0,0 +1,75 @@
+#ifndef HTMLWRITER_H
+#define HTMLWRITER_H
+
+#include <string>
+#include <string.h>
+
+class ClCppKeywords;
+class wxString;
+
+/** @brief Builds an HTML document in a single UTF-8 buffer, for the documentation popups
+ *
+ * Text is appended in runs: escaping copies the unescaped stretches at once, and C++ code is
+ * highlighted in one pass without temporary strings. Only GetHtml() converts to a wxString.
+ */
+class ClHtmlWriter
+{
+public:
+    explicit ClHtmlWriter(size_t capacity = 1024);
+
+    void Clear()
+    {
+        m_Html.clear();
+    }
+    bool IsEmpty() const
+    {
+        return m_Html.empty();
+    }
+
+    /** @brief Append markup as is */
+    void Append(const char* utf8Markup, size_t length)
+    {
+        m_Html.append(utf8Markup, length);
+    }
+    void Append(const char* utf8Markup)
+    {
+        m_Html.append(utf8Markup);
+    }
+    void Append(const wxString& markup);
+    void Append(const ClHtmlWriter& other)
+    {
+        m_Html.append(other.m_Html);
+    }
+
+    /** @brief Append text, the HTML special characters are escaped and line breaks become <br> */
+    void AppendEscaped(const char* utf8Text, size_t length);
+    void AppendEscaped(const char* utf8Text)
+    {
+        AppendEscaped(utf8Text, strlen(utf8Text));
+    }
+    void AppendEscaped(const wxString& text);
+
+    /** @brief Append escaped text in a font colour
+     *
+     * @param colour HTML colour, a name or "#rrggbb"
+     */
+    void AppendColoured(const char* utf8Text, size_t length, const char* colour);
+
+    /** @brief Append C++ (ish) code with syntax highlighting
+     *
+     * @param cppKeywords The keywords are shown in bold
+     */
+    void AppendCode(const char* utf8Code, size_t length, const ClCppKeywords& cppKeywords);
+    void AppendCode(const wxString& code, const ClCppKeywords& cppKeywords);
+
+    const std::string& GetUTF8() const
+    {
+        return m_Html;
+    }
+    wxString GetHtml() const;
+
+private:
+    std::string m_Html;
+};
+
+#endif // HTMLWRITER_H
@@ -0,0 +1,738 @@
+#include "includeindex.h"
+
+#include <wx/dir.h>
+#include <wx/file.h>
+#include <wx/filefn.h>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef __linux__
+#include <errno.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif // __linux__
+
+#include "cclogger.h"
+
+/// Directories deeper below an include directory are not scanned
+static const int MaxScanDepth = 8;
+/// Stop adding entries when the index gets this big, a bad include directory could be the whole disk
+static const size_t MaxNodes = 500000;
+/// Milliseconds the scanner waits for work or file system events
+static const int ScannerPollInterval = 250;
+
+static const uint32_t ClIncludeIndexVersion = 1;
+static const uint32_t ClIncludeIndexByteOrder = 0x01020304;
+
+struct ClIncludeIndexHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t rootCount;     ///< Number of root name offsets following the header
+    uint32_t nodeCount;     ///< Number of node records following the roots
+    uint32_t stringsSize;   ///< Size of the string table following the nodes
+};
+
+struct ClIncludeIndexNodeRecord
+{
+    int32_t parent;         ///< Always before the node itself, -1 for the file system root
+    uint32_t nameOffset;
+    uint32_t flags;
+};
+
+enum
+{
+    ClIncludeIndexNodeFlag_dir = 1<<0
+};
+
+/** @brief Check whether a file can be included
+ *
+ * Files without extension are included too, like the C++ standard headers.
+ */
+static bool IsHeaderName(const wxString& name)
+{
+    if (name.IsEmpty() || name.EndsWith(wxT("~")))
+        return false;
+    const int dotPos = name.Find(wxT('.'), true);
+    if (dotPos == wxNOT_FOUND)
+        return true;
+    const wxString ext = name.Mid(dotPos + 1).Lower();
+    return    ext == wxT("h")   || ext == wxT("hh")  || ext == wxT("hpp") || ext == wxT("hxx")
+           || ext == wxT("h++") || ext == wxT("inl") || ext == wxT("tcc") || ext == wxT("ipp")
+           || ext == wxT("tpp");
+}
+
+/** @brief Background thread that scans the include directories and keeps the index current
+ */
+class ClIncludeScanner : public wxThread
+{
+public:
+    ClIncludeScanner(ClIncludeIndex* pIndex);
+    ~ClIncludeScanner();
+
+protected:
+    ExitCode Entry();
+
+private:
+    bool IsStopping()
+    {
+        return TestDestroy() || m_pIndex->IsStopRequested();
+    }
+    void ScanDirectory(const wxString& dirPath, int depth);
+    int WatchDirectory(const wxString& dirPath, int depth);
+    void UnwatchDirectory(int wd);
+    void ProcessWatchEvents();
+
+    ClIncludeIndex* m_pIndex;
+    std::set<wxString> m_ScannedDirs;
+    bool m_IndexFull; ///< No more directories are scanned or watched once the index reached MaxNodes
+#ifdef __linux__
+    struct WatchedDir
+    {
+        wxString path;
+        int depth;
+    };
+    int m_InotifyFd;
+    std::map<int, WatchedDir> m_WatchedDirs;
+#endif // __linux__
+};
+
+ClIncludeScanner::ClIncludeScanner(ClIncludeIndex* pIndex) :
+    wxThread(wxTHREAD_JOINABLE),
+    m_pIndex(pIndex),
+    m_IndexFull(false)
+{
+#ifdef __linux__
+    m_InotifyFd = inotify_init1(IN_CLOEXEC);
+    if (m_InotifyFd < 0)
+        CCLogger::Get()->DebugLog(wxT("Include directories are not watched, inotify is not available"));
+#endif // __linux__
+}
+
+ClIncludeScanner::~ClIncludeScanner()
+{
+#ifdef __linux__
+    if (m_InotifyFd >= 0)
+        close(m_InotifyFd);
+#endif // __linux__
+}
+
+wxThread::ExitCode ClIncludeScanner::Entry()
+{
+    while (!IsStopping())
+    {
+        wxString dirPath;
+        if (m_pIndex->PopPendingDir(dirPath))
+        {
+            ScanDirectory(dirPath, 0);
+            continue;
+        }
+#ifdef __linux__
+        if (m_InotifyFd >= 0)
+        {
+            ProcessWatchEvents();
+            continue;
+        }
+#endif // __linux__
+        Sleep(ScannerPollInterval);
+    }
+    return 0;
+}
+
+/** @brief Index a directory and its subdirectories
+ *
+ * @param dirPath Absolute path of the directory
+ * @param depth Number of directories below the include directory
+ */
+void ClIncludeScanner::ScanDirectory(const wxString& dirPath, int depth)
+{
+    if (m_IndexFull || IsStopping() || !m_ScannedDirs.insert(dirPath).second)
+        return;
+    if (!wxDir::Exists(dirPath))
+        return;
+    // Watch before listing, so nothing changes unnoticed in between
+    const int wd = WatchDirectory(dirPath, depth);
+    wxDir dir(dirPath);
+    if (!dir.IsOpened())
+        return;
+
+    std::vector<wxString> subDirs;
+    std::vector<wxString> files;
+    wxString name;
+    for (bool found = dir.GetFirst(&name, wxEmptyString, wxDIR_DIRS); found; found = dir.GetNext(&name))
+        subDirs.push_back(name);
+    for (bool found = dir.GetFirst(&name, wxEmptyString, wxDIR_FILES); found; found = dir.GetNext(&name))
+    {
+        if (IsHeaderName(name))
+            files.push_back(name);
+    }
+    if (!m_pIndex->SyncDirectory(dirPath, subDirs, files))
+    {
+        // The directory is incomplete in the index, and nothing below it is added anyway
+        UnwatchDirectory(wd);
+        m_IndexFull = true;
+        CCLogger::Get()->DebugLog(F(wxT("The include index is full, stopped scanning at '%s'"), dirPath.wx_str()));
+        return;
+    }
+
+    if (depth >= MaxScanDepth)
+        return;
+    for (std::vector<wxString>::const_iterator it = subDirs.begin(); it != subDirs.end(); ++it)
+        ScanDirectory(dirPath + wxFILE_SEP_PATH + *it, depth + 1);
+}
+
+#ifdef __linux__
+/** @brief Watch a directory for added and removed entries
+ *
+ * @return The watch descriptor, -1 when the directory is not watched
+ */
+int ClIncludeScanner::WatchDirectory(const wxString& dirPath, int depth)
+{
+    if (m_InotifyFd < 0)
+        return -1;
+    const int wd = inotify_add_watch(m_InotifyFd, dirPath.fn_str(),
+                                     IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR);
+    if (wd < 0)
+    {
+        if (errno == ENOSPC)
+            CCLogger::Get()->DebugLog(F(wxT("Out of inotify watches, '%s' is not watched"), dirPath.wx_str()));
+        return -1;
+    }
+    WatchedDir& watched = m_WatchedDirs[wd];
+    watched.path = dirPath;
+    watched.depth = depth;
+    return wd;
+}
+
+void ClIncludeScanner::UnwatchDirectory(int wd)
+{
+    if (wd < 0)
+        return;
+    inotify_rm_watch(m_InotifyFd, wd);
+    m_WatchedDirs.erase(wd);
+}
+
+/** @brief Wait for changes in the watched directories and apply them to the index
+ */
+void ClIncludeScanner::ProcessWatchEvents()
+{
+    pollfd pfd;
+    pfd.fd = m_InotifyFd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, ScannerPollInterval) <= 0)
+        return;
+    union
+    {
+        inotify_event event;
+        char buffer[4096];
+    } events;
+    const ssize_t length = read(m_InotifyFd, events.buffer, sizeof(events.buffer));
+    for (ssize_t offset = 0; offset + (ssize_t)sizeof(inotify_event) <= length;)
+    {
+        const inotify_event* pEvent = reinterpret_cast<const inotify_event*>(events.buffer + offset);
+        offset += sizeof(inotify_event) + pEvent->len;
+        if (pEvent->mask & IN_IGNORED)
+        {
+            m_WatchedDirs.erase(pEvent->wd);
+            continue;
+        }
+        std::map<int, WatchedDir>::const_iterator dirIt = m_WatchedDirs.find(pEvent->wd);
+        if ((dirIt == m_WatchedDirs.end()) || (pEvent->len == 0))
+            continue;
+        const WatchedDir watched = dirIt->second;
+        const wxString name = wxString::FromUTF8(pEvent->name);
+        const wxString path = watched.path + wxFILE_SEP_PATH + name;
+        const bool isDir = (pEvent->mask & IN_ISDIR) != 0;
+        if (pEvent->mask & (IN_CREATE | IN_MOVED_TO))
+        {
+            if (isDir)
+            {
+                m_pIndex->UpdateEntry(watched.path, name, true, true);
+                m_ScannedDirs.erase(path);
+                if (watched.depth < MaxScanDepth)
+                    ScanDirectory(path, watched.depth + 1);
+            }
+            else if (IsHeaderName(name))
+                m_pIndex->UpdateEntry(watched.path, name, false, true);
+        }
+        else if (pEvent->mask & (IN_DELETE | IN_MOVED_FROM))
+        {
+            m_pIndex->UpdateEntry(watched.path, name, isDir, false);
+            if (isDir)
+            {
+                // Scan it again when it comes back
+                const wxString subPathPrefix = path + wxFILE_SEP_PATH;
+                std::set<wxString>::iterator it = m_ScannedDirs.lower_bound(path);
+                while ((it != m_ScannedDirs.end()) && ((*it == path) || it->StartsWith(subPathPrefix)))
+                    m_ScannedDirs.erase(it++);
+                if (pEvent->mask & IN_MOVED_FROM)
+                {
+                    // The watches follow the moved directories, they would report changes under the old paths
+                    std::vector<int> movedWds;
+                    for (std::map<int, WatchedDir>::const_iterator wdIt = m_WatchedDirs.begin(); wdIt != m_WatchedDirs.end(); ++wdIt)
+                    {
+                        if ((wdIt->second.path == path) || wdIt->second.path.StartsWith(subPathPrefix))
+                            movedWds.push_back(wdIt->first);
+                    }
+                    for (std::vector<int>::const_iterator wdIt = movedWds.begin(); wdIt != movedWds.end(); ++wdIt)
+                        UnwatchDirectory(*wdIt);
+                }
+            }
+        }
+    }
+}
+#else
+int ClIncludeScanner::WatchDirectory(const wxString& WXUNUSED(dirPath), int WXUNUSED(depth))
+{
+    return -1;
+}
+
+void ClIncludeScanner::UnwatchDirectory(int WXUNUSED(wd))
+{
+}
+#endif // __linux__
+
+ClIncludeIndex::ClIncludeIndex() :
+    m_Nodes(1),
+    m_NodeCount(1),
+    m_pScanner(nullptr),
+    m_StopRequested(false)
+{
+    m_Nodes[0].isDir = true;
+}
+
+ClIncludeIndex::~ClIncludeIndex()
+{
+    Shutdown();
+}
+
+void ClIncludeIndex::SplitPath(const wxString& path, std::vector<wxString>& out_components)
+{
+    out_components.clear();
+    wxString component;
+    for (size_t i = 0; i <= path.Length(); ++i)
+    {
+        const wxChar ch = (i < path.Length()) ? (wxChar)path[i] : wxT('/');
+        if ((ch != wxT('/')) && (ch != wxT('\\')))
+        {
+            component += ch;
+            continue;
+        }
+        if (component == wxT(".."))
+        {
+            if (!out_components.empty())
+                out_components.pop_back();
+        }
+        else if (!component.IsEmpty() && (component != wxT(".")))
+            out_components.push_back(component);
+        component.Clear();
+    }
+}
+
+int ClIncludeIndex::FindChild(int parent, const wxString& name) const
+{
+    const std::vector<int>& children = m_Nodes[parent].children;
+    size_t first = 0;
+    size_t last = children.size();
+    while (first < last)
+    {
+        const size_t mid = (first + last) / 2;
+        const int cmp = m_Nodes[children[mid]].name.Cmp(name);
+        if (cmp == 0)
+            return children[mid];
+        if (cmp < 0)
+            first = mid + 1;
+        else
+            last = mid;
+    }
+    return wxNOT_FOUND;
+}
+
+int ClIncludeIndex::FindNode(const std::vector<wxString>& components) const
+{
+    int nodeId = 0;
+    for (std::vector<wxString>::const_iterator it = components.begin(); (nodeId != wxNOT_FOUND) && (it != components.end()); ++it)
+        nodeId = FindChild(nodeId, *it);
+    return nodeId;
+}
+
+/** @brief Add an entry to a directory node
+ *
+ * @return The id of the new or existing node, wxNOT_FOUND when the index is full
+ */
+int ClIncludeIndex::AddChild(int parent, const wxString& name, bool isDir)
+{
+    int nodeId = FindChild(parent, name);
+    if (nodeId != wxNOT_FOUND)
+    {
+        if (m_Nodes[nodeId].isDir != isDir)
+        {
+            RemoveNode(nodeId);
+            return AddChild(parent, name, isDir);
+        }
+        return nodeId;
+    }
+    if (m_NodeCount >= MaxNodes)
+        return wxNOT_FOUND;
+    if (m_FreeNodes.empty())
+    {
+        nodeId = m_Nodes.size();
+        m_Nodes.push_back(Node());
+    }
+    else
+    {
+        nodeId = m_FreeNodes.back();
+        m_FreeNodes.pop_back();
+    }
+    ++m_NodeCount;
+    Node& node = m_Nodes[nodeId];
+    node.name = name.c_str();
+    node.parent = parent;
+    node.isDir = isDir;
+    std::vector<int>& siblings = m_Nodes[parent].children;
+    std::vector<int>::iterator pos = siblings.begin();
+    for (size_t count = siblings.size(); count > 0;)
+    {
+        const size_t step = count / 2;
+        if (m_Nodes[*(pos + step)].name.Cmp(name) < 0)
+        {
+            pos += step + 1;
+            count -= step + 1;
+        }
+        else
+            count = step;
+    }
+    siblings.insert(pos, nodeId);
+    return nodeId;
+}
+
+/** @brief Remove a node and everything below it
+ */
+void ClIncludeIndex::RemoveNode(int nodeId)
+{
+    const int parent = m_Nodes[nodeId].parent;
+    if (parent != wxNOT_FOUND)
+    {
+        std::vector<int>& siblings = m_Nodes[parent].children;
+        siblings.erase(std::remove(siblings.begin(), siblings.end(), nodeId), siblings.end());
+    }
+    std::vector<int> pending(1, nodeId);
+    while (!pending.empty())
+    {
+        const int id = pending.back();
+        pending.pop_back();
+        Node& node = m_Nodes[id];
+        pending.insert(pending.end(), node.children.begin(), node.children.end());
+        node.children.clear();
+        node.name.Clear();
+        node.parent = wxNOT_FOUND;
+        m_FreeNodes.push_back(id);
+        --m_NodeCount;
+    }
+}
+
+bool ClIncludeIndex::SyncDirectory(const wxString& dirPath, const std::vector<wxString>& subDirs,
+                                   const std::vector<wxString>& files)
+{
+    std::vector<wxString> components;
+    SplitPath(dirPath, components);
+    std::vector< std::pair<wxString, bool> > entries;
+    entries.reserve(subDirs.size() + files.size());
+    for (std::vector<wxString>::const_iterator it = subDirs.begin(); it != subDirs.end(); ++it)
+        entries.push_back(std::make_pair(*it, true));
+    for (std::vector<wxString>::const_iterator it = files.begin(); it != files.end(); ++it)
+        entries.push_back(std::make_pair(*it, false));
+    std::sort(entries.begin(), entries.end());
+
+    wxMutexLocker lock(m_Mutex);
+    int nodeId = 0;
+    for (std::vector<wxString>::const_iterator it = components.begin(); (nodeId != wxNOT_FOUND) && (it != components.end()); ++it)
+        nodeId = AddChild(nodeId, *it, true);
+    if (nodeId == wxNOT_FOUND)
+        return false;
+
+    // Entries that are gone, children and entries are both sorted on name
+    std::vector<int> removed;
+    std::vector< std::pair<wxString, bool> >::const_iterator entryIt = entries.begin();
+    const std::vector<int>& children = m_Nodes[nodeId].children;
+    for (std::vector<int>::const_iterator childIt = children.begin(); childIt != children.end(); ++childIt)
+    {
+        const wxString& name = m_Nodes[*childIt].name;
+        while ((entryIt != entries.end()) && (entryIt->first.Cmp(name) < 0))
+            ++entryIt;
+        if ((entryIt == entries.end()) || (entryIt->first != name))
+            removed.push_back(*childIt);
+    }
+    for (std::vector<int>::const_iterator it = removed.begin(); it != removed.end(); ++it)
+        RemoveNode(*it);
+    for (entryIt = entries.begin(); entryIt != entries.end(); ++entryIt)
+    {
+        if (AddChild(nodeId, entryIt->first, entryIt->second) == wxNOT_FOUND)
+            return false;
+    }
+    return true;
+}
+
+void ClIncludeIndex::UpdateEntry(const wxString& dirPath, const wxString& name, bool isDir, bool exists)
+{
+    std::vector<wxString> components;
+    SplitPath(dirPath, components);
+
+    wxMutexLocker lock(m_Mutex);
+    const int dirId = FindNode(components);
+    if ((dirId == wxNOT_FOUND) || !m_Nodes[dirId].isDir)
+        return;
+    if (exists)
+        AddChild(dirId, name, isDir);
+    else
+    {
+        const int nodeId = FindChild(dirId, name);
+        if (nodeId != wxNOT_FOUND)
+            RemoveNode(nodeId);
+    }
+}
+
+bool ClIncludeIndex::PopPendingDir(wxString& out_dirPath)
+{
+    wxMutexLocker lock(m_Mutex);
+    if (m_PendingDirs.empty())
+        return false;
+    out_dirPath = m_PendingDirs.front().c_str();
+    m_PendingDirs.pop_front();
+    return true;
+}
+
+bool ClIncludeIndex::IsStopRequested() const
+{
+    wxMutexLocker lock(m_Mutex);
+    return m_StopRequested;
+}
+
+void ClIncludeIndex::StartScanner()
+{
+    if (m_pScanner || m_PendingDirs.empty())
+        return;
+    m_StopRequested = false;
+    m_pScanner = new ClIncludeScanner(this);
+    if ((m_pScanner->Create() != wxTHREAD_NO_ERROR) || (m_pScanner->Run() != wxTHREAD_NO_ERROR))
+    {
+        CCLogger::Get()->DebugLog(wxT("Failed to start the include directory scanner"));
+        delete m_pScanner;
+        m_pScanner = nullptr;
+    }
+}
+
+void ClIncludeIndex::AddRoots(const wxArrayString& dirs)
+{
+    wxMutexLocker lock(m_Mutex);
+    std::vector<wxString> components;
+    for (size_t i = 0; i < dirs.GetCount(); ++i)
+    {
+        SplitPath(dirs[i], components);
+        if (components.empty())
+            continue;
+        wxString key;
+        for (std::vector<wxString>::const_iterator it = components.begin(); it != components.end(); ++it)
+            key += wxT("/") + *it;
+        wxString dir = dirs[i].c_str();
+        while ((dir.Length() > 1) && ((dir.Last() == wxT('/')) || (dir.Last() == wxT('\\'))))
+            dir.RemoveLast();
+        if (m_Roots.insert(std::make_pair(key, dir)).second)
+            m_PendingDirs.push_back(dir);
+    }
+    StartScanner();
+}
+
+void ClIncludeIndex::GetEntries(const wxArrayString& roots, const wxString& subDir, const wxString& prefix,
+                                wxArrayString& out_entries) const
+{
+    std::vector<wxString> subComponents;
+    SplitPath(subDir, subComponents);
+    std::set<wxString> entries;
+    std::vector<wxString> components;
+
+    wxMutexLocker lock(m_Mutex);
+    for (size_t i = 0; i < roots.GetCount(); ++i)
+    {
+        SplitPath(roots[i], components);
+        components.insert(components.end(), subComponents.begin(), subComponents.end());
+        const int dirId = FindNode(components);
+        if ((dirId == wxNOT_FOUND) || !m_Nodes[dirId].isDir)
+            continue;
+        const std::vector<int>& children = m_Nodes[dirId].children;
+        for (std::vector<int>::const_iterator it = children.begin(); it != children.end(); ++it)
+        {
+            const Node& node = m_Nodes[*it];
+            if (node.name.StartsWith(prefix))
+                entries.insert(node.isDir ? node.name + wxT("/") : wxString(node.name.c_str()));
+        }
+    }
+    out_entries.Clear();
+    out_entries.Alloc(entries.size());
+    for (std::set<wxString>::const_iterator it = entries.begin(); it != entries.end(); ++it)
+        out_entries.Add(*it);
+}
+
+void ClIncludeIndex::Shutdown()
+{
+    ClIncludeScanner* pScanner = nullptr;
+    {
+        wxMutexLocker lock(m_Mutex);
+        pScanner = m_pScanner;
+        m_pScanner = nullptr;
+        m_StopRequested = true;
+    }
+    if (pScanner)
+    {
+        pScanner->Wait();
+        delete pScanner;
+    }
+}
+
+bool ClIncludeIndex::ReadIn(const wxString& filename)
+{
+    if (!wxFileExists(filename))
+        return false;
+    wxFile in(filename);
+    if (!in.IsOpened())
+        return false;
+    std::vector<char> data(in.Length());
+    if (data.size() < sizeof(ClIncludeIndexHeader) || (in.Read(&data[0], data.size()) != (ssize_t)data.size()))
+        return false;
+    ClIncludeIndexHeader header;
+    memcpy(&header, &data[0], sizeof(header));
+    const uint64_t expectedSize = sizeof(header) + uint64_t(header.rootCount) * sizeof(uint32_t)
+                                  + uint64_t(header.nodeCount) * sizeof(ClIncludeIndexNodeRecord) + header.stringsSize;
+    if (   (memcmp(header.magic, "CbCi", 4) != 0)
+        || (header.version != ClIncludeIndexVersion)
+        || (header.byteOrder != ClIncludeIndexByteOrder)
+        || (expectedSize != data.size())
+        || (header.nodeCount == 0) || (header.nodeCount > MaxNodes)
+        || (header.stringsSize == 0) )
+    {
+        CCLogger::Get()->DebugLog(F(_T("Include index '%s' has an unsupported format, ignored"), filename.wx_str()));
+        return false;
+    }
+    const char* pRoots = &data[sizeof(header)];
+    const char* pNodes = pRoots + header.rootCount * sizeof(uint32_t);
+    const char* pStrings = pNodes + header.nodeCount * sizeof(ClIncludeIndexNodeRecord);
+    if (pStrings[header.stringsSize - 1] != '\0')
+        return false;
+
+    std::vector<Node> nodes(header.nodeCount);
+    for (uint32_t i = 0; i < header.nodeCount; ++i)
+    {
+        ClIncludeIndexNodeRecord record;
+        memcpy(&record, pNodes + i * sizeof(record), sizeof(record));
+        if (   (record.nameOffset >= header.stringsSize)
+            || ((i == 0) != (record.parent < 0))
+            || (record.parent >= (int32_t)i) )
+        {
+            return false;
+        }
+        nodes[i].name = wxString::FromUTF8(pStrings + record.nameOffset);
+        nodes[i].parent = record.parent;
+        nodes[i].isDir = (record.flags & ClIncludeIndexNodeFlag_dir) != 0;
+        if (record.parent >= 0)
+        {
+            // Written in pre-order of sorted children, so the children stay sorted
+            if (!nodes[record.parent].isDir)
+                return false;
+            nodes[record.parent].children.push_back(i);
+        }
+    }
+    wxArrayString roots;
+    for (uint32_t i = 0; i < header.rootCount; ++i)
+    {
+        uint32_t rootOffset;
+        memcpy(&rootOffset, pRoots + i * sizeof(rootOffset), sizeof(rootOffset));
+        if (rootOffset >= header.stringsSize)
+            return false;
+        roots.Add(wxString::FromUTF8(pStrings + rootOffset));
+    }
+
+    {
+        wxMutexLocker lock(m_Mutex);
+        m_Nodes.swap(nodes);
+        m_FreeNodes.clear();
+        m_NodeCount = m_Nodes.size();
+    }
+    // The saved entries are used until the refresh has caught up
+    AddRoots(roots);
+    return true;
+}
+
+bool ClIncludeIndex::WriteOut(const wxString& filename) const
+{
+    std::vector<char> strings;
+    std::vector<uint32_t> rootOffsets;
+    std::vector<ClIncludeIndexNodeRecord> records;
+    {
+        wxMutexLocker lock(m_Mutex);
+        for (std::map<wxString, wxString>::const_iterator it = m_Roots.begin(); it != m_Roots.end(); ++it)
+        {
+            rootOffsets.push_back(strings.size());
+            const wxCharBuffer utf8Name = it->second.ToUTF8();
+            strings.insert(strings.end(), utf8Name.data(), utf8Name.data() + strlen(utf8Name.data()) + 1);
+        }
+        records.reserve(m_NodeCount);
+        // Pre-order, (node id, new id of the parent)
+        std::vector< std::pair<int, int32_t> > pending(1, std::make_pair(0, -1));
+        while (!pending.empty())
+        {
+            const std::pair<int, int32_t> item = pending.back();
+            pending.pop_back();
+            const Node& node = m_Nodes[item.first];
+            ClIncludeIndexNodeRecord record;
+            record.parent = item.second;
+            record.nameOffset = strings.size();
+            record.flags = node.isDir ? ClIncludeIndexNodeFlag_dir : 0;
+            const wxCharBuffer utf8Name = node.name.ToUTF8();
+            strings.insert(strings.end(), utf8Name.data(), utf8Name.data() + strlen(utf8Name.data()) + 1);
+            const int32_t newId = records.size();
+            records.push_back(record);
+            for (std::vector<int>::const_reverse_iterator it = node.children.rbegin(); it != node.children.rend(); ++it)
+                pending.push_back(std::make_pair(*it, newId));
+        }
+    }
+
+    ClIncludeIndexHeader header;
+    memcpy(header.magic, "CbCi", 4);
+    header.version = ClIncludeIndexVersion;
+    header.byteOrder = ClIncludeIndexByteOrder;
+    header.rootCount = rootOffsets.size();
+    header.nodeCount = records.size();
+    header.stringsSize = strings.size();
+    std::vector<char> data(sizeof(header));
+    memcpy(&data[0], &header, sizeof(header));
+    if (!rootOffsets.empty())
+        data.insert(data.end(), reinterpret_cast<const char*>(&rootOffsets[0]), reinterpret_cast<const char*>(&rootOffsets[0] + rootOffsets.size()));
+    data.insert(data.end(), reinterpret_cast<const char*>(&records[0]), reinterpret_cast<const char*>(&records[0] + records.size()));
+    data.insert(data.end(), strings.begin(), strings.end());
+
+    const wxString tmpFilename = filename + wxT(".tmp");
+    {
+        wxFile out;
+        if (!out.Create(tmpFilename, true))
+            return false;
+        if ((out.Write(&data[0], data.size()) != data.size()) || (!out.Flush()))
+        {
+            out.Close();
+            wxRemoveFile(tmpFilename);
+            return false;
+        }
+    }
+    if (!wxRenameFile(tmpFilename, filename, true))
+    {
+        wxRemoveFile(tmpFilename);
+        return false;
+    }
+    CCLogger::Get()->DebugLog(F(_T("Wrote include index: %d entries below %d include directories"), (int)records.size(), (int)rootOffsets.size()));
+    return true;
+}
@@ -0,0 +1,90 @@
+#ifndef INCLUDEINDEX_H
+#define INCLUDEINDEX_H
+
+#include <wx/arrstr.h>
+#include <wx/string.h>
+#include <wx/thread.h>
+#include <deque>
+#include <map>
+#include <vector>
+
+class ClIncludeScanner;
+
+/** @brief Index of the files in the include search directories, for #include completion
+ *
+ * All indexed directories share one trie on the path components of their absolute path, so nested
+ * include directories are stored once. The directories are scanned in a background thread that keeps
+ * the trie current (on Linux through inotify), the UI thread only looks up entries. The trie is kept
+ * between sessions, it answers lookups directly on startup while it is refreshed in the background.
+ */
+class ClIncludeIndex
+{
+public:
+    ClIncludeIndex();
+    ~ClIncludeIndex();
+
+    /** @brief Index directories in the background
+     *
+     * @param dirs Absolute paths of the directories, the ones that are indexed already are skipped
+     */
+    void AddRoots(const wxArrayString& dirs);
+
+    /** @brief List the entries of a directory relative to include directories
+     *
+     * @param roots The include directories, in search order
+     * @param subDir Directory relative to the include directories, empty or ending in '/'
+     * @param prefix Start of the entry names
+     * @param out_entries Sorted names without duplicates, subdirectories end in '/'
+     */
+    void GetEntries(const wxArrayString& roots, const wxString& subDir, const wxString& prefix,
+                    wxArrayString& out_entries) const;
+
+    /** @brief Stop the background thread, the entries stay */
+    void Shutdown();
+
+    /** @brief Read an index written by WriteOut(), the roots are queued for a refresh
+     *
+     * @return false if the file does not exist or has an unsupported format
+     */
+    bool ReadIn(const wxString& filename);
+    bool WriteOut(const wxString& filename) const;
+
+private:
+    friend class ClIncludeScanner;
+
+    struct Node
+    {
+        Node() : parent(-1), isDir(false) {}
+        wxString name;
+        int parent;
+        bool isDir;
+        std::vector<int> children; ///< Sorted on name
+    };
+
+    static void SplitPath(const wxString& path, std::vector<wxString>& out_components);
+    int FindChild(int parent, const wxString& name) const;
+    int FindNode(const std::vector<wxString>& components) const;
+    int AddChild(int parent, const wxString& name, bool isDir);
+    void RemoveNode(int nodeId);
+
+    /** Make the children of a directory node the given entries, called by the scanner.
+     *  Returns false when the index is full and not all entries were added */
+    bool SyncDirectory(const wxString& dirPath, const std::vector<wxString>& subDirs, const std::vector<wxString>& files);
+    /** Add or remove a single entry, called by the scanner */
+    void UpdateEntry(const wxString& dirPath, const wxString& name, bool isDir, bool exists);
+    bool PopPendingDir(wxString& out_dirPath);
+    bool IsStopRequested() const;
+    /** Start the background thread when it is not running, call with m_Mutex locked */
+    void StartScanner();
+
+    mutable wxMutex m_Mutex;
+    std::vector<Node> m_Nodes;      ///< Node 0 is the file system root
+    std::vector<int> m_FreeNodes;
+    size_t m_NodeCount;             ///< Number of nodes in use
+    std::map<wxString, wxString> m_Roots; ///< Normalized path to the path as it was added
+    std::deque<wxString> m_PendingDirs;
+    ClIncludeScanner* m_pScanner;
+    bool m_StopRequested;
+};
+
+#endif // INCLUDEINDEX_H
@@ -0,0 +1,248 @@
+#include "keymatcher.h"
+
+#include <algorithm>
+#include <cstring>
+#include <wx/string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define CL_KEYMATCHER_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+/// Bytes after the last key, so a vector load starting at any key character stays in the buffer
+static const size_t KeyPadding = 16;
+/// Patterns up to this length only match at word starts
+static const size_t MaxShortPatternLength = 3;
+/// Longer patterns are not matched at word starts, that search can backtrack
+static const size_t MaxWordStartPatternLength = 8;
+
+static inline char FoldChar(char c)
+{
+    return ((c >= 'A') && (c <= 'Z')) ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+static inline bool IsAlnum(char c)
+{
+    return ((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) || ((c >= '0') && (c <= '9'));
+}
+
+static inline bool IsUpper(char c)
+{
+    return (c >= 'A') && (c <= 'Z');
+}
+
+static inline bool IsLower(char c)
+{
+    return (c >= 'a') && (c <= 'z');
+}
+
+static inline uint64_t GetCharBit(char c)
+{
+    const unsigned char uc = static_cast<unsigned char>(c);
+    if ((uc >= 'a') && (uc <= 'z'))
+        return 1ULL << (uc - 'a');
+    if ((uc >= '0') && (uc <= '9'))
+        return 1ULL << (26 + uc - '0');
+    if (uc == '_')
+        return 1ULL << 36;
+    return 1ULL << (37 + uc % 27);
+}
+
+/** @brief Find the first occurrence of a character
+ *
+ * @return The position of the character, or end when it is not in [pos, end)
+ */
+static inline const char* FindChar(const char* pos, const char* end, char c)
+{
+#ifdef CL_KEYMATCHER_SSE2
+    const __m128i needle = _mm_set1_epi8(c);
+    for (; pos < end; pos += 16)
+    {
+        // Reading past end is fine, the key buffer is padded
+        const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos));
+        const unsigned bits = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle)));
+        if (bits)
+        {
+#ifdef _MSC_VER
+            unsigned long idx;
+            _BitScanForward(&idx, bits);
+#else
+            const unsigned idx = __builtin_ctz(bits);
+#endif
+            return (pos + idx < end) ? pos + idx : end;
+        }
+    }
+    return end;
+#else
+    const void* hit = memchr(pos, c, end - pos);
+    return hit ? static_cast<const char*>(hit) : end;
+#endif
+}
+
+/** @brief Match a pattern as a sequence of segments that each begin at a word start of the key
+ *
+ * Every pattern character either follows the previously matched character directly, or is at a word start.
+ */
+static bool MatchWordStarts(const char* key, const uint8_t* wordStarts, const char* keyPos, const char* keyEnd,
+                            const char* pattern, const char* patternEnd, bool contiguous)
+{
+    if (pattern == patternEnd)
+        return true;
+    if (contiguous && (keyPos < keyEnd) && (*keyPos == *pattern)
+        && MatchWordStarts(key, wordStarts, keyPos + 1, keyEnd, pattern + 1, patternEnd, true))
+    {
+        return true;
+    }
+    for (const char* hit = FindChar(keyPos, keyEnd, *pattern); hit < keyEnd; hit = FindChar(hit + 1, keyEnd, *pattern))
+    {
+        if (wordStarts[hit - key] && MatchWordStarts(key, wordStarts, hit + 1, keyEnd, pattern + 1, patternEnd, true))
+            return true;
+    }
+    return false;
+}
+
+ClKeyMatcher::ClKeyMatcher()
+{
+    Clear();
+}
+
+void ClKeyMatcher::Clear()
+{
+    m_Keys.assign(KeyPadding, '\0');
+    m_WordStarts.clear();
+    m_Offsets.assign(1, 0);
+    m_Masks.clear();
+}
+
+void ClKeyMatcher::Reserve(size_t keyCount, size_t totalLength)
+{
+    m_Keys.reserve(totalLength + KeyPadding);
+    m_WordStarts.reserve(totalLength);
+    m_Offsets.reserve(keyCount + 1);
+    m_Masks.reserve(keyCount);
+}
+
+void ClKeyMatcher::AddKey(const wxString& key)
+{
+    const wxCharBuffer utf8Key = key.ToUTF8();
+    AddFoldedKey(utf8Key.data(), strlen(utf8Key.data()));
+}
+
+void ClKeyMatcher::AddKey(const char* utf8Key)
+{
+    AddFoldedKey(utf8Key, strlen(utf8Key));
+}
+
+void ClKeyMatcher::AddFoldedKey(const char* utf8Key, size_t length)
+{
+    m_Keys.resize(m_Offsets.back());
+    uint64_t mask = 0;
+    for (size_t i = 0; i < length; ++i)
+    {
+        const char c = utf8Key[i];
+        bool isWordStart = false;
+        if (i == 0)
+            isWordStart = true;
+        else if (IsAlnum(c) && !IsAlnum(utf8Key[i - 1]) && !(utf8Key[i - 1] & 0x80))
+            isWordStart = true; // after an underscore
+        else if (IsUpper(c) && !IsUpper(utf8Key[i - 1]) && IsAlnum(utf8Key[i - 1]))
+            isWordStart = true; // camel hump
+        else if (IsUpper(c) && IsUpper(utf8Key[i - 1]) && (i + 1 < length) && IsLower(utf8Key[i + 1]))
+            isWordStart = true; // last capital of an acronym, like the W in HTMLWriter
+        const char folded = FoldChar(c);
+        m_Keys.push_back(folded);
+        m_WordStarts.push_back(isWordStart ? 1 : 0);
+        mask |= GetCharBit(folded);
+    }
+    m_Keys.append(KeyPadding, '\0');
+    m_Offsets.push_back(m_Offsets.back() + length);
+    m_Masks.push_back(mask);
+}
+
+bool ClKeyMatcher::IsShortPattern(const wxString& pattern)
+{
+    return pattern.Length() <= MaxShortPatternLength;
+}
+
+void ClKeyMatcher::Match(const wxString& pattern, std::vector< std::pair<size_t, int> >& out_matches) const
+{
+    out_matches.clear();
+    const size_t keyCount = GetCount();
+    if (pattern.IsEmpty())
+    {
+        out_matches.reserve(keyCount);
+        for (size_t keyIdx = 0; keyIdx < keyCount; ++keyIdx)
+            out_matches.push_back(std::make_pair(keyIdx, 1));
+        return;
+    }
+
+    const wxCharBuffer utf8Pattern = pattern.ToUTF8();
+    std::string folded(utf8Pattern.data());
+    uint64_t patternMask = 0;
+    for (std::string::iterator it = folded.begin(); it != folded.end(); ++it)
+    {
+        *it = FoldChar(*it);
+        patternMask |= GetCharBit(*it);
+    }
+    const char* patternBegin = folded.data();
+    const char* patternEnd = patternBegin + folded.length();
+    const size_t patternLen = folded.length();
+    const bool isShort = IsShortPattern(pattern);
+    const bool tryWordStarts = isShort || (patternLen <= MaxWordStartPatternLength);
+
+    const char* keys = m_Keys.data();
+    const uint8_t* allWordStarts = m_WordStarts.empty() ? nullptr : &m_WordStarts[0];
+    for (size_t keyIdx = 0; keyIdx < keyCount; ++keyIdx)
+    {
+        if ((m_Masks[keyIdx] & patternMask) != patternMask)
+            continue;
+        const size_t keyLen = m_Offsets[keyIdx + 1] - m_Offsets[keyIdx];
+        if (keyLen < patternLen)
+            continue;
+        const char* key = keys + m_Offsets[keyIdx];
+        const char* keyEnd = key + keyLen;
+        const uint8_t* wordStarts = allWordStarts + m_Offsets[keyIdx];
+        const int lengthPenalty = static_cast<int>(std::min<size_t>(keyLen, 999));
+
+        // Best first: prefix, word starts, substring, subsequence. Shorter keys and earlier matches rank higher
+        int score = 0;
+        if (memcmp(key, patternBegin, patternLen) == 0)
+            score = 4000 - lengthPenalty;
+        else if (tryWordStarts && MatchWordStarts(key, wordStarts, key, keyEnd, patternBegin, patternEnd, false))
+            score = 3000 - lengthPenalty;
+        else if (!isShort)
+        {
+            for (const char* hit = FindChar(key, keyEnd, *patternBegin); hit + patternLen <= keyEnd;
+                 hit = FindChar(hit + 1, keyEnd, *patternBegin))
+            {
+                if (memcmp(hit, patternBegin, patternLen) == 0)
+                {
+                    score = 2000 - static_cast<int>(std::min<size_t>(hit - key, 999));
+                    break;
+                }
+            }
+            if (score == 0)
+            {
+                const char* pos = key;
+                const char* first = keyEnd;
+                for (const char* patPos = patternBegin; (patPos < patternEnd) && (pos < keyEnd); ++patPos)
+                {
+                    pos = FindChar(pos, keyEnd, *patPos);
+                    if (pos < keyEnd)
+                    {
+                        if (patPos == patternBegin)
+                            first = pos;
+                        ++pos;
+                        if (patPos + 1 == patternEnd)
+                            score = 1000 - static_cast<int>(std::min<size_t>((pos - first) - patternLen, 999));
+                    }
+                }
+            }
+        }
+        if (score > 0)
+            out_matches.push_back(std::make_pair(keyIdx, score));
+    }
+}
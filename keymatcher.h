@@ -0,0 +1,53 @@
+#ifndef KEYMATCHER_H
+#define KEYMATCHER_H
+
+#include <string>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+class wxString;
+
+/** @brief Matches a list of identifiers against a typed pattern, for filtering completion lists
+ *
+ * The keys are folded to lower case ASCII once and stored back to back, every keystroke only scans
+ * them. Short patterns (up to 3 characters) match at the start of a key or at the start of its words
+ * ("gv" matches "GetValue" and "get_value"), longer patterns match any subsequence of a key. Extending
+ * a pattern within the short or within the long patterns never adds matches. Going from a short to a long
+ * pattern can, so results may only be re-filtered with the longer pattern when IsShortPattern() gives the
+ * same answer for both.
+ */
+class ClKeyMatcher
+{
+public:
+    ClKeyMatcher();
+
+    void Clear();
+    void Reserve(size_t keyCount, size_t totalLength);
+    void AddKey(const wxString& key);
+    void AddKey(const char* utf8Key);
+    size_t GetCount() const
+    {
+        return m_Offsets.size() - 1;
+    }
+
+    /// Short patterns only match at word starts, see the class description
+    static bool IsShortPattern(const wxString& pattern);
+
+    /** @brief Match all keys against a pattern
+     *
+     * @param pattern The typed text, matched case insensitively. An empty pattern matches all keys
+     * @param out_matches (key index, score) pairs in key order, a higher score is a better match
+     */
+    void Match(const wxString& pattern, std::vector< std::pair<size_t, int> >& out_matches) const;
+
+private:
+    void AddFoldedKey(const char* utf8Key, size_t length);
+
+    std::string m_Keys;                 ///< Folded keys back to back, padded for vector loads
+    std::vector<uint8_t> m_WordStarts;  ///< Per character of m_Keys: 1 when a word starts there
+    std::vector<uint32_t> m_Offsets;    ///< Start of key i in m_Keys, with an end marker
+    std::vector<uint64_t> m_Masks;      ///< Set of the characters of a key
+};
+
+#endif // KEYMATCHER_H
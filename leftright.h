@@ -0,0 +1,120 @@
+#ifndef LEFTRIGHT_H
+#define LEFTRIGHT_H
+
+/*
+ * Left-right concurrency control: two copies of a data structure, readers use one of them
+ * without taking any lock while the single writer modifies the other one. After a batch of
+ * modifications the writer publishes its copy, waits until the readers of the old copy have
+ * left and then applies the same modifications to the old copy.
+ *
+ * Readers never block and never see a partial modification. The modifications must be
+ * deterministic, so both copies end up identical (including any ids they hand out).
+ */
+
+#include <atomic>
+#include <wx/thread.h>
+
+template<typename _TpInstance>
+class ClLeftRight
+{
+public:
+    /** @brief Constructor
+     *
+     * @param pLeft First copy, ownership is taken
+     * @param pRight Second copy, must be identical to the first one. Ownership is taken
+     *
+     */
+    ClLeftRight(_TpInstance* pLeft, _TpInstance* pRight) :
+        m_ReadIdx(0),
+        m_VersionIdx(0)
+    {
+        m_pInstances[0] = pLeft;
+        m_pInstances[1] = pRight;
+        m_ReaderCount[0] = 0;
+        m_ReaderCount[1] = 0;
+    }
+    ~ClLeftRight()
+    {
+        delete m_pInstances[0];
+        delete m_pInstances[1];
+    }
+
+    /** @brief Scoped read access to the published copy
+     *
+     * The copy stays valid and unmodified for the lifetime of the reader. Keep readers short, the writer waits for them.
+     */
+    class Reader
+    {
+    public:
+        Reader(const ClLeftRight& leftRight) :
+            m_LeftRight(leftRight),
+            m_VersionIdx(leftRight.Arrive()),
+            m_pInstance(leftRight.m_pInstances[leftRight.m_ReadIdx.load()]) {}
+        ~Reader()
+        {
+            m_LeftRight.Depart(m_VersionIdx);
+        }
+        const _TpInstance& operator*() const
+        {
+            return *m_pInstance;
+        }
+        const _TpInstance* operator->() const
+        {
+            return m_pInstance;
+        }
+    private:
+        Reader(const Reader&);
+        Reader& operator=(const Reader&);
+
+        const ClLeftRight& m_LeftRight;
+        const int m_VersionIdx;
+        const _TpInstance* m_pInstance;
+    };
+
+    /** @brief Get the copy that is not visible to readers. Only for the writer, writers must be serialized by the caller
+     */
+    _TpInstance& GetWriteInstance()
+    {
+        return *m_pInstances[1 - m_ReadIdx.load()];
+    }
+
+    /** @brief Make the write copy visible to readers. Only for the writer
+     *
+     * On return, no reader uses the other copy anymore and GetWriteInstance() returns it, so the
+     * modifications can be applied to it.
+     */
+    void Publish()
+    {
+        m_ReadIdx.store(1 - m_ReadIdx.load());
+        const int prevVersionIdx = m_VersionIdx.load();
+        const int nextVersionIdx = 1 - prevVersionIdx;
+        // Readers that arrived on the next version before the previous publish may still read the old copy
+        while (m_ReaderCount[nextVersionIdx].load() != 0)
+            wxThread::Yield();
+        m_VersionIdx.store(nextVersionIdx);
+        while (m_ReaderCount[prevVersionIdx].load() != 0)
+            wxThread::Yield();
+    }
+
+private:
+    ClLeftRight(const ClLeftRight&);
+    ClLeftRight& operator=(const ClLeftRight&);
+
+    int Arrive() const
+    {
+        const int versionIdx = m_VersionIdx.load();
+        m_ReaderCount[versionIdx].fetch_add(1);
+        return versionIdx;
+    }
+    void Depart(int versionIdx) const
+    {
+        m_ReaderCount[versionIdx].fetch_sub(1);
+    }
+
+    _TpInstance* m_pInstances[2];
+    std::atomic<int> m_ReadIdx;       ///< The copy readers use
+    std::atomic<int> m_VersionIdx;    ///< The reader counter new readers register on
+    mutable std::atomic<int> m_ReaderCount[2];
+};
+
+#endif // LEFTRIGHT_H
@@ -10,548 +10,1839 @@
 
 #include <wx/filename.h>
 #include <wx/string.h>
-#include <iostream>
-#include <wx/mstream.h>
+#include <wx/file.h>
+#include <wx/filefn.h>
+#include <wx/hashmap.h>
+#include <algorithm>
+#include <map>
+#include <queue>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef __WXMSW__
+#include <wx/msw/wrapwin.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif // __WXMSW__
 
 #include "treemap.h"
+#include "leftright.h"
 #include "cclogger.h"
 
+/*
+ * On-disk format of the token database. Everything is stored in native byte order,
+ * the header records it so a file from another platform is simply rejected.
+ *
+ * ClTokenDbHeader
+ * ClTokenDbSection[sectionCount]
+ * sections, each starting at an 8 byte aligned offset:
+ *   strings:   UTF-8 zero terminated strings, referenced by byte offset. Offset 0 is the empty string
+ *   files:     ClTokenDbFileRecord per file, the index is the file id within this file
+ *   tokens:    ClTokenDbTokenRecord per token, sorted on identifier
+ *   references:     ClTokenDatabase::ReferenceRecord per reference, grouped by file, sorted on USR hash and offset
+ *   referenceIndex: ClTokenDbRange of reference records per file record
+ *   relations:      ClTokenDatabase::RelationRecord per base class or override edge, grouped by the file of the derived declaration, sorted
+ *   relationIndex:  ClTokenDbRange of relation records per file record
+ */
+enum ClTokenDbSectionType
+{
+    ClTokenDbSection_strings = 1,
+    ClTokenDbSection_files,
+    ClTokenDbSection_tokens,
+    ClTokenDbSection_references,
+    ClTokenDbSection_referenceIndex,
+    ClTokenDbSection_relations,
+    ClTokenDbSection_relationIndex
+};
+
 enum
 {
-    ClTokenPacketType_filenames = 1<<0,
-    ClTokenPacketType_tokens = 1<<1
+    ClTokenDbFileFlag_timestamp = 1<<0
+};
+
+static const uint32_t ClTokenDbVersion = 6;
+static const uint32_t ClTokenDbByteOrder = 0x01020304;
+
+struct ClTokenDbHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t sectionCount;
+};
+
+struct ClTokenDbSection
+{
+    uint32_t type;
+    uint32_t count;     ///< Number of records
+    uint64_t offset;    ///< From the start of the file
+    uint64_t size;      ///< In bytes
+};
+
+struct ClTokenDbFileRecord
+{
+    uint32_t nameOffset;
+    uint32_t flags;
+    int64_t timestamp;
+};
+
+struct ClTokenDbTokenRecord
+{
+    uint64_t tokenHash;
+    uint32_t identifierOffset;
+    int32_t fileId;
+    uint32_t line;
+    uint32_t column;
+    int32_t tokenType;
+    uint32_t reserved;
+};
+
+struct ClTokenDbRange
+{
+    uint32_t first;
+    uint32_t count;
+};
+
+/** @brief A reference as stored in the token database, in memory and on disk. The file is implied by the table it is in
+ */
+struct ClTokenDatabase::ReferenceRecord
+{
+    uint64_t usrHash;
+    uint32_t offset;
+    uint32_t line;
+    uint32_t column;
+    int32_t cursorKind;
+
+    bool operator<(const ReferenceRecord& other) const
+    {
+        if (usrHash != other.usrHash)
+            return usrHash < other.usrHash;
+        return offset < other.offset;
+    }
+    bool operator==(const ReferenceRecord& other) const
+    {
+        return (usrHash == other.usrHash) && (offset == other.offset) && (cursorKind == other.cursorKind);
+    }
+    /// For searching a table on USR hash only
+    struct UsrLess
+    {
+        bool operator()(const ReferenceRecord& a, uint64_t b) const
+        {
+            return a.usrHash < b;
+        }
+        bool operator()(uint64_t a, const ReferenceRecord& b) const
+        {
+            return a < b.usrHash;
+        }
+    };
+};
+
+/** @brief A base class or override edge as stored in the token database, in memory and on disk. The file is implied by the table it is in
+ */
+struct ClTokenDatabase::RelationRecord
+{
+    uint64_t fromHash;
+    uint64_t toHash;
+    uint32_t line;
+    uint32_t column;
+    int32_t kind;
+    uint32_t reserved;
+
+    bool operator<(const RelationRecord& other) const
+    {
+        if (fromHash != other.fromHash)
+            return fromHash < other.fromHash;
+        if (toHash != other.toHash)
+            return toHash < other.toHash;
+        return kind < other.kind;
+    }
+    bool operator==(const RelationRecord& other) const
+    {
+        return (fromHash == other.fromHash) && (toHash == other.toHash) && (kind == other.kind);
+    }
 };
 
-/** @brief Write an int to an output stream
+/** @brief Read-only memory mapping of a whole file
+ */
+class ClMappedFile
+{
+public:
+    ClMappedFile() :
+        m_pData(nullptr),
+        m_Size(0) {}
+    ~ClMappedFile()
+    {
+        Close();
+    }
+
+    bool Open(const wxString& filename);
+    void Close();
+
+    const char* GetData() const
+    {
+        return m_pData;
+    }
+    size_t GetSize() const
+    {
+        return m_Size;
+    }
+private:
+    ClMappedFile(const ClMappedFile&);
+    ClMappedFile& operator=(const ClMappedFile&);
+
+    const char* m_pData;
+    size_t m_Size;
+};
+
+/** @brief Map a file in memory
  *
- * @param out wxOutputStream&
- * @param val const int
- * @return bool
+ * @param filename The file to map
+ * @return true if the file was mapped, false if it does not exist, is empty or could not be mapped
  *
  */
-static bool WriteInt( wxOutputStream& out, const int val )
+bool ClMappedFile::Open( const wxString& filename )
 {
-    out.Write((const void*)&val, sizeof(val));
+    Close();
+#ifdef __WXMSW__
+    HANDLE hFile = ::CreateFileW(filename.wc_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER size;
+    if ((!::GetFileSizeEx(hFile, &size)) || (size.QuadPart == 0) || ((unsigned long long)size.QuadPart > (size_t)-1))
+    {
+        ::CloseHandle(hFile);
+        return false;
+    }
+    HANDLE hMapping = ::CreateFileMappingW(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    ::CloseHandle(hFile);
+    if (!hMapping)
+        return false;
+    void* pData = ::MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+    ::CloseHandle(hMapping); // The view keeps the mapping alive
+    if (!pData)
+        return false;
+    m_pData = static_cast<const char*>(pData);
+    m_Size = (size_t)size.QuadPart;
+#else
+    int fd = ::open(filename.fn_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if ((::fstat(fd, &st) != 0) || (st.st_size == 0))
+    {
+        ::close(fd);
+        return false;
+    }
+    void* pData = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd); // The mapping keeps the file alive
+    if (pData == MAP_FAILED)
+        return false;
+    m_pData = static_cast<const char*>(pData);
+    m_Size = st.st_size;
+#endif // __WXMSW__
     return true;
 }
 
-/** @brief Write a long long to an outputstream
+void ClMappedFile::Close()
+{
+    if (!m_pData)
+        return;
+#ifdef __WXMSW__
+    ::UnmapViewOfFile(m_pData);
+#else
+    ::munmap(const_cast<char*>(m_pData), m_Size);
+#endif // __WXMSW__
+    m_pData = nullptr;
+    m_Size = 0;
+}
+
+/** @brief Builder of the string table section, identical strings are stored once
+ */
+class ClStringTableBuilder
+{
+public:
+    ClStringTableBuilder() :
+        m_Data(1, '\0') {}
+
+    /** @brief Add a string to the table
+     *
+     * @param str The string to add
+     * @return Offset of the string in the table
+     *
+     */
+    uint32_t Add(const wxString& str)
+    {
+        std::map<wxString, uint32_t>::const_iterator it = m_Offsets.find(str);
+        if (it != m_Offsets.end())
+            return it->second;
+        const wxCharBuffer buffer = str.utf8_str();
+        const char* pStr = buffer.data();
+        uint32_t offset = m_Data.size();
+        m_Data.insert(m_Data.end(), pStr, pStr + strlen(pStr) + 1);
+        m_Offsets.insert(std::make_pair(str, offset));
+        return offset;
+    }
+    const std::vector<char>& GetData() const
+    {
+        return m_Data;
+    }
+private:
+    std::vector<char> m_Data;
+    std::map<wxString, uint32_t> m_Offsets;
+};
+
+/** @brief Order token records on identifier
+ */
+struct TokenNameLess
+{
+    TokenNameLess(const char* pStrings) :
+        m_pStrings(pStrings) {}
+    bool operator()(const ClTokenDbTokenRecord& a, const ClTokenDbTokenRecord& b) const
+    {
+        return strcmp(m_pStrings + a.identifierOffset, m_pStrings + b.identifierOffset) < 0;
+    }
+    const char* m_pStrings;
+};
+
+/** @brief Append the records of a section to the file data and fill its section table entry
  *
- * @param out wxOutputStream&
- * @param val const longlong
- * @return bool
+ * @param data The file data
+ * @param sectionIdx Index of the section in the section table
+ * @param type Section type
+ * @param records The records to append
+ * @return void
  *
  */
-static bool WriteLongLong( wxOutputStream& out, const long long val )
+template<typename _TpRecord>
+static void AppendSection( std::vector<char>& data, int sectionIdx, ClTokenDbSectionType type, const std::vector<_TpRecord>& records )
 {
-    out.Write((const void*)&val, sizeof(val));
-    return true;
+    data.resize((data.size() + 7) & ~(size_t)7, '\0');
+    ClTokenDbSection section;
+    section.type = type;
+    section.count = records.size();
+    section.offset = data.size();
+    section.size = records.size() * sizeof(_TpRecord);
+    memcpy(&data[sizeof(ClTokenDbHeader) + sectionIdx * sizeof(ClTokenDbSection)], &section, sizeof(section));
+    if (!records.empty())
+    {
+        const char* pRecords = reinterpret_cast<const char*>(&records[0]);
+        data.insert(data.end(), pRecords, pRecords + section.size);
+    }
 }
 
-/** @brief Write a string to an output stream
+/** @brief Find a section in a mapped token database file
  *
- * @param out wxOutputStream&
- * @param str const char*
- * @return bool
+ * @param file The mapped file
+ * @param type Section type
+ * @param out_pRecords Returns the first record
+ * @param out_count Returns the number of records
+ * @return true if the section is present and consistent, false otherwise
  *
  */
-static bool WriteString( wxOutputStream& out, const char* str )
+template<typename _TpRecord>
+static bool GetSection( const ClMappedFile& file, ClTokenDbSectionType type, const _TpRecord*& out_pRecords, uint32_t& out_count )
 {
-    int len = 0;
-
-    if (str != nullptr)
-        len = strlen(str); // Need size in amount of bytes
-    if (!WriteInt(out, len))
-        return false;
-    if (len > 0)
-        out.Write((const void*)str, len);
-    return true;
+    const ClTokenDbHeader* pHeader = reinterpret_cast<const ClTokenDbHeader*>(file.GetData());
+    const ClTokenDbSection* pSections = reinterpret_cast<const ClTokenDbSection*>(file.GetData() + sizeof(ClTokenDbHeader));
+    for (uint32_t i = 0; i < pHeader->sectionCount; ++i)
+    {
+        const ClTokenDbSection& section = pSections[i];
+        if (section.type != (uint32_t)type)
+            continue;
+        if (   (section.offset % 8 != 0)
+            || (section.offset > file.GetSize())
+            || (section.size > file.GetSize() - section.offset)
+            || (section.size != (uint64_t)section.count * sizeof(_TpRecord)) )
+            return false;
+        out_pRecords = reinterpret_cast<const _TpRecord*>(file.GetData() + section.offset);
+        out_count = section.count;
+        return true;
+    }
+    return false;
 }
 
-/** @brief Read an int from an input stream
+/** @brief Pool of unique identifiers, referenced by id from the token storage
  *
- * @param in wxInputStream&
- * @param out_Int int&
- * @return bool
+ * Each identifier is stored once, its id is the index in the pool. Ids only change when the pool is
+ * compacted, which increments the generation of the pool.
+ */
+class ClIdentifierPool
+{
+public:
+    ClIdentifierPool() :
+        m_Generation(0) {}
+
+    /** @brief Get the id of an identifier, adding it to the pool when it is not present yet
+     *
+     * @param identifier The identifier
+     * @return uint32_t Its id
+     *
+     */
+    uint32_t Intern(const wxString& identifier)
+    {
+        int id = Find(identifier);
+        if (id != wxNOT_FOUND)
+            return id;
+        // Deep copy, the pool of the other database copy must not share the string buffer
+        m_Identifiers.push_back(wxString(identifier.c_str()));
+        m_Masks.push_back(ClFuzzyMatcher::GetMask(identifier));
+        return m_Index.Insert(identifier, m_Identifiers.size() - 1);
+    }
+    /// Returns the id of an identifier, or wxNOT_FOUND when it is not in the pool
+    int Find(const wxString& identifier) const
+    {
+        std::vector<int> ids = m_Index.GetIdSet(identifier);
+        if (ids.empty())
+            return wxNOT_FOUND;
+        return ids.front();
+    }
+    const wxString& Get(uint32_t id) const
+    {
+        return m_Identifiers[id];
+    }
+    /// Character mask of an identifier, see ClFuzzyMatcher::GetMask()
+    unsigned long long GetMask(uint32_t id) const
+    {
+        return m_Masks[id];
+    }
+    size_t GetCount() const
+    {
+        return m_Identifiers.size();
+    }
+    /// Incremented each time the ids are renumbered
+    unsigned long GetGeneration() const
+    {
+        return m_Generation;
+    }
+    std::vector<int> GetIdSetByPrefix(const wxString& prefix, size_t maxCount) const
+    {
+        return m_Index.GetIdSetByPrefix(prefix, maxCount);
+    }
+    void GetFuzzyIdSet(const wxString& pattern, size_t maxCount, std::vector< std::pair<int, int> >& out_matches) const
+    {
+        m_Index.GetFuzzyIdSet(pattern, maxCount, out_matches);
+    }
+    void Shrink()
+    {
+        m_Index.Shrink();
+#if __cplusplus >= 201103L
+        m_Identifiers.shrink_to_fit();
+        m_Masks.shrink_to_fit();
+#else
+        std::vector<wxString>(m_Identifiers).swap(m_Identifiers);
+        std::vector<unsigned long long>(m_Masks).swap(m_Masks);
+#endif
+    }
+    void Clear()
+    {
+        ClTreeMap().Swap(m_Index);
+        m_Identifiers.clear();
+        m_Masks.clear();
+        m_Generation++;
+    }
+
+    /** @brief Drop the identifiers that are no longer used and rebuild the index
+     *
+     * @param used Indexed by identifier id, true for the identifiers to keep
+     * @param out_idMap Receives the new id of every old id, or -1 for the dropped identifiers
+     * @return void
+     *
+     * The relative order of the identifiers is kept.
+     */
+    void Compact(const std::vector<bool>& used, std::vector<int>& out_idMap)
+    {
+        out_idMap.assign(m_Identifiers.size(), -1);
+        ClTreeMap index;
+        int newId = 0;
+        for (int id = 0; id < (int)m_Identifiers.size(); ++id)
+        {
+            if ((id >= (int)used.size()) || (!used[id]))
+                continue;
+            if (newId != id)
+            {
+                m_Identifiers[newId].swap(m_Identifiers[id]);
+                m_Masks[newId] = m_Masks[id];
+            }
+            index.Insert(m_Identifiers[newId], newId);
+            out_idMap[id] = newId++;
+        }
+        m_Identifiers.resize(newId);
+        m_Masks.resize(newId);
+        m_Index.Swap(index);
+        m_Generation++;
+        Shrink();
+    }
+private:
+    ClTreeMap m_Index;
+    std::vector<wxString> m_Identifiers;
+    std::vector<unsigned long long> m_Masks;
+    unsigned long m_Generation;
+};
+
+/** @brief Token storage as parallel arrays of packed fields
  *
+ * The identifier is stored as an id in the identifier pool of the database, lookups on identifier go
+ * through the pool and then through the token ids kept per identifier id. Removed slots are reused by the next insert.
  */
-static bool ReadInt( wxInputStream& in, int& out_Int )
+class ClTokenStore
 {
-    int val = 0;
-    if (!in.CanRead())
-        return false;
-    in.Read(&val, sizeof(val));
-    out_Int = val;
+public:
+    ClTokenStore() {}
+
+    /** @brief Insert a token
+     *
+     * @param token The token
+     * @param identifierId Id of token.identifier in the identifier pool
+     * @return int The id of the token
+     *
+     */
+    int Insert(const ClAbstractToken& token, uint32_t identifierId)
+    {
+        int id;
+        if (!m_FreeSlots.empty())
+        {
+            id = m_FreeSlots.back();
+            m_FreeSlots.pop_back();
+            m_Alive[id] = true;
+        }
+        else
+        {
+            id = m_IdentifierIds.size();
+            m_IdentifierIds.push_back(0);
+            m_FileIds.push_back(0);
+            m_Lines.push_back(0);
+            m_TypeColumns.push_back(0);
+            m_Hashes.push_back(0);
+            m_Alive.push_back(true);
+        }
+        m_IdentifierIds[id] = identifierId;
+        m_FileIds[id] = token.fileId;
+        m_Lines[id] = token.location.line;
+        m_TypeColumns[id] = PackTypeColumn(token.tokenType, token.location.column);
+        m_Hashes[id] = token.tokenHash;
+        if (identifierId >= m_IdentifierTokens.size())
+            m_IdentifierTokens.resize(identifierId + 1);
+        std::vector<int>& ids = m_IdentifierTokens[identifierId];
+        ids.insert(std::lower_bound(ids.begin(), ids.end(), id), id);
+        return id;
+    }
 
-    return true;
-}
+    /** @brief Remove a token, its slot is put on the free-list
+     *
+     * @param id The token id
+     * @return void
+     *
+     */
+    void Remove(int id)
+    {
+        if (!HasValue(id))
+            return;
+        std::vector<int>& ids = m_IdentifierTokens[m_IdentifierIds[id]];
+        ids.erase(std::lower_bound(ids.begin(), ids.end(), id));
+        m_Alive[id] = false;
+        m_FreeSlots.push_back(id);
+    }
 
-/** @brief Read a long long from an input stream
+    void Shrink()
+    {
+#if __cplusplus >= 201103L
+        m_IdentifierIds.shrink_to_fit();
+        m_FileIds.shrink_to_fit();
+        m_Lines.shrink_to_fit();
+        m_TypeColumns.shrink_to_fit();
+        m_Hashes.shrink_to_fit();
+        m_FreeSlots.shrink_to_fit();
+        m_IdentifierTokens.shrink_to_fit();
+#else
+        std::vector<uint32_t>(m_IdentifierIds).swap(m_IdentifierIds);
+        std::vector<int32_t>(m_FileIds).swap(m_FileIds);
+        std::vector<uint32_t>(m_Lines).swap(m_Lines);
+        std::vector<uint32_t>(m_TypeColumns).swap(m_TypeColumns);
+        std::vector<uint64_t>(m_Hashes).swap(m_Hashes);
+        std::vector<int>(m_FreeSlots).swap(m_FreeSlots);
+        std::vector< std::vector<int> >(m_IdentifierTokens).swap(m_IdentifierTokens);
+#endif
+    }
+
+    /** @brief Move all live tokens to the front and drop the free slots, keeping their relative order
+     *
+     * @param out_idMap Receives the new id of every old id, or -1 for removed slots
+     * @return void
+     *
+     */
+    void Compact(std::vector<int>& out_idMap)
+    {
+        out_idMap.assign(m_Alive.size(), -1);
+        int newId = 0;
+        for (int id = 0; id < (int)m_Alive.size(); ++id)
+        {
+            if (!m_Alive[id])
+                continue;
+            if (newId != id)
+            {
+                m_IdentifierIds[newId] = m_IdentifierIds[id];
+                m_FileIds[newId] = m_FileIds[id];
+                m_Lines[newId] = m_Lines[id];
+                m_TypeColumns[newId] = m_TypeColumns[id];
+                m_Hashes[newId] = m_Hashes[id];
+            }
+            out_idMap[id] = newId++;
+        }
+        m_IdentifierIds.resize(newId);
+        m_FileIds.resize(newId);
+        m_Lines.resize(newId);
+        m_TypeColumns.resize(newId);
+        m_Hashes.resize(newId);
+        m_Alive.assign(newId, true);
+        m_FreeSlots.clear();
+        for (std::vector< std::vector<int> >::iterator it = m_IdentifierTokens.begin(); it != m_IdentifierTokens.end(); ++it)
+        {
+            // Removed tokens are no longer listed, and the new ids keep the order of the old ones
+            for (std::vector<int>::iterator idIt = it->begin(); idIt != it->end(); ++idIt)
+                *idIt = out_idMap[*idIt];
+        }
+    }
+
+    /** @brief Renumber the identifier ids after the identifier pool was compacted
+     *
+     * @param identifierMap The new id of every old identifier id, see ClIdentifierPool::Compact()
+     * @return void
+     *
+     */
+    void RemapIdentifiers(const std::vector<int>& identifierMap)
+    {
+        for (size_t id = 0; id < m_IdentifierIds.size(); ++id)
+        {
+            if (m_Alive[id])
+                m_IdentifierIds[id] = identifierMap[m_IdentifierIds[id]];
+        }
+        std::vector< std::vector<int> > identifierTokens;
+        for (size_t identifierId = 0; identifierId < m_IdentifierTokens.size(); ++identifierId)
+        {
+            if (m_IdentifierTokens[identifierId].empty())
+                continue;
+            const size_t newIdentifierId = identifierMap[identifierId];
+            if (newIdentifierId >= identifierTokens.size())
+                identifierTokens.resize(newIdentifierId + 1);
+            identifierTokens[newIdentifierId].swap(m_IdentifierTokens[identifierId]);
+        }
+        m_IdentifierTokens.swap(identifierTokens);
+    }
+
+    /// True when a live token has this identifier
+    bool HasIdentifier(uint32_t identifierId) const
+    {
+        return (identifierId < m_IdentifierTokens.size()) && (!m_IdentifierTokens[identifierId].empty());
+    }
+
+    /** @brief Move a token
+     *
+     * @param id The token id
+     * @param location The new location
+     * @return bool true when the location changed
+     *
+     */
+    bool SetLocation(int id, const ClTokenPosition& location)
+    {
+        const uint32_t typeColumn = PackTypeColumn(GetType(id), location.column);
+        if ((m_Lines[id] == location.line) && (m_TypeColumns[id] == typeColumn))
+            return false;
+        m_Lines[id] = location.line;
+        m_TypeColumns[id] = typeColumn;
+        return true;
+    }
+
+    bool HasValue(int id) const
+    {
+        if ((id < 0) || (id >= (int)m_Alive.size()))
+            return false;
+        return m_Alive[id];
+    }
+    // number of slots, including the removed ones
+    int GetCount() const
+    {
+        return m_Alive.size();
+    }
+    int GetFreeCount() const
+    {
+        return m_FreeSlots.size();
+    }
+
+    /// Sorted ids of the live tokens with an identifier
+    std::vector<int> GetIdSet(uint32_t identifierId) const
+    {
+        if (identifierId >= m_IdentifierTokens.size())
+            return std::vector<int>();
+        return m_IdentifierTokens[identifierId];
+    }
+
+    uint32_t GetIdentifierId(int id) const
+    {
+        return m_IdentifierIds[id];
+    }
+    ClFileId GetFileId(int id) const
+    {
+        return m_FileIds[id];
+    }
+    unsigned GetLine(int id) const
+    {
+        return m_Lines[id];
+    }
+    ClTokenType GetType(int id) const
+    {
+        return (ClTokenType)(m_TypeColumns[id] >> ColumnBits);
+    }
+    unsigned GetColumn(int id) const
+    {
+        return m_TypeColumns[id] & ColumnMask;
+    }
+    ClUSRHash GetHash(int id) const
+    {
+        return m_Hashes[id];
+    }
+private:
+    // The token type needs 10 bits, columns beyond 1M are clamped
+    enum
+    {
+        ColumnBits = 20,
+        ColumnMask = (1u << ColumnBits) - 1
+    };
+
+    static uint32_t PackTypeColumn(ClTokenType tokenType, unsigned column)
+    {
+        return ((uint32_t)tokenType << ColumnBits) | std::min<uint32_t>(column, (uint32_t)ColumnMask);
+    }
+
+    std::vector< std::vector<int> > m_IdentifierTokens; ///< Indexed by identifier id
+    std::vector<uint32_t> m_IdentifierIds;
+    std::vector<int32_t> m_FileIds;
+    std::vector<uint32_t> m_Lines;
+    std::vector<uint32_t> m_TypeColumns; ///< Token type in the high bits, column in the low ColumnBits bits
+    std::vector<uint64_t> m_Hashes;
+    std::vector<bool> m_Alive;
+    std::vector<int> m_FreeSlots;
+};
+
+/** @brief One copy of the token database, see ClLeftRight
  *
- * @param in wxInputStream&
- * @param out_LongLong long long&
- * @return bool
+ * Each copy has its own identifier pool. Both copies receive the same modifications in the same
+ * order, so they hand out the same token ids and identifier ids.
+ */
+struct ClTokenDatabase::Instance
+{
+    Instance() :
+        pTokens(new ClTokenStore()),
+        pFileTokens(new ClTreeMap()),
+        referenceCount(0) {}
+    Instance(const Instance& other) :
+        identifiers(other.identifiers),
+        pTokens(new ClTokenStore(*other.pTokens)),
+        pFileTokens(new ClTreeMap(*other.pFileTokens)),
+        fileReferences(other.fileReferences),
+        referenceCount(other.referenceCount),
+        fileRelations(other.fileRelations),
+        outgoingRelations(other.outgoingRelations),
+        incomingRelations(other.incomingRelations) {}
+    ~Instance()
+    {
+        delete pTokens;
+        delete pFileTokens;
+    }
+    void Clear()
+    {
+        delete pTokens;
+        delete pFileTokens;
+        pTokens = new ClTokenStore();
+        pFileTokens = new ClTreeMap();
+        identifiers.Clear();
+        fileReferences.clear();
+        referenceCount = 0;
+        fileRelations.clear();
+        outgoingRelations.clear();
+        incomingRelations.clear();
+    }
+
+    /// One end of a relation, the other end is the key in the adjacency list
+    struct RelationEdge
+    {
+        uint64_t usrHash;
+        ClFileId fileId;
+        uint32_t line;
+        uint32_t column;
+        int32_t kind;
+    };
+    typedef std::multimap<uint64_t, RelationEdge> RelationGraph;
+
+    ClIdentifierPool identifiers;
+    ClTokenStore* pTokens;
+    ClTreeMap* pFileTokens;
+    std::vector<ReferenceTable> fileReferences; ///< Indexed by file id
+    unsigned long referenceCount;
+    std::map<ClFileId, RelationTable> fileRelations;
+    RelationGraph outgoingRelations; ///< Derived declaration to its bases or overridden methods
+    RelationGraph incomingRelations; ///< Base declaration to its derived classes or overriding methods
+private:
+    Instance& operator=(const Instance&);
+};
+
+WX_DECLARE_STRING_HASH_MAP(ClFileId, ClFilenameIdMap);
+
+/** @brief One copy of the filename database, see ClLeftRight
  *
+ * Filenames are never removed, the file id is the index in the entries.
  */
-static bool ReadLongLong( wxInputStream& in, long long& out_LongLong )
+struct ClFilenameDatabase::Instance
 {
-    long long val = 0;
-    if (!in.CanRead())
-        return false;
-    in.Read(&val, sizeof(val));
-    out_LongLong = val;
+    std::vector<ClFilenameEntry> entries;
+    ClFilenameIdMap normalizedIds; ///< Normalized path to file id
+    ClFilenameIdMap spelledIds;    ///< Absolute path as it was passed to GetFilenameId() to file id, skips the normalization
+};
 
-    return true;
+/** @brief Filename database constructor
+ */
+ClFilenameDatabase::ClFilenameDatabase() :
+    m_pInstances(new ClLeftRight<Instance>(new Instance(), new Instance()))
+{
 }
 
-/** @brief Read a string from an input stream
+ClFilenameDatabase::~ClFilenameDatabase()
+{
+    delete m_pInstances;
+}
+
+/** @brief Get a filename id from a filename. Creates a new ID if the filename was not known yet.
  *
- * @param in wxInputStream&
- * @param out_String wxString&
- * @return bool
+ * @param filename const wxString&
+ * @return ClFileId
  *
+ * Known filenames are looked up without locking, only adding a new filename or spelling is serialized.
+ * An absolute filename that was seen before is resolved with a single hash lookup, without normalizing it.
  */
-static bool ReadString( wxInputStream& in, wxString& out_String )
+ClFileId ClFilenameDatabase::GetFilenameId(const wxString& filename) const
 {
-    int len;
-    if (!ReadInt(in, len))
-        return false;
-    if (len == 0)
+    // A relative path depends on the working directory, only absolute spellings are remembered
+    const bool isAbsolute = wxIsAbsolutePath(filename);
+    if (isAbsolute)
     {
-        out_String = out_String.Truncate(0);
-        return true;
+        ClLeftRight<Instance>::Reader instance(*m_pInstances);
+        ClFilenameIdMap::const_iterator it = instance->spelledIds.find(filename);
+        if (it != instance->spelledIds.end())
+            return it->second;
+    }
+    wxFileName fln(filename.c_str());
+    fln.Normalize(wxPATH_NORM_ALL & ~wxPATH_NORM_CASE);
+    const wxString& normFile = fln.GetFullPath(wxPATH_UNIX);
+    if (!isAbsolute)
+    {
+        ClLeftRight<Instance>::Reader instance(*m_pInstances);
+        ClFilenameIdMap::const_iterator it = instance->normalizedIds.find(normFile);
+        if (it != instance->normalizedIds.end())
+            return it->second;
     }
-    if (!in.CanRead())
-        return false;
-    char buffer[len + 1];
 
-    in.Read( buffer, len );
-    buffer[len] = '\0';
+    wxMutexLocker lock(m_Mutex);
+    // Another thread might have added it in the meantime. The write copy is up to date while we hold the lock
+    const Instance& current = m_pInstances->GetWriteInstance();
+    ClFilenameIdMap::const_iterator it = current.normalizedIds.find(normFile);
+    const bool isKnown = (it != current.normalizedIds.end());
+    const ClFileId fId = isKnown ? it->second : (ClFileId)current.entries.size();
+    if (isKnown && ((!isAbsolute) || (current.spelledIds.find(filename) != current.spelledIds.end())))
+        return fId;
+    const wxString spelling = isAbsolute ? filename : wxString();
+    DoInsert(m_pInstances->GetWriteInstance(), fId, spelling, normFile);
+    m_pInstances->Publish();
+    DoInsert(m_pInstances->GetWriteInstance(), fId, spelling, normFile);
+    return fId;
+}
 
-    out_String = wxString::FromUTF8(buffer);
+/** @brief Get the filename from its ID
+ *
+ * @param fId const ClFileId
+ * @return wxString
+ *
+ */
+wxString ClFilenameDatabase::GetFilename( const ClFileId fId) const
+{
+    ClLeftRight<Instance>::Reader instance(*m_pInstances);
 
-    return true;
+    assert((fId >= 0) && (fId < (ClFileId)instance->entries.size()));
+
+    const wxChar* val = instance->entries[fId].filename.c_str();
+    if (val == nullptr)
+        return wxEmptyString;
+
+    return wxString(val);
 }
 
-/** @brief Write a token to an output stream
+/** @brief Get the timestamp from a filename
  *
- * @param token const ClAbstractToken&
- * @param out wxOutputStream&
- * @return bool
+ * @param fId const ClFileId
+ * @return const wxDateTime
  *
+ * @note Not a reference returned due to multithreading
  */
-bool ClAbstractToken::WriteOut( const ClAbstractToken& token,  wxOutputStream& out )
+const wxDateTime ClFilenameDatabase::GetFilenameTimestamp( const ClFileId fId ) const
 {
-    // This is a cached database so we don't care about endianness for now. Who will ever copy these from one platform to another?
-    WriteInt(out, token.tokenType);
-    WriteInt(out, token.fileId);
-    WriteInt(out, token.location.line);
-    WriteInt(out, token.location.column);
-    WriteString(out, token.identifier.mb_str());
-    WriteInt(out, token.tokenHash);
-    return true;
+    ClLeftRight<Instance>::Reader instance(*m_pInstances);
+
+    assert((fId >= 0) && (fId < (ClFileId)instance->entries.size()));
+
+    return instance->entries[fId].timestamp;
 }
 
-/** @brief Read a token from an input stream
+/** @brief Update the filename timestamp to indicate we have processed this file at this timestamp.
  *
- * @param token ClAbstractToken&
- * @param in wxInputStream&
- * @return bool
+ * @param fId const ClFileId
+ * @param timestamp const wxDateTime&
+ * @return void
  *
  */
-bool ClAbstractToken::ReadIn( ClAbstractToken& token, wxInputStream& in )
+void ClFilenameDatabase::UpdateFilenameTimestamp( const ClFileId fId, const wxDateTime& timestamp )
 {
-    int val = 0;
-    if (!ReadInt(in, val))
-        return false;
-    token.tokenType = (ClTokenType)val;
-    if (!ReadInt(in, val))
+    wxMutexLocker lock(m_Mutex);
+
+    assert((fId >= 0) && (fId < (ClFileId)m_pInstances->GetWriteInstance().entries.size()));
+
+    m_pInstances->GetWriteInstance().entries[fId].timestamp = timestamp;
+    m_pInstances->Publish();
+    m_pInstances->GetWriteInstance().entries[fId].timestamp = timestamp;
+}
+
+/** @brief Get the number of filenames in the database
+ *
+ * @return int All file ids below this number are valid
+ *
+ */
+int ClFilenameDatabase::GetFilenameCount() const
+{
+    ClLeftRight<Instance>::Reader instance(*m_pInstances);
+    return instance->entries.size();
+}
+
+/** @brief Add a filename or a new spelling of a known filename to one copy of the database
+ *
+ * @param instance Instance& The copy to modify
+ * @param fId const ClFileId The id of the filename, the next free id when the filename is new
+ * @param spelling const wxString& Absolute path as it was passed to GetFilenameId(), empty if it should not be remembered
+ * @param normFile const wxString& Normalized path
+ * @return void
+ *
+ * The strings are copied, so the copies of the database never share a string buffer.
+ */
+void ClFilenameDatabase::DoInsert( Instance& instance, const ClFileId fId, const wxString& spelling, const wxString& normFile )
+{
+    if (fId == (ClFileId)instance.entries.size())
+    {
+        wxDateTime ts; // Timestamp updated when file was parsed into the token database.
+        instance.entries.push_back(ClFilenameEntry(wxString(normFile.c_str()), ts));
+        instance.normalizedIds[wxString(normFile.c_str())] = fId;
+    }
+    if (!spelling.IsEmpty())
+        instance.spelledIds[wxString(spelling.c_str())] = fId;
+}
+
+ClTokenDatabase::ClTokenDatabase(ClFilenameDatabase& fileDB) :
+        m_FileDB(fileDB),
+        m_pInstances(new ClLeftRight<Instance>(new Instance(), new Instance())),
+        m_Generation(0),
+        m_Mutex(wxMUTEX_RECURSIVE)
+{
+}
+
+/** @brief Copy onstructor
+ *
+ * @param other The other ClTokenDatabase
+ *
+ */
+ClTokenDatabase::ClTokenDatabase( const ClTokenDatabase& other) :
+    m_FileDB(other.m_FileDB),
+    m_pInstances(nullptr),
+    m_Generation(0),
+    m_Mutex(wxMUTEX_RECURSIVE)
+{
+    ClLeftRight<Instance>::Reader instance(*other.m_pInstances);
+    m_pInstances = new ClLeftRight<Instance>(new Instance(*instance), new Instance(*instance));
+}
+
+/** @brief Destructor
+ */
+ClTokenDatabase::~ClTokenDatabase()
+{
+    delete m_pInstances;
+}
+
+/** @brief Read a token database from a file written by WriteOut()
+ *
+ * @param tokenDatabase The token database to read into, its tokens are replaced
+ * @param filename The file to read from
+ * @return true if the operation succeeded, false if the file does not exist or is not a valid token database
+ *
+ * The file is mapped in memory and checked completely before anything is inserted. The files it refers to are
+ * added to the filename database, so the file ids are remapped when the filename database already has entries.
+ */
+bool ClTokenDatabase::ReadIn( ClTokenDatabase& tokenDatabase, const wxString& filename )
+{
+    ClMappedFile file;
+    if (!file.Open(filename))
         return false;
-    token.fileId = val;
-    if (!ReadInt(in, val))
+    if (file.GetSize() < sizeof(ClTokenDbHeader))
         return false;
-    token.location.line = val;
-    if (!ReadInt(in, val))
+    const ClTokenDbHeader* pHeader = reinterpret_cast<const ClTokenDbHeader*>(file.GetData());
+    if (   (memcmp(pHeader->magic, "CbCc", 4) != 0)
+        || (pHeader->version != ClTokenDbVersion)
+        || (pHeader->byteOrder != ClTokenDbByteOrder)
+        || (pHeader->sectionCount > (file.GetSize() - sizeof(ClTokenDbHeader)) / sizeof(ClTokenDbSection)) )
+    {
+        CCLogger::Get()->DebugLog(F(_T("Token database '%s' has an unsupported format, ignored"), filename.wx_str()));
         return false;
-    token.location.column = val;
-    if (!ReadString(in, token.identifier))
+    }
+    const char* pStrings = nullptr;
+    const ClTokenDbFileRecord* pFiles = nullptr;
+    const ClTokenDbTokenRecord* pTokens = nullptr;
+    const ReferenceRecord* pReferences = nullptr;
+    const ClTokenDbRange* pReferenceIndex = nullptr;
+    const RelationRecord* pRelations = nullptr;
+    const ClTokenDbRange* pRelationIndex = nullptr;
+    uint32_t stringsSize = 0;
+    uint32_t fileCount = 0;
+    uint32_t tokenCount = 0;
+    uint32_t referenceCount = 0;
+    uint32_t referenceIndexCount = 0;
+    uint32_t relationCount = 0;
+    uint32_t relationIndexCount = 0;
+    if (   (!GetSection(file, ClTokenDbSection_strings, pStrings, stringsSize))
+        || (!GetSection(file, ClTokenDbSection_files, pFiles, fileCount))
+        || (!GetSection(file, ClTokenDbSection_tokens, pTokens, tokenCount))
+        || (!GetSection(file, ClTokenDbSection_references, pReferences, referenceCount))
+        || (!GetSection(file, ClTokenDbSection_referenceIndex, pReferenceIndex, referenceIndexCount))
+        || (!GetSection(file, ClTokenDbSection_relations, pRelations, relationCount))
+        || (!GetSection(file, ClTokenDbSection_relationIndex, pRelationIndex, relationIndexCount))
+        || (stringsSize == 0) || (pStrings[stringsSize - 1] != '\0')
+        || (referenceIndexCount != fileCount)
+        || (relationIndexCount != fileCount) )
+    {
+        CCLogger::Get()->DebugLog(F(_T("Token database '%s' is corrupt, ignored"), filename.wx_str()));
         return false;
-    if (!ReadInt(in, val))
+    }
+    for (uint32_t i = 0; i < fileCount; ++i)
+    {
+        if (   (pFiles[i].nameOffset >= stringsSize)
+            || (pReferenceIndex[i].first > referenceCount) || (pReferenceIndex[i].count > referenceCount - pReferenceIndex[i].first)
+            || (pRelationIndex[i].first > relationCount) || (pRelationIndex[i].count > relationCount - pRelationIndex[i].first) )
+            return false;
+    }
+    for (uint32_t i = 0; i < tokenCount; ++i)
+    {
+        if (   (pTokens[i].identifierOffset >= stringsSize)
+            || (pTokens[i].fileId < 0) || ((uint32_t)pTokens[i].fileId >= fileCount) )
+            return false;
+    }
+
+    ClFilenameDatabase& fileDB = tokenDatabase.m_FileDB;
+    std::vector<ClFileId> fileIdMap(fileCount, wxNOT_FOUND);
+    for (uint32_t i = 0; i < fileCount; ++i)
+    {
+        ClFileId fId = fileDB.GetFilenameId(wxString::FromUTF8(pStrings + pFiles[i].nameOffset));
+        if ((pFiles[i].flags & ClTokenDbFileFlag_timestamp) && !fileDB.GetFilenameTimestamp(fId).IsValid())
+            fileDB.UpdateFilenameTimestamp(fId, wxDateTime(wxLongLong(pFiles[i].timestamp)));
+        fileIdMap[i] = fId;
+    }
+
+    // The records are stored in identifier order, this keeps the tree inserts local and equal identifiers adjacent
+    ClAbstractTokenList tokens;
+    tokens.reserve(tokenCount);
+    for (uint32_t i = 0; i < tokenCount; ++i)
+    {
+        const ClTokenDbTokenRecord& record = pTokens[i];
+        wxString identifier;
+        if ((i > 0) && (record.identifierOffset == pTokens[i - 1].identifierOffset))
+            identifier = tokens.back().identifier;
+        else
+            identifier = wxString::FromUTF8(pStrings + record.identifierOffset);
+        tokens.push_back(ClAbstractToken((ClTokenType)record.tokenType, fileIdMap[record.fileId],
+                                         ClTokenPosition(record.line, record.column), identifier, record.tokenHash));
+    }
+    ReferenceTableMap references;
+    for (uint32_t i = 0; i < fileCount; ++i)
+    {
+        if (pReferenceIndex[i].count == 0)
+            continue;
+        const ReferenceRecord* pFirst = pReferences + pReferenceIndex[i].first;
+        ReferenceTable& table = references[fileIdMap[i]];
+        table.assign(pFirst, pFirst + pReferenceIndex[i].count);
+        if (!std::is_sorted(table.begin(), table.end()))
+            std::sort(table.begin(), table.end());
+    }
+    RelationTableMap relations;
+    for (uint32_t i = 0; i < fileCount; ++i)
+    {
+        if (pRelationIndex[i].count == 0)
+            continue;
+        const RelationRecord* pFirst = pRelations + pRelationIndex[i].first;
+        RelationTable& table = relations[fileIdMap[i]];
+        table.assign(pFirst, pFirst + pRelationIndex[i].count);
+        if (!std::is_sorted(table.begin(), table.end()))
+            std::sort(table.begin(), table.end());
+    }
+    {
+        wxMutexLocker lock(tokenDatabase.m_Mutex);
+        DoReplace(tokenDatabase.m_pInstances->GetWriteInstance(), tokens, references, relations);
+        tokenDatabase.m_pInstances->Publish();
+        DoReplace(tokenDatabase.m_pInstances->GetWriteInstance(), tokens, references, relations);
+        tokenDatabase.m_Generation++;
+    }
+
+    CCLogger::Get()->DebugLog(F(_T("Read token database: %d tokens, %d references, %d relations, %d files"), (int)tokenCount, (int)referenceCount, (int)relationCount, (int)fileCount));
+    return true;
+}
+
+/** @brief Write the database to a file
+ *
+ * @param tokenDatabase The database to write
+ * @param filename The file to write to
+ * @return true if the operation was successful, false otherwise
+ *
+ * The file is first written next to the destination and then renamed over it, so a crash never leaves a partial file behind.
+ * The contents are collected from the published copy of the database, so they are consistent without blocking the readers.
+ */
+bool ClTokenDatabase::WriteOut( const ClTokenDatabase& tokenDatabase, const wxString& filename )
+{
+    ClStringTableBuilder strings;
+    std::vector<ClTokenDbFileRecord> files;
+    std::vector<ClTokenDbTokenRecord> tokens;
+    std::vector<ReferenceTable> fileReferences;
+    RelationTableMap fileRelations;
+    {
+        ClLeftRight<Instance>::Reader instance(*tokenDatabase.m_pInstances);
+        fileReferences = instance->fileReferences;
+        fileRelations = instance->fileRelations;
+        const ClTokenStore& tokenStore = *instance->pTokens;
+        tokens.reserve(tokenStore.GetCount() - tokenStore.GetFreeCount());
+        for (ClTokenId tId = 0; tId < tokenStore.GetCount(); ++tId)
+        {
+            if ((!tokenStore.HasValue(tId)) || (tokenStore.GetFileId(tId) < 0))
+                continue;
+            ClTokenDbTokenRecord record;
+            record.identifierOffset = strings.Add(instance->identifiers.Get(tokenStore.GetIdentifierId(tId)));
+            record.fileId = tokenStore.GetFileId(tId);
+            record.line = tokenStore.GetLine(tId);
+            record.column = tokenStore.GetColumn(tId);
+            record.tokenType = tokenStore.GetType(tId);
+            record.tokenHash = tokenStore.GetHash(tId);
+            record.reserved = 0;
+            tokens.push_back(record);
+        }
+    }
+    // The filename database only grows, so this covers all files referenced by the tokens
+    const ClFilenameDatabase& fileDB = tokenDatabase.m_FileDB;
+    const int fileCount = fileDB.GetFilenameCount();
+    for (ClFileId fId = 0; fId < fileCount; ++fId)
+    {
+        ClTokenDbFileRecord record;
+        record.nameOffset = strings.Add(fileDB.GetFilename(fId));
+        record.flags = 0;
+        record.timestamp = 0;
+        wxDateTime timestamp = fileDB.GetFilenameTimestamp(fId);
+        if (timestamp.IsValid())
+        {
+            record.flags |= ClTokenDbFileFlag_timestamp;
+            record.timestamp = timestamp.GetValue().GetValue();
+        }
+        files.push_back(record);
+    }
+
+    std::stable_sort(tokens.begin(), tokens.end(), TokenNameLess(&strings.GetData()[0]));
+    std::vector<ReferenceRecord> references;
+    std::vector<ClTokenDbRange> referenceIndex(files.size());
+    for (ClFileId fId = 0; (fId < (ClFileId)fileReferences.size()) && (fId < fileCount); ++fId)
+    {
+        referenceIndex[fId].first = references.size();
+        referenceIndex[fId].count = fileReferences[fId].size();
+        references.insert(references.end(), fileReferences[fId].begin(), fileReferences[fId].end());
+    }
+    std::vector<RelationRecord> relations;
+    std::vector<ClTokenDbRange> relationIndex(files.size());
+    for (RelationTableMap::const_iterator it = fileRelations.begin(); it != fileRelations.end(); ++it)
+    {
+        if ((it->first < 0) || (it->first >= fileCount))
+            continue;
+        relationIndex[it->first].first = relations.size();
+        relationIndex[it->first].count = it->second.size();
+        relations.insert(relations.end(), it->second.begin(), it->second.end());
+    }
+
+    const int sectionCount = 7;
+    std::vector<char> data(sizeof(ClTokenDbHeader) + sectionCount * sizeof(ClTokenDbSection), '\0');
+    ClTokenDbHeader header;
+    memcpy(header.magic, "CbCc", 4);
+    header.version = ClTokenDbVersion;
+    header.byteOrder = ClTokenDbByteOrder;
+    header.sectionCount = sectionCount;
+    memcpy(&data[0], &header, sizeof(header));
+    AppendSection(data, 0, ClTokenDbSection_strings, strings.GetData());
+    AppendSection(data, 1, ClTokenDbSection_files, files);
+    AppendSection(data, 2, ClTokenDbSection_tokens, tokens);
+    AppendSection(data, 3, ClTokenDbSection_references, references);
+    AppendSection(data, 4, ClTokenDbSection_referenceIndex, referenceIndex);
+    AppendSection(data, 5, ClTokenDbSection_relations, relations);
+    AppendSection(data, 6, ClTokenDbSection_relationIndex, relationIndex);
+
+    const wxString tmpFilename = filename + wxT(".tmp");
+    {
+        wxFile out;
+        if (!out.Create(tmpFilename, true))
+            return false;
+        if ((out.Write(&data[0], data.size()) != data.size()) || (!out.Flush()))
+        {
+            out.Close();
+            wxRemoveFile(tmpFilename);
+            return false;
+        }
+    }
+    if (!wxRenameFile(tmpFilename, filename, true))
+    {
+        wxRemoveFile(tmpFilename);
         return false;
-    token.tokenHash = val;
+    }
+    CCLogger::Get()->DebugLog(F(_T("Wrote token database: %d tokens, %d references, %d relations, %d files"), (int)tokens.size(), (int)references.size(), (int)relations.size(), (int)files.size()));
     return true;
 }
 
-/** @brief Filename database constructor
+/** @brief Clear the token database
+ *
+ */
+void ClTokenDatabase::Clear()
+{
+    wxMutexLocker lock(m_Mutex);
+    m_pInstances->GetWriteInstance().Clear();
+    m_pInstances->Publish();
+    m_pInstances->GetWriteInstance().Clear();
+    m_Generation++;
+}
+
+/** @brief Get an ID for a filename. Creates a new ID if the filename was not known yet.
+ *
+ * @param filename Full path to the filename
+ * @return ClFileId
+ *
+ */
+ClFileId ClTokenDatabase::GetFilenameId(const wxString& filename) const
+{
+    return m_FileDB.GetFilenameId(filename);
+}
+
+/** @brief Get the filename that is known with an ID
+ *
+ * @param fId The file ID
+ * @return Full path to the file
+ *
+ */
+wxString ClTokenDatabase::GetFilename(ClFileId fId) const
+{
+    return m_FileDB.GetFilename(fId);
+}
+
+/** @brief Get the timestamp of the filename entry when the file was last parsed
+ *
+ * @param fId The file id
+ * @return wxDateTime object which represents a timestamp
+ *
+ */
+wxDateTime ClTokenDatabase::GetFilenameTimestamp( const ClFileId fId ) const
+{
+    return m_FileDB.GetFilenameTimestamp(fId);
+}
+
+/** @brief Insert or update a token into the token database
+ *
+ * @param token The token to insert/update
+ * @return ClTokenId of the newly inserted token, or of the existing token. An existing token is moved to the location of the new one
+ *
+ */
+ClTokenId ClTokenDatabase::InsertToken( const ClAbstractToken& token )
+{
+    wxMutexLocker lock(m_Mutex);
+
+    ClTokenId tId = DoGetTokenId(m_pInstances->GetWriteInstance(), token.identifier, token.fileId, token.tokenType, token.tokenHash);
+    if (tId == wxNOT_FOUND)
+    {
+        tId = DoInsertToken(m_pInstances->GetWriteInstance(), token);
+        m_pInstances->Publish();
+        DoInsertToken(m_pInstances->GetWriteInstance(), token);
+        m_Generation++;
+    }
+    else if (m_pInstances->GetWriteInstance().pTokens->SetLocation(tId, token.location))
+    {
+        m_pInstances->Publish();
+        m_pInstances->GetWriteInstance().pTokens->SetLocation(tId, token.location);
+        m_Generation++;
+    }
+    return tId;
+}
+
+/** @brief Find a token ID by value
+ *
+ * @param identifier const wxString&
+ * @param fileId ClFileId
+ * @param tokenType ClTokenType
+ * @param tokenHash ClUSRHash
+ * @return ClTokenId
+ *
+ */
+ClTokenId ClTokenDatabase::GetTokenId( const wxString& identifier, ClFileId fileId, ClTokenType tokenType, ClUSRHash tokenHash ) const
+{
+    ClLeftRight<Instance>::Reader instance(*m_pInstances);
+    return DoGetTokenId(*instance, identifier, fileId, tokenType, tokenHash);
+}
+
+/** @brief Get a token with it's ID
+ *
+ * @param tId const ClTokenId
+ * @return ClTokenView
+ *
+ * @note The view is a copy of the token fields
  */
-ClFilenameDatabase::ClFilenameDatabase() :
-    m_pFileEntries(new ClTreeMap<ClFilenameEntry>())
+ClTokenView ClTokenDatabase::GetToken(const ClTokenId tId) const
 {
+    ClLeftRight<Instance>::Reader instance(*m_pInstances);
+    const ClTokenStore& tokens = *instance->pTokens;
+    assert(tokens.HasValue(tId));
+    return ClTokenView(tokens.GetType(tId), tokens.GetFileId(tId), tokens.GetLine(tId), tokens.GetColumn(tId),
+                       tokens.GetHash(tId), instance->identifiers.Get(tokens.GetIdentifierId(tId)));
 }
 
-ClFilenameDatabase::~ClFilenameDatabase()
+/** @brief Find the token IDs of all matches of an identifier
+ *
+ * @param identifier const wxString&
+ * @return std::vector<ClTokenId>
+ *
+ */
+std::vector<ClTokenId> ClTokenDatabase::GetTokenMatches(const wxString& identifier) const
 {
-    delete m_pFileEntries;
+    ClLeftRight<Instance>::Reader instance(*m_pInstances);
+    const int identifierId = instance->identifiers.Find(identifier);
+    if (identifierId == wxNOT_FOUND)
+        return std::vector<ClTokenId>();
+    return instance->pTokens->GetIdSet(identifierId);
 }
 
-/** @brief Write a filename database to an output stream
+/** @brief Get all tokens whose identifier starts with a prefix
  *
- * @param db const ClFilenameDatabase&
- * @param out wxOutputStream&
- * @return bool
+ * @param prefix const wxString& The prefix, case sensitive
+ * @param maxCount size_t Maximum number of tokens to return, 0 to return all of them
+ * @return std::vector<ClTokenId> The tokens, ordered on identifier
  *
  */
-bool ClFilenameDatabase::WriteOut( const ClFilenameDatabase& db, wxOutputStream& out )
+std::vector<ClTokenId> ClTokenDatabase::GetTokensByPrefix(const wxString& prefix, size_t maxCount) const
 {
-    int i;
-    wxMutexLocker l(db.m_Mutex);
-    int cnt = db.m_pFileEntries->GetCount();
-    WriteInt(out, cnt);
-    for (i = 0; i < cnt; ++i)
+    ClLeftRight<Instance>::Reader instance(*m_pInstances);
+    std::vector<ClTokenId> tokenIds;
+    // Identifiers without live tokens are only dropped by Compact(), so ask for more identifiers when they were not enough
+    size_t identifierCount = maxCount;
+    for (;;)
     {
-        ClFilenameEntry entry = db.m_pFileEntries->GetValue((ClFileId)i);
-        if (!WriteString(out, entry.filename.mb_str()))
-            return false;
-        if (!WriteLongLong(out, entry.timestamp.GetValue().GetValue()))
-            return false;
+        std::vector<int> identifierIds = instance->identifiers.GetIdSetByPrefix(prefix, identifierCount);
+        tokenIds.clear();
+        for (std::vector<int>::const_iterator it = identifierIds.begin(); it != identifierIds.end(); ++it)
+        {
+            std::vector<int> ids = instance->pTokens->GetIdSet(*it);
+            tokenIds.insert(tokenIds.end(), ids.begin(), ids.end());
+            if ((maxCount > 0) && (tokenIds.size() >= maxCount))
+            {
+                tokenIds.resize(maxCount);
+                return tokenIds;
+            }
+        }
+        if ((maxCount == 0) || (identifierIds.size() < identifierCount))
+            return tokenIds;
+        identifierCount *= 2;
     }
-    return true;
 }
 
-/** @brief Read a filename database from an input stream
+/** @brief Get the tokens whose identifier best matches a fuzzy pattern
  *
- * @param db ClFilenameDatabase&
- * @param in wxInputStream&
- * @return bool
+ * @param pattern const wxString& Characters that must appear in order in the identifier, case insensitive
+ * @param maxCount size_t Maximum number of tokens to return
+ * @param out_matches std::vector< std::pair<ClTokenId, int> >& The (tokenId, rank) pairs, best match first
+ * @return void
  *
  */
-bool ClFilenameDatabase::ReadIn( ClFilenameDatabase& db, wxInputStream& in )
+void ClTokenDatabase::GetTokenMatchesFuzzy(const wxString& pattern, size_t maxCount, std::vector< std::pair<ClTokenId, int> >& out_matches) const
 {
-    int i;
-    wxMutexLocker l(db.m_Mutex);
-    int packetCount = 0;
-    if (!ReadInt(in, packetCount))
-        return false;
-    for (i = 0; i < packetCount; ++i)
+    ClLeftRight<Instance>::Reader instance(*m_pInstances);
+    size_t identifierCount = maxCount;
+    for (;;)
     {
-        wxString filename;
-        if (!ReadString(in, filename))
-            return false;
-        long long ts = 0;
-        if (!ReadLongLong(in, ts))
-            return false;
-        db.m_pFileEntries->Insert(filename, ClFilenameEntry(filename, wxDateTime(wxLongLong(ts))));
+        std::vector< std::pair<int, int> > identifierMatches;
+        instance->identifiers.GetFuzzyIdSet(pattern, identifierCount, identifierMatches);
+        out_matches.clear();
+        for (std::vector< std::pair<int, int> >::const_iterator it = identifierMatches.begin(); it != identifierMatches.end(); ++it)
+        {
+            std::vector<int> ids = instance->pTokens->GetIdSet(it->first);
+            for (std::vector<int>::const_iterator idIt = ids.begin(); idIt != ids.end(); ++idIt)
+            {
+                out_matches.push_back(std::make_pair(*idIt, it->second));
+                if ((maxCount > 0) && (out_matches.size() >= maxCount))
+                    return;
+            }
+        }
+        if ((maxCount == 0) || (identifierMatches.size() < identifierCount))
+            return;
+        identifierCount *= 2;
     }
-    return true;
 }
 
-/** @brief Get a filename id from a filename. Creates a new ID if the filename was not known yet.
- *
- * @param filename const wxString&
- * @return ClFileId
+/** @brief Rank of a token kind in symbol searches, added to the rank of the match
  *
+ * Smaller than the difference between matches of different quality, so it mostly orders equally good matches.
  */
-ClFileId ClFilenameDatabase::GetFilenameId(const wxString& filename) const
+static int GetSymbolKindRank(ClTokenType tokenType)
 {
-    wxMutexLocker lock(m_Mutex);
-    assert(m_pFileEntries);
-    wxFileName fln(filename.c_str());
-    fln.Normalize(wxPATH_NORM_ALL & ~wxPATH_NORM_CASE);
-    const wxString& normFile = fln.GetFullPath(wxPATH_UNIX);
-    std::vector<int> id = m_pFileEntries->GetIdSet(normFile);
-    if (id.empty())
+    int rank = 0;
+    switch (tokenType & ~ClTokenType_DefGroup)
     {
-        wxString f = wxString(normFile.c_str());
-        wxDateTime ts; // Timestamp updated when file was parsed into the token database.
-        ClFilenameEntry entry(f,ts);
-        return m_pFileEntries->Insert(f, entry);
+    case ClTokenType_ScopeDecl:
+        rank = 96;
+        break;
+    case ClTokenType_FuncDecl:
+        rank = 64;
+        break;
+    case ClTokenType_VarDecl:
+        rank = 32;
+        break;
+    default:
+        break;
     }
-    return id.front();
+    if (tokenType & ClTokenType_DefGroup)
+        rank += 16;
+    return rank;
 }
 
-/** @brief Get the filename from its ID
+static const int MaxSymbolKindRank = 96 + 16;
+/// Minimum number of identifiers a symbol search collects. When a pattern matches fewer identifiers they are remembered
+static const size_t MinSymbolCandidates = 512;
+
+struct SymbolRankGreater
+{
+    bool operator()(const std::pair<uint32_t, int>& a, const std::pair<uint32_t, int>& b) const
+    {
+        if (a.second != b.second)
+            return a.second > b.second;
+        return a.first < b.first;
+    }
+};
+
+/** @brief Search the symbols of all indexed files with a fuzzy pattern
  *
- * @param fId const ClFileId
- * @return wxString
+ * @param search ClSymbolSearch& The state of the search, refined with each call. Only use it with this database
+ * @param pattern const wxString& Characters that must appear in order in the identifier, case insensitive
+ * @param maxCount size_t Maximum number of tokens to return
+ * @param out_tokens std::vector<ClTokenView>& The tokens, best match first
+ * @return void
  *
+ * The distinct identifiers are matched, not the tokens. A short pattern matches most identifiers, it is answered by a
+ * pruned walk of the identifier tree. Once the pattern matches few enough identifiers they are remembered, and when the
+ * next pattern extends this one only those identifiers, and the ones that were added since, are matched again. The tokens
+ * of the best identifiers are ranked on the quality of the match and on their kind, types before functions before variables.
+ * Views are returned instead of token ids, the ids may be renumbered by Compact() as soon as the database is unlocked.
  */
-wxString ClFilenameDatabase::GetFilename( const ClFileId fId) const
+void ClTokenDatabase::SearchSymbols(ClSymbolSearch& search, const wxString& pattern, size_t maxCount,
+                                    std::vector<ClTokenView>& out_tokens) const
 {
-    wxMutexLocker lock(m_Mutex);
-
-    assert(m_pFileEntries->HasValue(fId));
-
-    ClFilenameEntry entry = m_pFileEntries->GetValue(fId);
-    const wxChar* val = entry.filename.c_str();
-    if (val == nullptr)
-        return wxEmptyString;
+    out_tokens.clear();
+    if (pattern.IsEmpty() || (maxCount == 0))
+    {
+        search.Reset();
+        return;
+    }
+    ClFuzzyMatcher matcher(pattern);
+    const unsigned long long patternMask = matcher.GetPatternMask();
+    ClLeftRight<Instance>::Reader instance(*m_pInstances);
+    const ClIdentifierPool& identifiers = instance->identifiers;
+    const size_t identifierCount = identifiers.GetCount();
+    const bool refine = (!search.m_Pattern.IsEmpty()) && pattern.StartsWith(search.m_Pattern)
+                        && (search.m_PoolGeneration == identifiers.GetGeneration())
+                        && (search.m_IdentifierCount <= identifierCount);
+
+    std::vector< std::pair<uint32_t, int> > matches; // (identifier id, rank)
+    if (refine)
+    {
+        int rank = 0;
+        for (std::vector<uint32_t>::const_iterator it = search.m_Candidates.begin(); it != search.m_Candidates.end(); ++it)
+        {
+            if (((identifiers.GetMask(*it) & patternMask) == patternMask) && matcher.Match(identifiers.Get(*it), rank))
+                matches.push_back(std::make_pair(*it, rank));
+        }
+        for (uint32_t id = search.m_IdentifierCount; id < identifierCount; ++id)
+        {
+            if (((identifiers.GetMask(id) & patternMask) == patternMask) && matcher.Match(identifiers.Get(id), rank))
+                matches.push_back(std::make_pair(id, rank));
+        }
+    }
+    else
+    {
+        std::vector< std::pair<int, int> > treeMatches;
+        identifiers.GetFuzzyIdSet(pattern, std::max(maxCount * 4, MinSymbolCandidates), treeMatches);
+        matches.assign(treeMatches.begin(), treeMatches.end());
+    }
+    // When the tree walk was cut off, not all matching identifiers are known
+    search.Reset();
+    if (refine || (matches.size() < std::max(maxCount * 4, MinSymbolCandidates)))
+    {
+        search.m_Pattern = pattern;
+        search.m_PoolGeneration = identifiers.GetGeneration();
+        search.m_IdentifierCount = identifierCount;
+        search.m_Candidates.resize(matches.size());
+        for (size_t i = 0; i < matches.size(); ++i)
+            search.m_Candidates[i] = matches[i].first;
+    }
 
-    return wxString(val);
+    // Expand the best identifiers to their tokens until no other identifier can make it into the result
+    const ClTokenStore& tokens = *instance->pTokens;
+    std::vector< std::pair<ClTokenId, int> > tokenMatches;
+    std::priority_queue< int, std::vector<int>, std::greater<int> > bestRanks; // the top is the worst rank kept
+    size_t sortedCount = 0;
+    for (size_t i = 0; i < matches.size(); ++i)
+    {
+        if (i == sortedCount)
+        {
+            sortedCount = std::min(matches.size(), std::max(sortedCount * 2, maxCount));
+            std::partial_sort(matches.begin() + i, matches.begin() + sortedCount, matches.end(), SymbolRankGreater());
+        }
+        if ((bestRanks.size() >= maxCount) && (matches[i].second + MaxSymbolKindRank <= bestRanks.top()))
+            break;
+        std::vector<int> ids = tokens.GetIdSet(matches[i].first);
+        for (std::vector<int>::const_iterator it = ids.begin(); it != ids.end(); ++it)
+        {
+            if (!tokens.HasValue(*it))
+                continue;
+            const int tokenRank = matches[i].second + GetSymbolKindRank(tokens.GetType(*it));
+            if (bestRanks.size() < maxCount)
+                bestRanks.push(tokenRank);
+            else if (tokenRank > bestRanks.top())
+            {
+                bestRanks.pop();
+                bestRanks.push(tokenRank);
+            }
+            else
+                continue;
+            tokenMatches.push_back(std::make_pair(*it, tokenRank));
+        }
+    }
+    std::stable_sort(tokenMatches.begin(), tokenMatches.end(), SymbolRankGreater());
+    if (tokenMatches.size() > maxCount)
+        tokenMatches.resize(maxCount);
+    out_tokens.reserve(tokenMatches.size());
+    for (std::vector< std::pair<ClTokenId, int> >::const_iterator it = tokenMatches.begin(); it != tokenMatches.end(); ++it)
+    {
+        const ClTokenId tId = it->first;
+        out_tokens.push_back(ClTokenView(tokens.GetType(tId), tokens.GetFileId(tId), tokens.GetLine(tId), tokens.GetColumn(tId),
+                                         tokens.GetHash(tId), identifiers.Get(tokens.GetIdentifierId(tId))));
+    }
 }
 
-/** @brief Get the timestamp from a filename
+/** @brief Get all tokens linked to a file ID
  *
  * @param fId const ClFileId
- * @return const wxDateTime
+ * @return std::vector<ClTokenId>
  *
- * @note Not a reference returned due to multithreading
  */
-const wxDateTime ClFilenameDatabase::GetFilenameTimestamp( const ClFileId fId ) const
+std::vector<ClTokenId> ClTokenDatabase::GetFileTokens(const ClFileId fId) const
 {
-    wxMutexLocker lock(m_Mutex);
-
-    assert(m_pFileEntries->HasValue(fId));
-
-    ClFilenameEntry entry = m_pFileEntries->GetValue(fId);
-    return entry.timestamp;
+    wxString key = wxString::Format(wxT("%d"), fId);
+    ClLeftRight<Instance>::Reader instance(*m_pInstances);
+    return instance->pFileTokens->GetIdSet(key);
 }
 
-/** @brief Update the filename timestamp to indicate we have processed this file at this timestamp.
+/** @brief Get all indexed references to a declaration
  *
- * @param fId const ClFileId
- * @param timestamp const wxDateTime&
+ * @param usrHash ClUSRHash The hash of the USR of the declaration
+ * @param out_references ClTokenReferenceList& Receives the references, ordered on file and offset
  * @return void
  *
  */
-void ClFilenameDatabase::UpdateFilenameTimestamp( const ClFileId fId, const wxDateTime& timestamp )
-{
-    wxMutexLocker lock(m_Mutex);
-
-    assert(m_pFileEntries->HasValue(fId));
-
-    ClFilenameEntry& entryRef = m_pFileEntries->GetValue(fId);
-    entryRef.timestamp = timestamp;
-}
-
-ClTokenDatabase::ClTokenDatabase(ClFilenameDatabase& fileDB) :
-        m_FileDB(fileDB),
-        m_pTokens(new ClTreeMap<ClAbstractToken>()),
-        m_pFileTokens(new ClTreeMap<int>()),
-        m_Mutex(wxMUTEX_RECURSIVE)
+void ClTokenDatabase::GetReferences(ClUSRHash usrHash, ClTokenReferenceList& out_references) const
 {
+    ClLeftRight<Instance>::Reader instance(*m_pInstances);
+    for (ClFileId fId = 0; fId < (ClFileId)instance->fileReferences.size(); ++fId)
+    {
+        const ReferenceTable& table = instance->fileReferences[fId];
+        std::pair<ReferenceTable::const_iterator, ReferenceTable::const_iterator> range =
+            std::equal_range(table.begin(), table.end(), usrHash, ReferenceRecord::UsrLess());
+        for (ReferenceTable::const_iterator it = range.first; it != range.second; ++it)
+            out_references.push_back(ClTokenReference(it->usrHash, fId, it->offset, ClTokenPosition(it->line, it->column), it->cursorKind));
+    }
 }
 
-/** @brief Copy onstructor
+/** @brief Get the bases of a class or the methods a method overrides
  *
- * @param other The other ClTokenDatabase
+ * @param fromHash ClUSRHash The hash of the USR of the derived class or overriding method
+ * @param kind ClTokenRelationKind
+ * @param out_relations ClTokenRelationList& Receives the direct relations, the location is the one of the derived declaration
+ * @return void
  *
  */
-ClTokenDatabase::ClTokenDatabase( const ClTokenDatabase& other) :
-    m_FileDB(other.m_FileDB),
-    m_pTokens(new ClTreeMap<ClAbstractToken>(*other.m_pTokens)),
-    //m_pFileEntries(new ClTreeMap<ClFileEntry>(*other.m_pFileEntries)),
-    m_pFileTokens(new ClTreeMap<int>(*other.m_pFileTokens)),
-    m_Mutex(wxMUTEX_RECURSIVE)
+void ClTokenDatabase::GetRelationsFrom(ClUSRHash fromHash, ClTokenRelationKind kind, ClTokenRelationList& out_relations) const
 {
-
+    DoGetRelations(fromHash, kind, false, out_relations);
 }
 
-/** @brief Destructor
+/** @brief Get the classes derived from a class or the methods overriding a method
+ *
+ * @param toHash ClUSRHash The hash of the USR of the base class or overridden method
+ * @param kind ClTokenRelationKind
+ * @param out_relations ClTokenRelationList& Receives the direct relations, the location is the one of the derived declaration
+ * @return void
+ *
  */
-ClTokenDatabase::~ClTokenDatabase()
+void ClTokenDatabase::GetRelationsTo(ClUSRHash toHash, ClTokenRelationKind kind, ClTokenRelationList& out_relations) const
 {
-    delete m_pTokens;
+    DoGetRelations(toHash, kind, true, out_relations);
 }
 
-/** @brief Swap 2 token databases
+/** @brief Look up the edges of a declaration in one of the adjacency lists
  *
- * @param first ClTokenDatabase&
- * @param second ClTokenDatabase&
+ * @param usrHash ClUSRHash
+ * @param kind ClTokenRelationKind
+ * @param incoming bool true to follow the edges that end at the declaration
+ * @param out_relations ClTokenRelationList&
  * @return void
  *
  */
-void swap( ClTokenDatabase& first, ClTokenDatabase& second )
+void ClTokenDatabase::DoGetRelations(ClUSRHash usrHash, ClTokenRelationKind kind, bool incoming, ClTokenRelationList& out_relations) const
 {
-    using std::swap;
-
-    // Let's assume no inverse swap will be performed at the same time for now
-    wxMutexLocker l1(first.m_Mutex);
-    wxMutexLocker l2(second.m_Mutex);
-
-    swap(*first.m_pTokens, *second.m_pTokens);
-    swap(*first.m_pFileTokens, *second.m_pFileTokens);
+    ClLeftRight<Instance>::Reader instance(*m_pInstances);
+    const Instance::RelationGraph& graph = incoming ? instance->incomingRelations : instance->outgoingRelations;
+    std::pair<Instance::RelationGraph::const_iterator, Instance::RelationGraph::const_iterator> range = graph.equal_range(usrHash);
+    for (Instance::RelationGraph::const_iterator it = range.first; it != range.second; ++it)
+    {
+        if (it->second.kind != kind)
+            continue;
+        const ClTokenPosition location(it->second.line, it->second.column);
+        if (incoming)
+            out_relations.push_back(ClTokenRelation(it->second.usrHash, usrHash, kind, it->second.fileId, location));
+        else
+            out_relations.push_back(ClTokenRelation(usrHash, it->second.usrHash, kind, it->second.fileId, location));
+    }
 }
 
-
-/** @brief Read a tokendatabase from disk
+/** @brief Shrink the database to reclaim some memory
  *
- * @param tokenDatabase The tokendatabase to read into
- * @param in The wxInputStream to read from
- * @return true if the operation succeeded, false otherwise
+ * @return void
  *
  */
-bool ClTokenDatabase::ReadIn( ClTokenDatabase& tokenDatabase, wxInputStream& in )
+void ClTokenDatabase::Shrink()
 {
-    in.SeekI(4); // Magic number
-    int version = 0;
-    if (!ReadInt(in, version))
-        return false;
-    int i = 0;
-    if (version != 0x01)
-    {
-        return false;
-    }
-    tokenDatabase.Clear();
-    int read_count = 0;
-
-    wxMutexLocker(tokenDatabase.m_Mutex);
-    while (in.CanRead())
+    wxMutexLocker lock(m_Mutex);
+    for (int i = 0; i < 2; ++i)
     {
-        int packetType = 0;
-        if (!ReadInt(in, packetType))
-            return false;
-        switch (packetType)
-        {
-        case ClTokenPacketType_filenames:
-            if (!ClFilenameDatabase::ReadIn(tokenDatabase.m_FileDB, in))
-                return false;
-            break;
-        case ClTokenPacketType_tokens:
-            int packetCount = 0;
-            if (!ReadInt(in, packetCount))
-                return false;
-            for (i = 0; i < packetCount; ++i)
-            {
-                ClAbstractToken token;
-                if (!ClAbstractToken::ReadIn(token, in))
-                    return false;
-                if (token.fileId != -1)
-                {
-                    //ClTokenId tokId =
-                    tokenDatabase.InsertToken(token);
-                    //fprintf( stdout, " '%s' / '%s' / fId=%d location=%d:%d hash=%d dbEntryId=%d\n", (const char*)token.identifier.mb_str(), (const char*)token.displayName.mbc_str(), token.fileId, token.location.line, token.location.column,  token.tokenHash, tokId );
-                    read_count++;
-                }
-            }
-            break;
-        }
+        if (i > 0)
+            m_pInstances->Publish();
+        Instance& instance = m_pInstances->GetWriteInstance();
+        instance.pTokens->Shrink();
+        instance.pFileTokens->Shrink();
+        instance.identifiers.Shrink();
     }
-    return true;
 }
 
-/** @brief Write the database to an output stream
+/** @brief Remove a token from the token database
  *
- * @param tokenDatabase The database to write
- * @param out Were to write the database to
- * @return true if the operation was successful, false otherwise
+ * @param tokenId const ClTokenId
+ * @return void
  *
+ * The token is removed from the indexes and its slot is put on the free-list, so the next inserted token reuses it.
+ * The slots that are left free are only reclaimed by Compact().
  */
-bool ClTokenDatabase::WriteOut( const ClTokenDatabase& tokenDatabase, wxOutputStream& out )
+void ClTokenDatabase::RemoveToken( const ClTokenId tokenId )
 {
-    int i;
-    int cnt;
-    out.Write("CbCc", 4); // Magic number
-    WriteInt(out, 1); // Version number
-
-    WriteInt(out, ClTokenPacketType_filenames);
-    if (!ClFilenameDatabase::WriteOut(tokenDatabase.m_FileDB, out))
-        return false;
-
-    wxMutexLocker(tokenDatabase.m_Mutex);
-
-    WriteInt(out, ClTokenPacketType_tokens);
-    cnt = tokenDatabase.m_pTokens->GetCount();
+    wxMutexLocker lock(m_Mutex);
+    if (!m_pInstances->GetWriteInstance().pTokens->HasValue(tokenId))
+        return;
+    DoRemoveToken(m_pInstances->GetWriteInstance(), tokenId);
+    m_pInstances->Publish();
+    DoRemoveToken(m_pInstances->GetWriteInstance(), tokenId);
+    m_Generation++;
+}
 
-    WriteInt(out, cnt);
-    uint32_t written_count = 0;
-    for (i = 0; i < cnt; ++i)
+/** @brief Compact the token storage by dropping all free slots and rebuilding the indexes
+ *
+ * @return true if the storage was compacted, false if there was nothing to compact
+ *
+ * Readers keep using the old copy while the new one is compacted. All token ids change, so this
+ * should only run at a point where no token ids are kept, e.g. as an idle job on the job thread.
+ * Other threads must not keep token ids across calls, they get views instead, see SearchSymbols().
+ * The identifiers that no token uses anymore are dropped from the identifier pool, which is rebuilt.
+ */
+bool ClTokenDatabase::Compact()
+{
+    int deadCount = 0;
+    int tokenCount = 0;
     {
-        ClAbstractToken tok = tokenDatabase.m_pTokens->GetValue(i);
-        if (!ClAbstractToken::WriteOut(tok, out))
+        wxMutexLocker lock(m_Mutex);
+        deadCount = m_pInstances->GetWriteInstance().pTokens->GetFreeCount();
+        if (deadCount == 0)
             return false;
-        written_count++;
+        std::vector<int> idMap;
+        for (int i = 0; i < 2; ++i)
+        {
+            if (i > 0)
+                m_pInstances->Publish();
+            Instance& instance = m_pInstances->GetWriteInstance();
+            instance.pTokens->Compact(idMap);
+            instance.pFileTokens->Remap(idMap);
+            std::vector<bool> usedIdentifiers(instance.identifiers.GetCount());
+            for (size_t identifierId = 0; identifierId < usedIdentifiers.size(); ++identifierId)
+                usedIdentifiers[identifierId] = instance.pTokens->HasIdentifier(identifierId);
+            std::vector<int> identifierMap;
+            instance.identifiers.Compact(usedIdentifiers, identifierMap);
+            instance.pTokens->RemapIdentifiers(identifierMap);
+            instance.pTokens->Shrink();
+            instance.pFileTokens->Shrink();
+        }
+        tokenCount = m_pInstances->GetWriteInstance().pTokens->GetCount();
+        m_Generation++;
     }
-    CCLogger::Get()->DebugLog(F(_T("Wrote token database: %d tokens"), written_count));
+    CCLogger::Get()->DebugLog(F(_T("Compacted token database: %d dead tokens removed, %d tokens left"), deadCount, tokenCount));
     return true;
 }
 
-/** @brief Clear the token database
+/** @brief Get the number of token slots, including the free ones
+ *
+ * @return unsigned long
  *
  */
-void ClTokenDatabase::Clear()
+unsigned long ClTokenDatabase::GetTokenCount() const
 {
-    wxMutexLocker lock(m_Mutex);
-    delete m_pTokens;
-    delete m_pFileTokens;
-    m_pTokens = new ClTreeMap<ClAbstractToken>(),
-    m_pFileTokens = new ClTreeMap<int>();
+    ClLeftRight<Instance>::Reader instance(*m_pInstances);
+    return instance->pTokens->GetCount();
 }
 
-/** @brief Get an ID for a filename. Creates a new ID if the filename was not known yet.
+/** @brief Get the number of indexed references
  *
- * @param filename Full path to the filename
- * @return ClFileId
+ * @return unsigned long
  *
  */
-ClFileId ClTokenDatabase::GetFilenameId(const wxString& filename) const
+unsigned long ClTokenDatabase::GetReferenceCount() const
 {
-    return m_FileDB.GetFilenameId(filename);
+    ClLeftRight<Instance>::Reader instance(*m_pInstances);
+    return instance->referenceCount;
 }
 
-/** @brief Get the filename that is known with an ID
+/** @brief Get the number of free token slots
  *
- * @param fId The file ID
- * @return Full path to the file
+ * @return unsigned long
  *
  */
-wxString ClTokenDatabase::GetFilename(ClFileId fId) const
+unsigned long ClTokenDatabase::GetDeadTokenCount() const
 {
-    return m_FileDB.GetFilename(fId);
+    ClLeftRight<Instance>::Reader instance(*m_pInstances);
+    return instance->pTokens->GetFreeCount();
 }
 
-/** @brief Get the timestamp of the filename entry when the file was last parsed
+/** @brief Get the modification counter of the database
  *
- * @param fId The file id
- * @return wxDateTime object which represents a timestamp
+ * @return unsigned long
  *
+ * Does not lock, so it never waits for a writer. A modification in progress is counted once it completed.
  */
-wxDateTime ClTokenDatabase::GetFilenameTimestamp( const ClFileId fId ) const
+unsigned long ClTokenDatabase::GetGeneration() const
 {
-    return m_FileDB.GetFilenameTimestamp(fId);
+    return m_Generation.load();
 }
 
-/** @brief Insert or update a token into the token database
+/** @brief Replace the tokens of a set of files
  *
- * @param token The token to insert/update
- * @return ClTokenId of the updated token or if the token allready existed the newly inserted token
+ * @param fileTokens const ClFileTokenMap& The new tokens per file
+ * @param fileReferences const ClFileReferenceMap& The new references per file
+ * @param fileRelations const ClFileRelationMap& The new base class and override edges per file
+ * @param fileTimestamps const std::map<ClFileId, wxDateTime>& The files to replace the tokens of, with the stamp of the file contents the tokens were collected from. Invalid if not from disk
+ * @return void
  *
+ * A file that has no entry in fileTokens, fileReferences or fileRelations loses all its tokens, references or relations. The whole batch is published at once.
  */
-ClTokenId ClTokenDatabase::InsertToken( const ClAbstractToken& token )
+void ClTokenDatabase::Update( const ClFileTokenMap& fileTokens, const ClFileReferenceMap& fileReferences, const ClFileRelationMap& fileRelations,
+                              const std::map<ClFileId, wxDateTime>& fileTimestamps )
 {
-    wxMutexLocker lock(m_Mutex);
-
-    ClTokenId tId = GetTokenId(token.identifier, token.fileId, token.tokenType, token.tokenHash);
-    if (tId == wxNOT_FOUND)
+    ReferenceTableMap references;
+    for (ClFileReferenceMap::const_iterator fileIt = fileReferences.begin(); fileIt != fileReferences.end(); ++fileIt)
     {
-        tId = m_pTokens->Insert(wxString(token.identifier), token);
-        wxString filen = wxString::Format(wxT("%d"), token.fileId);
-        m_pFileTokens->Insert(filen, tId);
+        if (fileTimestamps.find(fileIt->first) == fileTimestamps.end())
+            continue;
+        ReferenceTable& table = references[fileIt->first];
+        table.reserve(fileIt->second.size());
+        for (ClTokenReferenceList::const_iterator it = fileIt->second.begin(); it != fileIt->second.end(); ++it)
+        {
+            ReferenceRecord record;
+            record.usrHash = it->usrHash;
+            record.offset = it->offset;
+            record.line = it->location.line;
+            record.column = it->location.column;
+            record.cursorKind = it->cursorKind;
+            table.push_back(record);
+        }
+        std::sort(table.begin(), table.end());
+        table.erase(std::unique(table.begin(), table.end()), table.end());
     }
-    return tId;
+    RelationTableMap relations;
+    for (ClFileRelationMap::const_iterator fileIt = fileRelations.begin(); fileIt != fileRelations.end(); ++fileIt)
+    {
+        if (fileTimestamps.find(fileIt->first) == fileTimestamps.end())
+            continue;
+        RelationTable& table = relations[fileIt->first];
+        table.reserve(fileIt->second.size());
+        for (ClTokenRelationList::const_iterator it = fileIt->second.begin(); it != fileIt->second.end(); ++it)
+        {
+            RelationRecord record;
+            record.fromHash = it->fromHash;
+            record.toHash = it->toHash;
+            record.line = it->location.line;
+            record.column = it->location.column;
+            record.kind = it->kind;
+            record.reserved = 0;
+            table.push_back(record);
+        }
+        std::sort(table.begin(), table.end());
+        table.erase(std::unique(table.begin(), table.end()), table.end());
+    }
+    {
+        wxMutexLocker lock(m_Mutex);
+        DoUpdate(m_pInstances->GetWriteInstance(), fileTokens, references, relations, fileTimestamps);
+        m_pInstances->Publish();
+        DoUpdate(m_pInstances->GetWriteInstance(), fileTokens, references, relations, fileTimestamps);
+        m_Generation++;
+    }
+    for (std::map<ClFileId, wxDateTime>::const_iterator it = fileTimestamps.begin(); it != fileTimestamps.end(); ++it)
+        m_FileDB.UpdateFilenameTimestamp(it->first, it->second);
 }
 
-/** @brief Find a token ID by value
+/** @brief Find a token ID by value in one copy of the database
  *
+ * @param instance const Instance& The copy to search
  * @param identifier const wxString&
- * @param fileId ClFileId
- * @param tokenType ClTokenType
- * @param tokenHash unsigned
+ * @param fileId ClFileId wxNOT_FOUND matches any file
+ * @param tokenType ClTokenType ClTokenType_Unknown matches any type
+ * @param tokenHash ClUSRHash
  * @return ClTokenId
  *
  */
-ClTokenId ClTokenDatabase::GetTokenId( const wxString& identifier, ClFileId fileId, ClTokenType tokenType, unsigned tokenHash ) const
+ClTokenId ClTokenDatabase::DoGetTokenId( const Instance& instance, const wxString& identifier, ClFileId fileId, ClTokenType tokenType, ClUSRHash tokenHash )
 {
-    wxMutexLocker lock(m_Mutex);
-    std::vector<int> ids = m_pTokens->GetIdSet(identifier);
+    const int identifierId = instance.identifiers.Find(identifier);
+    if (identifierId == wxNOT_FOUND)
+        return wxNOT_FOUND;
+    const ClTokenStore& tokens = *instance.pTokens;
+    std::vector<int> ids = tokens.GetIdSet(identifierId);
     for (std::vector<int>::const_iterator itr = ids.begin();
             itr != ids.end(); ++itr)
     {
-        if (m_pTokens->HasValue(*itr))
+        if (tokens.HasValue(*itr))
         {
-            ClAbstractToken tok = m_pTokens->GetValue(*itr);
-            if (   (tok.tokenHash == tokenHash)
-                && ((tok.tokenType == tokenType) || (tokenType == ClTokenType_Unknown))
-                && ((tok.fileId == fileId) || (fileId == wxNOT_FOUND)) )
+            if (   (tokens.GetHash(*itr) == tokenHash)
+                && ((tokens.GetType(*itr) == tokenType) || (tokenType == ClTokenType_Unknown))
+                && ((tokens.GetFileId(*itr) == fileId) || (fileId == wxNOT_FOUND)) )
             {
 
                 return *itr;
@@ -561,139 +1852,197 @@ ClTokenId ClTokenDatabase::GetTokenId( const wxString& identifier, ClFileId file
     return wxNOT_FOUND;
 }
 
-/** @brief Get a token with it's ID
+/** @brief Insert a token in one copy of the database, without checking for duplicates
  *
- * @param tId const ClTokenId
- * @return ClAbstractToken
+ * @param instance Instance& The copy to modify
+ * @param token const ClAbstractToken&
+ * @return ClTokenId The id of the new token
  *
- * @note No reference returned for multi-threading reasons
  */
-ClAbstractToken ClTokenDatabase::GetToken(const ClTokenId tId) const
+ClTokenId ClTokenDatabase::DoInsertToken( Instance& instance, const ClAbstractToken& token )
 {
-    wxMutexLocker lock(m_Mutex);
-    assert(m_pTokens->HasValue(tId));
-    return m_pTokens->GetValue(tId);
+    ClTokenId tId = instance.pTokens->Insert(token, instance.identifiers.Intern(token.identifier));
+    instance.pFileTokens->Insert(wxString::Format(wxT("%d"), token.fileId), tId);
+    return tId;
 }
 
-/** @brief Find the token IDs of all matches of an identifier
+/** @brief Remove a token from one copy of the database
  *
- * @param identifier const wxString&
- * @return std::vector<ClTokenId>
+ * @param instance Instance& The copy to modify
+ * @param tokenId const ClTokenId
+ * @return void
  *
  */
-std::vector<ClTokenId> ClTokenDatabase::GetTokenMatches(const wxString& identifier) const
+void ClTokenDatabase::DoRemoveToken( Instance& instance, const ClTokenId tokenId )
 {
-    wxMutexLocker lock(m_Mutex);
-    return m_pTokens->GetIdSet(identifier);
+    if (!instance.pTokens->HasValue(tokenId))
+        return;
+    wxString key = wxString::Format(wxT("%d"), instance.pTokens->GetFileId(tokenId));
+    instance.pFileTokens->Remove(key, tokenId);
+    instance.pTokens->Remove(tokenId);
 }
 
-/** @brief Get all tokens linked to a file ID
+/** @brief Replace the tokens of a set of files in one copy of the database
  *
- * @param fId const ClFileId
- * @return std::vector<ClTokenId>
+ * @param instance Instance& The copy to modify
+ * @param fileTokens const ClFileTokenMap& The new tokens per file
+ * @param fileReferences const ReferenceTableMap& The new sorted references per file
+ * @param fileRelations const RelationTableMap& The new sorted relations per file
+ * @param fileTimestamps const std::map<ClFileId, wxDateTime>& The files to replace the tokens of
+ * @return void
  *
+ * Tokens that are still present keep their id and are moved to their new location, only the tokens that disappeared are removed.
  */
-std::vector<ClTokenId> ClTokenDatabase::GetFileTokens(const ClFileId fId) const
+void ClTokenDatabase::DoUpdate( Instance& instance, const ClFileTokenMap& fileTokens, const ReferenceTableMap& fileReferences,
+                                const RelationTableMap& fileRelations, const std::map<ClFileId, wxDateTime>& fileTimestamps )
 {
-    wxMutexLocker lock(m_Mutex);
-    wxString key = wxString::Format(wxT("%d"), fId);
-    std::vector<ClTokenId> tokens = m_pFileTokens->GetIdSet(key);
-
-    return tokens;
+    static const ClAbstractTokenList noTokens;
+    static const ReferenceTable noReferences;
+    static const RelationTable noRelations;
+    for (std::map<ClFileId, wxDateTime>::const_iterator fileIt = fileTimestamps.begin(); fileIt != fileTimestamps.end(); ++fileIt)
+    {
+        const ClFileId fileId = fileIt->first;
+        ReferenceTableMap::const_iterator referencesIt = fileReferences.find(fileId);
+        DoSetReferences(instance, fileId, (referencesIt == fileReferences.end()) ? noReferences : referencesIt->second);
+        RelationTableMap::const_iterator relationsIt = fileRelations.find(fileId);
+        DoSetRelations(instance, fileId, (relationsIt == fileRelations.end()) ? noRelations : relationsIt->second);
+        ClFileTokenMap::const_iterator tokensIt = fileTokens.find(fileId);
+        const ClAbstractTokenList& newTokens = (tokensIt == fileTokens.end()) ? noTokens : tokensIt->second;
+        std::vector<ClTokenId> oldTokenIds = instance.pFileTokens->GetIdSet(wxString::Format(wxT("%d"), fileId));
+        std::vector<ClTokenId> keptTokenIds;
+        keptTokenIds.reserve(newTokens.size());
+        for (ClAbstractTokenList::const_iterator it = newTokens.begin(); it != newTokens.end(); ++it)
+        {
+            ClTokenId tId = DoGetTokenId(instance, it->identifier, fileId, it->tokenType, it->tokenHash);
+            if (tId == wxNOT_FOUND)
+                tId = DoInsertToken(instance, *it);
+            else
+                instance.pTokens->SetLocation(tId, it->location); // e.g. lines were inserted above the declaration
+            keptTokenIds.push_back(tId);
+        }
+        std::sort(keptTokenIds.begin(), keptTokenIds.end());
+        for (std::vector<ClTokenId>::const_iterator it = oldTokenIds.begin(); it != oldTokenIds.end(); ++it)
+        {
+            if (!std::binary_search(keptTokenIds.begin(), keptTokenIds.end(), *it))
+                DoRemoveToken(instance, *it);
+        }
+    }
 }
 
-/** @brief Shrink the database to reclaim some memory
+/** @brief Replace all tokens of one copy of the database
  *
+ * @param instance Instance& The copy to modify
+ * @param tokens const ClAbstractTokenList& The new tokens, inserted in this order
+ * @param fileReferences const ReferenceTableMap& The new sorted references per file
+ * @param fileRelations const RelationTableMap& The new sorted relations per file
  * @return void
  *
  */
-void ClTokenDatabase::Shrink()
+void ClTokenDatabase::DoReplace( Instance& instance, const ClAbstractTokenList& tokens, const ReferenceTableMap& fileReferences,
+                                 const RelationTableMap& fileRelations )
 {
-    wxMutexLocker lock(m_Mutex);
-    m_pTokens->Shrink();
-    m_pFileTokens->Shrink();
+    instance.Clear();
+    for (ReferenceTableMap::const_iterator it = fileReferences.begin(); it != fileReferences.end(); ++it)
+        DoSetReferences(instance, it->first, it->second);
+    for (RelationTableMap::const_iterator it = fileRelations.begin(); it != fileRelations.end(); ++it)
+        DoSetRelations(instance, it->first, it->second);
+    uint32_t identifierId = 0;
+    for (ClAbstractTokenList::const_iterator it = tokens.begin(); it != tokens.end(); ++it)
+    {
+        // Equal identifiers are usually adjacent
+        if ((it == tokens.begin()) || (it->identifier != (it - 1)->identifier))
+            identifierId = instance.identifiers.Intern(it->identifier);
+        ClTokenId tId = instance.pTokens->Insert(*it, identifierId);
+        instance.pFileTokens->Insert(wxString::Format(wxT("%d"), it->fileId), tId);
+    }
+    instance.pTokens->Shrink();
+    instance.pFileTokens->Shrink();
+    instance.identifiers.Shrink();
 }
 
-/** @brief Update a token that was previously cleared
+/** @brief Replace the references of a file in one copy of the database
  *
- * @param freeTokenId const ClTokenId
- * @param token const ClAbstractToken&
+ * @param instance Instance& The copy to modify
+ * @param fileId const ClFileId
+ * @param references const ReferenceTable& The new references, sorted
+ * @return void
  *
  */
-void ClTokenDatabase::UpdateToken( const ClTokenId freeTokenId, const ClAbstractToken& token )
+void ClTokenDatabase::DoSetReferences( Instance& instance, const ClFileId fileId, const ReferenceTable& references )
 {
-    ClAbstractToken tokenRef = m_pTokens->GetValue(freeTokenId);
-    m_pTokens->RemoveIdKey(tokenRef.identifier, freeTokenId);
-    assert((tokenRef.fileId == wxNOT_FOUND) && "Only an unused token can be updated");
-    tokenRef.fileId = token.fileId;
-    tokenRef.identifier = token.identifier;
-    tokenRef.location = token.location;
-    tokenRef.tokenHash = token.tokenHash;
-    tokenRef.tokenType = token.tokenType;
-    wxString filen = wxString::Format(wxT("%d"), token.fileId);
-    m_pFileTokens->Insert(filen, freeTokenId);
+    if (fileId < 0)
+        return;
+    if (fileId >= (ClFileId)instance.fileReferences.size())
+    {
+        if (references.empty())
+            return;
+        instance.fileReferences.resize(fileId + 1);
+    }
+    ReferenceTable& table = instance.fileReferences[fileId];
+    instance.referenceCount -= table.size();
+    instance.referenceCount += references.size();
+    table = references;
 }
 
-/** @brief Remove a token from the token database
+/** @brief Erase one edge from an adjacency list
  *
- * @param tokenId const ClTokenId
+ * @param graph The adjacency list
+ * @param key uint64_t The declaration the edge is listed under
+ * @param usrHash uint64_t The other end of the edge
+ * @param fileId ClFileId
+ * @param kind int32_t
  * @return void
  *
- * This will not remove the token, it will only clear it in memory and will later on be reused.
  */
-void ClTokenDatabase::RemoveToken( const ClTokenId tokenId )
-{
-    ClAbstractToken oldToken = GetToken(tokenId);
-    wxString key = wxString::Format(wxT("%d"), oldToken.fileId);
-    m_pFileTokens->Remove(key, tokenId);
-    ClAbstractToken t;
-    // We just invalidate it here. Real removal is rather complex
-    UpdateToken(tokenId, t);
-}
-
-unsigned long ClTokenDatabase::GetTokenCount()
+template<typename _TpGraph>
+static void EraseRelationEdge(_TpGraph& graph, uint64_t key, uint64_t usrHash, ClFileId fileId, int32_t kind)
 {
-    return m_pTokens->GetCount();
+    std::pair<typename _TpGraph::iterator, typename _TpGraph::iterator> range = graph.equal_range(key);
+    for (typename _TpGraph::iterator it = range.first; it != range.second; ++it)
+    {
+        if ((it->second.usrHash == usrHash) && (it->second.fileId == fileId) && (it->second.kind == kind))
+        {
+            graph.erase(it);
+            return;
+        }
+    }
 }
 
-/** @brief Update the tokendatabase with data from another token database
+/** @brief Replace the relations declared in a file in one copy of the database
  *
+ * @param instance Instance& The copy to modify
  * @param fileId const ClFileId
- * @param db const ClTokenDatabase&
+ * @param relations const RelationTable& The new relations, sorted and without duplicates
  * @return void
  *
+ * Keeps the adjacency lists in both directions up to date.
  */
-void ClTokenDatabase::Update( const ClFileId fileId, const ClTokenDatabase& db )
+void ClTokenDatabase::DoSetRelations( Instance& instance, const ClFileId fileId, const RelationTable& relations )
 {
-    assert( &db.m_FileDB == &m_FileDB );
-    int i;
-    std::vector<ClTokenId> oldTokenIds;
-    wxString filename = GetFilename(fileId);
-    wxFileName fln(filename);
-    wxDateTime timestamp = fln.GetModificationTime();
+    std::map<ClFileId, RelationTable>::iterator tableIt = instance.fileRelations.find(fileId);
+    if (tableIt != instance.fileRelations.end())
     {
-        wxMutexLocker lock(m_Mutex);
-        oldTokenIds = GetFileTokens(fileId);
-        int cnt = db.m_pTokens->GetCount();
-        for (i = 0; i < cnt; ++i)
-        {
-            ClAbstractToken tok = db.m_pTokens->GetValue(i);
-            ClTokenId tokId = InsertToken(tok);
-            for(std::vector<ClTokenId>::iterator it = oldTokenIds.begin(); it != oldTokenIds.end(); ++it)
-            {
-                if (*it == tokId)
-                {
-                    it = oldTokenIds.erase(it);
-                    break;
-                }
-            }
-        }
-        for (std::vector<ClTokenId>::iterator it = oldTokenIds.begin(); it != oldTokenIds.end(); ++it)
+        const RelationTable& oldRelations = tableIt->second;
+        for (RelationTable::const_iterator it = oldRelations.begin(); it != oldRelations.end(); ++it)
         {
-            ClAbstractToken tok = db.m_pTokens->GetValue(*it);
-            CCLogger::Get()->DebugLog(F(_T("Removing token in %s type=%d from database, "), (const char*)filename.mb_str(), (int)tok.tokenType));
-            RemoveToken( *it );
+            EraseRelationEdge(instance.outgoingRelations, it->fromHash, it->toHash, fileId, it->kind);
+            EraseRelationEdge(instance.incomingRelations, it->toHash, it->fromHash, fileId, it->kind);
         }
+        instance.fileRelations.erase(tableIt);
+    }
+    if (relations.empty())
+        return;
+    instance.fileRelations[fileId] = relations;
+    for (RelationTable::const_iterator it = relations.begin(); it != relations.end(); ++it)
+    {
+        Instance::RelationEdge edge;
+        edge.fileId = fileId;
+        edge.line = it->line;
+        edge.column = it->column;
+        edge.kind = it->kind;
+        edge.usrHash = it->toHash;
+        instance.outgoingRelations.insert(std::make_pair(it->fromHash, edge));
+        edge.usrHash = it->fromHash;
+        instance.incomingRelations.insert(std::make_pair(it->toHash, edge));
     }
-    m_FileDB.UpdateFilenameTimestamp(fileId, timestamp);
 }
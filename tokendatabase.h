@@ -3,33 +3,146 @@
 
 #include "clangpluginapi.h"
 
+#include <atomic>
+#include <map>
 #include <vector>
+#include <stdint.h>
 #include <wx/thread.h>
 #include <wx/string.h>
-#include <wx/archive.h>
+#include <wx/datetime.h>
 
-template<typename _Tp> class ClTreeMap;
+template<typename _TpInstance> class ClLeftRight;
 class wxString;
 typedef int ClFileId;
+typedef uint64_t ClUSRHash; ///< 64 bit hash of the Unified Symbol Resolution of a declaration
 
 struct ClAbstractToken
 {
     ClAbstractToken() :
         tokenType(ClTokenType_Unknown), fileId(-1), location(ClTokenPosition( 0, 0 )), identifier(), tokenHash(0) {}
-    ClAbstractToken(ClTokenType typ, ClFileId fId, ClTokenPosition loc, wxString name, unsigned tknHash) :
+    ClAbstractToken(ClTokenType typ, ClFileId fId, ClTokenPosition loc, wxString name, ClUSRHash tknHash) :
         tokenType(typ), fileId(fId), location(loc), identifier(name), tokenHash(tknHash) {}
     ClAbstractToken( const ClAbstractToken& other ) :
         tokenType(other.tokenType), fileId(other.fileId), location(other.location),
         identifier(other.identifier), tokenHash(other.tokenHash) {}
 
-    static bool ReadIn(ClAbstractToken& token, wxInputStream& in);
-    static bool WriteOut(const ClAbstractToken& token,  wxOutputStream& out);
-
     ClTokenType tokenType;
     ClFileId fileId;
     ClTokenPosition location;
     wxString identifier;
-    unsigned tokenHash;
+    ClUSRHash tokenHash;
+};
+
+typedef std::vector<ClAbstractToken> ClAbstractTokenList;
+typedef std::map<ClFileId, ClAbstractTokenList> ClFileTokenMap;
+
+/** @brief A use or declaration of a symbol, recorded by the indexer
+ */
+struct ClTokenReference
+{
+    ClTokenReference(ClUSRHash usr, ClFileId fId, unsigned off, const ClTokenPosition& loc, int kind) :
+        usrHash(usr), fileId(fId), offset(off), location(loc), cursorKind(kind) {}
+
+    ClUSRHash usrHash;        ///< The referenced declaration
+    ClFileId fileId;
+    unsigned offset;          ///< Byte offset in the file
+    ClTokenPosition location;
+    int cursorKind;           ///< CXCursorKind of the reference, a declaration kind for the declarations themselves
+};
+
+typedef std::vector<ClTokenReference> ClTokenReferenceList;
+typedef std::map<ClFileId, ClTokenReferenceList> ClFileReferenceMap;
+
+enum ClTokenRelationKind
+{
+    ClTokenRelation_Base = 0,     ///< A class derives from a base class
+    ClTokenRelation_Override = 1  ///< A method overrides a virtual method
+};
+
+/** @brief An edge in the class hierarchy or override graph, recorded by the indexer
+ */
+struct ClTokenRelation
+{
+    ClTokenRelation(ClUSRHash from, ClUSRHash to, ClTokenRelationKind knd, ClFileId fId, const ClTokenPosition& loc) :
+        fromHash(from), toHash(to), kind(knd), fileId(fId), location(loc) {}
+
+    ClUSRHash fromHash;       ///< The derived class or overriding method
+    ClUSRHash toHash;         ///< The base class or overridden method
+    ClTokenRelationKind kind;
+    ClFileId fileId;          ///< Where the derived class or overriding method is declared
+    ClTokenPosition location;
+};
+
+typedef std::vector<ClTokenRelation> ClTokenRelationList;
+typedef std::map<ClFileId, ClTokenRelationList> ClFileRelationMap;
+
+/** @brief State of an incremental symbol search, see ClTokenDatabase::SearchSymbols()
+ *
+ * Remembers the identifiers that matched the previous pattern, so typing one more character only
+ * matches those again.
+ */
+class ClSymbolSearch
+{
+public:
+    ClSymbolSearch() :
+        m_PoolGeneration(0),
+        m_IdentifierCount(0) {}
+    void Reset()
+    {
+        m_Pattern.Clear();
+        m_Candidates.clear();
+        m_PoolGeneration = 0;
+        m_IdentifierCount = 0;
+    }
+private:
+    friend class ClTokenDatabase;
+
+    wxString m_Pattern;
+    std::vector<uint32_t> m_Candidates; ///< Identifier ids that match m_Pattern
+    unsigned long m_PoolGeneration;     ///< Generation of the identifier pool the ids belong to
+    size_t m_IdentifierCount;           ///< Size of the identifier pool when the candidates were collected
+};
+
+/** @brief Read-only view on a token in the token database
+ *
+ * Holds its own copy of the identifier, so the view stays valid when the token is removed or the
+ * database is modified or compacted.
+ */
+class ClTokenView
+{
+public:
+    ClTokenType GetType() const
+    {
+        return m_TokenType;
+    }
+    ClFileId GetFileId() const
+    {
+        return m_FileId;
+    }
+    ClTokenPosition GetLocation() const
+    {
+        return ClTokenPosition(m_Line, m_Column);
+    }
+    ClUSRHash GetHash() const
+    {
+        return m_TokenHash;
+    }
+    const wxString& GetIdentifier() const
+    {
+        return m_Identifier;
+    }
+private:
+    friend class ClTokenDatabase;
+    // Deep copy, the view is handed to other threads
+    ClTokenView(ClTokenType typ, ClFileId fId, unsigned line, unsigned column, ClUSRHash tknHash, const wxString& identifier) :
+        m_TokenType(typ), m_FileId(fId), m_Line(line), m_Column(column), m_TokenHash(tknHash), m_Identifier(identifier.c_str()) {}
+
+    ClTokenType m_TokenType;
+    ClFileId m_FileId;
+    unsigned m_Line;
+    unsigned m_Column;
+    ClUSRHash m_TokenHash;
+    wxString m_Identifier;
 };
 
 class ClFilenameEntry
@@ -42,24 +155,39 @@ public:
     wxDateTime timestamp;
 };
 
+/** @brief Database of filenames, identified by a ClFileId
+ *
+ * Lookups do not take a lock, they read a published copy of the database. Only adding a
+ * new filename and updating a timestamp are serialized.
+ */
 class ClFilenameDatabase
 {
 public:
     ClFilenameDatabase();
     ~ClFilenameDatabase();
 
-    static bool ReadIn(ClFilenameDatabase& tokenDatabase, wxInputStream& in);
-    static bool WriteOut(const ClFilenameDatabase& db, wxOutputStream& out);
-
     ClFileId GetFilenameId(const wxString& filename) const;
     wxString GetFilename(const ClFileId fId) const;
     const wxDateTime GetFilenameTimestamp(const ClFileId fId) const;
     void UpdateFilenameTimestamp(const ClFileId fId, const wxDateTime& timestamp);
+    int GetFilenameCount() const;
 private:
-    ClTreeMap<ClFilenameEntry>* m_pFileEntries;
-    mutable wxMutex m_Mutex;
+    struct Instance;
+    ClFilenameDatabase(const ClFilenameDatabase&);
+    ClFilenameDatabase& operator=(const ClFilenameDatabase&);
+
+    static void DoInsert(Instance& instance, const ClFileId fId, const wxString& spelling, const wxString& normFile);
+
+    ClLeftRight<Instance>* m_pInstances;
+    mutable wxMutex m_Mutex; ///< Serializes the writers
 };
 
+/** @brief Database of the tokens of all parsed files
+ *
+ * All queries are lock-free: they read a published copy of the database and never wait for an
+ * update in progress. Modifications are serialized, applied to the unpublished copy, published
+ * and then applied to the other copy once its last reader has left.
+ */
 class ClTokenDatabase
 {
 public:
@@ -67,31 +195,61 @@ public:
     ClTokenDatabase(const ClTokenDatabase& other);
     ~ClTokenDatabase();
 
-    friend void swap(ClTokenDatabase& first, ClTokenDatabase& second);
-
-
-    static bool ReadIn(ClTokenDatabase& tokenDatabase, wxInputStream& in);
-    static bool WriteOut(const ClTokenDatabase& tokenDatabase, wxOutputStream& out);
+    /**
+     * Replace the tokens by the ones stored in a file written by WriteOut()
+     */
+    static bool ReadIn(ClTokenDatabase& tokenDatabase, const wxString& filename);
+    /**
+     * Atomically write the database to a file
+     */
+    static bool WriteOut(const ClTokenDatabase& tokenDatabase, const wxString& filename);
 
     ClFileId GetFilenameId(const wxString& filename) const;
     wxString GetFilename(const ClFileId fId) const;
     wxDateTime GetFilenameTimestamp(const ClFileId fId) const;
-    ClTokenId GetTokenId(const wxString& identifier, ClFileId fId, ClTokenType tokenType, unsigned tokenHash) const; ///< returns wxNOT_FOUND on failure
+    ClTokenId GetTokenId(const wxString& identifier, ClFileId fId, ClTokenType tokenType, ClUSRHash tokenHash) const; ///< returns wxNOT_FOUND on failure
     ClTokenId InsertToken(const ClAbstractToken& token); // duplicate tokens are discarded
-    ClAbstractToken GetToken(const ClTokenId tId) const;
+    ClTokenView GetToken(const ClTokenId tId) const;
     ClFilenameDatabase& GetFileDB() const
     {
         return m_FileDB;
     }
+    /**
+     * Remove a token, its slot is put on the free-list and reused by the next insert
+     */
     void RemoveToken(const ClTokenId tokenId);
     /**
      * Return a list of tokenId's for the given token identifier
      */
     std::vector<ClTokenId> GetTokenMatches(const wxString& identifier) const;
+    /**
+     * Return a list of tokenId's whose identifier starts with the given prefix, ordered on identifier
+     */
+    std::vector<ClTokenId> GetTokensByPrefix(const wxString& prefix, size_t maxCount = 0) const;
+    /**
+     * Return the (tokenId, rank) pairs of the best fuzzy matches of the given pattern, best match first
+     */
+    void GetTokenMatchesFuzzy(const wxString& pattern, size_t maxCount, std::vector< std::pair<ClTokenId, int> >& out_matches) const;
+    /**
+     * Incremental version of GetTokenMatchesFuzzy() for symbol pickers, ranks on match quality and token kind
+     */
+    void SearchSymbols(ClSymbolSearch& search, const wxString& pattern, size_t maxCount, std::vector<ClTokenView>& out_tokens) const;
     /**
      * Return a list of tokenId's that are found in the given file
      */
     std::vector<ClTokenId> GetFileTokens(const ClFileId fId) const;
+    /**
+     * Return all indexed references to a declaration in all files, ordered on file and offset
+     */
+    void GetReferences(ClUSRHash usrHash, ClTokenReferenceList& out_references) const;
+    /**
+     * Return the direct relations that start at a declaration: the bases of a class or the methods a method overrides
+     */
+    void GetRelationsFrom(ClUSRHash fromHash, ClTokenRelationKind kind, ClTokenRelationList& out_relations) const;
+    /**
+     * Return the direct relations that end at a declaration: the classes derived from a class or the methods overriding a method
+     */
+    void GetRelationsTo(ClUSRHash toHash, ClTokenRelationKind kind, ClTokenRelationList& out_relations) const;
 
     /**
      * Clears the database
@@ -101,19 +259,54 @@ public:
      * Shrinks the database by removing all unnecessary elements and memory
      */
     void Shrink();
+    /**
+     * Compacts the database by dropping the removed token slots. This renumbers all tokens!
+     */
+    bool Compact();
 
     /**
-     * Updates the data from the argument into the database. This invalidates any token previously present in the database, replacing it by the matching token from the merged-in database.
+     * Replaces the tokens, references and relations of a set of files in one update. Tokens that did not change keep their id, readers see either all old or all new tokens.
      */
-    void Update(const ClFileId fileId, const ClTokenDatabase& db);
-    unsigned long GetTokenCount();
-private:
-    void UpdateToken(const ClTokenId tokenId, const ClAbstractToken& token);
+    void Update(const ClFileTokenMap& fileTokens, const ClFileReferenceMap& fileReferences, const ClFileRelationMap& fileRelations,
+                const std::map<ClFileId, wxDateTime>& fileTimestamps);
+    unsigned long GetTokenCount() const;
+    /**
+     * Return the number of indexed references
+     */
+    unsigned long GetReferenceCount() const;
+    /**
+     * Return the number of removed token slots that are waiting to be reused or compacted
+     */
+    unsigned long GetDeadTokenCount() const;
+    /**
+     * Return a number that changes whenever the database is modified
+     */
+    unsigned long GetGeneration() const;
 private:
+    struct Instance;
+    struct ReferenceRecord;
+    typedef std::vector<ReferenceRecord> ReferenceTable; ///< References of one file, sorted on USR hash and offset
+    typedef std::map<ClFileId, ReferenceTable> ReferenceTableMap;
+    struct RelationRecord;
+    typedef std::vector<RelationRecord> RelationTable; ///< Relations declared in one file, sorted
+    typedef std::map<ClFileId, RelationTable> RelationTableMap;
+    ClTokenDatabase& operator=(const ClTokenDatabase&);
+
+    static ClTokenId DoGetTokenId(const Instance& instance, const wxString& identifier, ClFileId fId, ClTokenType tokenType, ClUSRHash tokenHash);
+    static ClTokenId DoInsertToken(Instance& instance, const ClAbstractToken& token);
+    static void DoRemoveToken(Instance& instance, const ClTokenId tokenId);
+    static void DoUpdate(Instance& instance, const ClFileTokenMap& fileTokens, const ReferenceTableMap& fileReferences,
+                         const RelationTableMap& fileRelations, const std::map<ClFileId, wxDateTime>& fileTimestamps);
+    static void DoReplace(Instance& instance, const ClAbstractTokenList& tokens, const ReferenceTableMap& fileReferences,
+                          const RelationTableMap& fileRelations);
+    static void DoSetReferences(Instance& instance, const ClFileId fileId, const ReferenceTable& references);
+    static void DoSetRelations(Instance& instance, const ClFileId fileId, const RelationTable& relations);
+    void DoGetRelations(ClUSRHash usrHash, ClTokenRelationKind kind, bool incoming, ClTokenRelationList& out_relations) const;
+
     ClFilenameDatabase& m_FileDB;
-    ClTreeMap<ClAbstractToken>* m_pTokens;
-    ClTreeMap<int>* m_pFileTokens;
-    mutable wxMutex m_Mutex;
+    ClLeftRight<Instance>* m_pInstances;
+    std::atomic<unsigned long> m_Generation; ///< Incremented on every modification, only written with m_Mutex held
+    mutable wxMutex m_Mutex; ///< Serializes the writers
 };
 
 #endif // TOKENDATABASE_H
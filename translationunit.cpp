@@ -27,13 +27,31 @@ public:
 
 struct ClangVisitorContext
 {
-    ClangVisitorContext(ClTokenDatabase* pDatabase)
+    ClangVisitorContext(const ClTokenDatabase* pDatabase, ClFileId mainFileId, const ClFunctionScopeMap& knownFunctionScopes) :
+        functionScopesKnown(knownFunctionScopes)
     {
         database = pDatabase;
+        mainFile = mainFileId;
+        lastFile = nullptr;
+        lastFileIt = dirtyFiles.end();
         tokenCount = 0;
+        referenceCount = 0;
     }
-    ClTokenDatabase* database;
+    const ClTokenDatabase* database;
+    ClFileId mainFile;
+    std::vector<ClFileId> unsavedFiles; ///< Sorted
+    std::vector<ClFileId> includeFiles;
+    std::map<CXFile, ClFileId> dirtyFiles; ///< Files that have to be walked, all other files are pruned from the AST walk
+    std::map<CXFile, ClFileId> scopeFiles; ///< Clean files without function scopes in this translation unit yet, only their function scopes are collected
+    const ClFunctionScopeMap& functionScopesKnown; ///< The function scopes the translation unit already has
+    CXFile lastFile; ///< File of the previous cursor, dirtyFiles is only searched when the file changes
+    std::map<CXFile, ClFileId>::const_iterator lastFileIt;
+    std::map<ClFileId, wxDateTime> indexedFiles; ///< Stamp of every walked file, invalid when the file is not parsed from disk
+    ClFileTokenMap fileTokens; ///< Tokens of the walked files
+    ClFileReferenceMap fileReferences; ///< Declarations and uses of symbols in the walked files
+    ClFileRelationMap fileRelations; ///< Base classes and overridden methods declared in the walked files
     unsigned long long tokenCount;
+    unsigned long long referenceCount;
     ClFunctionScopeMap functionScopes;
 };
 
@@ -41,6 +59,7 @@ static void ClInclusionVisitor(CXFile included_file, CXSourceLocation* inclusion
                                unsigned include_len, CXClientData client_data);
 
 static CXChildVisitResult ClAST_Visitor(CXCursor cursor, CXCursor parent, CXClientData client_data);
+static CXChildVisitResult ClReference_Visitor(CXCursor cursor, CXCursor parent, CXClientData client_data);
 
 ClTranslationUnit::ClTranslationUnit(const ClTranslUnitId id, CXIndex clIndex) :
     m_Id(id),
@@ -48,6 +67,8 @@ ClTranslationUnit::ClTranslationUnit(const ClTranslUnitId id, CXIndex clIndex) :
     m_ClIndex(clIndex),
     m_ClTranslUnit(nullptr),
     m_LastCC(nullptr),
+    m_LastCallCC(nullptr),
+    m_LastCallKey(0),
     m_LastPos(-1, -1),
     m_Occupied(false),
     m_LastParsed(wxDateTime::Now())
@@ -59,6 +80,8 @@ ClTranslationUnit::ClTranslationUnit(const ClTranslUnitId id) :
     m_ClIndex(nullptr),
     m_ClTranslUnit(nullptr),
     m_LastCC(nullptr),
+    m_LastCallCC(nullptr),
+    m_LastCallKey(0),
     m_LastPos(-1, -1),
     m_Occupied(true),
     m_LastParsed(wxDateTime::Now())
@@ -71,9 +94,12 @@ ClTranslationUnit::ClTranslationUnit(ClTranslationUnit&& other) :
     m_Id(other.m_Id),
     m_FileId(other.m_FileId),
     m_Files(std::move(other.m_Files)),
+    m_UnsavedFiles(std::move(other.m_UnsavedFiles)),
     m_ClIndex(other.m_ClIndex),
     m_ClTranslUnit(other.m_ClTranslUnit),
     m_LastCC(nullptr),
+    m_LastCallCC(nullptr),
+    m_LastCallKey(0),
     m_LastPos(-1, -1)
 {
     other.m_ClTranslUnit = nullptr;
@@ -85,9 +111,12 @@ ClTranslationUnit::ClTranslationUnit(const ClTranslationUnit& other) :
     m_ClIndex(other.m_ClIndex),
     m_ClTranslUnit(other.m_ClTranslUnit),
     m_LastCC(nullptr),
+    m_LastCallCC(nullptr),
+    m_LastCallKey(0),
     m_LastPos(-1, -1)
 {
     m_Files.swap(const_cast<ClTranslationUnit&>(other).m_Files);
+    m_UnsavedFiles.swap(const_cast<ClTranslationUnit&>(other).m_UnsavedFiles);
     const_cast<ClTranslationUnit&>(other).m_ClTranslUnit = nullptr;
 }
 #endif
@@ -96,6 +125,8 @@ ClTranslationUnit::~ClTranslationUnit()
 {
     if (m_LastCC)
         clang_disposeCodeCompleteResults(m_LastCC);
+    if (m_LastCallCC)
+        clang_disposeCodeCompleteResults(m_LastCallCC);
     if (m_ClTranslUnit)
     {
         clang_disposeTranslationUnit(m_ClTranslUnit);
@@ -120,11 +151,7 @@ CXCodeCompleteResults* ClTranslationUnit::CodeCompleteAt(const wxString& complet
     {
         return nullptr;
     }
-    //if (m_LastPos.Equals(complete_location.line, complete_location.column)&&(m_LastCC)&&m_LastCC->NumResults)
-    //{
-    //    fprintf(stdout,"%s: Returning last CC %d,%d (%d)\n", __PRETTY_FUNCTION__, (int)complete_location.line, (int)complete_location.column,  m_LastCC->NumResults);
-    //    return m_LastCC;
-    //}
+    // Results are reused by the code completion component, which knows whether the buffer changed
     if (m_LastCC)
         clang_disposeCodeCompleteResults(m_LastCC);
     m_LastCC = clang_codeCompleteAt(m_ClTranslUnit, (const char*)complete_filename.ToUTF8(), complete_location.line, complete_location.column,
@@ -150,6 +177,68 @@ CXCodeCompleteResults* ClTranslationUnit::CodeCompleteAt(const wxString& complet
     return m_LastCC;
 }
 
+/** @brief Code completion right after the open parenthesis of a call, for its overload candidates
+ *
+ * Unlike CodeCompleteAt(), this leaves the results that the code completion tokens refer to alone.
+ * The overload candidates only depend on the text in front of the call, so the results are reused
+ * while the arguments are typed: until the call moves, the text in front of it or another unsaved
+ * buffer changes, or the translation unit is reparsed.
+ */
+CXCodeCompleteResults* ClTranslationUnit::CodeCompleteCallAt(const wxString& call_filename, const ClTokenPosition& location,
+                                                             struct CXUnsavedFile* unsaved_files, unsigned num_unsaved_files )
+{
+    if (m_ClTranslUnit == nullptr)
+    {
+        return nullptr;
+    }
+    const wxCharBuffer filename = call_filename.ToUTF8();
+    unsigned long long key = 14695981039346656037ULL;
+    for (const char* pCh = filename.data(); *pCh; ++pCh)
+    {
+        key ^= (unsigned char)*pCh;
+        key *= 1099511628211ULL;
+    }
+    key ^= location.line;
+    key *= 1099511628211ULL;
+    key ^= location.column;
+    key *= 1099511628211ULL;
+    for (unsigned fileIdx = 0; fileIdx < num_unsaved_files; ++fileIdx)
+    {
+        const CXUnsavedFile& unsaved = unsaved_files[fileIdx];
+        unsigned long length = unsaved.Length;
+        if (strcmp(unsaved.Filename, filename.data()) == 0)
+        {
+            // Only the text up to the call, lines and columns are 1 based and count bytes
+            unsigned long offset = 0;
+            for (unsigned line = 1; (line < location.line) && (offset < length); ++offset)
+            {
+                if (unsaved.Contents[offset] == '\n')
+                    ++line;
+            }
+            length = std::min<unsigned long>(length, offset + location.column - 1);
+        }
+        for (const char* pCh = unsaved.Filename; *pCh; ++pCh)
+        {
+            key ^= (unsigned char)*pCh;
+            key *= 1099511628211ULL;
+        }
+        for (unsigned long idx = 0; idx < length; ++idx)
+        {
+            key ^= (unsigned char)unsaved.Contents[idx];
+            key *= 1099511628211ULL;
+        }
+    }
+    if (m_LastCallCC && (key == m_LastCallKey))
+        return m_LastCallCC;
+
+    if (m_LastCallCC)
+        clang_disposeCodeCompleteResults(m_LastCallCC);
+    m_LastCallCC = clang_codeCompleteAt(m_ClTranslUnit, filename.data(), location.line, location.column,
+                                        unsaved_files, num_unsaved_files, clang_defaultCodeCompleteOptions());
+    m_LastCallKey = key;
+    return m_LastCallCC;
+}
+
 const CXCompletionResult* ClTranslationUnit::GetCCResult(unsigned index)
 {
     if (m_LastCC && index < m_LastCC->NumResults)
@@ -178,6 +267,11 @@ void ClTranslationUnit::Parse(const wxString& filename, ClFileId fileId, const s
         clang_disposeCodeCompleteResults(m_LastCC);
         m_LastCC = nullptr;
     }
+    if (m_LastCallCC)
+    {
+        clang_disposeCodeCompleteResults(m_LastCallCC);
+        m_LastCallCC = nullptr;
+    }
     if (m_ClTranslUnit)
     {
         clang_disposeTranslationUnit(m_ClTranslUnit);
@@ -187,10 +281,12 @@ void ClTranslationUnit::Parse(const wxString& filename, ClFileId fileId, const s
     // TODO: check and handle error conditions
     std::vector<CXUnsavedFile> clUnsavedFiles;
     std::vector<wxCharBuffer> clFileBuffer;
+    std::vector<wxString> unsavedFilenames;
     for (std::map<wxString, wxString>::const_iterator fileIt = unsavedFiles.begin();
             fileIt != unsavedFiles.end(); ++fileIt)
     {
         CXUnsavedFile unit;
+        unsavedFilenames.push_back(fileIt->first);
         clFileBuffer.push_back(fileIt->first.ToUTF8());
         unit.Filename = clFileBuffer.back().data();
         clFileBuffer.push_back(fileIt->second.ToUTF8());
@@ -204,6 +300,7 @@ void ClTranslationUnit::Parse(const wxString& filename, ClFileId fileId, const s
     }
     m_FileId = fileId;
     m_Files.push_back( fileId );
+    m_UnsavedFiles.swap(unsavedFilenames);
     m_LastParsed = wxDateTime::Now();
     m_FunctionScopes.clear();
 
@@ -248,12 +345,20 @@ void ClTranslationUnit::Reparse( const std::map<wxString, wxString>& unsavedFile
     {
         return;
     }
+    // Files that are not in the unsaved buffers may have changed on disk
+    if (m_LastCallCC)
+    {
+        clang_disposeCodeCompleteResults(m_LastCallCC);
+        m_LastCallCC = nullptr;
+    }
     std::vector<CXUnsavedFile> clUnsavedFiles;
     std::vector<wxCharBuffer> clFileBuffer;
+    std::vector<wxString> unsavedFilenames;
     for (std::map<wxString, wxString>::const_iterator fileIt = unsavedFiles.begin();
          fileIt != unsavedFiles.end(); ++fileIt)
     {
         CXUnsavedFile unit;
+        unsavedFilenames.push_back(fileIt->first);
         clFileBuffer.push_back(fileIt->first.ToUTF8());
         unit.Filename = clFileBuffer.back().data();
         clFileBuffer.push_back(fileIt->second.ToUTF8());
@@ -285,6 +390,7 @@ void ClTranslationUnit::Reparse( const std::map<wxString, wxString>& unsavedFile
         m_ClTranslUnit = nullptr;
         return;
     }
+    m_UnsavedFiles.swap(unsavedFilenames);
     if (m_LastCC)
     {
         clang_disposeCodeCompleteResults(m_LastCC);
@@ -295,30 +401,56 @@ void ClTranslationUnit::Reparse( const std::map<wxString, wxString>& unsavedFile
     CCLogger::Get()->DebugLog(F(_T("ClTranslationUnit::Reparse id=%d finished"), (int)m_Id));
 }
 
-void ClTranslationUnit::ProcessAllTokens(ClTokenDatabase& database, std::vector<ClFileId>& out_includeFileList, ClFunctionScopeMap& out_functionScopes) const
+/** @brief Walk the AST and collect the tokens and references of all files that changed since they were last indexed
+ *
+ * @param database The database the file ids and timestamps are taken from
+ * @param out_includeFileList All files used by this translation unit, sorted
+ * @param out_fileTokens The tokens of the walked files, may contain duplicates
+ * @param out_fileReferences The declarations and uses of symbols in the walked files, may contain duplicates
+ * @param out_fileRelations The base class and override edges declared in the walked files, may contain duplicates
+ * @param out_indexedFiles The files that were walked and their stamp. Only the tokens of these files are complete
+ * @param out_functionScopes The function scopes of the walked files and of the files this translation unit had no function scopes of yet
+ * @return void
+ *
+ * A file is walked when it is the main file, when it was parsed from an unsaved editor buffer or when its
+ * modification time differs from the timestamp in the filename database. All AST subtrees of other files
+ * are pruned, so the system headers are only walked once. A file that was indexed by another translation unit
+ * is still walked once for its function scopes, without collecting its tokens or references.
+ */
+void ClTranslationUnit::ProcessAllTokens(const ClTokenDatabase& database, std::vector<ClFileId>& out_includeFileList, ClFileTokenMap& out_fileTokens,
+                                         ClFileReferenceMap& out_fileReferences, ClFileRelationMap& out_fileRelations,
+                                         std::map<ClFileId, wxDateTime>& out_indexedFiles, ClFunctionScopeMap& out_functionScopes) const
 {
     if (m_ClTranslUnit == nullptr)
         return;
-    std::pair<std::vector<ClFileId>*, ClTokenDatabase*> visitorData = std::make_pair(&out_includeFileList, &database);
-    clang_getInclusions(m_ClTranslUnit, ClInclusionVisitor, &visitorData);
-    //m_Files.reserve(1024);
-    //m_Files.push_back(m_FileId);
-    //std::sort(m_Files.begin(), m_Files.end());
-    //std::unique(m_Files.begin(), m_Files.end());
+    struct ClangVisitorContext ctx(&database, m_FileId, m_FunctionScopes);
+    for (std::vector<wxString>::const_iterator it = m_UnsavedFiles.begin(); it != m_UnsavedFiles.end(); ++it)
+        ctx.unsavedFiles.push_back(database.GetFilenameId(*it));
+    std::sort(ctx.unsavedFiles.begin(), ctx.unsavedFiles.end());
+    clang_getInclusions(m_ClTranslUnit, ClInclusionVisitor, &ctx);
+
+    out_includeFileList.swap(ctx.includeFiles);
     out_includeFileList.push_back( m_FileId );
     std::sort(out_includeFileList.begin(), out_includeFileList.end());
-    std::unique(out_includeFileList.begin(), out_includeFileList.end());
+    out_includeFileList.erase(std::unique(out_includeFileList.begin(), out_includeFileList.end()), out_includeFileList.end());
 #if __cplusplus >= 201103L
-    //m_Files.shrink_to_fit();
     out_includeFileList.shrink_to_fit();
 #else
-    //std::vector<ClFileId>(m_Files).swap(m_Files);
     std::vector<ClFileId>(out_includeFileList).swap(out_includeFileList);
 #endif
-    struct ClangVisitorContext ctx(&database);
     //unsigned rc =
     clang_visitChildren(clang_getTranslationUnitCursor(m_ClTranslUnit), ClAST_Visitor, &ctx);
-    CCLogger::Get()->DebugLog(F(_T("ClTranslationUnit::UpdateTokenDatabase %d finished: %d tokens processed, %d function scopes"), (int)m_Id, (int)ctx.tokenCount, (int)ctx.functionScopes.size()));
+    CCLogger::Get()->DebugLog(F(_T("ClTranslationUnit::UpdateTokenDatabase %d finished: %d tokens processed, %d references, %d function scopes, %d of %d files walked"),
+                                (int)m_Id, (int)ctx.tokenCount, (int)ctx.referenceCount, (int)ctx.functionScopes.size(), (int)ctx.indexedFiles.size(), (int)out_includeFileList.size()));
+    out_fileTokens.swap(ctx.fileTokens);
+    out_fileReferences.swap(ctx.fileReferences);
+    out_fileRelations.swap(ctx.fileRelations);
+    // Also report the files without function scopes, so they are not walked for their scopes again
+    for (std::map<ClFileId, wxDateTime>::const_iterator it = ctx.indexedFiles.begin(); it != ctx.indexedFiles.end(); ++it)
+        ctx.functionScopes[it->first];
+    for (std::map<CXFile, ClFileId>::const_iterator it = ctx.scopeFiles.begin(); it != ctx.scopeFiles.end(); ++it)
+        ctx.functionScopes[it->second];
+    out_indexedFiles.swap(ctx.indexedFiles);
     out_functionScopes = ctx.functionScopes;
 }
 
@@ -463,12 +595,14 @@ void ClTranslationUnit::UpdateFunctionScopes( const ClFileId fileId, const ClFun
     m_FunctionScopes.insert(std::make_pair(fileId, functionScopes));
 }
 
-/** @brief Calculate a hash from a Clang token
+/** @brief Calculate a hash from a Clang completion string
  *
  * @param token CXCompletionString
  * @param identifier wxString&
  * @return unsigned
  *
+ * Only used to tell apart the declarations with the same identifier when resolving a completion
+ * result, which has no cursor. Tokens in the database are identified by HashCursorUSR().
  */
 unsigned HashToken(CXCompletionString token, wxString& identifier)
 {
@@ -490,6 +624,62 @@ unsigned HashToken(CXCompletionString token, wxString& identifier)
     return hVal;
 }
 
+/** @brief Calculate the identity hash of a declaration
+ *
+ * @param cursor The declaration
+ * @return ClUSRHash 64 bit FNV-1a hash of its USR
+ *
+ * All declarations of the same entity have the same USR, also across translation units. Declarations without
+ * USR (some local declarations) are hashed on their kind, type, name and the file and offset of the declaration
+ * instead, so equally named locals in different scopes do not collide.
+ */
+ClUSRHash HashCursorUSR(CXCursor cursor)
+{
+    ClUSRHash hVal = 14695981039346656037ULL;
+    CXString str = clang_getCursorUSR(cursor);
+    const char* pCh = clang_getCString(str);
+    if (pCh && *pCh)
+    {
+        for (; *pCh; ++pCh)
+        {
+            hVal ^= (unsigned char)*pCh;
+            hVal *= 1099511628211ULL;
+        }
+        clang_disposeString(str);
+        return hVal;
+    }
+    clang_disposeString(str);
+
+    hVal ^= (unsigned)cursor.kind;
+    hVal *= 1099511628211ULL;
+    CXString parts[2] = { clang_getTypeSpelling(clang_getCursorType(cursor)), clang_getCursorSpelling(cursor) };
+    for (int i = 0; i < 2; ++i)
+    {
+        for (pCh = clang_getCString(parts[i]); pCh && *pCh; ++pCh)
+        {
+            hVal ^= (unsigned char)*pCh;
+            hVal *= 1099511628211ULL;
+        }
+        clang_disposeString(parts[i]);
+    }
+    CXFile file = nullptr;
+    unsigned offset = 0;
+    clang_getExpansionLocation(clang_getCursorLocation(cursor), &file, nullptr, nullptr, &offset);
+    if (file)
+    {
+        CXString filename = clang_getFileName(file);
+        for (pCh = clang_getCString(filename); pCh && *pCh; ++pCh)
+        {
+            hVal ^= (unsigned char)*pCh;
+            hVal *= 1099511628211ULL;
+        }
+        clang_disposeString(filename);
+    }
+    hVal ^= offset;
+    hVal *= 1099511628211ULL;
+    return hVal;
+}
+
 /** @brief Static function used in the Clang AST visitor functions
  *
  * @param inclusion_stack
@@ -500,25 +690,187 @@ static void ClInclusionVisitor(CXFile included_file, CXSourceLocation* WXUNUSED(
                                unsigned WXUNUSED(include_len), CXClientData client_data)
 {
     CXString filename = clang_getFileName(included_file);
-    wxFileName inclFile(wxString::FromUTF8(clang_getCString(filename)));
-    if (inclFile.MakeAbsolute())
+    const wxString& inclFile = wxString::FromUTF8(clang_getCString(filename));
+    if (!inclFile.IsEmpty())
     {
-        std::pair<std::vector<ClFileId>*, ClTokenDatabase*>* data = static_cast<std::pair<std::vector<ClFileId>*, ClTokenDatabase*>*>(client_data);
-        ClFileId fileId = data->second->GetFilenameId( inclFile.GetFullPath() );
-        data->first->push_back( fileId );
-        //clTranslUnit->first->AddInclude(clTranslUnit->second->GetFilenameId(inclFile.GetFullPath()));
+        struct ClangVisitorContext* ctx = static_cast<struct ClangVisitorContext*>(client_data);
+        // The filename database makes the path absolute and resolves a known spelling without touching the file system
+        ClFileId fileId = ctx->database->GetFilenameId( inclFile );
+        ctx->includeFiles.push_back( fileId );
+        wxDateTime stamp((time_t)clang_getFileTime(included_file));
+        // The contents of these files may not match the file on disk
+        if ((fileId == ctx->mainFile) || std::binary_search(ctx->unsavedFiles.begin(), ctx->unsavedFiles.end(), fileId))
+            stamp = wxDateTime();
+        if ((!stamp.IsValid()) || (stamp != ctx->database->GetFilenameTimestamp(fileId)))
+        {
+            ctx->dirtyFiles[included_file] = fileId;
+            ctx->indexedFiles[fileId] = stamp;
+        }
+        else if (ctx->functionScopesKnown.find(fileId) == ctx->functionScopesKnown.end())
+            ctx->scopeFiles[included_file] = fileId;
     }
     clang_disposeString(filename);
 }
 
+/** @brief Get the file and position a cursor is indexed at
+ *
+ * @param cursor CXCursor
+ * @param out_line unsigned&
+ * @param out_column unsigned&
+ * @param out_offset unsigned&
+ * @return CXFile The file, nullptr when the cursor is not in a file
+ *
+ * This is the spelling location, except for what a macro expands from its definition: that is indexed
+ * at the macro use. The declaration is made in the file that uses the macro, and the file that defines
+ * the macro may be skipped as clean.
+ */
+static CXFile GetIndexLocation(CXCursor cursor, unsigned& out_line, unsigned& out_column, unsigned& out_offset)
+{
+    CXSourceLocation loc = clang_getCursorLocation(cursor);
+    CXFile expansionFile = nullptr;
+    clang_getExpansionLocation(loc, &expansionFile, &out_line, &out_column, &out_offset);
+    CXFile spellingFile = nullptr;
+    unsigned line = 0, column = 0, offset = 0;
+    clang_getSpellingLocation(loc, &spellingFile, &line, &column, &offset);
+    // Macro arguments are spelled at the macro use
+    if (spellingFile == expansionFile)
+    {
+        out_line = line;
+        out_column = column;
+        out_offset = offset;
+    }
+    return expansionFile;
+}
+
+/** @brief Find the walked file a cursor is indexed in
+ *
+ * @param ctx ClangVisitorContext*
+ * @param clFile CXFile
+ * @return std::map<CXFile, ClFileId>::const_iterator The dirty file, or dirtyFiles.end() when the file is already indexed
+ *
+ */
+static std::map<CXFile, ClFileId>::const_iterator FindDirtyFile(struct ClangVisitorContext* ctx, CXFile clFile)
+{
+    // Consecutive cursors are nearly always spelled in the same file
+    if (clFile != ctx->lastFile)
+    {
+        ctx->lastFile = clFile;
+        ctx->lastFileIt = ctx->dirtyFiles.find(clFile);
+    }
+    return ctx->lastFileIt;
+}
+
+/** @brief Record the declaration or use of a symbol
+ *
+ * @param ctx ClangVisitorContext*
+ * @param cursor CXCursor A declaration, a reference or a reference expression. Other cursors are ignored
+ * @param fileId ClFileId The walked file the cursor is spelled in
+ * @param location const ClTokenPosition&
+ * @param offset unsigned
+ * @return void
+ *
+ */
+static void AddReference(struct ClangVisitorContext* ctx, CXCursor cursor, ClFileId fileId, const ClTokenPosition& location, unsigned offset)
+{
+    if (   !clang_isDeclaration(cursor.kind) && !clang_isReference(cursor.kind)
+        && (cursor.kind != CXCursor_DeclRefExpr) && (cursor.kind != CXCursor_MemberRefExpr) )
+        return;
+    CXCursor referenced = clang_getCursorReferenced(cursor);
+    if (clang_Cursor_isNull(referenced) || !clang_isDeclaration(referenced.kind))
+        return; // e.g. an unresolved overload set
+    ctx->fileReferences[fileId].push_back(ClTokenReference(HashCursorUSR(referenced), fileId, offset, location, cursor.kind));
+    ctx->referenceCount++;
+}
+
+/** @brief Record the base classes of a class or the methods a method overrides
+ *
+ * @param ctx ClangVisitorContext*
+ * @param cursor CXCursor A base specifier or a method. Other cursors are ignored
+ * @param parent CXCursor The class of a base specifier
+ * @param fileId ClFileId The walked file the cursor is spelled in
+ * @param location const ClTokenPosition&
+ * @return void
+ *
+ * Specializations are recorded as their template, so the hierarchy of a template is found from any of its instantiations.
+ */
+static void AddRelations(struct ClangVisitorContext* ctx, CXCursor cursor, CXCursor parent, ClFileId fileId, const ClTokenPosition& location)
+{
+    if (cursor.kind == CXCursor_CXXBaseSpecifier)
+    {
+        CXCursor base = clang_getTypeDeclaration(clang_getCursorType(cursor));
+        CXCursor templ = clang_getSpecializedCursorTemplate(base);
+        if (!clang_Cursor_isNull(templ))
+            base = templ;
+        if (clang_Cursor_isNull(base) || !clang_isDeclaration(base.kind) || !clang_isDeclaration(parent.kind))
+            return;
+        // Listed at the derived class, not at the base specifier
+        unsigned line = location.line, col = location.column, offset = 0;
+        GetIndexLocation(parent, line, col, offset);
+        ctx->fileRelations[fileId].push_back(ClTokenRelation(HashCursorUSR(parent), HashCursorUSR(base), ClTokenRelation_Base,
+                                                             fileId, ClTokenPosition(line, col)));
+    }
+    else if (cursor.kind == CXCursor_CXXMethod)
+    {
+        CXCursor* overridden = nullptr;
+        unsigned overriddenCount = 0;
+        clang_getOverriddenCursors(cursor, &overridden, &overriddenCount);
+        if (overriddenCount == 0)
+            return;
+        const ClUSRHash methodHash = HashCursorUSR(cursor);
+        for (unsigned i = 0; i < overriddenCount; ++i)
+        {
+            ctx->fileRelations[fileId].push_back(ClTokenRelation(methodHash, HashCursorUSR(overridden[i]), ClTokenRelation_Override,
+                                                                 fileId, location));
+        }
+        clang_disposeOverriddenCursors(overridden);
+    }
+}
+
+/** @brief Visitor for the subtrees that only contain references, like function bodies
+ *
+ * @param cursor CXCursor
+ * @param parent CXCursor
+ * @param client_data CXClientData The ClangVisitorContext
+ * @return CXChildVisitResult
+ *
+ */
+static CXChildVisitResult ClReference_Visitor(CXCursor cursor, CXCursor WXUNUSED(parent), CXClientData client_data)
+{
+    struct ClangVisitorContext* ctx = static_cast<struct ClangVisitorContext*>(client_data);
+    unsigned line = 1, col = 1, offset = 0;
+    CXFile clFile = GetIndexLocation(cursor, line, col, offset);
+    std::map<CXFile, ClFileId>::const_iterator fileIt = FindDirtyFile(ctx, clFile);
+    if (clFile && (fileIt != ctx->dirtyFiles.end()))
+        AddReference(ctx, cursor, fileIt->second, ClTokenPosition(line, col), offset);
+    return CXChildVisit_Recurse;
+}
+
 /** @brief Static function used in the Clang AST visitor functions
  *
  * @param parent
  * @return CXChildVisitResult ClAST_Visitor(CXCursor cursor, CXCursor
  *
  */
-static CXChildVisitResult ClAST_Visitor(CXCursor cursor, CXCursor WXUNUSED(parent), CXClientData client_data)
+static CXChildVisitResult ClAST_Visitor(CXCursor cursor, CXCursor parent, CXClientData client_data)
 {
+    struct ClangVisitorContext* ctx = static_cast<struct ClangVisitorContext*>(client_data);
+    unsigned line = 1, col = 1, offset = 0;
+    CXFile clFile = GetIndexLocation(cursor, line, col, offset);
+    std::map<CXFile, ClFileId>::const_iterator fileIt = FindDirtyFile(ctx, clFile);
+    bool scopesOnly = false;
+    if (clFile && (fileIt == ctx->dirtyFiles.end()))
+    {
+        fileIt = ctx->scopeFiles.find(clFile);
+        if (fileIt == ctx->scopeFiles.end())
+            return CXChildVisit_Continue; // The file is already indexed at this stamp
+        scopesOnly = true;
+    }
+    if (clFile && !scopesOnly)
+    {
+        AddReference(ctx, cursor, fileIt->second, ClTokenPosition(line, col), offset);
+        AddRelations(ctx, cursor, parent, fileIt->second, ClTokenPosition(line, col));
+    }
+
     ClTokenType typ = ClTokenType_Unknown;
     CXChildVisitResult ret = CXChildVisit_Break; // should never happen
     switch (cursor.kind)
@@ -567,21 +919,19 @@ static CXChildVisitResult ClAST_Visitor(CXCursor cursor, CXCursor WXUNUSED(paren
         return CXChildVisit_Recurse;
     }
 
-    CXSourceLocation loc = clang_getCursorLocation(cursor);
-    CXFile clFile;
-    unsigned line = 1, col = 1;
-    clang_getSpellingLocation(loc, &clFile, &line, &col, nullptr);
-    CXString str = clang_getFileName(clFile);
-    wxString filename = wxString::FromUTF8(clang_getCString(str));
-    clang_disposeString(str);
-    if (filename.IsEmpty())
+    if (!clFile)
         return ret;
-
-    CXCompletionString token = clang_getCursorCompletionString(cursor);
-    wxString identifier;
-    unsigned tokenHash = HashToken(token, identifier);
+    // Bodies, initializers and types are not walked for tokens, only the uses of symbols in them are indexed
+    if ((ret == CXChildVisit_Continue) && !scopesOnly)
+        clang_visitChildren(cursor, ClReference_Visitor, ctx);
+    CXString str = clang_getCursorSpelling(cursor);
+    wxString identifier = wxString::FromUTF8(clang_getCString(str));
+    clang_disposeString(str);
+    if (identifier.StartsWith(wxT("~")))
+        identifier.Remove(0, 1); // Destructors are found by the class name, like in HashToken()
     if (!identifier.IsEmpty())
     {
+        const ClUSRHash tokenHash = scopesOnly ? 0 : HashCursorUSR(cursor);
         wxString displayName;
         wxString scopeName;
         while (!clang_Cursor_isNull(cursor))
@@ -610,11 +960,12 @@ static CXChildVisitResult ClAST_Visitor(CXCursor cursor, CXCursor WXUNUSED(paren
             }
             cursor = clang_getCursorSemanticParent(cursor);
         }
-        struct ClangVisitorContext* ctx = static_cast<struct ClangVisitorContext*>(client_data);
-        ClFileId fileId = ctx->database->GetFilenameId(filename);
-        ClAbstractToken tok(typ, fileId, ClTokenPosition(line, col), identifier, tokenHash);
-        ctx->database->InsertToken(tok);
-        ctx->tokenCount++;
+        ClFileId fileId = fileIt->second;
+        if (!scopesOnly)
+        {
+            ctx->fileTokens[fileId].push_back(ClAbstractToken(typ, fileId, ClTokenPosition(line, col), identifier, tokenHash));
+            ctx->tokenCount++;
+        }
         if (displayName.Length() > 0)
         {
             if (ctx->functionScopes[fileId].size() > 0)
@@ -11,6 +11,7 @@
 
 
 unsigned HashToken(CXCompletionString token, wxString& identifier);
+ClUSRHash HashCursorUSR(CXCursor cursor);
 
 struct ClFunctionScope
 {
@@ -55,9 +56,12 @@ public:
         swap(first.m_Id, second.m_Id);
         swap(first.m_FileId, second.m_FileId);
         swap(first.m_Files, second.m_Files);
+        swap(first.m_UnsavedFiles, second.m_UnsavedFiles);
         swap(first.m_ClIndex, second.m_ClIndex);
         swap(first.m_ClTranslUnit, second.m_ClTranslUnit);
         swap(first.m_LastCC, second.m_LastCC);
+        swap(first.m_LastCallCC, second.m_LastCallCC);
+        swap(first.m_LastCallKey, second.m_LastCallKey);
         swap(first.m_LastPos.line, second.m_LastPos.line);
         swap(first.m_LastPos.column, second.m_LastPos.column);
         swap(first.m_LastParsed, second.m_LastParsed);
@@ -103,12 +107,17 @@ public:
     CXCodeCompleteResults* CodeCompleteAt( const wxString& complete_filename, const ClTokenPosition& location,
                                            struct CXUnsavedFile* unsaved_files,
                                            unsigned num_unsaved_files );
+    CXCodeCompleteResults* CodeCompleteCallAt( const wxString& call_filename, const ClTokenPosition& location,
+                                               struct CXUnsavedFile* unsaved_files,
+                                               unsigned num_unsaved_files );
     const CXCompletionResult* GetCCResult(unsigned index);
     CXCursor GetTokenAt(const wxString& filename, const ClTokenPosition& location);
     void Parse( const wxString& filename, ClFileId FileId, const std::vector<const char*>& args,
                 const std::map<wxString, wxString>& unsavedFiles );
     void Reparse(const std::map<wxString, wxString>& unsavedFiles);
-    void ProcessAllTokens(ClTokenDatabase& database, std::vector<ClFileId>& out_includeFileList, ClFunctionScopeMap& out_functionScopes) const;
+    void ProcessAllTokens(const ClTokenDatabase& database, std::vector<ClFileId>& out_includeFileList, ClFileTokenMap& out_fileTokens,
+                          ClFileReferenceMap& out_fileReferences, ClFileRelationMap& out_fileRelations,
+                          std::map<ClFileId, wxDateTime>& out_indexedFiles, ClFunctionScopeMap& out_functionScopes) const;
 
     void GetDiagnostics(const wxString& filename, std::vector<ClDiagnostic>& diagnostics);
     CXFile GetFileHandle(const wxString& filename) const;
@@ -122,9 +131,12 @@ private:
     ClTranslUnitId m_Id;
     ClFileId m_FileId; ///< The file that triggered the creation of this TU
     std::vector<ClFileId> m_Files; ///< All files linked to this TU
+    std::vector<wxString> m_UnsavedFiles; ///< Files that were parsed from an editor buffer instead of from disk
     CXIndex m_ClIndex;
     CXTranslationUnit m_ClTranslUnit;
     CXCodeCompleteResults* m_LastCC;
+    CXCodeCompleteResults* m_LastCallCC; ///< Completion at the call of the last call tips, kept apart from the indexed m_LastCC
+    unsigned long long m_LastCallKey; ///< Hash of the file, location and buffer contents m_LastCallCC was computed for
 
     struct FilePos
     {
@@ -2,59 +2,247 @@
  * Data structure for reasonably fast and memory efficient key/value pairs.
  * Intended for use with large token sets (map between wxString and an arbitrary type).
  * Each key can have multiple values.
+ *
+ * Besides exact lookups, the map answers prefix queries and ranked fuzzy
+ * (subsequence) queries, which is what symbol navigation needs.
  */
 
 #include "treemap.h"
 #include <wx/string.h>
 
-//#define USE_TREE_MAP // TODO: see if we actually get a performance change
-
-#ifdef USE_TREE_MAP
 #include <algorithm>
+#include <queue>
 
-struct TreeNode
+// Use the compressed trie, the multimap variant below is the simple reference implementation
+#define USE_TREE_MAP
+
+/** @brief Case fold an ASCII character, identifiers are mostly ASCII so this is all we need for matching
+ */
+static inline wxChar FoldChar(wxChar ch)
+{
+    if (ch >= wxT('A') && ch <= wxT('Z'))
+        return ch + (wxT('a') - wxT('A'));
+    return ch;
+}
+
+/** @brief Map a character on a bit of a 64 bit set, used to quickly reject subtrees in fuzzy queries
+ *
+ * Letters are case folded, so a set built from a key is a superset of the set of the lowercase pattern.
+ */
+static inline unsigned long long CharMask(wxChar ch)
+{
+    if (ch >= wxT('a') && ch <= wxT('z'))
+        return 1ULL << (ch - wxT('a'));
+    if (ch >= wxT('A') && ch <= wxT('Z'))
+        return 1ULL << (ch - wxT('A'));
+    if (ch >= wxT('0') && ch <= wxT('9'))
+        return 1ULL << (26 + ch - wxT('0'));
+    if (ch == wxT('_'))
+        return 1ULL << 36;
+    return 1ULL << (37 + (unsigned)ch % 27);
+}
+
+static unsigned long long StringMask(const wxChar* str, size_t len)
+{
+    unsigned long long mask = 0;
+    for (size_t i = 0; i < len; ++i)
+        mask |= CharMask(str[i]);
+    return mask;
+}
+
+static inline bool IsLowerChar(wxChar ch)
 {
-    TreeNode() {}
+    return (ch >= wxT('a') && ch <= wxT('z'));
+}
 
-    TreeNode(const wxString& key) : value(key) {}
+static inline bool IsAlnumChar(wxChar ch)
+{
+    return IsLowerChar(FoldChar(ch)) || (ch >= wxT('0') && ch <= wxT('9'));
+}
+
+/** @brief A fuzzy query in progress: the pattern and the best matches found so far
+ */
+struct FuzzyQuery
+{
+    FuzzyQuery(const wxString& pattern, size_t maxCount) :
+        original(pattern),
+        folded(pattern),
+        suffixMask(pattern.Length() + 1, 0),
+        count(maxCount)
+    {
+        for (size_t i = 0; i < folded.Length(); ++i)
+            folded[i] = FoldChar(folded[i]);
+        for (size_t i = folded.Length(); i > 0; --i)
+            suffixMask[i - 1] = suffixMask[i] | CharMask(folded[i - 1]);
+    }
 
-    TreeNode(const wxString& key, int id) : value(key)
+    bool IsFull() const
+    {
+        return best.size() >= count;
+    }
+    int WorstRank() const
     {
-        leaves.push_back(id);
+        return best.top().first;
+    }
+    void Add(int id, int rank)
+    {
+        if (!IsFull())
+            best.push(std::make_pair(rank, -id));
+        else if (rank > WorstRank())
+        {
+            best.pop();
+            best.push(std::make_pair(rank, -id));
+        }
+    }
+    // move the matches out, best first
+    void GetMatches(std::vector< std::pair<int, int> >& out_matches)
+    {
+        out_matches.resize(best.size());
+        for (size_t i = best.size(); i > 0; --i)
+        {
+            out_matches[i - 1] = std::make_pair(-best.top().second, best.top().first);
+            best.pop();
+        }
     }
 
-    // calling AddLeaf() after Freeze() may Thaw() parts of the tree
-    void AddLeaf(TreeNode& leaf);
+    wxString original;
+    wxString folded;
+    std::vector<unsigned long long> suffixMask; ///< suffixMask[i] is the set of characters in folded[i..]
+    size_t count;
+    // min-heap on (rank, -id): the top is the worst match kept
+    std::priority_queue< std::pair<int, int>, std::vector< std::pair<int, int> >, std::greater< std::pair<int, int> > > best;
+};
 
-    // compress the data structure to (hopefully) make it more efficient
-    void Freeze()
+/// Keys up to this length rank lower with every character, longer keys all get the rank of this length
+static const size_t MaxRankedKeyLength = 255;
+
+/** @brief State of a greedy subsequence match of a fuzzy pattern along a key
+ */
+struct FuzzyState
+{
+    FuzzyState() :
+        matched(0), score(0), length(0), prev(0), prevMatched(false) {}
+
+    /** @brief Feed the next character of the key
+     *
+     * Every matched pattern character scores, with a bonus when it follows the previous match, when it starts a word
+     * (start of the key, after an underscore or a camel hump) and when the case is the same. Characters skipped
+     * before the first match cost a little. Once the whole pattern is matched the score does not change anymore.
+     */
+    void Step(const FuzzyQuery& query, wxChar ch)
     {
-        while (children.size() == 1)
+        if (matched < query.folded.Length() && FoldChar(ch) == (wxChar)query.folded[matched])
+        {
+            int bonus = 1;
+            if (prevMatched)
+                bonus += 2;
+            if ((prev == 0) || (prev == wxT('_')) || (IsLowerChar(prev) && !IsLowerChar(ch) && IsAlnumChar(ch))
+                || (!IsAlnumChar(prev) && IsAlnumChar(ch)))
+                bonus += 3;
+            if (ch == (wxChar)query.original[matched])
+                bonus += 1;
+            score += bonus;
+            ++matched;
+            prevMatched = true;
+        }
+        else
         {
-            if (leaves.empty())
-            {
-                value += children.front().value;
-//#if __cplusplus >= 201103L // TODO: test if this C++11 code functions as expected
-//                leaves = std::move(children.front().leaves);
-//                std::vector<TreeNode> nextChildren = std::move(children.front().children);
-//                children = std::move(nextChildren);
-//#else
-                leaves.swap(children.front().leaves);
-                //children.swap(children.front().children); // This looks wrong...
-                std::vector<TreeNode> nextChildren;
-                nextChildren.swap(children.front().children);
-                children.swap(nextChildren);
-//#endif
-            }
-            else
-                break;
+            if ((matched == 0) && (length < 3))
+                --score;
+            prevMatched = false;
         }
+        prev = ch;
+        ++length;
+    }
+    bool IsComplete(const FuzzyQuery& query) const
+    {
+        return matched == query.folded.Length();
+    }
+    /// Rank of a key that ends here. Shorter keys rank higher, so extending a complete match never raises the rank.
+    int GetRank() const
+    {
+        return score * (int)(MaxRankedKeyLength + 1) - (int)std::min(length, MaxRankedKeyLength);
+    }
+    /// Best rank of a key that extends a complete match by at least one character
+    int GetExtendedRank() const
+    {
+        return (length < MaxRankedKeyLength) ? GetRank() - 1 : GetRank();
+    }
+
+    size_t matched;
+    int score;
+    size_t length;
+    wxChar prev;
+    bool prevMatched;
+};
+
+#ifdef USE_TREE_MAP
+
+struct TreeNode
+{
+    TreeNode() : mask(0) {}
+
+    TreeNode(const wxString& key) : value(key), mask(0) {}
+
+#if __cplusplus >= 201103L
+    // Children are kept in a vector, make sure growing it moves subtrees instead of copying them
+    TreeNode(const TreeNode& other) = default;
+    TreeNode& operator=(const TreeNode& other) = default;
+    TreeNode(TreeNode&& other) noexcept : mask(other.mask)
+    {
+        value.swap(other.value);
+        children.swap(other.children);
+        leaves.swap(other.leaves);
+    }
+    TreeNode& operator=(TreeNode&& other) noexcept
+    {
+        value.swap(other.value);
+        children.swap(other.children);
+        leaves.swap(other.leaves);
+        mask = other.mask;
+        return *this;
+    }
+#endif
+
+    bool IsEmpty() const
+    {
+        return leaves.empty() && children.empty();
+    }
+
+    void Insert(const wxChar* key, size_t len, int id);
+    void Remove(const wxChar* key, size_t len, int id);
+
+    // split the edge of this node so it keeps only the first 'at' characters
+    void Split(size_t at)
+    {
+        std::vector<TreeNode> tailChildren;
+        tailChildren.swap(children);
+        std::vector<int> tailLeaves;
+        tailLeaves.swap(leaves);
+        children.resize(1);
+        TreeNode& tail = children.front();
+        tail.value = value.Mid(at);
+        tail.children.swap(tailChildren);
+        tail.leaves.swap(tailLeaves);
+        tail.mask = mask; // conservative, recomputed by Freeze()
+        value.Truncate(at);
+    }
+
+    // compress the children: drop empty branches, merge single child chains and recompute the character masks
+    void FreezeChildren()
+    {
+        std::vector<TreeNode>::iterator out = children.begin();
         for (std::vector<TreeNode>::iterator itr = children.begin();
                 itr != children.end(); ++itr)
         {
             itr->Freeze();
+            if (itr->IsEmpty())
+                continue;
+            if (out != itr)
+                std::swap(*out, *itr);
+            ++out;
         }
-        value.Shrink();
+        children.erase(out, children.end());
 #if __cplusplus >= 201103L
         children.shrink_to_fit();
         leaves.shrink_to_fit();
@@ -64,25 +252,48 @@ struct TreeNode
 #endif
     }
 
-    // decompress the data structure to allow modifications
-    void Thaw()
+    // compress the data structure to (hopefully) make it more efficient
+    void Freeze()
     {
-        if (value.Length() > 1)
+        FreezeChildren();
+        while (children.size() == 1 && leaves.empty())
         {
-            TreeNode node(value.Mid(1));
-            node.children.swap(children);
-            node.leaves.swap(leaves);
-            value.Truncate(1);
-            children.push_back(node);
+            value += children.front().value;
+            leaves.swap(children.front().leaves);
+            std::vector<TreeNode> nextChildren;
+            nextChildren.swap(children.front().children);
+            children.swap(nextChildren);
         }
-        for (std::vector<TreeNode>::iterator itr = children.begin();
+        mask = StringMask(value.c_str(), value.Length());
+        for (std::vector<TreeNode>::const_iterator itr = children.begin();
                 itr != children.end(); ++itr)
         {
-            itr->Thaw();
+            mask |= itr->mask;
         }
+        value.Shrink();
     }
 
-    std::vector<int> GetLeaves(const wxString& key) const;
+    const TreeNode* Find(const wxChar* key, size_t len, bool prefix) const;
+    void GetAllLeaves(std::vector<int>& out, size_t maxCount) const;
+    void GetFuzzyLeaves(FuzzyQuery& query, FuzzyState state) const;
+
+    // replace all leaf ids through the map, dropping the ones that map to -1
+    void Remap(const std::vector<int>& idMap)
+    {
+        std::vector<int>::iterator out = leaves.begin();
+        for (std::vector<int>::const_iterator itr = leaves.begin();
+                itr != leaves.end(); ++itr)
+        {
+            if (*itr < (int)idMap.size() && idMap[*itr] >= 0)
+                *out++ = idMap[*itr];
+        }
+        leaves.erase(out, leaves.end());
+        for (std::vector<TreeNode>::iterator itr = children.begin();
+                itr != children.end(); ++itr)
+        {
+            itr->Remap(idMap);
+        }
+    }
 
 #if 0
     void Dump(wxString& out, wxString prefix = wxT("\n"))
@@ -101,53 +312,137 @@ struct TreeNode
     }
 #endif // 0
 
-    wxString value;
-    std::vector<TreeNode> children;
-    std::vector<int> leaves;
+    wxString value;                 ///< Edge label, only the root has an empty one
+    std::vector<TreeNode> children; ///< Sorted on the first character of their value
+    std::vector<int> leaves;        ///< Sorted ids of the key that ends here
+    unsigned long long mask;        ///< CharMask() of all characters in this edge and below
 };
 
 struct TreeNodeLess
 {
-    bool operator() (const TreeNode& a, const TreeNode& b)
+    bool operator() (const TreeNode& a, wxChar ch) const
     {
-        return (a.value < b.value);
+        return ((wxChar)a.value[0] < ch);
     }
 };
 
-void TreeNode::AddLeaf(TreeNode& leaf)
+void TreeNode::Insert(const wxChar* key, size_t len, int id)
 {
-    if (leaf.value.IsEmpty())
+    TreeNode* node = this;
+    size_t pos = 0;
+    while (pos < len)
     {
-        size_t len = leaves.size();
-        leaves.insert(leaves.end(), leaf.leaves.begin(), leaf.leaves.end());
-        std::inplace_merge(leaves.begin(), leaves.begin() + len, leaves.end());
-        leaves.erase(std::unique(leaves.begin(), leaves.end()), leaves.end());
+        std::vector<TreeNode>::iterator itr = std::lower_bound(node->children.begin(), node->children.end(),
+                                              key[pos], TreeNodeLess());
+        if (itr == node->children.end() || (wxChar)itr->value[0] != key[pos])
+        {
+            itr = node->children.insert(itr, TreeNode(wxString(key + pos, len - pos)));
+            itr->mask = StringMask(key + pos, len - pos);
+            itr->leaves.push_back(id);
+            return;
+        }
+        itr->mask |= StringMask(key + pos, len - pos);
+        const wxChar* label = itr->value.c_str();
+        const size_t labelLen = itr->value.Length();
+        size_t common = 1;
+        while (common < labelLen && pos + common < len && label[common] == key[pos + common])
+            ++common;
+        if (common < labelLen)
+            itr->Split(common);
+        pos += common;
+        node = &*itr;
+    }
+    std::vector<int>::iterator leafItr = std::lower_bound(node->leaves.begin(), node->leaves.end(), id);
+    if (leafItr == node->leaves.end() || *leafItr != id)
+        node->leaves.insert(leafItr, id);
+}
+
+// Empty nodes are left in place, they are cleaned up by Freeze()
+void TreeNode::Remove(const wxChar* key, size_t len, int id)
+{
+    TreeNode* node = const_cast<TreeNode*>(Find(key, len, false));
+    if (!node)
+        return;
+    std::vector<int>::iterator leafItr = std::lower_bound(node->leaves.begin(), node->leaves.end(), id);
+    if (leafItr != node->leaves.end() && *leafItr == id)
+        node->leaves.erase(leafItr);
+}
+
+/** @brief Find the node of a key
+ *
+ * @param key The key
+ * @param len Length of the key
+ * @param prefix If true, also return the node whose edge contains the end of the key
+ * @return The node, or nullptr when it is not in the tree
+ */
+const TreeNode* TreeNode::Find(const wxChar* key, size_t len, bool prefix) const
+{
+    const TreeNode* node = this;
+    size_t pos = 0;
+    while (pos < len)
+    {
+        std::vector<TreeNode>::const_iterator itr = std::lower_bound(node->children.begin(), node->children.end(),
+                key[pos], TreeNodeLess());
+        if (itr == node->children.end() || (wxChar)itr->value[0] != key[pos])
+            return nullptr;
+        const wxChar* label = itr->value.c_str();
+        const size_t labelLen = itr->value.Length();
+        size_t i = 1;
+        while (i < labelLen && pos + i < len && label[i] == key[pos + i])
+            ++i;
+        if (i < labelLen)
+        {
+            if (prefix && pos + i == len)
+                return &*itr;
+            return nullptr;
+        }
+        pos += labelLen;
+        node = &*itr;
     }
-    else
+    return node;
+}
+
+// collect the leaves of this subtree in key order, stops when maxCount (if not 0) is reached
+void TreeNode::GetAllLeaves(std::vector<int>& out, size_t maxCount) const
+{
+    for (std::vector<int>::const_iterator itr = leaves.begin(); itr != leaves.end(); ++itr)
     {
-        const wxString& suffix = leaf.value.Mid(1);
-        leaf.value = leaf.value[0];
-        std::vector<TreeNode>::iterator itr = std::lower_bound(children.begin(), children.end(),
-                                              leaf, TreeNodeLess());
-        if (itr == children.end() || itr->value[0] != leaf.value)
-            itr = children.insert(itr, TreeNode(leaf.value));
-        else if (itr->value.Length() > 1)
-            itr->Thaw();
-        leaf.value = suffix;
-        itr->AddLeaf(leaf);
+        if (maxCount && out.size() >= maxCount)
+            return;
+        out.push_back(*itr);
+    }
+    for (std::vector<TreeNode>::const_iterator itr = children.begin(); itr != children.end(); ++itr)
+    {
+        if (maxCount && out.size() >= maxCount)
+            return;
+        itr->GetAllLeaves(out, maxCount);
     }
 }
 
-std::vector<int> TreeNode::GetLeaves(const wxString& key) const
+void TreeNode::GetFuzzyLeaves(FuzzyQuery& query, FuzzyState state) const
 {
-    if (key.IsEmpty())
-        return leaves;
-    std::vector<TreeNode>::const_iterator itr = std::lower_bound(children.begin(), children.end(),
-            TreeNode(key[0]), TreeNodeLess());
-    wxString suffix;
-    if (itr == children.end() || !key.StartsWith(itr->value, &suffix))
-        return std::vector<int>();
-    return itr->GetLeaves(suffix);
+    const wxChar* label = value.c_str();
+    const size_t labelLen = value.Length();
+    for (size_t i = 0; i < labelLen; ++i)
+        state.Step(query, label[i]);
+    const bool complete = state.IsComplete(query);
+    if (complete)
+    {
+        // Nothing below this point can rank better than a key ending here
+        if (query.IsFull() && state.GetRank() <= query.WorstRank())
+            return;
+        for (std::vector<int>::const_iterator itr = leaves.begin(); itr != leaves.end(); ++itr)
+            query.Add(*itr, state.GetRank());
+    }
+    const unsigned long long needed = query.suffixMask[state.matched];
+    for (std::vector<TreeNode>::const_iterator itr = children.begin(); itr != children.end(); ++itr)
+    {
+        if ((itr->mask & needed) != needed)
+            continue;
+        if (complete && query.IsFull() && state.GetExtendedRank() <= query.WorstRank())
+            return;
+        itr->GetFuzzyLeaves(query, state);
+    }
 }
 #else
 #include <map>
@@ -159,35 +454,37 @@ struct TreeNode
 #endif // USE_TREE_MAP
 
 
-ClTreeMap<int>::ClTreeMap() :
+ClTreeMap::ClTreeMap() :
     m_Root(new TreeNode())
 {
 }
 
-ClTreeMap<int>::ClTreeMap( const ClTreeMap<int>& other ) :
+ClTreeMap::ClTreeMap( const ClTreeMap& other ) :
     m_Root(new TreeNode(*other.m_Root))
 {
 
 }
 
-ClTreeMap<int>::~ClTreeMap()
+ClTreeMap::~ClTreeMap()
 {
     delete m_Root;
 }
 
-int ClTreeMap<int>::Insert(const wxString& key, int value)
+int ClTreeMap::Insert(const wxString& key, int value)
 {
 #ifdef USE_TREE_MAP
-    TreeNode leaf(key, value);
-    m_Root->AddLeaf(leaf);
+    m_Root->Insert(key.c_str(), key.Length(), value);
 #else
     m_Root->leaves.insert(std::make_pair(key, value));
 #endif // USE_TREE_MAP
     return value;
 }
 
-void ClTreeMap<int>::Remove(const wxString& key, int value)
+void ClTreeMap::Remove(const wxString& key, int value)
 {
+#ifdef USE_TREE_MAP
+    m_Root->Remove(key.c_str(), key.Length(), value);
+#else
     typedef std::multimap<wxString, int>::iterator leafItr;
     std::pair<leafItr, leafItr> rg = m_Root->leaves.equal_range(key);
     for (leafItr itr = rg.first; itr != rg.second; ++itr)
@@ -198,22 +495,23 @@ void ClTreeMap<int>::Remove(const wxString& key, int value)
             return;
         }
     }
+#endif // USE_TREE_MAP
 }
 
-void ClTreeMap<int>::Shrink()
+void ClTreeMap::Shrink()
 {
 #ifdef USE_TREE_MAP
-    if (m_Root->children.size() == 1) // do not let the root node gain a value
-        m_Root->children.front().Freeze();
-    else
-        m_Root->Freeze();
+    m_Root->FreezeChildren(); // do not let the root node gain a value
 #endif // USE_TREE_MAP
 }
 
-std::vector<int> ClTreeMap<int>::GetIdSet(const wxString& key) const
+std::vector<int> ClTreeMap::GetIdSet(const wxString& key) const
 {
 #ifdef USE_TREE_MAP
-    return m_Root->GetLeaves(key);
+    const TreeNode* node = m_Root->Find(key.c_str(), key.Length(), false);
+    if (!node)
+        return std::vector<int>();
+    return node->leaves;
 #else
     typedef std::multimap<wxString, int>::const_iterator constLeafItr;
     std::pair<constLeafItr, constLeafItr> rg = m_Root->leaves.equal_range(key);
@@ -224,14 +522,153 @@ std::vector<int> ClTreeMap<int>::GetIdSet(const wxString& key) const
 #endif // USE_TREE_MAP
 }
 
+/** @brief Get the values of all keys that start with a prefix
+ *
+ * @param prefix The prefix, case sensitive
+ * @param maxCount Maximum number of values to return, 0 for all of them
+ * @return The values, ordered on their key
+ *
+ */
+std::vector<int> ClTreeMap::GetIdSetByPrefix(const wxString& prefix, size_t maxCount) const
+{
+    std::vector<int> out;
+#ifdef USE_TREE_MAP
+    const TreeNode* node = m_Root->Find(prefix.c_str(), prefix.Length(), true);
+    if (node)
+        node->GetAllLeaves(out, maxCount);
+#else
+    typedef std::multimap<wxString, int>::const_iterator constLeafItr;
+    for (constLeafItr itr = m_Root->leaves.lower_bound(prefix);
+            itr != m_Root->leaves.end() && itr->first.StartsWith(prefix); ++itr)
+    {
+        if (maxCount && out.size() >= maxCount)
+            break;
+        out.push_back(itr->second);
+    }
+#endif // USE_TREE_MAP
+    return out;
+}
+
+/** @brief Get the best matching values of all keys that contain the pattern as a subsequence (case insensitive)
+ *
+ * @param pattern The characters to match, in order
+ * @param maxCount Maximum number of values to return
+ * @param out_matches The (value, rank) pairs, best match first
+ * @return void
+ *
+ * The rank prefers consecutive matches, matches at the start of words and camel humps, and shorter keys.
+ */
+void ClTreeMap::GetFuzzyIdSet(const wxString& pattern, size_t maxCount, std::vector< std::pair<int, int> >& out_matches) const
+{
+    out_matches.clear();
+    if (pattern.IsEmpty() || maxCount == 0)
+        return;
+    FuzzyQuery query(pattern, maxCount);
+#ifdef USE_TREE_MAP
+    const unsigned long long needed = query.suffixMask[0];
+    for (std::vector<TreeNode>::const_iterator itr = m_Root->children.begin(); itr != m_Root->children.end(); ++itr)
+    {
+        if ((itr->mask & needed) == needed)
+            itr->GetFuzzyLeaves(query, FuzzyState());
+    }
+#else
+    typedef std::multimap<wxString, int>::const_iterator constLeafItr;
+    for (constLeafItr itr = m_Root->leaves.begin(); itr != m_Root->leaves.end(); ++itr)
+    {
+        FuzzyState state;
+        const wxChar* key = itr->first.c_str();
+        const size_t keyLen = itr->first.Length();
+        for (size_t i = 0; i < keyLen && !state.IsComplete(query); ++i)
+            state.Step(query, key[i]);
+        if (!state.IsComplete(query))
+            continue;
+        state.length = keyLen;
+        query.Add(itr->second, state.GetRank());
+    }
+#endif // USE_TREE_MAP
+    query.GetMatches(out_matches);
+}
+
+ClFuzzyMatcher::ClFuzzyMatcher(const wxString& pattern) :
+    m_pQuery(new FuzzyQuery(pattern, 0))
+{
+}
+
+ClFuzzyMatcher::~ClFuzzyMatcher()
+{
+    delete m_pQuery;
+}
+
+unsigned long long ClFuzzyMatcher::GetMask(const wxString& key)
+{
+    return StringMask(key.c_str(), key.Length());
+}
+
+unsigned long long ClFuzzyMatcher::GetPatternMask() const
+{
+    return m_pQuery->suffixMask[0];
+}
+
+/** @brief Rank a key
+ *
+ * @param key The key to match
+ * @param out_rank Receives the rank when the key matches, higher is better
+ * @return true if the key contains the pattern as a subsequence (case insensitive)
+ *
+ */
+bool ClFuzzyMatcher::Match(const wxString& key, int& out_rank) const
+{
+    FuzzyState state;
+    const wxChar* pKey = key.c_str();
+    const size_t keyLen = key.Length();
+    for (size_t i = 0; i < keyLen && !state.IsComplete(*m_pQuery); ++i)
+        state.Step(*m_pQuery, pKey[i]);
+    if (!state.IsComplete(*m_pQuery))
+        return false;
+    state.length = keyLen;
+    out_rank = state.GetRank();
+    return true;
+}
+
 // Function just returns itself.
-int ClTreeMap<int>::GetValue(int id) const
+int ClTreeMap::GetValue(int id) const
 {
     return id;
 }
 
-int ClTreeMap<int>::GetCount() const
+int ClTreeMap::GetCount() const
 {
     return 0;
 }
 
+/** @brief Renumber all values after a compaction of the value storage
+ *
+ * @param idMap Maps each old id to its new id, or to -1 when the id was removed
+ * @return void
+ *
+ * The map must preserve the order of the ids, which keeps the leaves sorted.
+ */
+void ClTreeMap::Remap(const std::vector<int>& idMap)
+{
+#ifdef USE_TREE_MAP
+    m_Root->Remap(idMap);
+#else
+    typedef std::multimap<wxString, int>::iterator leafItr;
+    leafItr itr = m_Root->leaves.begin();
+    while (itr != m_Root->leaves.end())
+    {
+        if (itr->second < (int)idMap.size() && idMap[itr->second] >= 0)
+        {
+            itr->second = idMap[itr->second];
+            ++itr;
+        }
+        else
+            m_Root->leaves.erase(itr++);
+    }
+#endif // USE_TREE_MAP
+}
+
+void ClTreeMap::Swap(ClTreeMap& other)
+{
+    std::swap(m_Root, other.m_Root);
+}
@@ -1,80 +1,56 @@
 #ifndef TREEMAP_H
 #define TREEMAP_H
 
+#include <cstddef>
+#include <utility>
 #include <vector>
 
 struct TreeNode;
+struct FuzzyQuery;
 class wxString;
-template<typename _TpVal> class ClTreeMap;
 
-template<>
-class ClTreeMap<int>
+/** @brief Ranks single keys as fuzzy (subsequence) matches of a pattern
+ *
+ * Gives the same ranks as ClTreeMap::GetFuzzyIdSet(), for scanning a list of keys instead of a tree.
+ */
+class ClFuzzyMatcher
+{
+public:
+    ClFuzzyMatcher(const wxString& pattern);
+    ~ClFuzzyMatcher();
+    /// Set of the (case folded) characters of a key. A key can only match when its mask contains the mask of the pattern
+    static unsigned long long GetMask(const wxString& key);
+    unsigned long long GetPatternMask() const;
+    bool Match(const wxString& key, int& out_rank) const; // returns false when the key does not match
+private:
+    ClFuzzyMatcher(const ClFuzzyMatcher&);
+    ClFuzzyMatcher& operator=(const ClFuzzyMatcher&);
+
+    FuzzyQuery* m_pQuery;
+};
+
+/** @brief Maps keys to sets of int ids, stored as a compressed trie
+ */
+class ClTreeMap
 {
 public:
     ClTreeMap();
-    ClTreeMap(const ClTreeMap<int>& other);
+    ClTreeMap(const ClTreeMap& other);
     ~ClTreeMap();
     int Insert(const wxString& key, int value); // returns value
     void Remove(const wxString& key, int value);
     void Shrink();
     std::vector<int> GetIdSet(const wxString& key) const;
+    std::vector<int> GetIdSetByPrefix(const wxString& prefix, size_t maxCount) const; // maxCount 0 means unlimited
+    void GetFuzzyIdSet(const wxString& pattern, size_t maxCount, std::vector< std::pair<int, int> >& out_matches) const; // (id, rank), best first
     int GetValue(int id) const; // returns id
     int GetCount() const;
+    void Remap(const std::vector<int>& idMap); // idMap[oldId] is the new id, or -1 to drop it
+    void Swap(ClTreeMap& other);
 private:
-    TreeNode* m_Root;
-};
+    ClTreeMap& operator=(const ClTreeMap&);
 
-template<typename _TpVal>
-class ClTreeMap
-{
-public:
-    // returns the id of the value inserted
-    int Insert(const wxString& key, const _TpVal& value)
-    {
-        m_Data.push_back(value);
-        return m_Tree.Insert(key, m_Data.size() - 1);
-    }
-
-    void Shrink()
-    {
-        m_Tree.Shrink();
-#if __cplusplus >= 201103L
-        m_Data.shrink_to_fit();
-#else
-        std::vector<_TpVal>(m_Data).swap(m_Data);
-#endif
-    }
-
-    std::vector<int> GetIdSet(const wxString& key) const
-    {
-        return m_Tree.GetIdSet(key);
-    }
-    void RemoveIdKey( const wxString& key, int id )
-    {
-        m_Tree.Remove(key, id);
-    }
-
-    bool HasValue(int id)
-    {
-        if (id < 0)
-            return false;
-        if (id >= (int)m_Data.size())
-            return false;
-        return true;
-    }
-
-    _TpVal& GetValue(int id)
-    {
-        return m_Data[id];
-    }
-    int GetCount() const
-    {
-        return m_Data.size();
-    }
-
-private:
-    ClTreeMap<int> m_Tree;
-    std::vector<_TpVal> m_Data;
+    TreeNode* m_Root;
 };
 
 #endif // TREEMAP_H